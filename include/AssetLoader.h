@@ -0,0 +1,250 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Profiler.h"
+
+/** @brief Loads assets on background threads and hands them to GL within a per-frame budget.
+ *
+ *  An asset is a decode function, run on one of the loader's threads to
+ *  read files and build CPU buffers, and an upload function, run on the GL
+ *  thread by update() to create the GL objects from those buffers. Decoded
+ *  assets wait in a bounded queue; while it is full the threads take no
+ *  more work, which caps the memory held by assets read but not uploaded.
+ *  update() uploads in the order assets finish decoding until the frame's
+ *  byte or time budget is spent, so a scene streaming in costs a bounded
+ *  slice of each frame. The first upload of a frame always goes ahead, so
+ *  an asset larger than the byte budget still arrives.
+ *
+ *  The threads are separate from JobSystem's because they block on the
+ *  file system. The decode and upload functions are released once the
+ *  asset is ready, and with them whatever buffers they captured.
+ */
+class AssetLoader
+{
+public:
+    typedef std::size_t Handle;
+
+    enum State
+    {
+        QUEUED,
+        DECODING,
+        DECODED,
+        READY,
+        FAILED
+    };
+
+    /// Reads and decodes on a loader thread; returns the bytes the upload sends to GL, or -1 on failure.
+    typedef std::function<GLsizeiptr()> Decode;
+
+    /// Creates the GL objects on the GL thread.
+    typedef std::function<void()> Upload;
+
+private:
+    struct Asset
+    {
+        Decode decode;
+        Upload upload;
+        GLsizeiptr size;
+        State state;
+    };
+
+    const std::size_t capacity;
+
+    std::deque<Asset> assets;  // never shrinks, so handles and references stay valid
+    std::deque<Handle> queued;
+    std::deque<Handle> decoded;
+    std::size_t decoding;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool running;
+    std::vector<std::thread> threads;
+
+    // statistics of update()
+    GLsizei uploaded;
+    GLsizeiptr frameBytes;
+    double frameMilliseconds;
+    GLsizeiptr peakBytes;
+    double peakMilliseconds;
+
+    AssetLoader(const AssetLoader &);
+    AssetLoader &operator=(const AssetLoader &);
+
+    void work()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for(;;) {
+            // a decoded asset stays in memory until it is uploaded, so only start one if it has room to wait
+            changed.wait(lock, [this] {
+                return !running || (!queued.empty() && decoded.size() + decoding < capacity);
+            });
+            if(!running)
+                return;
+
+            const Handle h(queued.front());
+            queued.pop_front();
+            ++decoding;
+            assets[h].state = DECODING;
+            const Decode decode(assets[h].decode);
+
+            lock.unlock();
+            const GLsizeiptr size(decode());
+            lock.lock();
+
+            --decoding;
+            Asset &a(assets[h]);
+            a.size = size;
+            if(size < 0) {
+                a.state = FAILED;
+                a.decode = Decode();
+                a.upload = Upload();
+            } else {
+                a.state = DECODED;
+                decoded.push_back(h);
+            }
+            changed.notify_all();
+        }
+    }
+
+public:
+    /** @param threads loader threads; a few are enough to keep the disk and the decoders busy.
+     *  @param capacity decoded assets that may wait for upload at once.
+     */
+    explicit AssetLoader(unsigned int threads = 2, std::size_t capacity = 4)
+        : capacity(std::max(capacity, static_cast<std::size_t>(1))), decoding(0), running(true), uploaded(0),
+          frameBytes(0), frameMilliseconds(0.0), peakBytes(0), peakMilliseconds(0.0)
+    {
+        for(unsigned int i = 0; i < threads; i++)
+            this->threads.push_back(std::thread(&AssetLoader::work, this));
+    }
+
+    /// Assets still being decoded are finished and dropped.
+    virtual ~AssetLoader()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        changed.notify_all();
+        for(std::size_t i = 0; i < threads.size(); ++i)
+            threads[i].join();
+    }
+
+    /** @brief Queue an asset; decode runs on a loader thread, upload later in update().
+     */
+    Handle request(const Decode &decode, const Upload &upload)
+    {
+        const Asset a = {decode, upload, 0, QUEUED};
+
+        std::lock_guard<std::mutex> lock(mutex);
+        assets.push_back(a);
+        queued.push_back(assets.size() - 1);
+        changed.notify_all();
+        return assets.size() - 1;
+    }
+
+    /** @brief Upload decoded assets until either budget is spent; call once per frame on the GL thread.
+     *  @return the number of assets that became ready.
+     */
+    GLsizei update(GLsizeiptr maxBytes, double maxMilliseconds)
+    {
+        PROFILE_SCOPE("upload assets");
+
+        const std::chrono::steady_clock::time_point start(std::chrono::steady_clock::now());
+        GLsizeiptr bytes(0);
+        GLsizei count(0);
+        double ms(0.0);
+
+        for(;;) {
+            Handle h;
+            Upload upload;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if(decoded.empty() || (count > 0 && bytes + assets[decoded.front()].size > maxBytes))
+                    break;
+
+                h = decoded.front();
+                decoded.pop_front();
+                upload.swap(assets[h].upload);
+                assets[h].decode = Decode();
+            }
+            changed.notify_all();  // room for another decode
+
+            upload();
+            upload = Upload();  // free the buffers before the next one
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                assets[h].state = READY;
+                bytes += assets[h].size;
+            }
+            ++count;
+
+            ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            if(ms >= maxMilliseconds)
+                break;
+        }
+
+        PROFILE_COUNT(UPLOAD_BYTES, bytes);
+        uploaded += count;
+        frameBytes = bytes;
+        frameMilliseconds = ms;
+        peakBytes = std::max(peakBytes, bytes);
+        peakMilliseconds = std::max(peakMilliseconds, ms);
+        return count;
+    }
+
+    State getState(Handle h)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return assets[h].state;
+    }
+
+    bool isReady(Handle h)
+    {
+        return getState(h) == READY;
+    }
+
+    /// Whether every asset requested so far is ready or failed.
+    bool isIdle()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return queued.empty() && decoded.empty() && decoding == 0;
+    }
+
+    /// Assets uploaded so far.
+    GLsizei getUploadedCount() const
+    {
+        return uploaded;
+    }
+
+    /// Bytes and milliseconds spent by the last update() and the most by any one.
+    GLsizeiptr getFrameBytes() const
+    {
+        return frameBytes;
+    }
+
+    double getFrameMilliseconds() const
+    {
+        return frameMilliseconds;
+    }
+
+    GLsizeiptr getPeakBytes() const
+    {
+        return peakBytes;
+    }
+
+    double getPeakMilliseconds() const
+    {
+        return peakMilliseconds;
+    }
+};
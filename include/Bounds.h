@@ -0,0 +1,120 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "Matrix.h"
+#include "Object.h"
+
+/** @brief Axis-aligned bounding box with its bounding sphere.
+ */
+struct Bounds
+{
+    GLfloat min[3];
+    GLfloat max[3];
+
+    /** @brief An empty box; merging anything into it yields that thing.
+     */
+    static Bounds empty()
+    {
+        const Bounds b = {{FLT_MAX, FLT_MAX, FLT_MAX}, {-FLT_MAX, -FLT_MAX, -FLT_MAX}};
+        return b;
+    }
+
+    static Bounds fromVertices(GLsizei vertexcount, const Object::Vertex *vertex)
+    {
+        Bounds b(empty());
+        for(GLsizei i = 0; i < vertexcount; ++i)
+            b.merge(vertex[i].position);
+        return b;
+    }
+
+    bool isEmpty() const
+    {
+        return min[0] > max[0];
+    }
+
+    void merge(const GLfloat *p)
+    {
+        for(int k = 0; k < 3; k++) {
+            min[k] = std::min(min[k], p[k]);
+            max[k] = std::max(max[k], p[k]);
+        }
+    }
+
+    void merge(const Bounds &b)
+    {
+        for(int k = 0; k < 3; k++) {
+            min[k] = std::min(min[k], b.min[k]);
+            max[k] = std::max(max[k], b.max[k]);
+        }
+    }
+
+    void getCenter(GLfloat *c) const
+    {
+        for(int k = 0; k < 3; k++)
+            c[k] = (min[k] + max[k]) * 0.5f;
+    }
+
+    void getExtent(GLfloat *e) const
+    {
+        for(int k = 0; k < 3; k++)
+            e[k] = (max[k] - min[k]) * 0.5f;
+    }
+
+    GLfloat getRadius() const
+    {
+        GLfloat e[3];
+        getExtent(e);
+        return sqrt(e[0] * e[0] + e[1] * e[1] + e[2] * e[2]);
+    }
+
+    bool overlaps(const Bounds &b) const
+    {
+        for(int k = 0; k < 3; k++) {
+            if(min[k] > b.max[k] || max[k] < b.min[k])
+                return false;
+        }
+        return true;
+    }
+
+    /** @brief Slab test of the ray origin + t * direction for 0 <= t <= tMax.
+     *  @param inverseDirection 1 / direction per axis; infinities are fine.
+     *  @param t where the ray enters the box, 0 if it starts inside.
+     */
+    bool intersect(const GLfloat *origin, const GLfloat *inverseDirection, GLfloat tMax, GLfloat &t) const
+    {
+        GLfloat t0(0.0f), t1(tMax);
+        for(int k = 0; k < 3; k++) {
+            const GLfloat a((min[k] - origin[k]) * inverseDirection[k]);
+            const GLfloat b((max[k] - origin[k]) * inverseDirection[k]);
+            t0 = std::max(t0, std::min(a, b));
+            t1 = std::min(t1, std::max(a, b));
+        }
+        t = t0;
+        return t0 <= t1;
+    }
+
+    /** @brief Box enclosing this box after an affine transform (Arvo's method).
+     */
+    Bounds transform(const Matrix &m) const
+    {
+        if(isEmpty())
+            return *this;
+
+        Bounds b;
+        for(int i = 0; i < 3; i++) {
+            b.min[i] = b.max[i] = m[12 + i];
+
+            for(int j = 0; j < 3; j++) {
+                const GLfloat e(m[j * 4 + i] * min[j]);
+                const GLfloat f(m[j * 4 + i] * max[j]);
+                b.min[i] += std::min(e, f);
+                b.max[i] += std::max(e, f);
+            }
+        }
+
+        return b;
+    }
+};
@@ -0,0 +1,287 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <vector>
+
+#include "Bounds.h"
+#include "Frustum.h"
+
+/** @brief Bounding volume hierarchy over scene instances for frustum culling,
+ *  ray casts and box queries.
+ *
+ *  Nodes are stored in depth-first order, so a node's left child follows it
+ *  and every subtree covers a contiguous range of items. When the transform
+ *  of an instance changes, update() its bounds and call refit() once per
+ *  frame: only the changed leaves and their ancestors are recomputed. The
+ *  tree topology is kept, so rebuild with build() after large changes.
+ */
+class Bvh
+{
+    struct Node
+    {
+        Bounds bounds;
+        GLuint first;   // first entry in items
+        GLuint count;   // number of items under this node
+        GLuint right;   // right child, 0 for a leaf
+        GLuint parent;
+    };
+
+    static const GLuint leafSize = 4;
+
+    std::vector<Node> nodes;
+
+    std::vector<GLuint> items;
+
+    std::vector<Bounds> bounds;
+
+    std::vector<GLuint> leaf;  // leaf node of each item
+
+    std::vector<bool> dirty;
+
+    bool refitNeeded;
+
+    GLsizei visibleCount;
+    GLsizei culledCount;
+    GLsizei nodeTests;
+
+    struct CenterLess
+    {
+        const std::vector<Bounds> &bounds;
+        int axis;
+
+        bool operator()(GLuint a, GLuint b) const
+        {
+            return bounds[a].min[axis] + bounds[a].max[axis] < bounds[b].min[axis] + bounds[b].max[axis];
+        }
+    };
+
+    void fit(Node &node) const
+    {
+        node.bounds = Bounds::empty();
+        for(GLuint i = node.first; i < node.first + node.count; ++i)
+            node.bounds.merge(bounds[items[i]]);
+    }
+
+    GLuint build(GLuint first, GLuint count, GLuint parent)
+    {
+        const GLuint index(static_cast<GLuint>(nodes.size()));
+        const Node empty = {Bounds::empty(), first, count, 0, parent};
+        nodes.push_back(empty);
+        fit(nodes[index]);
+
+        if(count <= leafSize) {
+            for(GLuint i = first; i < first + count; ++i)
+                leaf[items[i]] = index;
+            return index;
+        }
+
+        Bounds centers(Bounds::empty());
+        for(GLuint i = first; i < first + count; ++i) {
+            GLfloat c[3];
+            bounds[items[i]].getCenter(c);
+            centers.merge(c);
+        }
+
+        int axis(0);
+        for(int k = 1; k < 3; k++) {
+            if(centers.max[k] - centers.min[k] > centers.max[axis] - centers.min[axis])
+                axis = k;
+        }
+
+        const GLuint half(count / 2);
+        const CenterLess less = {bounds, axis};
+        std::nth_element(items.begin() + first, items.begin() + first + half, items.begin() + first + count, less);
+
+        build(first, half, index);
+        const GLuint right(build(first + half, count - half, index));
+        nodes[index].right = right;
+
+        return index;
+    }
+
+    void collect(const Node &node, std::vector<GLuint> &visible) const
+    {
+        visible.insert(visible.end(), items.begin() + node.first, items.begin() + node.first + node.count);
+    }
+
+public:
+    Bvh() : refitNeeded(false), visibleCount(0), culledCount(0), nodeTests(0)
+    {
+    }
+
+    void build(GLsizei count, const Bounds *instanceBounds)
+    {
+        bounds.assign(instanceBounds, instanceBounds + count);
+
+        items.resize(count);
+        for(GLsizei i = 0; i < count; ++i)
+            items[i] = static_cast<GLuint>(i);
+
+        leaf.resize(count);
+        nodes.clear();
+        if(count > 0)
+            build(0, static_cast<GLuint>(count), 0);
+
+        dirty.assign(nodes.size(), false);
+        refitNeeded = false;
+    }
+
+    void build(const std::vector<Bounds> &instanceBounds)
+    {
+        build(static_cast<GLsizei>(instanceBounds.size()), instanceBounds.data());
+    }
+
+    /** @brief Set new bounds of instance i; takes effect at the next refit().
+     */
+    void update(GLuint i, const Bounds &b)
+    {
+        bounds[i] = b;
+        dirty[leaf[i]] = true;
+        refitNeeded = true;
+    }
+
+    void refit()
+    {
+        if(!refitNeeded)
+            return;
+
+        // children come after their parent, so a reverse sweep sees them first
+        for(std::size_t n = nodes.size(); n-- > 0;) {
+            if(!dirty[n])
+                continue;
+
+            Node &node(nodes[n]);
+            if(node.right == 0) {
+                fit(node);
+            } else {
+                node.bounds = nodes[n + 1].bounds;
+                node.bounds.merge(nodes[node.right].bounds);
+            }
+
+            dirty[n] = false;
+            if(n > 0)
+                dirty[node.parent] = true;
+        }
+
+        refitNeeded = false;
+    }
+
+    /** @brief Append the indices of the instances that may be visible.
+     */
+    void cull(const Frustum &frustum, std::vector<GLuint> &visible)
+    {
+        const std::size_t start(visible.size());
+        nodeTests = 0;
+
+        if(!nodes.empty()) {
+            GLuint stack[64];
+            int top(0);
+            stack[top++] = 0;
+
+            while(top > 0) {
+                const Node &node(nodes[stack[--top]]);
+
+                ++nodeTests;
+                const Frustum::Result result(frustum.classify(node.bounds));
+                if(result == Frustum::OUTSIDE)
+                    continue;
+
+                if(result == Frustum::INSIDE) {
+                    collect(node, visible);
+                } else if(node.right == 0) {
+                    for(GLuint i = node.first; i < node.first + node.count; ++i) {
+                        if(frustum.isVisible(bounds[items[i]]))
+                            visible.push_back(items[i]);
+                    }
+                } else {
+                    stack[top++] = node.right;
+                    stack[top++] = static_cast<GLuint>(&node - &nodes[0]) + 1;
+                }
+            }
+        }
+
+        visibleCount = static_cast<GLsizei>(visible.size() - start);
+        culledCount = static_cast<GLsizei>(bounds.size()) - visibleCount;
+    }
+
+    /** @brief Append the instances whose boxes the ray origin + t * direction,
+     *  0 <= t <= tMax, passes through, in no particular order.
+     */
+    void raycast(const GLfloat *origin, const GLfloat *direction, GLfloat tMax, std::vector<GLuint> &hit) const
+    {
+        if(nodes.empty())
+            return;
+
+        const GLfloat inverse[3] = {1.0f / direction[0], 1.0f / direction[1], 1.0f / direction[2]};
+
+        GLuint stack[64];
+        int top(0);
+        stack[top++] = 0;
+
+        while(top > 0) {
+            const GLuint n(stack[--top]);
+            const Node &node(nodes[n]);
+
+            GLfloat t;
+            if(!node.bounds.intersect(origin, inverse, tMax, t))
+                continue;
+
+            if(node.right == 0) {
+                for(GLuint i = node.first; i < node.first + node.count; ++i) {
+                    if(bounds[items[i]].intersect(origin, inverse, tMax, t))
+                        hit.push_back(items[i]);
+                }
+            } else {
+                stack[top++] = node.right;
+                stack[top++] = n + 1;
+            }
+        }
+    }
+
+    /** @brief Append the instances whose boxes overlap the given one.
+     */
+    void query(const Bounds &box, std::vector<GLuint> &found) const
+    {
+        if(nodes.empty())
+            return;
+
+        GLuint stack[64];
+        int top(0);
+        stack[top++] = 0;
+
+        while(top > 0) {
+            const GLuint n(stack[--top]);
+            const Node &node(nodes[n]);
+            if(!node.bounds.overlaps(box))
+                continue;
+
+            if(node.right == 0) {
+                for(GLuint i = node.first; i < node.first + node.count; ++i) {
+                    if(bounds[items[i]].overlaps(box))
+                        found.push_back(items[i]);
+                }
+            } else {
+                stack[top++] = node.right;
+                stack[top++] = n + 1;
+            }
+        }
+    }
+
+    /// Instances reported visible by the last cull().
+    GLsizei getVisibleCount() const
+    {
+        return visibleCount;
+    }
+
+    /// Instances rejected by the last cull().
+    GLsizei getCulledCount() const
+    {
+        return culledCount;
+    }
+
+    /// Nodes classified by the last cull().
+    GLsizei getNodeTests() const
+    {
+        return nodeTests;
+    }
+};
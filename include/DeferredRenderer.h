@@ -0,0 +1,224 @@
+#pragma once
+#include <GL/glew.h>
+#include <iostream>
+#include <vector>
+
+#include "LightGrid.h"
+#include "Matrix.h"
+#include "Profiler.h"
+#include "RenderState.h"
+#include "UniformBlock.h"
+
+/** @brief G-buffer and clustered lighting pass for many point lights.
+ *
+ *  The geometry pass draws with gbuffer.vert/gbuffer.frag into a
+ *  framebuffer holding the eye-space normal and shininess (RGBA16F), the
+ *  diffuse color (RGBA8), the specular color (RGBA8) and the depth. The lighting
+ *  pass then shades every covered pixel once with deferred.frag, looping
+ *  over the lights LightGrid binned into its cluster; the lights, the
+ *  clusters and the light indices reach the shader through buffer
+ *  textures, so their number is not limited by the Frame block.
+ *
+ *  Usage: bind(); glClear(); draw the geometry; setLights(); bind the
+ *  target; draw(lightingProgram).
+ */
+class DeferredRenderer
+{
+public:
+    enum Attachment
+    {
+        NORMAL,
+        ALBEDO,
+        SPECULAR,
+        DEPTH,
+        ATTACHMENTS
+    };
+
+    enum Data
+    {
+        LIGHTS,
+        CLUSTERS,
+        INDICES,
+        DATA
+    };
+
+private:
+    GLsizei width;
+    GLsizei height;
+
+    GLuint fbo;
+    GLuint attachment[ATTACHMENTS];
+
+    // light data for the lighting pass, read through buffer textures
+    GLuint buffer[DATA];
+    GLuint texture[DATA];
+
+    GLuint vao;  // no attributes, for the full-screen triangle
+
+    LightGrid grid;
+
+    DeferredRenderer(const DeferredRenderer &);
+    DeferredRenderer &operator=(const DeferredRenderer &);
+
+    void allocate()
+    {
+        static const GLenum internal[ATTACHMENTS] = {GL_RGBA16F, GL_RGBA8, GL_RGBA8, GL_DEPTH_COMPONENT24};
+        static const GLenum format[ATTACHMENTS] = {GL_RGBA, GL_RGBA, GL_RGBA, GL_DEPTH_COMPONENT};
+        static const GLenum type[ATTACHMENTS] = {GL_FLOAT, GL_UNSIGNED_BYTE, GL_UNSIGNED_BYTE, GL_UNSIGNED_INT};
+
+        RenderState &state(RenderState::get());
+        state.bindFramebuffer(GL_FRAMEBUFFER, fbo);
+        for(int a = 0; a < ATTACHMENTS; ++a) {
+            state.bindTexture(0, GL_TEXTURE_2D, attachment[a]);
+            glTexImage2D(GL_TEXTURE_2D, 0, internal[a], width, height, 0, format[a], type[a], NULL);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, a == DEPTH ? GL_DEPTH_ATTACHMENT : GL_COLOR_ATTACHMENT0 + a,
+                                   GL_TEXTURE_2D, attachment[a], 0);
+        }
+
+        const GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2};
+        glDrawBuffers(DEPTH, drawBuffers);
+
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "Can't create the G-buffer." << std::endl;
+            exit(1);
+        }
+
+        state.bindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void upload(Data d, GLsizeiptr size, const GLvoid *data)
+    {
+        // an empty buffer texture is still bound, so keep a few bytes
+        static const GLint empty[4] = {0, 0, 0, 0};
+        if(size == 0) {
+            size = sizeof(empty);
+            data = empty;
+        }
+
+        RenderState::get().bindBuffer(GL_COPY_WRITE_BUFFER, buffer[d]);
+        glBufferData(GL_COPY_WRITE_BUFFER, size, data, GL_STREAM_DRAW);
+        PROFILE_COUNT(UPLOAD_BYTES, size);
+    }
+
+public:
+    /** @param tileSize, slices cluster size in pixels and number of depth slices, see LightGrid.
+     */
+    DeferredRenderer(GLsizei width, GLsizei height, GLsizei tileSize = 32, GLsizei slices = 16)
+        : width(width), height(height), grid(tileSize, slices)
+    {
+        glGenFramebuffers(1, &fbo);
+        glGenTextures(ATTACHMENTS, attachment);
+        allocate();
+
+        static const GLenum format[DATA] = {GL_RGBA32F, GL_RG32I, GL_R32I};
+        glGenBuffers(DATA, buffer);
+        glGenTextures(DATA, texture);
+        for(int d = 0; d < DATA; ++d) {
+            upload(static_cast<Data>(d), 0, NULL);
+            RenderState::get().bindTexture(0, GL_TEXTURE_BUFFER, texture[d]);
+            glTexBuffer(GL_TEXTURE_BUFFER, format[d], buffer[d]);
+        }
+
+        glGenVertexArrays(1, &vao);
+    }
+
+    virtual ~DeferredRenderer()
+    {
+        RenderState &state(RenderState::get());
+        state.forgetVertexArray(vao);
+        glDeleteVertexArrays(1, &vao);
+        for(int d = 0; d < DATA; ++d) {
+            state.forgetTexture(texture[d]);
+            state.forgetBuffer(buffer[d]);
+        }
+        glDeleteTextures(DATA, texture);
+        glDeleteBuffers(DATA, buffer);
+        for(int a = 0; a < ATTACHMENTS; ++a)
+            state.forgetTexture(attachment[a]);
+        glDeleteTextures(ATTACHMENTS, attachment);
+        state.forgetFramebuffer(fbo);
+        glDeleteFramebuffers(1, &fbo);
+    }
+
+    /// Reallocate the G-buffer if the target size changed.
+    void resize(GLsizei width, GLsizei height)
+    {
+        if(width == this->width && height == this->height)
+            return;
+
+        this->width = width;
+        this->height = height;
+        allocate();
+    }
+
+    /** @brief Render the geometry pass into the G-buffer and set the viewport to cover it.
+     */
+    void bind() const
+    {
+        RenderState::get().bindFramebuffer(GL_FRAMEBUFFER, fbo);
+        RenderState::get().viewport(0, 0, width, height);
+    }
+
+    /** @brief Bin the lights into clusters and upload them for draw().
+     *  @param light in eye coordinates; any number of them.
+     */
+    void setLights(const Matrix &projection, GLsizei count, const Light *light)
+    {
+        PROFILE_SCOPE("light grid");
+
+        grid.build(projection, width, height, count, light);
+        upload(LIGHTS, count * sizeof(Light), light);
+        upload(CLUSTERS, grid.getClusters().size() * sizeof(GLint), grid.getClusters().data());
+        upload(INDICES, grid.getIndices().size() * sizeof(GLint), grid.getIndices().data());
+    }
+
+    /** @brief Light the G-buffer into the bound framebuffer with the
+     *  deferred.vert/deferred.frag program. Background pixels are left as
+     *  they are. The Frame block must be bound; depth testing is left enabled.
+     */
+    void draw(GLuint program) const
+    {
+        RenderState &state(RenderState::get());
+        state.useProgram(program);
+
+        static const char *const sampler[ATTACHMENTS + DATA] = {
+            "normalTexture", "albedoTexture", "specularTexture", "depthTexture",
+            "lightTexture",  "clusterTexture", "indexTexture"};
+        for(GLuint unit = 0; unit < ATTACHMENTS + DATA; ++unit) {
+            if(unit < ATTACHMENTS)
+                state.bindTexture(unit, GL_TEXTURE_2D, attachment[unit]);
+            else
+                state.bindTexture(unit, GL_TEXTURE_BUFFER, texture[unit - ATTACHMENTS]);
+            glUniform1i(glGetUniformLocation(program, sampler[unit]), unit);
+        }
+
+        glUniform2f(glGetUniformLocation(program, "viewportSize"), static_cast<GLfloat>(width),
+                    static_cast<GLfloat>(height));
+        glUniform1i(glGetUniformLocation(program, "tileSize"), grid.getTileSize());
+        glUniform2i(glGetUniformLocation(program, "tileCount"), grid.getTilesX(), grid.getTilesY());
+        glUniform1i(glGetUniformLocation(program, "sliceCount"), grid.getSlices());
+        glUniform2f(glGetUniformLocation(program, "sliceTransform"), grid.getSliceScale(), grid.getSliceBias());
+
+        state.disable(GL_DEPTH_TEST);
+        state.bindVertexArray(vao);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        state.enable(GL_DEPTH_TEST);
+    }
+
+    const LightGrid &getGrid() const
+    {
+        return grid;
+    }
+
+    GLsizei getWidth() const
+    {
+        return width;
+    }
+
+    GLsizei getHeight() const
+    {
+        return height;
+    }
+};
@@ -0,0 +1,179 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <vector>
+
+/** @brief Linear allocator for data that lives for one frame.
+ *
+ *  allocate() bumps a pointer through one block and reset() rewinds it, so
+ *  freeing is free and nothing is ever returned to the heap. A frame that
+ *  does not fit gets overflow blocks from the heap; the next reset() then
+ *  replaces the block with one large enough for that frame, so once the
+ *  working set is known the arena makes no heap allocation at all.
+ *  Not thread safe: use one arena per thread.
+ */
+class FrameArena
+{
+    char *block;
+    std::size_t capacity;
+    std::size_t used;
+
+    std::vector<char *> overflow;
+    std::size_t overflowBytes;
+
+    std::size_t peak;       // bytes used by the busiest frame
+    std::size_t framePeak;  // bytes used by the last finished frame
+    GLsizei heapAllocations;
+    GLsizei frameHeapAllocations;
+
+    FrameArena(const FrameArena &);
+    FrameArena &operator=(const FrameArena &);
+
+    static char *allocateBlock(std::size_t size)
+    {
+        char *const p(static_cast<char *>(malloc(size)));
+        if(p == NULL) {
+            std::cerr << "Can't allocate the frame arena." << std::endl;
+            exit(1);
+        }
+        return p;
+    }
+
+public:
+    explicit FrameArena(std::size_t capacity = 1 << 20)
+        : block(allocateBlock(capacity)), capacity(capacity), used(0), overflowBytes(0), peak(0), framePeak(0),
+          heapAllocations(0), frameHeapAllocations(0)
+    {
+        overflow.reserve(16);
+    }
+
+    virtual ~FrameArena()
+    {
+        for(std::size_t i = 0; i < overflow.size(); ++i)
+            free(overflow[i]);
+        free(block);
+    }
+
+    /** @param alignment a power of two no larger than alignof(std::max_align_t).
+     */
+    void *allocate(std::size_t size, std::size_t alignment = alignof(std::max_align_t))
+    {
+        const std::size_t start((used + alignment - 1) & ~(alignment - 1));
+        if(start + size <= capacity) {
+            used = start + size;
+            return block + start;
+        }
+
+        // malloc aligns for any fundamental type
+        char *const p(allocateBlock(size));
+        overflow.push_back(p);
+        overflowBytes += size;
+        ++heapAllocations;
+        ++frameHeapAllocations;
+        return p;
+    }
+
+    template <typename T> T *allocate(std::size_t count)
+    {
+        return static_cast<T *>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    /** @brief Start a new frame; everything allocated so far is released.
+     */
+    void reset()
+    {
+        framePeak = used + overflowBytes;
+        peak = std::max(peak, framePeak);
+
+        if(!overflow.empty()) {
+            for(std::size_t i = 0; i < overflow.size(); ++i)
+                free(overflow[i]);
+            overflow.clear();
+
+            // grow to what this frame needed, with headroom
+            free(block);
+            capacity = framePeak + framePeak / 2;
+            block = allocateBlock(capacity);
+            ++heapAllocations;
+        }
+
+        used = 0;
+        overflowBytes = 0;
+        frameHeapAllocations = 0;
+    }
+
+    /// Bytes used by the last frame that was reset.
+    std::size_t getFramePeak() const
+    {
+        return framePeak;
+    }
+
+    /// Bytes used by the busiest frame so far.
+    std::size_t getPeak() const
+    {
+        return peak;
+    }
+
+    std::size_t getCapacity() const
+    {
+        return capacity;
+    }
+
+    /// Heap allocations since construction, not counting the initial block.
+    GLsizei getHeapAllocations() const
+    {
+        return heapAllocations;
+    }
+
+    /// Heap allocations in the current frame; zero in steady state.
+    GLsizei getFrameHeapAllocations() const
+    {
+        return frameHeapAllocations;
+    }
+};
+
+/** @brief STL allocator drawing from a FrameArena, e.g.
+ *  std::vector<GLuint, ArenaAllocator<GLuint>> v(ArenaAllocator<GLuint>(arena));
+ *  Containers using it must not outlive the frame.
+ */
+template <typename T> class ArenaAllocator
+{
+    template <typename U> friend class ArenaAllocator;
+
+    FrameArena *arena;
+
+public:
+    typedef T value_type;
+
+    explicit ArenaAllocator(FrameArena &arena) : arena(&arena)
+    {
+    }
+
+    template <typename U> ArenaAllocator(const ArenaAllocator<U> &a) : arena(a.arena)
+    {
+    }
+
+    T *allocate(std::size_t count)
+    {
+        return arena->allocate<T>(count);
+    }
+
+    void deallocate(T *, std::size_t)
+    {
+        // released all at once by FrameArena::reset()
+    }
+
+    template <typename U> bool operator==(const ArenaAllocator<U> &a) const
+    {
+        return arena == a.arena;
+    }
+
+    template <typename U> bool operator!=(const ArenaAllocator<U> &a) const
+    {
+        return arena != a.arena;
+    }
+};
@@ -0,0 +1,68 @@
+#pragma once
+#include <GL/glew.h>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "Instance.h"
+#include "Matrix.h"
+#include "Ray.h"
+
+/** @brief Everything the GL thread needs to draw one frame.
+ *
+ *  The inputs (time, viewport and window state) are captured on the GL
+ *  thread; the job threads then fill in the matrices and one slot per
+ *  object, each job writing only its own slots. Submission reads the
+ *  packet without touching the scene, so the next frame can be simulated
+ *  into another packet meanwhile.
+ */
+struct FramePacket
+{
+    // inputs
+    GLuint frame;
+    GLfloat time;
+    GLfloat size[2];
+    GLfloat scale;
+    GLfloat location[2];
+    bool clicked;
+    GLfloat click[2];  // in normalized device coordinates, if clicked
+
+    // outputs
+    Matrix projection;
+    Matrix view;
+    Matrix parent;  // view * world of the objects' parent, for GpuCuller
+    RayHit pick;    // the object under the click, as its index
+
+    std::vector<Instance> instance;
+    std::vector<GLubyte> visible;
+    std::vector<GLint> level;
+    std::vector<std::uint64_t> sortKey;
+
+    // objects tested against the occluders, and those found hidden
+    GLsizei occlusionTested;
+    GLsizei occlusionCulled;
+
+    // occluder candidates and the objects in the frustum; scratch kept with the packet so it is not
+    // reallocated every frame
+    std::vector<GLuint> nearest;
+    std::vector<GLuint> inFrustum;
+
+    void resize(std::size_t objects)
+    {
+        instance.resize(objects);
+        visible.resize(objects);
+        level.resize(objects);
+        sortKey.resize(objects);
+    }
+
+    /** @brief Key that orders draws by level, then front to back.
+     *  @param depth distance along the view direction; non-negative floats sort like their bits.
+     */
+    static std::uint64_t makeSortKey(GLint level, GLfloat depth)
+    {
+        std::uint32_t bits(0);
+        if(depth > 0.0f)
+            memcpy(&bits, &depth, sizeof(bits));
+        return static_cast<std::uint64_t>(level) << 32 | bits;
+    }
+};
@@ -0,0 +1,103 @@
+#pragma once
+#include <GL/glew.h>
+#include <chrono>
+#include <ostream>
+#include <vector>
+
+/** @brief Per-frame CPU and GPU time recorder.
+ *
+ *  GPU time comes from GL_TIME_ELAPSED queries. A query is read back only
+ *  when its slot is reused `latency` frames later, so recording never waits
+ *  on the GPU in the middle of the loop; finish() collects the rest.
+ */
+class FrameTimer
+{
+public:
+    struct Sample
+    {
+        GLuint frame;
+        double cpu;  // milliseconds
+        double gpu;  // milliseconds
+    };
+
+private:
+    static const GLuint latency = 4;
+
+    GLuint query[latency];
+
+    std::chrono::steady_clock::time_point start;
+
+    std::vector<Sample> samples;
+
+    FrameTimer(const FrameTimer &);
+    FrameTimer &operator=(const FrameTimer &);
+
+    void collect(GLuint frame)
+    {
+        GLuint64 elapsed(0);
+        glGetQueryObjectui64v(query[frame % latency], GL_QUERY_RESULT, &elapsed);
+        samples[frame].gpu = static_cast<double>(elapsed) * 1.0e-6;
+    }
+
+public:
+    FrameTimer(GLuint frames = 0)
+    {
+        glGenQueries(latency, query);
+        samples.reserve(frames);
+    }
+
+    virtual ~FrameTimer()
+    {
+        glDeleteQueries(latency, query);
+    }
+
+    void begin()
+    {
+        const GLuint frame(static_cast<GLuint>(samples.size()));
+        if(frame >= latency)
+            collect(frame - latency);
+
+        start = std::chrono::steady_clock::now();
+        glBeginQuery(GL_TIME_ELAPSED, query[frame % latency]);
+    }
+
+    void end()
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+
+        const std::chrono::duration<double, std::milli> cpu(std::chrono::steady_clock::now() - start);
+        const Sample sample = {static_cast<GLuint>(samples.size()), cpu.count(), 0.0};
+        samples.push_back(sample);
+    }
+
+    /** @brief Wait for the queries still in flight.
+     */
+    void finish()
+    {
+        const GLuint frames(static_cast<GLuint>(samples.size()));
+        for(GLuint frame = frames > latency ? frames - latency : 0; frame < frames; ++frame)
+            collect(frame);
+    }
+
+    const std::vector<Sample> &getSamples() const
+    {
+        return samples;
+    }
+
+    void writeCsv(std::ostream &out) const
+    {
+        out << "frame,cpu_ms,gpu_ms\n";
+        for(std::size_t i = 0; i < samples.size(); ++i)
+            out << samples[i].frame << ',' << samples[i].cpu << ',' << samples[i].gpu << '\n';
+    }
+
+    void writeJson(std::ostream &out) const
+    {
+        out << "{\"frames\":[";
+        for(std::size_t i = 0; i < samples.size(); ++i) {
+            out << (i > 0 ? "," : "") << "\n  {\"frame\":" << samples[i].frame << ",\"cpu_ms\":" << samples[i].cpu
+                << ",\"gpu_ms\":" << samples[i].gpu << "}";
+        }
+        out << "\n]}\n";
+    }
+};
@@ -0,0 +1,82 @@
+#pragma once
+#include <GL/glew.h>
+#include <iostream>
+#include <vector>
+
+#include "RenderState.h"
+
+/** @brief Offscreen render target with a color and a depth renderbuffer.
+ *  Used in place of the window's default framebuffer when running headless.
+ */
+class Framebuffer
+{
+    GLuint fbo;
+    GLuint color;
+    GLuint depth;
+
+    GLsizei width;
+    GLsizei height;
+
+    Framebuffer(const Framebuffer &);
+    Framebuffer &operator=(const Framebuffer &);
+
+public:
+    Framebuffer(GLsizei width, GLsizei height) : width(width), height(height)
+    {
+        glGenRenderbuffers(1, &color);
+        glBindRenderbuffer(GL_RENDERBUFFER, color);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+        glGenRenderbuffers(1, &depth);
+        glBindRenderbuffer(GL_RENDERBUFFER, depth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+        glGenFramebuffers(1, &fbo);
+        RenderState::get().bindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "Can't create the framebuffer object." << std::endl;
+            exit(1);
+        }
+
+        RenderState::get().bindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    virtual ~Framebuffer()
+    {
+        RenderState::get().forgetFramebuffer(fbo);
+        glDeleteFramebuffers(1, &fbo);
+        glDeleteRenderbuffers(1, &depth);
+        glDeleteRenderbuffers(1, &color);
+    }
+
+    /** @brief Render into this framebuffer and set the viewport to cover it.
+     */
+    void bind() const
+    {
+        RenderState::get().bindFramebuffer(GL_FRAMEBUFFER, fbo);
+        RenderState::get().viewport(0, 0, width, height);
+    }
+
+    /** @brief Read back the color attachment as RGBA8, bottom row first.
+     */
+    void readPixels(std::vector<GLubyte> &pixels) const
+    {
+        pixels.resize(width * height * 4);
+
+        RenderState::get().bindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    }
+
+    GLsizei getWidth() const
+    {
+        return width;
+    }
+
+    GLsizei getHeight() const
+    {
+        return height;
+    }
+};
@@ -0,0 +1,143 @@
+#pragma once
+#include <GL/glew.h>
+#include <cfloat>
+#include <cmath>
+
+#include "Bounds.h"
+#include "Matrix.h"
+#include "MatrixKernel.h"
+
+/** @brief Six clip planes extracted from a projection (or projection * view) matrix.
+ *
+ *  Planes are stored as structure of arrays padded to eight, the two extra
+ *  planes always passing, so a box is tested against four planes per SSE
+ *  instruction. Boxes must be in the space the matrix maps from: with
+ *  projection * view that is world space, with projection alone it is
+ *  view space.
+ */
+class Frustum
+{
+public:
+    enum Result
+    {
+        OUTSIDE,
+        INTERSECT,
+        INSIDE
+    };
+
+private:
+    GLfloat nx[8], ny[8], nz[8], d[8];
+
+    // absolute values of the normals, for the projected box radius
+    GLfloat ax[8], ay[8], az[8];
+
+public:
+    explicit Frustum(const Matrix &m)
+    {
+        // plane = row 3 +/- row k of the column-major matrix
+        for(int p = 0; p < 6; p++) {
+            const int k(p >> 1);
+            const GLfloat s(p & 1 ? -1.0f : 1.0f);
+
+            const GLfloat a(m[3] + s * m[k]);
+            const GLfloat b(m[7] + s * m[4 + k]);
+            const GLfloat c(m[11] + s * m[8 + k]);
+            const GLfloat w(m[15] + s * m[12 + k]);
+            const GLfloat l(sqrt(a * a + b * b + c * c));
+            const GLfloat r(l > 0.0f ? 1.0f / l : 0.0f);
+
+            nx[p] = a * r;
+            ny[p] = b * r;
+            nz[p] = c * r;
+            d[p] = w * r;
+        }
+
+        for(int p = 6; p < 8; p++) {
+            nx[p] = ny[p] = nz[p] = 0.0f;
+            d[p] = FLT_MAX;
+        }
+
+        for(int p = 0; p < 8; p++) {
+            ax[p] = fabs(nx[p]);
+            ay[p] = fabs(ny[p]);
+            az[p] = fabs(nz[p]);
+        }
+    }
+
+    /** @brief Plane p as (a, b, c, d) with a unit normal pointing inside.
+     */
+    void getPlane(int p, GLfloat *plane) const
+    {
+        plane[0] = nx[p];
+        plane[1] = ny[p];
+        plane[2] = nz[p];
+        plane[3] = d[p];
+    }
+
+    Result classify(const Bounds &b) const
+    {
+        GLfloat c[3], e[3];
+        b.getCenter(c);
+        b.getExtent(e);
+
+#if defined(MATRIX_KERNEL_X86)
+        const __m128 cx(_mm_set1_ps(c[0])), cy(_mm_set1_ps(c[1])), cz(_mm_set1_ps(c[2]));
+        const __m128 ex(_mm_set1_ps(e[0])), ey(_mm_set1_ps(e[1])), ez(_mm_set1_ps(e[2]));
+        const __m128 zero(_mm_setzero_ps());
+
+        int outside(0), intersect(0);
+        for(int p = 0; p < 8; p += 4) {
+            const __m128 dist(_mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(nx + p), cx), _mm_mul_ps(_mm_loadu_ps(ny + p), cy)),
+                _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(nz + p), cz), _mm_loadu_ps(d + p))));
+            const __m128 r(
+                _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(ax + p), ex), _mm_mul_ps(_mm_loadu_ps(ay + p), ey)),
+                           _mm_mul_ps(_mm_loadu_ps(az + p), ez)));
+
+            outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(dist, r), zero));
+            intersect |= _mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(dist, r), zero));
+        }
+
+        return outside ? OUTSIDE : intersect ? INTERSECT : INSIDE;
+#else
+        Result result(INSIDE);
+        for(int p = 0; p < 6; p++) {
+            const GLfloat dist(nx[p] * c[0] + ny[p] * c[1] + nz[p] * c[2] + d[p]);
+            const GLfloat r(ax[p] * e[0] + ay[p] * e[1] + az[p] * e[2]);
+
+            if(dist + r < 0.0f)
+                return OUTSIDE;
+            if(dist - r < 0.0f)
+                result = INTERSECT;
+        }
+        return result;
+#endif
+    }
+
+    bool isVisible(const Bounds &b) const
+    {
+        return classify(b) != OUTSIDE;
+    }
+
+    bool isVisible(const GLfloat *center, GLfloat radius) const
+    {
+        for(int p = 0; p < 6; p++) {
+            if(nx[p] * center[0] + ny[p] * center[1] + nz[p] * center[2] + d[p] < -radius)
+                return false;
+        }
+        return true;
+    }
+
+    /** @brief Test count boxes; visible[i] is set to 1 or 0.
+     *  @return number of visible boxes.
+     */
+    GLsizei cull(const Bounds *bounds, GLsizei count, GLubyte *visible) const
+    {
+        GLsizei n(0);
+        for(GLsizei i = 0; i < count; ++i) {
+            visible[i] = isVisible(bounds[i]) ? 1 : 0;
+            n += visible[i];
+        }
+        return n;
+    }
+};
@@ -0,0 +1,218 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "Frustum.h"
+#include "InstancedShape.h"
+#include "LodSelector.h"
+#include "Matrix.h"
+#include "Profiler.h"
+#include "RenderQueue.h"
+#include "RenderState.h"
+
+/** @brief Frustum culling and level selection in a compute shader, feeding indirect draws.
+ *
+ *  The objects' transforms relative to a common parent live in a shader
+ *  storage buffer, uploaded once by setObjects(). cull() runs cull.comp
+ *  over all of them with the parent's modelview. An object whose box is in
+ *  the frustum picks its level as LodSelector::select() does, keeping the
+ *  level between frames in another buffer for the hysteresis, and appends
+ *  its index to that level's slice of the visible buffer, counting itself
+ *  in the level's DrawElementsIndirectCommand with an atomic add, and
+ *  writes its modelview and normal matrix to the transform buffer, so the
+ *  inverse is taken once per object rather than per vertex. draw() then
+ *  issues one glDrawElementsIndirect per level; culled.vert gets the object
+ *  index as an instance attribute and fetches both matrices from the
+ *  transform buffer. Nothing is read back, and the CPU work per frame is
+ *  a few uniforms and one command per level, whatever the object count.
+ *
+ *  Needs GL 4.3, or compute shaders, storage buffers, indirect draws and
+ *  base instance as extensions; without them isSupported() is false and
+ *  the caller culls on the CPU as before. A core context requested as 3.3
+ *  usually comes back as the newest version the driver has.
+ */
+class GpuCuller
+{
+public:
+    typedef RenderQueue::DrawElementsIndirectCommand DrawElementsIndirectCommand;
+
+    /// Storage buffer bindings, as declared in cull.comp and culled.vert.
+    enum Binding
+    {
+        OBJECTS,
+        LEVELS,
+        COMMANDS,
+        VISIBLE,
+        TRANSFORMS,
+        BINDINGS
+    };
+
+    /// Size of struct Transform in cull.comp and culled.vert: a mat4 and, in std430, a mat3 as three vec4.
+    static const GLsizeiptr TRANSFORM_SIZE = (16 + 12) * sizeof(GLfloat);
+
+    /// Size of the levelError array in cull.comp; coarser levels are not drawn.
+    static const GLsizei MAX_LEVELS = 8;
+
+    /// local_size_x of cull.comp.
+    static const GLuint GROUP_SIZE = 64;
+
+private:
+    GLuint buffer[BINDINGS];
+
+    GLsizei count;
+    GLsizei levels;  // commands written by the last cull()
+
+    DrawElementsIndirectCommand commands[MAX_LEVELS];
+
+    GpuCuller(const GpuCuller &);
+    GpuCuller &operator=(const GpuCuller &);
+
+    void allocate(Binding b, GLsizeiptr size, const GLvoid *data, GLenum usage)
+    {
+        RenderState::get().bindBuffer(GL_SHADER_STORAGE_BUFFER, buffer[b]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, usage);
+        if(data != NULL)
+            PROFILE_COUNT(UPLOAD_BYTES, size);
+    }
+
+public:
+    GpuCuller() : count(0), levels(0)
+    {
+        glGenBuffers(BINDINGS, buffer);
+        allocate(COMMANDS, sizeof(commands), NULL, GL_DYNAMIC_DRAW);
+    }
+
+    virtual ~GpuCuller()
+    {
+        for(int b = 0; b < BINDINGS; ++b)
+            RenderState::get().forgetBuffer(buffer[b]);
+        glDeleteBuffers(BINDINGS, buffer);
+    }
+
+    static bool isSupported()
+    {
+        return GLEW_VERSION_4_3 || (GLEW_ARB_compute_shader && GLEW_ARB_shader_storage_buffer_object &&
+                                    GLEW_ARB_draw_indirect && GLEW_ARB_base_instance);
+    }
+
+    /** @brief Replace the objects and forget their levels.
+     *  @param model transform of each object relative to the parent given to cull().
+     */
+    void setObjects(GLsizei count, const Matrix *model)
+    {
+        this->count = count;
+
+        std::vector<GLfloat> matrices(count * 16);
+        for(GLsizei i = 0; i < count; ++i)
+            std::copy(model[i].data(), model[i].data() + 16, &matrices[i * 16]);
+        allocate(OBJECTS, matrices.size() * sizeof(GLfloat), matrices.data(), GL_STATIC_DRAW);
+
+        const std::vector<GLint> none(count, -1);
+        allocate(LEVELS, none.size() * sizeof(GLint), none.data(), GL_DYNAMIC_COPY);
+        allocate(TRANSFORMS, count * TRANSFORM_SIZE, NULL, GL_DYNAMIC_COPY);
+
+        // a slice per level, each large enough for every object
+        allocate(VISIBLE, MAX_LEVELS * count * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+    }
+
+    /** @brief Cull the objects and write the commands for draw(), all on the GPU.
+     *  @param program built from cull.comp.
+     *  @param modelview of the parent: view * its world matrix.
+     *  @param height of the viewport in pixels, for the level errors.
+     *  @param shapes one per level, all with the bounds of the first.
+     */
+    void cull(GLuint program, const Matrix &projection, const Matrix &modelview, GLsizei height,
+              const LodSelector &selector, const std::vector<std::unique_ptr<InstancedShape>> &shapes)
+    {
+        PROFILE_SCOPE("gpu cull");
+        RenderState &state(RenderState::get());
+
+        levels = static_cast<GLsizei>(std::min<std::size_t>(shapes.size(), selector.getLevelCount()));
+        levels = std::min(levels, static_cast<GLsizei>(MAX_LEVELS));
+
+        // every level starts empty, reading its own slice of the visible buffer
+        for(GLsizei l = 0; l < levels; ++l) {
+            const DrawElementsIndirectCommand command = {static_cast<GLuint>(shapes[l]->getIndexCount()), 0, 0, 0,
+                                                         static_cast<GLuint>(l * count)};
+            commands[l] = command;
+        }
+        state.bindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer[COMMANDS]);
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, levels * sizeof(DrawElementsIndirectCommand), commands);
+        PROFILE_COUNT(UPLOAD_BYTES, levels * sizeof(DrawElementsIndirectCommand));
+
+        if(count == 0 || levels == 0)
+            return;
+
+        state.useProgram(program);
+
+        // the boxes are transformed to eye space, so the projection alone gives the frustum
+        const Frustum frustum(projection);
+        GLfloat plane[6 * 4];
+        for(int p = 0; p < 6; ++p)
+            frustum.getPlane(p, plane + p * 4);
+
+        GLfloat center[3], extent[3];
+        shapes[0]->getBounds().getCenter(center);
+        shapes[0]->getBounds().getExtent(extent);
+
+        GLfloat error[MAX_LEVELS];
+        for(GLsizei l = 0; l < levels; ++l)
+            error[l] = selector.getError(l);
+
+        glUniformMatrix4fv(glGetUniformLocation(program, "parentModelview"), 1, GL_FALSE, modelview.data());
+        glUniform4fv(glGetUniformLocation(program, "plane"), 6, plane);
+        glUniform3fv(glGetUniformLocation(program, "boundsCenter"), 1, center);
+        glUniform3fv(glGetUniformLocation(program, "boundsExtent"), 1, extent);
+        glUniform1ui(glGetUniformLocation(program, "objectCount"), count);
+        glUniform1i(glGetUniformLocation(program, "levelCount"), levels);
+        glUniform1fv(glGetUniformLocation(program, "levelError"), levels, error);
+        glUniform1f(glGetUniformLocation(program, "pixelScale"), projection[5] * height * 0.5f);
+        glUniform1f(glGetUniformLocation(program, "threshold"), selector.getThreshold());
+        glUniform1f(glGetUniformLocation(program, "hysteresis"), selector.getHysteresis());
+
+        for(GLuint b = 0; b < BINDINGS; ++b)
+            state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, b, buffer[b]);
+
+        glDispatchCompute((count + GROUP_SIZE - 1) / GROUP_SIZE, 1, 1);
+
+        // the draws read the commands, the object indices and the transforms written above
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+
+    /** @brief Draw what the last cull() kept, one indirect call per level.
+     *  @param program built from culled.vert; the Frame and Object blocks must be bound.
+     */
+    void draw(GLuint program, const std::vector<std::unique_ptr<InstancedShape>> &shapes)
+    {
+        PROFILE_SCOPE("gpu draw");
+        RenderState &state(RenderState::get());
+
+        state.useProgram(program);
+        state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, TRANSFORMS, buffer[TRANSFORMS]);
+
+        state.bindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer[COMMANDS]);
+        for(GLsizei l = 0; l < levels && l < static_cast<GLsizei>(shapes.size()); ++l)
+            shapes[l]->drawIndirect(buffer[VISIBLE], l * sizeof(DrawElementsIndirectCommand));
+    }
+
+    GLsizei getObjectCount() const
+    {
+        return count;
+    }
+
+    /** @brief Objects drawn by the last cull(). This reads the commands
+     *  back and so waits for the GPU; use it for reports, not every frame.
+     */
+    GLsizei getDrawnCount()
+    {
+        RenderState::get().bindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer[COMMANDS]);
+        glGetBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, levels * sizeof(DrawElementsIndirectCommand), commands);
+
+        GLsizei drawn(0);
+        for(GLsizei l = 0; l < levels; ++l)
+            drawn += commands[l].instanceCount;
+        return drawn;
+    }
+};
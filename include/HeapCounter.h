@@ -0,0 +1,18 @@
+#pragma once
+#include <cstddef>
+
+/** @brief Count of every call to operator new, from any thread.
+ *
+ *  src/HeapCounter.cpp replaces the global operator new and delete to keep
+ *  the count, so allocations made inside the standard library, such as a
+ *  growing vector or a std::function holding a large closure, are counted
+ *  with the explicit ones. Memory taken with malloc, like FrameArena's
+ *  blocks, is not. The replacements live in their own translation unit so
+ *  the compiler never inlines them into a caller.
+ */
+class HeapCounter
+{
+public:
+    /// Calls to operator new since the program started.
+    static std::size_t getCount();
+};
@@ -0,0 +1,55 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+
+#include "Matrix.h"
+#include "RenderState.h"
+
+/** @brief Per-instance transform read by instanced.vert.
+ *  instanceModelview uses attribute locations 2..5 and instanceNormalMatrix
+ *  uses 6..8, as bound by createProgram.
+ */
+struct Instance
+{
+    GLfloat modelview[16];
+    GLfloat normalMatrix[9];
+
+    void set(const Matrix &m)
+    {
+        std::copy(m.data(), m.data() + 16, modelview);
+        m.getNormalMatrix(normalMatrix);
+    }
+
+    /** @brief Point the instance attributes of the bound VAO at buffer.
+     *  @param first instance read for gl_InstanceID 0, where base instance is missing.
+     */
+    static void setup(GLuint buffer, GLsizei first = 0)
+    {
+        RenderState::get().bindBuffer(GL_ARRAY_BUFFER, buffer);
+
+        const Instance *const base(static_cast<Instance *>(0) + first);
+        for(GLuint i = 0; i < 4; i++) {
+            glVertexAttribPointer(2 + i, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), base->modelview + i * 4);
+            glEnableVertexAttribArray(2 + i);
+            glVertexAttribDivisor(2 + i, 1);
+        }
+
+        for(GLuint i = 0; i < 3; i++) {
+            glVertexAttribPointer(6 + i, 3, GL_FLOAT, GL_FALSE, sizeof(Instance), base->normalMatrix + i * 3);
+            glEnableVertexAttribArray(6 + i);
+            glVertexAttribDivisor(6 + i, 1);
+        }
+    }
+
+    /** @brief Set the instance attributes as constant values, for drawing
+     *  without an instance buffer. The arrays must be disabled.
+     */
+    void apply() const
+    {
+        for(GLuint i = 0; i < 4; i++)
+            glVertexAttrib4fv(2 + i, modelview + i * 4);
+
+        for(GLuint i = 0; i < 3; i++)
+            glVertexAttrib3fv(6 + i, normalMatrix + i * 3);
+    }
+};
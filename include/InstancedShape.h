@@ -0,0 +1,129 @@
+#pragma once
+#include <vector>
+
+#include "Instance.h"
+#include "Profiler.h"
+#include "RenderState.h"
+#include "SolidShapeIndex.h"
+
+/** @brief SolidShapeIndex drawn once per frame for every instance.
+ *
+ *  The modelview and normal matrices live in a per-instance vertex buffer
+ *  (glVertexAttribDivisor = 1) instead of uniforms, so N copies of the shape
+ *  cost one buffer upload and one glDrawElementsInstanced call.
+ */
+class InstancedShape : public SolidShapeIndex
+{
+public:
+    typedef ::Instance Instance;
+
+private:
+    GLuint instanceBuffer;
+
+    GLsizei instancecount;
+
+    GLuint indexBuffer;  // read at location 2 since the last drawIndirect(), or 0 for the instance data
+
+    InstancedShape(const InstancedShape &);
+    InstancedShape &operator=(const InstancedShape &);
+
+    void init()
+    {
+        bind();
+
+        glGenBuffers(1, &instanceBuffer);
+        Instance::setup(instanceBuffer);
+
+        RenderState::get().bindVertexArray(0);
+    }
+
+    /// Point the instance attributes back at the instance data after drawIndirect().
+    void restoreInstances()
+    {
+        if(indexBuffer == 0)
+            return;
+
+        bind();
+        Instance::setup(instanceBuffer);
+        indexBuffer = 0;
+    }
+
+public:
+    InstancedShape(GLint size, GLsizei vertexcount, const Object::Vertex *vertex, GLsizei indexcount,
+                   const GLuint *index)
+        : SolidShapeIndex(size, vertexcount, vertex, indexcount, index), instancecount(0), indexBuffer(0)
+    {
+        init();
+    }
+
+    InstancedShape(GLint size, GLsizei vertexcount, const Object::Vertex *vertex, GLsizei indexcount,
+                   const GLushort *index)
+        : SolidShapeIndex(size, vertexcount, vertex, indexcount, index), instancecount(0), indexBuffer(0)
+    {
+        init();
+    }
+
+    InstancedShape(const std::shared_ptr<const Object> &object, GLsizei vertexcount, const Bounds &bounds,
+                   GLsizei indexcount, GLenum indextype)
+        : SolidShapeIndex(object, vertexcount, bounds, indexcount, indextype), instancecount(0), indexBuffer(0)
+    {
+        init();
+    }
+
+    virtual ~InstancedShape()
+    {
+        RenderState::get().forgetBuffer(instanceBuffer);
+        glDeleteBuffers(1, &instanceBuffer);
+    }
+
+    /** @brief Replace the instance data for the next draw.
+     *  The buffer is orphaned on every call so the driver never waits for
+     *  the previous frame's draw to finish reading it.
+     */
+    void setInstances(GLsizei count, const Instance *instance)
+    {
+        restoreInstances();
+
+        RenderState::get().bindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        glBufferData(GL_ARRAY_BUFFER, count * sizeof(Instance), instance, GL_STREAM_DRAW);
+        instancecount = count;
+        PROFILE_COUNT(UPLOAD_BYTES, count * sizeof(Instance));
+    }
+
+    void setInstances(const std::vector<Instance> &instance)
+    {
+        setInstances(static_cast<GLsizei>(instance.size()), instance.data());
+    }
+
+    GLsizei getInstanceCount() const
+    {
+        return instancecount;
+    }
+
+    /** @brief Draw the command at the given offset into the bound
+     *  GL_DRAW_INDIRECT_BUFFER (GL 4.0 with base instance, 4.2). Instead of
+     *  the instance data the program gets one unsigned int per instance at
+     *  location 2, read from buffer from the command's baseInstance on.
+     */
+    void drawIndirect(GLuint buffer, GLintptr command)
+    {
+        bind();
+        if(indexBuffer != buffer) {
+            RenderState::get().bindBuffer(GL_ARRAY_BUFFER, buffer);
+            glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, 0, 0);
+            for(GLuint a = 3; a < 9; a++)
+                glDisableVertexAttribArray(a);
+            indexBuffer = buffer;
+        }
+
+        glDrawElementsIndirect(GL_TRIANGLES, indextype, reinterpret_cast<const GLvoid *>(command));
+        PROFILE_COUNT(DRAW_CALLS, 1);
+    }
+
+    virtual void excute() const
+    {
+        glDrawElementsInstanced(GL_TRIANGLES, indexcount, indextype, 0, instancecount);
+        PROFILE_COUNT(DRAW_CALLS, 1);
+        PROFILE_COUNT(TRIANGLES, indexcount / 3 * instancecount);
+    }
+};
@@ -0,0 +1,282 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "PoolAllocator.h"
+
+/** @brief Worker threads running small jobs, balanced by work stealing.
+ *
+ *  Every thread (the workers and the thread that created the system, which
+ *  counts as thread 0) owns a deque. A thread pushes and pops jobs at the
+ *  back of its own deque, so the jobs it just spawned run while their data
+ *  is still in cache, and steals from the front of the others when its own
+ *  is empty. wait() runs jobs instead of blocking, so a job may spawn and
+ *  wait for jobs of its own. None of this touches GL, which stays on the
+ *  thread that owns the context.
+ *
+ *  A job is moved, never copied, from run() to the thread that runs it, and
+ *  the deques are rings that only grow, so a closure small enough for
+ *  std::function to store in place costs no heap allocation. parallelFor()
+ *  keeps its chunks in a pool per queue and hands each job only a pointer
+ *  to one.
+ */
+class JobSystem
+{
+public:
+    typedef std::function<void()> Job;
+
+    /// Number of unfinished jobs started with it.
+    class Counter
+    {
+        std::atomic<int> pending;
+
+        friend class JobSystem;
+
+        Counter(const Counter &);
+        Counter &operator=(const Counter &);
+
+    public:
+        Counter() : pending(0)
+        {
+        }
+
+        bool done() const
+        {
+            return pending.load(std::memory_order_acquire) == 0;
+        }
+    };
+
+private:
+    struct Task
+    {
+        Job job;
+        Counter *counter;
+    };
+
+    struct Range
+    {
+        const void *func;
+        void (*call)(const void *func, std::size_t begin, std::size_t end);
+        std::size_t begin;
+        std::size_t end;
+        Range *next;  // the other chunks of the same parallelFor()
+    };
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::vector<Task> tasks;  // ring of count tasks from head
+        std::size_t head;
+        std::size_t count;
+        PoolAllocator<Range> ranges;  // chunks of parallelFor() calls made on the owning thread
+
+        Queue() : tasks(64), head(0), count(0)
+        {
+        }
+
+        void pushBack(Task &task)
+        {
+            if(count == tasks.size()) {
+                std::vector<Task> grown(tasks.size() * 2);
+                for(std::size_t i = 0; i < count; ++i)
+                    grown[i] = std::move(tasks[(head + i) % tasks.size()]);
+                tasks.swap(grown);
+                head = 0;
+            }
+            tasks[(head + count++) % tasks.size()] = std::move(task);
+        }
+
+        void popBack(Task &task)
+        {
+            task = std::move(tasks[(head + --count) % tasks.size()]);
+        }
+
+        void popFront(Task &task)
+        {
+            task = std::move(tasks[head]);
+            head = (head + 1) % tasks.size();
+            --count;
+        }
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+
+    std::atomic<bool> running;
+    std::atomic<int> queued;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+
+    JobSystem(const JobSystem &);
+    JobSystem &operator=(const JobSystem &);
+
+    /// Queue of the calling thread; threads outside the system use queue 0.
+    std::size_t self() const
+    {
+        const std::thread::id id(std::this_thread::get_id());
+        for(std::size_t i = 0; i < threads.size(); ++i) {
+            if(threads[i].get_id() == id)
+                return i + 1;
+        }
+        return 0;
+    }
+
+    bool take(std::size_t index, Task &task)
+    {
+        // own deque from the back
+        {
+            Queue &q(*queues[index]);
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if(q.count > 0) {
+                q.popBack(task);
+                --queued;
+                return true;
+            }
+        }
+
+        // the others from the front
+        for(std::size_t k = 1; k < queues.size(); ++k) {
+            Queue &q(*queues[(index + k) % queues.size()]);
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if(q.count > 0) {
+                q.popFront(task);
+                --queued;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool runOne(std::size_t index)
+    {
+        Task task;
+        if(!take(index, task))
+            return false;
+
+        task.job();
+        task.counter->pending.fetch_sub(1, std::memory_order_release);
+        return true;
+    }
+
+    void work(std::size_t index)
+    {
+        while(running.load()) {
+            if(runOne(index))
+                continue;
+
+            // run() and the destructor change what the predicate reads under
+            // sleepMutex, so their notification cannot slip in between
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [this] { return queued.load() > 0 || !running.load(); });
+        }
+    }
+
+public:
+    /** @param workers threads besides the calling one; by default one per remaining core.
+     */
+    explicit JobSystem(unsigned int workers = std::max(std::thread::hardware_concurrency(), 2u) - 1)
+        : running(true), queued(0)
+    {
+        for(unsigned int i = 0; i <= workers; i++)
+            queues.push_back(std::unique_ptr<Queue>(new Queue));
+
+        for(unsigned int i = 0; i < workers; i++)
+            threads.push_back(std::thread(&JobSystem::work, this, i + 1));
+    }
+
+    virtual ~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            running = false;
+        }
+        wake.notify_all();
+        for(std::size_t i = 0; i < threads.size(); ++i)
+            threads[i].join();
+    }
+
+    /** @brief Start job; counter is decremented when it has run.
+     */
+    void run(Job job, Counter &counter)
+    {
+        counter.pending.fetch_add(1, std::memory_order_relaxed);
+
+        Task task = {std::move(job), &counter};
+        Queue &q(*queues[self()]);
+        {
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.pushBack(task);
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            ++queued;
+        }
+        wake.notify_one();
+    }
+
+    /** @brief Run jobs until every job started with counter has finished.
+     */
+    void wait(const Counter &counter)
+    {
+        const std::size_t index(self());
+        while(!counter.done()) {
+            if(!runOne(index))
+                std::this_thread::yield();
+        }
+    }
+
+    /** @brief Call func(begin, end) over [0, count) in chunks of grain and wait for all of them.
+     *  A grain of 0 is taken as 1.
+     */
+    template <typename Func> void parallelFor(std::size_t count, std::size_t grain, const Func &func)
+    {
+        grain = std::max(grain, static_cast<std::size_t>(1));
+
+        // threads outside the system share queue 0, so its pool is locked like its deque
+        Queue &q(*queues[self()]);
+        Range *ranges(NULL);
+
+        Counter counter;
+        for(std::size_t begin = 0; begin < count; begin += grain) {
+            Range *r;
+            {
+                std::lock_guard<std::mutex> lock(q.mutex);
+                r = q.ranges.create();
+            }
+            // called through a plain function pointer, so func is not wrapped in an allocating std::function
+            r->func = &func;
+            r->call = [](const void *f, std::size_t begin, std::size_t end) {
+                (*static_cast<const Func *>(f))(begin, end);
+            };
+            r->begin = begin;
+            r->end = std::min(begin + grain, count);
+            r->next = ranges;
+            ranges = r;
+
+            run([r] { r->call(r->func, r->begin, r->end); }, counter);
+        }
+        wait(counter);
+
+        std::lock_guard<std::mutex> lock(q.mutex);
+        while(ranges != NULL) {
+            Range *const next(ranges->next);
+            q.ranges.destroy(ranges);
+            ranges = next;
+        }
+    }
+
+    /// Worker threads plus the calling thread.
+    std::size_t getThreadCount() const
+    {
+        return queues.size();
+    }
+};
@@ -0,0 +1,199 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "Matrix.h"
+#include "UniformBlock.h"
+
+/** @brief Point lights binned into screen tiles and depth slices (clusters).
+ *
+ *  The view volume is cut into tileSize x tileSize pixel tiles and into
+ *  slices whose depth grows geometrically from the near to the far plane,
+ *  so every cluster is about as deep as it is wide. Each light is added to
+ *  the clusters its bounding box overlaps; lights without a radius, and
+ *  directional ones, reach every cluster. The result is one (offset, count)
+ *  pair per cluster into a flat list of light indices, which deferred.frag
+ *  reads to loop over only the lights that can reach a pixel.
+ *
+ *  Clusters are numbered (slice * tilesY + tileY) * tilesX + tileX, with
+ *  tile rows counted from the bottom as gl_FragCoord does.
+ */
+class LightGrid
+{
+    const GLsizei tileSize;
+    const GLsizei slices;
+
+    GLsizei width;
+    GLsizei height;
+    GLsizei tilesX;
+    GLsizei tilesY;
+
+    // slice = log(depth) * sliceScale + sliceBias
+    GLfloat sliceScale;
+    GLfloat sliceBias;
+
+    std::vector<GLint> cluster;  // offset and count per cluster
+    std::vector<GLint> index;    // light indices
+    std::vector<GLint> range;    // x0, y0, z0, x1, y1, z1 per light; x1 < x0 if culled
+
+    GLint getSlice(GLfloat depth) const
+    {
+        const GLint s(static_cast<GLint>(floor(log(depth) * sliceScale + sliceBias)));
+        return std::min(std::max(s, 0), slices - 1);
+    }
+
+    /// Clusters reached by a light, or false if it can't reach the view volume.
+    bool getRange(const Matrix &projection, GLfloat zNear, GLfloat zFar, const Light &light, GLint *r) const
+    {
+        r[0] = r[1] = r[2] = 0;
+        r[3] = tilesX - 1;
+        r[4] = tilesY - 1;
+        r[5] = slices - 1;
+
+        const GLfloat radius(light.radius);
+        if(light.position[3] == 0.0f || radius <= 0.0f)
+            return true;
+
+        const GLfloat *const c(light.position);
+        const GLfloat nearest(-c[2] - radius), farthest(-c[2] + radius);
+        if(farthest < zNear || nearest > zFar)
+            return false;
+
+        r[2] = getSlice(std::max(nearest, zNear));
+        r[5] = getSlice(std::min(farthest, zFar));
+        if(nearest < zNear)
+            return true;  // the box reaches past the near plane: every tile
+
+        GLfloat x0(1.0f), y0(1.0f), x1(-1.0f), y1(-1.0f);
+        for(int i = 0; i < 8; ++i) {
+            const GLfloat p[4] = {c[0] + (i & 1 ? radius : -radius), c[1] + (i & 2 ? radius : -radius),
+                                  c[2] + (i & 4 ? radius : -radius), 1.0f};
+            GLfloat q[4];
+            projection.transform(p, q, 1);
+            x0 = std::min(x0, q[0] / q[3]);
+            x1 = std::max(x1, q[0] / q[3]);
+            y0 = std::min(y0, q[1] / q[3]);
+            y1 = std::max(y1, q[1] / q[3]);
+        }
+        if(x0 > 1.0f || x1 < -1.0f || y0 > 1.0f || y1 < -1.0f)
+            return false;
+
+        const GLfloat sx(width * 0.5f / tileSize), sy(height * 0.5f / tileSize);
+        r[0] = std::max(static_cast<GLint>(floor((x0 + 1.0f) * sx)), 0);
+        r[1] = std::max(static_cast<GLint>(floor((y0 + 1.0f) * sy)), 0);
+        r[3] = std::min(static_cast<GLint>(floor((x1 + 1.0f) * sx)), tilesX - 1);
+        r[4] = std::min(static_cast<GLint>(floor((y1 + 1.0f) * sy)), tilesY - 1);
+        return true;
+    }
+
+public:
+    LightGrid(GLsizei tileSize = 32, GLsizei slices = 16)
+        : tileSize(tileSize), slices(slices), width(0), height(0), tilesX(0), tilesY(0), sliceScale(0.0f),
+          sliceBias(0.0f)
+    {
+    }
+
+    /** @brief Bin the lights for a perspective projection and a viewport of width x height pixels.
+     *  @param light in eye coordinates, like FrameBlock::light.
+     */
+    void build(const Matrix &projection, GLsizei width, GLsizei height, GLsizei count, const Light *light)
+    {
+        this->width = width;
+        this->height = height;
+        tilesX = (width + tileSize - 1) / tileSize;
+        tilesY = (height + tileSize - 1) / tileSize;
+
+        // the near and far planes of a perspective projection
+        const GLfloat zNear(projection[14] / (projection[10] - 1.0f));
+        const GLfloat zFar(projection[14] / (projection[10] + 1.0f));
+        sliceScale = slices / log(zFar / zNear);
+        sliceBias = -log(zNear) * sliceScale;
+
+        // count, then place, so the index list is filled without reallocation
+        const GLsizei clusters(tilesX * tilesY * slices);
+        cluster.assign(clusters * 2, 0);
+        range.resize(count * 6);
+        for(GLsizei l = 0; l < count; ++l) {
+            GLint *const r(&range[l * 6]);
+            if(!getRange(projection, zNear, zFar, light[l], r)) {
+                r[3] = -1;
+                continue;
+            }
+
+            for(GLint z = r[2]; z <= r[5]; ++z) {
+                for(GLint y = r[1]; y <= r[4]; ++y) {
+                    for(GLint x = r[0]; x <= r[3]; ++x)
+                        ++cluster[((z * tilesY + y) * tilesX + x) * 2 + 1];
+                }
+            }
+        }
+
+        GLint offset(0);
+        for(GLsizei c = 0; c < clusters; ++c) {
+            cluster[c * 2] = offset;
+            offset += cluster[c * 2 + 1];
+            cluster[c * 2 + 1] = 0;
+        }
+
+        index.resize(offset);
+        for(GLsizei l = 0; l < count; ++l) {
+            const GLint *const r(&range[l * 6]);
+            for(GLint z = r[2]; z <= r[5]; ++z) {
+                for(GLint y = r[1]; y <= r[4]; ++y) {
+                    for(GLint x = r[0]; x <= r[3]; ++x) {
+                        GLint *const c(&cluster[((z * tilesY + y) * tilesX + x) * 2]);
+                        index[c[0] + c[1]++] = l;
+                    }
+                }
+            }
+        }
+    }
+
+    const std::vector<GLint> &getClusters() const
+    {
+        return cluster;
+    }
+
+    const std::vector<GLint> &getIndices() const
+    {
+        return index;
+    }
+
+    GLsizei getTileSize() const
+    {
+        return tileSize;
+    }
+
+    GLsizei getTilesX() const
+    {
+        return tilesX;
+    }
+
+    GLsizei getTilesY() const
+    {
+        return tilesY;
+    }
+
+    GLsizei getSlices() const
+    {
+        return slices;
+    }
+
+    GLfloat getSliceScale() const
+    {
+        return sliceScale;
+    }
+
+    GLfloat getSliceBias() const
+    {
+        return sliceBias;
+    }
+
+    /// Mean number of lights per cluster, for reporting.
+    GLfloat getAverageLights() const
+    {
+        return cluster.empty() ? 0.0f : static_cast<GLfloat>(index.size()) / (cluster.size() / 2);
+    }
+};
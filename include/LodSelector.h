@@ -0,0 +1,107 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "Bounds.h"
+#include "Matrix.h"
+
+/** @brief Picks a level of detail from its projected error in pixels.
+ *
+ *  A level whose geometric error is e model units, seen at distance d
+ *  through a projection whose [5] element is cot(fovy / 2), covers about
+ *  e * cot(fovy / 2) * (height / 2) / d pixels. select() returns the
+ *  coarsest level under the threshold, but only moves to a coarser level
+ *  once it is below threshold * (1 - hysteresis) and only back to a finer
+ *  one once the current level exceeds threshold * (1 + hysteresis), so an
+ *  object resting near a switching distance does not pop every frame.
+ */
+class LodSelector
+{
+    std::vector<GLfloat> error;
+
+    GLfloat threshold;
+    GLfloat hysteresis;
+    GLfloat pixelScale;
+
+    /// Coarsest level whose projected error is at most limit; level 0 is always acceptable.
+    int coarsest(GLfloat distance, GLfloat limit) const
+    {
+        int level(0);
+        for(int l = 1; l < static_cast<int>(error.size()); ++l) {
+            if(projectedError(l, distance) <= limit)
+                level = l;
+        }
+        return level;
+    }
+
+public:
+    /** @param error geometric error of each level, level 0 being the finest.
+     *  @param threshold largest acceptable error in pixels.
+     */
+    LodSelector(const std::vector<GLfloat> &error, GLfloat threshold = 1.0f, GLfloat hysteresis = 0.25f)
+        : error(error), threshold(threshold), hysteresis(hysteresis), pixelScale(0.0f)
+    {
+    }
+
+    /** @brief Must be called when the projection or the viewport height changes.
+     */
+    void setProjection(const Matrix &projection, GLsizei height)
+    {
+        pixelScale = projection[5] * height * 0.5f;
+    }
+
+    GLfloat projectedError(int level, GLfloat distance) const
+    {
+        return error[level] * pixelScale / std::max(distance, 1e-4f);
+    }
+
+    /** @brief Distance from the eye to the nearest point of the bounding sphere of
+     *  the given box in eye space (0 if the eye is inside it).
+     */
+    static GLfloat distance(const Bounds &viewBounds)
+    {
+        GLfloat c[3];
+        viewBounds.getCenter(c);
+        const GLfloat d(sqrt(c[0] * c[0] + c[1] * c[1] + c[2] * c[2]));
+        return std::max(d - viewBounds.getRadius(), 0.0f);
+    }
+
+    /** @param current level used last frame, or -1 for none.
+     */
+    int select(int current, GLfloat distance) const
+    {
+        if(current < 0 || current >= static_cast<int>(error.size()))
+            return coarsest(distance, threshold);
+
+        const int coarser(coarsest(distance, threshold * (1.0f - hysteresis)));
+        if(coarser > current)
+            return coarser;
+
+        if(projectedError(current, distance) > threshold * (1.0f + hysteresis))
+            return coarsest(distance, threshold);
+
+        return current;
+    }
+
+    int getLevelCount() const
+    {
+        return static_cast<int>(error.size());
+    }
+
+    GLfloat getError(int level) const
+    {
+        return error[level];
+    }
+
+    GLfloat getThreshold() const
+    {
+        return threshold;
+    }
+
+    GLfloat getHysteresis() const
+    {
+        return hysteresis;
+    }
+};
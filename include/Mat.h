@@ -0,0 +1,373 @@
+#pragma once
+#include <GL/glew.h>
+#include <cmath>
+#include <cstddef>
+
+/** @brief Column vector of N components, usable in constant expressions.
+ */
+template <std::size_t N, typename T = GLfloat> struct Vec
+{
+    T v[N];
+
+    /// Zero vector.
+    constexpr Vec() : v()
+    {
+    }
+
+    constexpr Vec(T x, T y) : v{x, y}
+    {
+        static_assert(N == 2, "Vec(x, y) needs N == 2");
+    }
+
+    constexpr Vec(T x, T y, T z) : v{x, y, z}
+    {
+        static_assert(N == 3, "Vec(x, y, z) needs N == 3");
+    }
+
+    constexpr Vec(T x, T y, T z, T w) : v{x, y, z, w}
+    {
+        static_assert(N == 4, "Vec(x, y, z, w) needs N == 4");
+    }
+
+    constexpr const T &operator[](std::size_t i) const
+    {
+        return v[i];
+    }
+
+    constexpr T &operator[](std::size_t i)
+    {
+        return v[i];
+    }
+
+    constexpr Vec operator+(const Vec &b) const
+    {
+        Vec t;
+        for(std::size_t i = 0; i < N; ++i)
+            t[i] = v[i] + b[i];
+        return t;
+    }
+
+    constexpr Vec operator-(const Vec &b) const
+    {
+        Vec t;
+        for(std::size_t i = 0; i < N; ++i)
+            t[i] = v[i] - b[i];
+        return t;
+    }
+
+    constexpr Vec operator*(T s) const
+    {
+        Vec t;
+        for(std::size_t i = 0; i < N; ++i)
+            t[i] = v[i] * s;
+        return t;
+    }
+
+    constexpr T dot(const Vec &b) const
+    {
+        T d(0);
+        for(std::size_t i = 0; i < N; ++i)
+            d += v[i] * b[i];
+        return d;
+    }
+
+    constexpr Vec cross(const Vec &b) const
+    {
+        static_assert(N == 3, "cross needs N == 3");
+        return Vec(v[1] * b[2] - v[2] * b[1], v[2] * b[0] - v[0] * b[2], v[0] * b[1] - v[1] * b[0]);
+    }
+
+    T length() const
+    {
+        return sqrt(dot(*this));
+    }
+
+    /// Unit vector in the same direction; the zero vector stays zero.
+    Vec normalize() const
+    {
+        const T l(length());
+        return l > T(0) ? *this * (T(1) / l) : *this;
+    }
+};
+
+/** @brief Column-major N x N matrix, laid out like Matrix and usable in constant expressions.
+ */
+template <std::size_t N, typename T = GLfloat> struct Mat
+{
+    T m[N * N];
+
+    /// Identity.
+    constexpr Mat() : m()
+    {
+        for(std::size_t i = 0; i < N; ++i)
+            m[i * N + i] = T(1);
+    }
+
+    /// Copy N * N column-major values, e.g. Matrix::data().
+    static Mat fromArray(const T *a)
+    {
+        Mat t;
+        for(std::size_t i = 0; i < N * N; ++i)
+            t.m[i] = a[i];
+        return t;
+    }
+
+    constexpr const T &operator()(std::size_t row, std::size_t column) const
+    {
+        return m[column * N + row];
+    }
+
+    constexpr T &operator()(std::size_t row, std::size_t column)
+    {
+        return m[column * N + row];
+    }
+
+    constexpr const T *data() const
+    {
+        return m;
+    }
+
+    constexpr Mat operator*(const Mat &b) const
+    {
+        Mat t;
+        for(std::size_t c = 0; c < N; ++c) {
+            for(std::size_t r = 0; r < N; ++r) {
+                T s(0);
+                for(std::size_t k = 0; k < N; ++k)
+                    s += (*this)(r, k) * b(k, c);
+                t(r, c) = s;
+            }
+        }
+        return t;
+    }
+
+    constexpr Vec<N, T> operator*(const Vec<N, T> &v) const
+    {
+        Vec<N, T> t;
+        for(std::size_t k = 0; k < N; ++k) {
+            for(std::size_t r = 0; r < N; ++r)
+                t[r] += (*this)(r, k) * v[k];
+        }
+        return t;
+    }
+
+    constexpr Mat transpose() const
+    {
+        Mat t;
+        for(std::size_t c = 0; c < N; ++c) {
+            for(std::size_t r = 0; r < N; ++r)
+                t(r, c) = (*this)(c, r);
+        }
+        return t;
+    }
+};
+
+/** @brief 4x4 transform whose last row is (0, 0, 0, 1), stored as the upper 3x4.
+ *
+ *  Translation, rotation and scale never touch the last row, so products,
+ *  inverses and point transforms skip it: a product costs 36 multiplies
+ *  instead of 64, and the inverse needs only the 3x3 inverse and one
+ *  translation. Convert with fromArray() and toArray() to pass transforms
+ *  to Matrix or to GL.
+ */
+template <typename T = GLfloat> struct Affine
+{
+    T m[12];  // column-major 3x4: the x, y and z axes, then the translation
+
+    /// Identity.
+    constexpr Affine() : m{1, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0}
+    {
+    }
+
+    /// The upper 3x4 of a column-major 4x4 array such as Matrix::data(); the last row is ignored.
+    static Affine fromArray(const T *a)
+    {
+        Affine t;
+        for(std::size_t c = 0; c < 4; ++c) {
+            for(std::size_t r = 0; r < 3; ++r)
+                t.m[c * 3 + r] = a[c * 4 + r];
+        }
+        return t;
+    }
+
+    /// Write the full column-major 4x4 matrix.
+    void toArray(T *a) const
+    {
+        for(std::size_t c = 0; c < 4; ++c) {
+            for(std::size_t r = 0; r < 3; ++r)
+                a[c * 4 + r] = m[c * 3 + r];
+            a[c * 4 + 3] = c == 3 ? T(1) : T(0);
+        }
+    }
+
+    constexpr Mat<4, T> toMat() const
+    {
+        Mat<4, T> t;
+        for(std::size_t c = 0; c < 4; ++c) {
+            for(std::size_t r = 0; r < 3; ++r)
+                t(r, c) = m[c * 3 + r];
+        }
+        return t;
+    }
+
+    constexpr const T &operator()(std::size_t row, std::size_t column) const
+    {
+        return m[column * 3 + row];
+    }
+
+    constexpr T &operator()(std::size_t row, std::size_t column)
+    {
+        return m[column * 3 + row];
+    }
+
+    static constexpr Affine translate(T x, T y, T z)
+    {
+        Affine t;
+        t.m[9] = x;
+        t.m[10] = y;
+        t.m[11] = z;
+        return t;
+    }
+
+    static constexpr Affine scale(T x, T y, T z)
+    {
+        Affine t;
+        t.m[0] = x;
+        t.m[4] = y;
+        t.m[8] = z;
+        return t;
+    }
+
+    /** @brief Rotation about a unit axis given the cosine and sine of the
+     *  angle, so it can be computed at compile time.
+     */
+    static constexpr Affine rotation(T c, T s, const Vec<3, T> &axis)
+    {
+        const T l(axis[0]), n(axis[1]), o(axis[2]);
+        const T c1(T(1) - c);
+
+        Affine t;
+        t.m[0] = l * l * c1 + c;
+        t.m[1] = l * n * c1 + o * s;
+        t.m[2] = o * l * c1 - n * s;
+        t.m[3] = l * n * c1 - o * s;
+        t.m[4] = n * n * c1 + c;
+        t.m[5] = n * o * c1 + l * s;
+        t.m[6] = o * l * c1 + n * s;
+        t.m[7] = n * o * c1 - l * s;
+        t.m[8] = o * o * c1 + c;
+        return t;
+    }
+
+    /** @brief Rotate by a radians about (x, y, z), like Matrix::rotate.
+     *  A zero axis gives the identity.
+     */
+    static Affine rotate(T a, T x, T y, T z)
+    {
+        const T d(sqrt(x * x + y * y + z * z));
+        if(d == T(0))
+            return Affine();
+
+        return rotation(cos(a), sin(a), Vec<3, T>(x / d, y / d, z / d));
+    }
+
+    constexpr Affine operator*(const Affine &b) const
+    {
+        Affine t;
+        for(std::size_t c = 0; c < 12; c += 3) {
+            const T x(b.m[c]), y(b.m[c + 1]), z(b.m[c + 2]);
+            t.m[c] = m[0] * x + m[3] * y + m[6] * z;
+            t.m[c + 1] = m[1] * x + m[4] * y + m[7] * z;
+            t.m[c + 2] = m[2] * x + m[5] * y + m[8] * z;
+        }
+        t.m[9] += m[9];
+        t.m[10] += m[10];
+        t.m[11] += m[11];
+        return t;
+    }
+
+    /// Transform a point: rotation, scale and translation.
+    constexpr Vec<3, T> transformPoint(const Vec<3, T> &p) const
+    {
+        return Vec<3, T>(m[0] * p[0] + m[3] * p[1] + m[6] * p[2] + m[9],
+                         m[1] * p[0] + m[4] * p[1] + m[7] * p[2] + m[10],
+                         m[2] * p[0] + m[5] * p[1] + m[8] * p[2] + m[11]);
+    }
+
+    /// Transform a direction: rotation and scale only.
+    constexpr Vec<3, T> transformVector(const Vec<3, T> &v) const
+    {
+        return Vec<3, T>(m[0] * v[0] + m[3] * v[1] + m[6] * v[2], m[1] * v[0] + m[4] * v[1] + m[7] * v[2],
+                         m[2] * v[0] + m[5] * v[1] + m[8] * v[2]);
+    }
+
+    /** @brief Cofactor matrix of the 3x3 part, i.e. its inverse transpose
+     *  times the determinant, as Matrix::getNormalMatrix computes. Normals
+     *  transformed by it only need renormalizing, and no division is done.
+     */
+    constexpr Mat<3, T> normalMatrix() const
+    {
+        Mat<3, T> t;
+        t.m[0] = m[4] * m[8] - m[5] * m[7];
+        t.m[1] = m[5] * m[6] - m[3] * m[8];
+        t.m[2] = m[3] * m[7] - m[4] * m[6];
+        t.m[3] = m[7] * m[2] - m[8] * m[1];
+        t.m[4] = m[8] * m[0] - m[6] * m[2];
+        t.m[5] = m[6] * m[1] - m[7] * m[0];
+        t.m[6] = m[1] * m[5] - m[2] * m[4];
+        t.m[7] = m[2] * m[3] - m[0] * m[5];
+        t.m[8] = m[0] * m[4] - m[1] * m[3];
+        return t;
+    }
+
+    constexpr T determinant() const
+    {
+        return m[0] * (m[4] * m[8] - m[5] * m[7]) - m[3] * (m[1] * m[8] - m[2] * m[7]) +
+               m[6] * (m[1] * m[5] - m[2] * m[4]);
+    }
+
+    /** @brief Inverse from the 3x3 inverse and the negated, back-rotated translation.
+     *  A singular matrix gives the identity.
+     */
+    constexpr Affine inverse() const
+    {
+        const T d(determinant());
+        if(d == T(0))
+            return Affine();
+
+        // the inverse of the 3x3 is the transposed cofactor matrix over the determinant
+        const Mat<3, T> n(normalMatrix());
+        const T id(T(1) / d);
+
+        Affine t;
+        for(std::size_t c = 0; c < 3; ++c) {
+            for(std::size_t r = 0; r < 3; ++r)
+                t(r, c) = n(c, r) * id;
+        }
+        for(std::size_t r = 0; r < 3; ++r)
+            t.m[9 + r] = -(t(r, 0) * m[9] + t(r, 1) * m[10] + t(r, 2) * m[11]);
+        return t;
+    }
+};
+
+/** @brief General 4x4 times affine, e.g. projection * modelview; 48 multiplies instead of 64.
+ */
+template <typename T> constexpr Mat<4, T> operator*(const Mat<4, T> &a, const Affine<T> &b)
+{
+    Mat<4, T> t;
+    for(std::size_t c = 0; c < 4; ++c) {
+        for(std::size_t r = 0; r < 4; ++r) {
+            T s(c == 3 ? a(r, 3) : T(0));
+            for(std::size_t k = 0; k < 3; ++k)
+                s += a(r, k) * b(k, c);
+            t(r, c) = s;
+        }
+    }
+    return t;
+}
+
+// constant transforms are folded by the compiler
+static_assert((Affine<>::translate(1.0f, 2.0f, 3.0f) * Affine<>::scale(2.0f, 2.0f, 2.0f)).m[9] == 1.0f,
+              "Affine products must be constant expressions");
+static_assert(Affine<>::scale(2.0f, 4.0f, 8.0f).inverse().m[4] == 0.25f,
+              "Affine inverses must be constant expressions");
@@ -3,13 +3,27 @@
 #include <algorithm>
 #include <cmath>
 
+#include "MatrixKernel.h"
+
 class Matrix
 {
     GLfloat matrix[16];
 
+    struct Uninitialized
+    {
+    };
+
+    /// For results that are written in full right away.
+    explicit Matrix(Uninitialized)
+    {
+    }
+
   public:
+    /** @brief Identity; degenerate arguments to the factories below also give the identity.
+     */
     Matrix()
     {
+        loadIdentity();
     }
 
     Matrix(const GLfloat *a)
@@ -45,6 +59,48 @@ class Matrix
         m[8] = matrix[0] * matrix[5] - matrix[1] * matrix[4];
     }
 
+    /** @brief General inverse by cofactors, e.g. of projection * view to
+     *  map screen points back into the world. A singular matrix gives the identity.
+     */
+    Matrix inverse() const
+    {
+        const GLfloat *const m(matrix);
+        Matrix t((Uninitialized()));
+        GLfloat *const r(t.matrix);
+
+        // 2x2 determinants of the first and last two rows, shared by the cofactors
+        const GLfloat s0(m[0] * m[5] - m[4] * m[1]), s1(m[0] * m[9] - m[8] * m[1]);
+        const GLfloat s2(m[0] * m[13] - m[12] * m[1]), s3(m[4] * m[9] - m[8] * m[5]);
+        const GLfloat s4(m[4] * m[13] - m[12] * m[5]), s5(m[8] * m[13] - m[12] * m[9]);
+        const GLfloat c5(m[10] * m[15] - m[14] * m[11]), c4(m[6] * m[15] - m[14] * m[7]);
+        const GLfloat c3(m[6] * m[11] - m[10] * m[7]), c2(m[2] * m[15] - m[14] * m[3]);
+        const GLfloat c1(m[2] * m[11] - m[10] * m[3]), c0(m[2] * m[7] - m[6] * m[3]);
+
+        const GLfloat det(s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0);
+        if(det == 0.0f)
+            return Matrix();
+        const GLfloat d(1.0f / det);
+
+        r[0] = (m[5] * c5 - m[9] * c4 + m[13] * c3) * d;
+        r[1] = (-m[1] * c5 + m[9] * c2 - m[13] * c1) * d;
+        r[2] = (m[1] * c4 - m[5] * c2 + m[13] * c0) * d;
+        r[3] = (-m[1] * c3 + m[5] * c1 - m[9] * c0) * d;
+        r[4] = (-m[4] * c5 + m[8] * c4 - m[12] * c3) * d;
+        r[5] = (m[0] * c5 - m[8] * c2 + m[12] * c1) * d;
+        r[6] = (-m[0] * c4 + m[4] * c2 - m[12] * c0) * d;
+        r[7] = (m[0] * c3 - m[4] * c1 + m[8] * c0) * d;
+        r[8] = (m[7] * s5 - m[11] * s4 + m[15] * s3) * d;
+        r[9] = (-m[3] * s5 + m[11] * s2 - m[15] * s1) * d;
+        r[10] = (m[3] * s4 - m[7] * s2 + m[15] * s0) * d;
+        r[11] = (-m[3] * s3 + m[7] * s1 - m[11] * s0) * d;
+        r[12] = (-m[6] * s5 + m[10] * s4 - m[14] * s3) * d;
+        r[13] = (m[2] * s5 - m[10] * s2 + m[14] * s1) * d;
+        r[14] = (-m[2] * s4 + m[6] * s2 - m[14] * s0) * d;
+        r[15] = (m[2] * s3 - m[6] * s1 + m[10] * s0) * d;
+
+        return t;
+    }
+
     void loadIdentity()
     {
         std::fill(matrix, matrix + 16, 0.0f);
@@ -212,15 +268,24 @@ class Matrix
 
     Matrix operator*(const Matrix &m) const
     {
-        Matrix t;
-
-        for(int i = 0; i < 16; i++) {
-            const int j(i & 3), k(i & ~3);
+        Matrix t((Uninitialized()));
+        MatrixKernel::multiply(matrix, m.matrix, t.matrix);
+        return t;
+    }
 
-            t[i] = matrix[0 + j] * m[k + 0] + matrix[4 + j] * m[k + 1] + matrix[8 + j] * m[k + 2] +
-                   matrix[12 + j] * m[k + 3];
-        }
+    /** @brief dst[i] = (*this) * src[i] for count matrices.
+     *  @param dst may be the same array as src.
+     */
+    void multiply(const Matrix *src, Matrix *dst, std::size_t count) const
+    {
+        MatrixKernel::multiply(matrix, src->matrix, dst->matrix, count);
+    }
 
-        return t;
+    /** @brief dst[i] = (*this) * src[i] for count homogeneous vectors (4 floats each).
+     *  @param dst may be the same array as src.
+     */
+    void transform(const GLfloat *src, GLfloat *dst, std::size_t count) const
+    {
+        MatrixKernel::transform(matrix, src, dst, count);
     }
 };
\ No newline at end of file
@@ -0,0 +1,246 @@
+#pragma once
+#include <GL/glew.h>
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE__)
+#define MATRIX_KERNEL_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define MATRIX_KERNEL_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(MATRIX_KERNEL_X86) && defined(__GNUC__)
+#define MATRIX_KERNEL_AVX2 1
+#endif
+
+/** @brief 4x4 column-major matrix kernels with runtime CPU dispatch.
+ *
+ *  Every function takes raw float arrays so that Matrix and any packed
+ *  transform arrays can share them. The best kernel for the running CPU is
+ *  chosen once on first use: AVX2+FMA, SSE, NEON, then the scalar loop.
+ */
+class MatrixKernel
+{
+public:
+    typedef void (*MultiplyFunc)(const GLfloat *a, const GLfloat *b, GLfloat *t, std::size_t count);
+    typedef void (*TransformFunc)(const GLfloat *a, const GLfloat *v, GLfloat *t, std::size_t count);
+
+    enum Isa
+    {
+        SCALAR,
+        SSE,
+        AVX2,
+        NEON
+    };
+
+    /** @brief t[i] = a * b[i] for count matrices of 16 floats.
+     *  @param t must not alias a; it may alias b.
+     */
+    static void multiply(const GLfloat *a, const GLfloat *b, GLfloat *t, std::size_t count = 1)
+    {
+        table().multiply(a, b, t, count);
+    }
+
+    /** @brief t[i] = a * v[i] for count vectors of 4 floats.
+     *  @param t may alias v.
+     */
+    static void transform(const GLfloat *a, const GLfloat *v, GLfloat *t, std::size_t count = 1)
+    {
+        table().transform(a, v, t, count);
+    }
+
+    static Isa isa()
+    {
+        return table().isa;
+    }
+
+    static const char *isaName()
+    {
+        static const char *const names[] = {"scalar", "sse", "avx2", "neon"};
+        return names[isa()];
+    }
+
+    static void multiplyScalar(const GLfloat *a, const GLfloat *b, GLfloat *t, std::size_t count)
+    {
+        for(std::size_t n = 0; n < count; ++n, b += 16, t += 16) {
+            GLfloat r[16];
+
+            for(int i = 0; i < 16; i++) {
+                const int j(i & 3), k(i & ~3);
+
+                r[i] = a[0 + j] * b[k + 0] + a[4 + j] * b[k + 1] + a[8 + j] * b[k + 2] + a[12 + j] * b[k + 3];
+            }
+
+            for(int i = 0; i < 16; i++)
+                t[i] = r[i];
+        }
+    }
+
+    static void transformScalar(const GLfloat *a, const GLfloat *v, GLfloat *t, std::size_t count)
+    {
+        for(std::size_t n = 0; n < count; ++n, v += 4, t += 4) {
+            const GLfloat x(v[0]), y(v[1]), z(v[2]), w(v[3]);
+
+            for(int j = 0; j < 4; j++)
+                t[j] = a[0 + j] * x + a[4 + j] * y + a[8 + j] * z + a[12 + j] * w;
+        }
+    }
+
+#if defined(MATRIX_KERNEL_X86)
+    static void multiplySse(const GLfloat *a, const GLfloat *b, GLfloat *t, std::size_t count)
+    {
+        const __m128 a0(_mm_loadu_ps(a + 0)), a1(_mm_loadu_ps(a + 4));
+        const __m128 a2(_mm_loadu_ps(a + 8)), a3(_mm_loadu_ps(a + 12));
+
+        for(std::size_t n = 0; n < count; ++n, b += 16, t += 16) {
+            __m128 c[4];
+
+            for(int k = 0; k < 4; k++) {
+                const GLfloat *const col(b + k * 4);
+                c[k] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a0, _mm_set1_ps(col[0])), _mm_mul_ps(a1, _mm_set1_ps(col[1]))),
+                                  _mm_add_ps(_mm_mul_ps(a2, _mm_set1_ps(col[2])), _mm_mul_ps(a3, _mm_set1_ps(col[3]))));
+            }
+
+            for(int k = 0; k < 4; k++)
+                _mm_storeu_ps(t + k * 4, c[k]);
+        }
+    }
+
+    static void transformSse(const GLfloat *a, const GLfloat *v, GLfloat *t, std::size_t count)
+    {
+        const __m128 a0(_mm_loadu_ps(a + 0)), a1(_mm_loadu_ps(a + 4));
+        const __m128 a2(_mm_loadu_ps(a + 8)), a3(_mm_loadu_ps(a + 12));
+
+        for(std::size_t n = 0; n < count; ++n, v += 4, t += 4) {
+            const __m128 r(_mm_add_ps(_mm_add_ps(_mm_mul_ps(a0, _mm_set1_ps(v[0])), _mm_mul_ps(a1, _mm_set1_ps(v[1]))),
+                                      _mm_add_ps(_mm_mul_ps(a2, _mm_set1_ps(v[2])), _mm_mul_ps(a3, _mm_set1_ps(v[3])))));
+            _mm_storeu_ps(t, r);
+        }
+    }
+#endif
+
+#if defined(MATRIX_KERNEL_AVX2)
+    /// Two columns (or two vectors) per iteration; each 128-bit lane holds one of them.
+    __attribute__((target("avx2,fma"))) static void multiplyAvx2(const GLfloat *a, const GLfloat *b, GLfloat *t,
+                                                                 std::size_t count)
+    {
+        const __m256 a0(_mm256_broadcast_ps(reinterpret_cast<const __m128 *>(a + 0)));
+        const __m256 a1(_mm256_broadcast_ps(reinterpret_cast<const __m128 *>(a + 4)));
+        const __m256 a2(_mm256_broadcast_ps(reinterpret_cast<const __m128 *>(a + 8)));
+        const __m256 a3(_mm256_broadcast_ps(reinterpret_cast<const __m128 *>(a + 12)));
+
+        for(std::size_t n = 0; n < count; ++n, b += 16, t += 16) {
+            const __m256 b01(_mm256_loadu_ps(b + 0)), b23(_mm256_loadu_ps(b + 8));
+
+            __m256 c01(_mm256_mul_ps(a0, _mm256_permute_ps(b01, 0x00)));
+            c01 = _mm256_fmadd_ps(a1, _mm256_permute_ps(b01, 0x55), c01);
+            c01 = _mm256_fmadd_ps(a2, _mm256_permute_ps(b01, 0xaa), c01);
+            c01 = _mm256_fmadd_ps(a3, _mm256_permute_ps(b01, 0xff), c01);
+
+            __m256 c23(_mm256_mul_ps(a0, _mm256_permute_ps(b23, 0x00)));
+            c23 = _mm256_fmadd_ps(a1, _mm256_permute_ps(b23, 0x55), c23);
+            c23 = _mm256_fmadd_ps(a2, _mm256_permute_ps(b23, 0xaa), c23);
+            c23 = _mm256_fmadd_ps(a3, _mm256_permute_ps(b23, 0xff), c23);
+
+            _mm256_storeu_ps(t + 0, c01);
+            _mm256_storeu_ps(t + 8, c23);
+        }
+    }
+
+    __attribute__((target("avx2,fma"))) static void transformAvx2(const GLfloat *a, const GLfloat *v, GLfloat *t,
+                                                                  std::size_t count)
+    {
+        const __m256 a0(_mm256_broadcast_ps(reinterpret_cast<const __m128 *>(a + 0)));
+        const __m256 a1(_mm256_broadcast_ps(reinterpret_cast<const __m128 *>(a + 4)));
+        const __m256 a2(_mm256_broadcast_ps(reinterpret_cast<const __m128 *>(a + 8)));
+        const __m256 a3(_mm256_broadcast_ps(reinterpret_cast<const __m128 *>(a + 12)));
+
+        std::size_t n(0);
+        for(; n + 2 <= count; n += 2, v += 8, t += 8) {
+            const __m256 p(_mm256_loadu_ps(v));
+
+            __m256 r(_mm256_mul_ps(a0, _mm256_permute_ps(p, 0x00)));
+            r = _mm256_fmadd_ps(a1, _mm256_permute_ps(p, 0x55), r);
+            r = _mm256_fmadd_ps(a2, _mm256_permute_ps(p, 0xaa), r);
+            r = _mm256_fmadd_ps(a3, _mm256_permute_ps(p, 0xff), r);
+
+            _mm256_storeu_ps(t, r);
+        }
+
+        if(n < count)
+            transformSse(a, v, t, count - n);
+    }
+#endif
+
+#if defined(MATRIX_KERNEL_NEON)
+    static void multiplyNeon(const GLfloat *a, const GLfloat *b, GLfloat *t, std::size_t count)
+    {
+        const float32x4_t a0(vld1q_f32(a + 0)), a1(vld1q_f32(a + 4));
+        const float32x4_t a2(vld1q_f32(a + 8)), a3(vld1q_f32(a + 12));
+
+        for(std::size_t n = 0; n < count; ++n, b += 16, t += 16) {
+            float32x4_t c[4];
+
+            for(int k = 0; k < 4; k++) {
+                const float32x4_t col(vld1q_f32(b + k * 4));
+                c[k] = vmulq_lane_f32(a0, vget_low_f32(col), 0);
+                c[k] = vmlaq_lane_f32(c[k], a1, vget_low_f32(col), 1);
+                c[k] = vmlaq_lane_f32(c[k], a2, vget_high_f32(col), 0);
+                c[k] = vmlaq_lane_f32(c[k], a3, vget_high_f32(col), 1);
+            }
+
+            for(int k = 0; k < 4; k++)
+                vst1q_f32(t + k * 4, c[k]);
+        }
+    }
+
+    static void transformNeon(const GLfloat *a, const GLfloat *v, GLfloat *t, std::size_t count)
+    {
+        const float32x4_t a0(vld1q_f32(a + 0)), a1(vld1q_f32(a + 4));
+        const float32x4_t a2(vld1q_f32(a + 8)), a3(vld1q_f32(a + 12));
+
+        for(std::size_t n = 0; n < count; ++n, v += 4, t += 4) {
+            const float32x4_t p(vld1q_f32(v));
+            float32x4_t r(vmulq_lane_f32(a0, vget_low_f32(p), 0));
+            r = vmlaq_lane_f32(r, a1, vget_low_f32(p), 1);
+            r = vmlaq_lane_f32(r, a2, vget_high_f32(p), 0);
+            r = vmlaq_lane_f32(r, a3, vget_high_f32(p), 1);
+            vst1q_f32(t, r);
+        }
+    }
+#endif
+
+private:
+    struct Table
+    {
+        MultiplyFunc multiply;
+        TransformFunc transform;
+        Isa isa;
+    };
+
+    static Table select()
+    {
+#if defined(MATRIX_KERNEL_AVX2)
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+            const Table t = {multiplyAvx2, transformAvx2, AVX2};
+            return t;
+        }
+#endif
+#if defined(MATRIX_KERNEL_X86)
+        const Table t = {multiplySse, transformSse, SSE};
+#elif defined(MATRIX_KERNEL_NEON)
+        const Table t = {multiplyNeon, transformNeon, NEON};
+#else
+        const Table t = {multiplyScalar, transformScalar, SCALAR};
+#endif
+        return t;
+    }
+
+    static const Table &table()
+    {
+        static const Table t(select());
+        return t;
+    }
+};
@@ -0,0 +1,116 @@
+#pragma once
+#include <GL/glew.h>
+#include <cstddef>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#endif
+
+#include "Object.h"
+
+/** @brief Vertex and index arrays of a mesh, owned or memory-mapped.
+ *
+ *  The arrays either live in vectors (after parsing or decoding) or point
+ *  straight into a mapped cache file; in both cases getVertex()/getIndex()
+ *  can be passed to the Shape constructors and on to glBufferData as is.
+ */
+class MeshData
+{
+    std::vector<Object::Vertex> vertices;
+    std::vector<GLuint> indices;
+
+    const Object::Vertex *vertex;
+    const GLuint *index;
+
+    GLsizei vertexcount;
+    GLsizei indexcount;
+
+    void *mapping;
+    std::size_t mappingSize;
+
+    MeshData(const MeshData &);
+    MeshData &operator=(const MeshData &);
+
+public:
+    MeshData() : vertex(NULL), index(NULL), vertexcount(0), indexcount(0), mapping(NULL), mappingSize(0)
+    {
+    }
+
+    virtual ~MeshData()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+#if !defined(_WIN32)
+        if(mapping != NULL)
+            munmap(mapping, mappingSize);
+#endif
+        mapping = NULL;
+        mappingSize = 0;
+
+        std::vector<Object::Vertex>().swap(vertices);
+        std::vector<GLuint>().swap(indices);
+
+        vertex = NULL;
+        index = NULL;
+        vertexcount = indexcount = 0;
+    }
+
+    /** @brief Take over the contents of v and i (they are left empty).
+     */
+    void assign(std::vector<Object::Vertex> &v, std::vector<GLuint> &i)
+    {
+        clear();
+
+        vertices.swap(v);
+        indices.swap(i);
+
+        vertex = vertices.data();
+        index = indices.data();
+        vertexcount = static_cast<GLsizei>(vertices.size());
+        indexcount = static_cast<GLsizei>(indices.size());
+    }
+
+    /** @brief Refer to arrays inside a mapping that is unmapped by clear().
+     */
+    void assign(void *map, std::size_t size, const Object::Vertex *v, GLsizei vcount, const GLuint *i, GLsizei icount)
+    {
+        clear();
+
+        mapping = map;
+        mappingSize = size;
+
+        vertex = v;
+        index = i;
+        vertexcount = vcount;
+        indexcount = icount;
+    }
+
+    bool isMapped() const
+    {
+        return mapping != NULL;
+    }
+
+    const Object::Vertex *getVertex() const
+    {
+        return vertex;
+    }
+
+    const GLuint *getIndex() const
+    {
+        return index;
+    }
+
+    GLsizei getVertexCount() const
+    {
+        return vertexcount;
+    }
+
+    GLsizei getIndexCount() const
+    {
+        return indexcount;
+    }
+};
@@ -0,0 +1,756 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/stat.h>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "MeshData.h"
+#include "MeshOptimizer.h"
+
+/** @brief Reads OBJ and PLY meshes into Object::Vertex and index arrays.
+ *
+ *  load() keeps a binary cache next to the source file (name + ".meshcache").
+ *  The cache has a versioned header followed by 64-byte aligned sections; on
+ *  later runs it is memory-mapped and the interleaved vertex and index
+ *  sections are handed out in place, so nothing is parsed or copied before
+ *  glBufferData. Parsed meshes are run through MeshOptimizer before the
+ *  cache is written. The cache records the size, modification time and a
+ *  content hash of its source. While the size and time still match the
+ *  source is not read at all; otherwise, or when the source was modified in
+ *  the same clock tick as the cache was written, where its time can't tell
+ *  an edit apart, the source is hashed and the cache is used if the hash
+ *  matches. A cache written with QUANTIZED_NORMALS stores normals as
+ *  16-bit integers; it is about a third smaller but is decoded on load.
+ */
+class MeshLoader
+{
+public:
+    enum Flags
+    {
+        QUANTIZED_NORMALS = 1
+    };
+
+private:
+    static const std::uint32_t cacheVersion = 4;
+    static const std::uint32_t byteOrderMark = 0x01020304;
+    static const std::size_t alignment = 64;
+
+    struct CacheHeader
+    {
+        char magic[8];  // "GLMESH\0\0"
+        std::uint32_t version;
+        std::uint32_t byteOrder;
+        std::uint32_t flags;
+        std::uint32_t vertexcount;
+        std::uint32_t indexcount;
+        std::uint32_t reserved;
+        std::uint64_t vertexOffset;  // Object::Vertex[], or GLfloat[3] positions when quantized
+        std::uint64_t normalOffset;  // GLshort[4] per vertex when quantized, otherwise 0
+        std::uint64_t indexOffset;   // GLuint[]
+        std::uint64_t fileSize;
+        std::uint64_t sourceSize;  // of the file the cache was made from
+        std::uint64_t sourceHash;
+        std::uint64_t sourceTime;  // modification time in nanoseconds
+    };
+
+    static std::uint64_t align(std::uint64_t offset)
+    {
+        return (offset + alignment - 1) & ~static_cast<std::uint64_t>(alignment - 1);
+    }
+
+    static GLshort quantize(GLfloat n)
+    {
+        const GLfloat c(std::max(-1.0f, std::min(1.0f, n)));
+        return static_cast<GLshort>(floor(c * 32767.0f + 0.5f));
+    }
+
+    static GLfloat dequantize(GLshort q)
+    {
+        return std::max(static_cast<GLfloat>(q) / 32767.0f, -1.0f);
+    }
+
+    /** @brief Area-weighted vertex normals of an indexed triangle list.
+     */
+    static void computeNormals(const std::vector<GLfloat> &position, const std::vector<GLuint> &triangle,
+                               std::vector<GLfloat> &normal)
+    {
+        normal.assign(position.size(), 0.0f);
+
+        for(std::size_t t = 0; t + 2 < triangle.size(); t += 3) {
+            const GLfloat *const a(&position[triangle[t] * 3]);
+            const GLfloat *const b(&position[triangle[t + 1] * 3]);
+            const GLfloat *const c(&position[triangle[t + 2] * 3]);
+
+            const GLfloat u[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+            const GLfloat v[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+            const GLfloat n[3] = {u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0]};
+
+            for(int k = 0; k < 3; k++) {
+                for(int j = 0; j < 3; j++)
+                    normal[triangle[t + k] * 3 + j] += n[j];
+            }
+        }
+
+        for(std::size_t i = 0; i + 2 < normal.size(); i += 3) {
+            const GLfloat l(sqrt(normal[i] * normal[i] + normal[i + 1] * normal[i + 1] + normal[i + 2] * normal[i + 2]));
+            if(l > 0.0f) {
+                normal[i] /= l;
+                normal[i + 1] /= l;
+                normal[i + 2] /= l;
+            }
+        }
+    }
+
+    static bool hasExtension(const std::string &name, const char *ext)
+    {
+        const std::size_t n(strlen(ext));
+        if(name.size() < n)
+            return false;
+
+        for(std::size_t i = 0; i < n; ++i) {
+            if(tolower(name[name.size() - n + i]) != ext[i])
+                return false;
+        }
+        return true;
+    }
+
+    /// Size and modification time in nanoseconds, as precise as the file system keeps it.
+    static bool status(const char *name, std::uint64_t &size, std::uint64_t &time)
+    {
+        struct stat st;
+        if(stat(name, &st) != 0)
+            return false;
+
+        size = static_cast<std::uint64_t>(st.st_size);
+#if defined(__linux__)
+        time = static_cast<std::uint64_t>(st.st_mtim.tv_sec) * 1000000000ull + st.st_mtim.tv_nsec;
+#else
+        time = static_cast<std::uint64_t>(st.st_mtime) * 1000000000ull;
+#endif
+        return true;
+    }
+
+    /** @brief Size and hash of a file's contents: FNV-1a taken a 64-bit word
+     *  at a time, so hashing keeps up with reading.
+     */
+    static bool fingerprint(const char *name, std::uint64_t &size, std::uint64_t &hash)
+    {
+        std::ifstream file(name, std::ios::binary);
+        if(file.fail())
+            return false;
+
+        // a multiple of 8, so words start at the same offsets whatever the chunking
+        std::vector<char> buffer(1 << 20);
+        size = 0;
+        hash = 1469598103934665603ull;
+        for(;;) {
+            file.read(&buffer[0], buffer.size());
+            const std::size_t n(static_cast<std::size_t>(file.gcount()));
+            if(n == 0)
+                break;
+
+            std::size_t i(0);
+            for(; i + 8 <= n; i += 8) {
+                std::uint64_t word;
+                memcpy(&word, &buffer[i], 8);
+                hash = (hash ^ word) * 1099511628211ull;
+            }
+            for(; i < n; ++i)
+                hash = (hash ^ static_cast<unsigned char>(buffer[i])) * 1099511628211ull;
+            size += n;
+        }
+        return !file.bad();
+    }
+
+    struct PlyProperty
+    {
+        std::string name;
+        std::string type;
+        std::string countType;  // non-empty for list properties
+    };
+
+    struct PlyElement
+    {
+        std::string name;
+        std::size_t count;
+        std::vector<PlyProperty> property;
+    };
+
+    enum PlyFormat
+    {
+        PLY_ASCII,
+        PLY_LITTLE_ENDIAN,
+        PLY_BIG_ENDIAN
+    };
+
+    static std::size_t plySize(const std::string &type)
+    {
+        if(type == "char" || type == "uchar" || type == "int8" || type == "uint8")
+            return 1;
+        if(type == "short" || type == "ushort" || type == "int16" || type == "uint16")
+            return 2;
+        if(type == "int" || type == "uint" || type == "int32" || type == "uint32" || type == "float" ||
+           type == "float32")
+            return 4;
+        if(type == "double" || type == "float64")
+            return 8;
+        return 0;
+    }
+
+    static bool plyRead(std::istream &in, PlyFormat format, const std::string &type, double &value)
+    {
+        if(format == PLY_ASCII) {
+            in >> value;
+            return !in.fail();
+        }
+
+        const std::size_t size(plySize(type));
+        unsigned char b[8];
+        if(size == 0 || !in.read(reinterpret_cast<char *>(b), size))
+            return false;
+
+        const std::uint32_t one(1);
+        const bool little(*reinterpret_cast<const unsigned char *>(&one) == 1);
+        if(little != (format == PLY_LITTLE_ENDIAN))
+            std::reverse(b, b + size);
+
+        if(type == "char" || type == "int8") {
+            value = static_cast<double>(*reinterpret_cast<std::int8_t *>(b));
+        } else if(type == "uchar" || type == "uint8") {
+            value = b[0];
+        } else if(type == "short" || type == "int16") {
+            std::int16_t v;
+            memcpy(&v, b, 2);
+            value = v;
+        } else if(type == "ushort" || type == "uint16") {
+            std::uint16_t v;
+            memcpy(&v, b, 2);
+            value = v;
+        } else if(type == "int" || type == "int32") {
+            std::int32_t v;
+            memcpy(&v, b, 4);
+            value = v;
+        } else if(type == "uint" || type == "uint32") {
+            std::uint32_t v;
+            memcpy(&v, b, 4);
+            value = v;
+        } else if(type == "float" || type == "float32") {
+            float v;
+            memcpy(&v, b, 4);
+            value = v;
+        } else {
+            double v;
+            memcpy(&v, b, 8);
+            value = v;
+        }
+
+        return true;
+    }
+
+    static void build(std::vector<GLfloat> &position, std::vector<GLfloat> &normal, std::vector<GLuint> &triangle,
+                      MeshData &mesh, MeshOptimizer::Stats &stats)
+    {
+        if(normal.size() != position.size())
+            computeNormals(position, triangle, normal);
+
+        std::vector<Object::Vertex> vertex(position.size() / 3);
+        for(std::size_t i = 0; i < vertex.size(); ++i) {
+            std::copy(&position[i * 3], &position[i * 3] + 3, vertex[i].position);
+            std::copy(&normal[i * 3], &normal[i * 3] + 3, vertex[i].normal);
+        }
+
+        stats = MeshOptimizer::optimize(vertex, triangle);
+        mesh.assign(vertex, triangle);
+    }
+
+    /// Record a new modification time of the source in a cache found to match it.
+    static void touchCache(const std::string &name, const CacheHeader &header, std::uint64_t sourceTime)
+    {
+        CacheHeader h(header);
+        h.sourceTime = sourceTime;
+
+        std::fstream file(name.c_str(), std::ios::binary | std::ios::in | std::ios::out);
+        file.write(reinterpret_cast<const char *>(&h), sizeof(h));
+    }
+
+#if !defined(_WIN32)
+    /** @param source the file the cache should have been made from.
+     *  @param sourceHash receives the hash of source if it had to be read, and hashed is set.
+     */
+    static bool readCache(const std::string &name, const char *source, std::uint64_t sourceSize,
+                          std::uint64_t sourceTime, std::uint64_t &sourceHash, bool &hashed, MeshData &mesh)
+    {
+        std::uint64_t cacheSize, cacheTime;
+        if(!status(name.c_str(), cacheSize, cacheTime))
+            return false;
+
+        const int fd(open(name.c_str(), O_RDONLY));
+        if(fd < 0)
+            return false;
+
+        struct stat st;
+        if(fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(CacheHeader)) {
+            close(fd);
+            return false;
+        }
+
+        const std::size_t size(static_cast<std::size_t>(st.st_size));
+        void *const map(mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0));
+        close(fd);
+        if(map == MAP_FAILED)
+            return false;
+
+        const char *const base(static_cast<const char *>(map));
+        const CacheHeader &h(*reinterpret_cast<const CacheHeader *>(base));
+        const bool quantized((h.flags & QUANTIZED_NORMALS) != 0);
+
+        const std::uint64_t vertexBytes(static_cast<std::uint64_t>(h.vertexcount) *
+                                        (quantized ? 3 * sizeof(GLfloat) : sizeof(Object::Vertex)));
+        const std::uint64_t normalBytes(quantized ? static_cast<std::uint64_t>(h.vertexcount) * 4 * sizeof(GLshort)
+                                                  : 0);
+        const std::uint64_t indexBytes(static_cast<std::uint64_t>(h.indexcount) * sizeof(GLuint));
+
+        const bool valid(memcmp(h.magic, "GLMESH\0\0", 8) == 0 && h.version == cacheVersion &&
+                         h.byteOrder == byteOrderMark && h.fileSize == size && h.sourceSize == sourceSize &&
+                         h.vertexOffset % alignment == 0 && h.indexOffset % alignment == 0 &&
+                         h.normalOffset % alignment == 0 && h.vertexOffset + vertexBytes <= size &&
+                         h.normalOffset + normalBytes <= size && h.indexOffset + indexBytes <= size);
+
+        // the same size and time say the source is unchanged, unless it changed in the tick the cache was written
+        const bool unchanged(valid && h.sourceTime == sourceTime && sourceTime < cacheTime);
+        if(valid && !unchanged) {
+            std::uint64_t hashedSize;
+            hashed = fingerprint(source, hashedSize, sourceHash);
+        }
+
+        if(!unchanged && (!hashed || sourceHash != h.sourceHash)) {
+            munmap(map, size);
+            return false;
+        }
+
+        if(h.sourceTime != sourceTime)
+            touchCache(name, h, sourceTime);
+
+        // a damaged index would make the GPU read outside the vertex buffer
+        const GLuint *const index(reinterpret_cast<const GLuint *>(base + h.indexOffset));
+        for(std::uint32_t i = 0; i < h.indexcount; ++i) {
+            if(index[i] >= h.vertexcount) {
+                munmap(map, size);
+                return false;
+            }
+        }
+
+        if(!quantized) {
+            mesh.assign(map, size, reinterpret_cast<const Object::Vertex *>(base + h.vertexOffset),
+                        static_cast<GLsizei>(h.vertexcount), index, static_cast<GLsizei>(h.indexcount));
+            return true;
+        }
+
+        const GLfloat *const position(reinterpret_cast<const GLfloat *>(base + h.vertexOffset));
+        const GLshort *const normal(reinterpret_cast<const GLshort *>(base + h.normalOffset));
+
+        std::vector<Object::Vertex> vertex(h.vertexcount);
+        for(std::size_t i = 0; i < vertex.size(); ++i) {
+            std::copy(position + i * 3, position + i * 3 + 3, vertex[i].position);
+            for(int k = 0; k < 3; k++)
+                vertex[i].normal[k] = dequantize(normal[i * 4 + k]);
+        }
+        std::vector<GLuint> indices(index, index + h.indexcount);
+
+        munmap(map, size);
+        mesh.assign(vertex, indices);
+        return true;
+    }
+#endif
+
+public:
+    static bool loadObj(const char *name, MeshData &mesh, MeshOptimizer::Stats &stats)
+    {
+        std::ifstream file(name);
+        if(file.fail()) {
+            std::cerr << "Can't open the file." << name << std::endl;
+            return false;
+        }
+
+        std::vector<GLfloat> position, normal;
+
+        // triangulated face corners as (position, normal) pairs; normal -1 if absent
+        std::vector<long> corner;
+        std::vector<long> face;
+
+        std::string line;
+        while(std::getline(file, line)) {
+            const char *p(line.c_str());
+            while(*p == ' ' || *p == '\t')
+                ++p;
+
+            if(p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+                char *end;
+                for(int k = 0; k < 3; k++, p = end)
+                    position.push_back(strtof(p + (k == 0 ? 1 : 0), &end));
+            } else if(p[0] == 'v' && p[1] == 'n') {
+                char *end;
+                for(int k = 0; k < 3; k++, p = end)
+                    normal.push_back(strtof(p + (k == 0 ? 2 : 0), &end));
+            } else if(p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+                face.clear();
+                ++p;
+
+                for(;;) {
+                    char *end;
+                    long v(strtol(p, &end, 10));
+                    if(end == p)
+                        break;
+                    p = end;
+
+                    long n(0);
+                    if(*p == '/') {
+                        strtol(++p, &end, 10);  // texture coordinate, unused
+                        p = end;
+                        if(*p == '/') {
+                            n = strtol(++p, &end, 10);
+                            p = end;
+                        }
+                    }
+
+                    const long vc(static_cast<long>(position.size() / 3));
+                    const long nc(static_cast<long>(normal.size() / 3));
+                    v = v < 0 ? vc + v : v - 1;
+                    n = n < 0 ? nc + n : n - 1;
+
+                    if(v < 0 || v >= vc || n >= nc) {
+                        std::cerr << "Bad face index in " << name << std::endl;
+                        return false;
+                    }
+
+                    face.push_back(v);
+                    face.push_back(n);
+                }
+
+                for(std::size_t i = 2; i < face.size() / 2; ++i) {
+                    const std::size_t fan[] = {0, i - 1, i};
+                    for(std::size_t k = 0; k < 3; ++k) {
+                        corner.push_back(face[fan[k] * 2]);
+                        corner.push_back(face[fan[k] * 2 + 1]);
+                    }
+                }
+            }
+        }
+
+        // corners without a normal get the smooth normal of their position
+        std::vector<GLfloat> smooth;
+        bool missing(false);
+        for(std::size_t i = 1; i < corner.size(); i += 2)
+            missing |= corner[i] < 0;
+
+        if(missing) {
+            std::vector<GLuint> triangle(corner.size() / 2);
+            for(std::size_t i = 0; i < triangle.size(); ++i)
+                triangle[i] = static_cast<GLuint>(corner[i * 2]);
+            computeNormals(position, triangle, smooth);
+        }
+
+        std::unordered_map<std::uint64_t, GLuint> unique;
+        std::vector<Object::Vertex> vertex;
+        std::vector<GLuint> index;
+        index.reserve(corner.size() / 2);
+
+        for(std::size_t i = 0; i < corner.size(); i += 2) {
+            const long v(corner[i]), n(corner[i + 1]);
+            const std::uint64_t key((static_cast<std::uint64_t>(v) << 32) | static_cast<std::uint32_t>(n + 1));
+
+            std::unordered_map<std::uint64_t, GLuint>::const_iterator found(unique.find(key));
+            if(found != unique.end()) {
+                index.push_back(found->second);
+                continue;
+            }
+
+            Object::Vertex e;
+            std::copy(&position[v * 3], &position[v * 3] + 3, e.position);
+            const GLfloat *const nv(n < 0 ? &smooth[v * 3] : &normal[n * 3]);
+            std::copy(nv, nv + 3, e.normal);
+
+            const GLuint id(static_cast<GLuint>(vertex.size()));
+            vertex.push_back(e);
+            unique[key] = id;
+            index.push_back(id);
+        }
+
+        stats = MeshOptimizer::optimize(vertex, index);
+        mesh.assign(vertex, index);
+        return true;
+    }
+
+    /** @brief ASCII and binary PLY; reads x, y, z, optional nx, ny, nz and the face list.
+     */
+    static bool loadPly(const char *name, MeshData &mesh, MeshOptimizer::Stats &stats)
+    {
+        std::ifstream file(name, std::ios::binary);
+        if(file.fail()) {
+            std::cerr << "Can't open the file." << name << std::endl;
+            return false;
+        }
+
+        std::string line;
+        if(!std::getline(file, line) || line.compare(0, 3, "ply") != 0) {
+            std::cerr << "Not a PLY file." << name << std::endl;
+            return false;
+        }
+
+        PlyFormat format(PLY_ASCII);
+        std::vector<PlyElement> element;
+
+        while(std::getline(file, line)) {
+            if(!line.empty() && line[line.size() - 1] == '\r')
+                line.erase(line.size() - 1);
+
+            char word[64], a[64], b[64], c[64];
+            if(sscanf(line.c_str(), "%63s", word) != 1)
+                continue;
+
+            if(strcmp(word, "end_header") == 0)
+                break;
+
+            if(strcmp(word, "format") == 0 && sscanf(line.c_str(), "%*s %63s", a) == 1) {
+                format = strcmp(a, "binary_little_endian") == 0 ? PLY_LITTLE_ENDIAN
+                         : strcmp(a, "binary_big_endian") == 0  ? PLY_BIG_ENDIAN
+                                                                : PLY_ASCII;
+            } else if(strcmp(word, "element") == 0) {
+                unsigned long count(0);
+                if(sscanf(line.c_str(), "%*s %63s %lu", a, &count) == 2) {
+                    PlyElement e;
+                    e.name = a;
+                    e.count = count;
+                    element.push_back(e);
+                }
+            } else if(strcmp(word, "property") == 0 && !element.empty()) {
+                PlyProperty p;
+                if(sscanf(line.c_str(), "%*s list %63s %63s %63s", a, b, c) == 3) {
+                    p.countType = a;
+                    p.type = b;
+                    p.name = c;
+                } else if(sscanf(line.c_str(), "%*s %63s %63s", a, b) == 2) {
+                    p.type = a;
+                    p.name = b;
+                }
+                element.back().property.push_back(p);
+            }
+        }
+
+        std::vector<GLfloat> position, normal;
+        std::vector<GLuint> triangle;
+        std::vector<double> list;
+
+        const std::streamoff start(file.tellg());
+        file.seekg(0, std::ios::end);
+        const std::streamoff end(file.tellg());
+        file.seekg(start);
+
+        for(std::size_t e = 0; e < element.size(); ++e) {
+            const PlyElement &el(element[e]);
+            const bool isVertex(el.name == "vertex"), isFace(el.name == "face");
+
+            for(std::size_t n = 0; n < el.count; ++n) {
+                GLfloat p[3] = {0.0f, 0.0f, 0.0f}, q[3] = {0.0f, 0.0f, 0.0f};
+                bool hasNormal(false);
+
+                for(std::size_t k = 0; k < el.property.size(); ++k) {
+                    const PlyProperty &prop(el.property[k]);
+                    double value;
+
+                    if(!prop.countType.empty()) {
+                        if(!plyRead(file, format, prop.countType, value)) {
+                            std::cerr << "Can't read the file." << name << std::endl;
+                            return false;
+                        }
+
+                        // a count the rest of the file can't hold is damage, not a large polygon
+                        const std::streamoff remaining(end - file.tellg());
+                        const std::size_t bytes(format == PLY_ASCII ? 2 : plySize(prop.type));
+                        const bool indices(isFace && (prop.name == "vertex_indices" || prop.name == "vertex_index"));
+                        if(value < 0.0 || value * bytes > remaining + 1.0) {
+                            std::cerr << "Can't read the file." << name << std::endl;
+                            return false;
+                        }
+                        if(indices && value != 3.0) {
+                            std::cerr << "Not a triangle in " << name << std::endl;
+                            return false;
+                        }
+
+                        list.resize(static_cast<std::size_t>(value));
+                        for(std::size_t i = 0; i < list.size(); ++i) {
+                            if(!plyRead(file, format, prop.type, list[i])) {
+                                std::cerr << "Can't read the file." << name << std::endl;
+                                return false;
+                            }
+                        }
+
+                        if(indices) {
+                            for(std::size_t i = 0; i < 3; ++i)
+                                triangle.push_back(static_cast<GLuint>(list[i]));
+                        }
+                        continue;
+                    }
+
+                    if(!plyRead(file, format, prop.type, value)) {
+                        std::cerr << "Can't read the file." << name << std::endl;
+                        return false;
+                    }
+
+                    if(isVertex) {
+                        static const char *const axis[] = {"x", "y", "z", "nx", "ny", "nz"};
+                        for(int i = 0; i < 6; i++) {
+                            if(prop.name == axis[i]) {
+                                (i < 3 ? p : q)[i % 3] = static_cast<GLfloat>(value);
+                                hasNormal |= i >= 3;
+                            }
+                        }
+                    }
+                }
+
+                if(isVertex) {
+                    position.insert(position.end(), p, p + 3);
+                    if(hasNormal)
+                        normal.insert(normal.end(), q, q + 3);
+                }
+            }
+        }
+
+        for(std::size_t i = 0; i < triangle.size(); ++i) {
+            if(triangle[i] >= position.size() / 3) {
+                std::cerr << "Bad face index in " << name << std::endl;
+                return false;
+            }
+        }
+
+        build(position, normal, triangle, mesh, stats);
+        return true;
+    }
+
+    /** @brief Write mesh to a cache file; written to a temporary name and
+     *  renamed so a reader never sees a partial file.
+     *  @param sourceSize, sourceHash, sourceTime fingerprint of the file the mesh came from.
+     */
+    static bool writeCache(const char *name, const MeshData &mesh, std::uint64_t sourceSize, std::uint64_t sourceHash,
+                           std::uint64_t sourceTime, unsigned flags = 0)
+    {
+        const bool quantized((flags & QUANTIZED_NORMALS) != 0);
+        const std::uint64_t vertexcount(static_cast<std::uint64_t>(mesh.getVertexCount()));
+        const std::uint64_t indexcount(static_cast<std::uint64_t>(mesh.getIndexCount()));
+
+        CacheHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, "GLMESH\0\0", 8);
+        h.version = cacheVersion;
+        h.byteOrder = byteOrderMark;
+        h.flags = flags;
+        h.vertexcount = static_cast<std::uint32_t>(vertexcount);
+        h.indexcount = static_cast<std::uint32_t>(indexcount);
+        h.vertexOffset = align(sizeof(CacheHeader));
+
+        std::uint64_t end(h.vertexOffset + vertexcount * (quantized ? 3 * sizeof(GLfloat) : sizeof(Object::Vertex)));
+        if(quantized) {
+            h.normalOffset = align(end);
+            end = h.normalOffset + vertexcount * 4 * sizeof(GLshort);
+        }
+        h.indexOffset = align(end);
+        h.fileSize = h.indexOffset + indexcount * sizeof(GLuint);
+        h.sourceSize = sourceSize;
+        h.sourceHash = sourceHash;
+        h.sourceTime = sourceTime;
+
+        std::vector<char> data(static_cast<std::size_t>(h.fileSize), 0);
+        memcpy(&data[0], &h, sizeof(h));
+
+        const Object::Vertex *const vertex(mesh.getVertex());
+        if(quantized) {
+            GLfloat *const position(reinterpret_cast<GLfloat *>(&data[h.vertexOffset]));
+            GLshort *const normal(reinterpret_cast<GLshort *>(&data[h.normalOffset]));
+            for(std::size_t i = 0; i < vertexcount; ++i) {
+                std::copy(vertex[i].position, vertex[i].position + 3, position + i * 3);
+                for(int k = 0; k < 3; k++)
+                    normal[i * 4 + k] = quantize(vertex[i].normal[k]);
+            }
+        } else if(vertexcount > 0) {
+            memcpy(&data[h.vertexOffset], vertex, vertexcount * sizeof(Object::Vertex));
+        }
+
+        if(indexcount > 0)
+            memcpy(&data[h.indexOffset], mesh.getIndex(), indexcount * sizeof(GLuint));
+
+        const std::string temporary(std::string(name) + ".tmp");
+        std::ofstream file(temporary.c_str(), std::ios::binary);
+        if(file.fail()) {
+            std::cerr << "Can't open the file." << temporary << std::endl;
+            return false;
+        }
+
+        file.write(&data[0], data.size());
+        file.close();
+        if(file.fail() || std::rename(temporary.c_str(), name) != 0) {
+            std::cerr << "Can't write the file." << name << std::endl;
+            std::remove(temporary.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    /** @brief Load an .obj or .ply file through its binary cache.
+     *  @param flags Flags used when the cache has to be (re)written.
+     *  @param stats If not NULL, receives the optimizer statistics when the
+     *  file had to be parsed; left untouched when the cache was used.
+     */
+    static bool load(const char *name, MeshData &mesh, unsigned flags = 0, MeshOptimizer::Stats *stats = NULL)
+    {
+        std::uint64_t sourceSize(0), sourceTime(0), sourceHash(0);
+        if(!status(name, sourceSize, sourceTime)) {
+            std::cerr << "Can't open the file." << name << std::endl;
+            return false;
+        }
+
+        const std::string cache(std::string(name) + ".meshcache");
+        bool hashed(false);
+
+#if !defined(_WIN32)
+        if(readCache(cache, name, sourceSize, sourceTime, sourceHash, hashed, mesh))
+            return true;
+#endif
+
+        bool loaded(false);
+        MeshOptimizer::Stats parsed;
+        if(hasExtension(name, ".obj")) {
+            loaded = loadObj(name, mesh, parsed);
+        } else if(hasExtension(name, ".ply")) {
+            loaded = loadPly(name, mesh, parsed);
+        } else {
+            std::cerr << "Unknown mesh format." << name << std::endl;
+        }
+
+        if(loaded) {
+            // readCache hashed the source already if it got as far as comparing hashes
+            if(hashed || fingerprint(name, sourceSize, sourceHash))
+                writeCache(cache.c_str(), mesh, sourceSize, sourceHash, sourceTime, flags);
+            if(stats != NULL)
+                *stats = parsed;
+        }
+
+        return loaded;
+    }
+};
@@ -0,0 +1,262 @@
+#pragma once
+#include <GL/glew.h>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include "Object.h"
+
+/** @brief CPU-side clean-up of indexed triangle meshes before upload.
+ *
+ *  weld() merges vertices with identical position and normal,
+ *  optimizeCache() reorders triangles for the post-transform vertex cache
+ *  with Tipsify (Sander, Nehab and Barczak 2007), optimizeFetch() renumbers
+ *  vertices in first-use order, and shrink() converts indices to 16 bits
+ *  when they fit. optimize() runs the first three in order and reports the
+ *  average cache miss ratio (misses per triangle) and average transform to
+ *  vertex ratio (misses per vertex) before and after, using a FIFO cache
+ *  of cacheSize entries.
+ */
+class MeshOptimizer
+{
+public:
+    struct Stats
+    {
+        GLsizei vertexBefore;
+        GLsizei vertexAfter;
+        GLfloat acmrBefore;
+        GLfloat acmrAfter;
+        GLfloat atvrBefore;
+        GLfloat atvrAfter;
+    };
+
+private:
+    struct VertexHash
+    {
+        std::size_t operator()(const Object::Vertex &v) const
+        {
+            std::uint32_t w[6];
+            memcpy(w, &v, sizeof(w));
+
+            std::uint64_t h(1469598103934665603ull);
+            for(int i = 0; i < 6; i++)
+                h = (h ^ w[i]) * 1099511628211ull;
+            return static_cast<std::size_t>(h);
+        }
+    };
+
+    struct VertexEqual
+    {
+        bool operator()(const Object::Vertex &a, const Object::Vertex &b) const
+        {
+            return memcmp(&a, &b, sizeof(Object::Vertex)) == 0;
+        }
+    };
+
+    static GLsizei countMisses(const std::vector<GLuint> &index, GLsizei vertexcount, GLsizei cacheSize)
+    {
+        // a vertex is in the FIFO cache if it entered it less than cacheSize misses ago
+        std::vector<GLsizei> entered(vertexcount, -1);
+        GLsizei misses(0);
+
+        for(std::size_t i = 0; i < index.size(); ++i) {
+            const GLuint v(index[i]);
+            if(entered[v] < 0 || misses - entered[v] >= cacheSize)
+                entered[v] = misses++;
+        }
+
+        return misses;
+    }
+
+    static GLint skipDeadEnd(std::vector<GLuint> &deadEnd, const std::vector<GLuint> &live, GLuint &cursor,
+                             GLsizei vertexcount)
+    {
+        while(!deadEnd.empty()) {
+            const GLuint d(deadEnd.back());
+            deadEnd.pop_back();
+            if(live[d] > 0)
+                return static_cast<GLint>(d);
+        }
+
+        for(; cursor < static_cast<GLuint>(vertexcount); ++cursor) {
+            if(live[cursor] > 0)
+                return static_cast<GLint>(cursor);
+        }
+
+        return -1;
+    }
+
+public:
+    /** @brief Average cache miss ratio: transformed vertices per triangle.
+     */
+    static GLfloat acmr(const std::vector<GLuint> &index, GLsizei vertexcount, GLsizei cacheSize = 16)
+    {
+        // fewer than 3 indices make no triangle to divide by
+        return index.size() < 3 ? 0.0f
+                                : static_cast<GLfloat>(countMisses(index, vertexcount, cacheSize)) / (index.size() / 3);
+    }
+
+    /** @brief Average transform to vertex ratio: 1.0 is optimal.
+     */
+    static GLfloat atvr(const std::vector<GLuint> &index, GLsizei vertexcount, GLsizei cacheSize = 16)
+    {
+        return vertexcount == 0 ? 0.0f
+                                : static_cast<GLfloat>(countMisses(index, vertexcount, cacheSize)) / vertexcount;
+    }
+
+    /** @brief Merge bitwise identical vertices and rewrite the indices.
+     */
+    static void weld(std::vector<Object::Vertex> &vertex, std::vector<GLuint> &index)
+    {
+        std::unordered_map<Object::Vertex, GLuint, VertexHash, VertexEqual> unique(vertex.size());
+        std::vector<GLuint> remap(vertex.size());
+        std::vector<Object::Vertex> welded;
+        welded.reserve(vertex.size());
+
+        for(std::size_t i = 0; i < vertex.size(); ++i) {
+            Object::Vertex v(vertex[i]);
+            for(int k = 0; k < 3; k++) {
+                // +0 and -0 compare equal but differ bitwise
+                v.position[k] += 0.0f;
+                v.normal[k] += 0.0f;
+            }
+
+            const std::pair<std::unordered_map<Object::Vertex, GLuint, VertexHash, VertexEqual>::iterator, bool> r(
+                unique.insert(std::make_pair(v, static_cast<GLuint>(welded.size()))));
+            if(r.second)
+                welded.push_back(v);
+            remap[i] = r.first->second;
+        }
+
+        for(std::size_t i = 0; i < index.size(); ++i)
+            index[i] = remap[index[i]];
+
+        vertex.swap(welded);
+    }
+
+    /** @brief Reorder triangles with Tipsify for a cache of cacheSize vertices.
+     */
+    static void optimizeCache(std::vector<GLuint> &index, GLsizei vertexcount, GLsizei cacheSize = 16)
+    {
+        const std::size_t triangles(index.size() / 3);
+
+        // vertex -> triangles adjacency in compressed rows
+        std::vector<GLuint> offset(vertexcount + 1, 0);
+        for(std::size_t i = 0; i < triangles * 3; ++i)
+            ++offset[index[i] + 1];
+        for(GLsizei v = 0; v < vertexcount; ++v)
+            offset[v + 1] += offset[v];
+
+        std::vector<GLuint> adjacency(triangles * 3);
+        std::vector<GLuint> live(vertexcount, 0);
+        for(std::size_t t = 0; t < triangles; ++t) {
+            for(int k = 0; k < 3; k++) {
+                const GLuint v(index[t * 3 + k]);
+                adjacency[offset[v] + live[v]++] = static_cast<GLuint>(t);
+            }
+        }
+
+        std::vector<GLsizei> stamp(vertexcount, 0);
+        std::vector<bool> emitted(triangles, false);
+        std::vector<GLuint> deadEnd, candidate, output;
+        output.reserve(triangles * 3);
+
+        GLsizei time(cacheSize + 1);
+        GLuint cursor(1);
+        GLint fanning(vertexcount > 0 ? 0 : -1);
+
+        while(fanning >= 0) {
+            candidate.clear();
+
+            for(GLuint a = offset[fanning]; a < offset[fanning + 1]; ++a) {
+                const GLuint t(adjacency[a]);
+                if(emitted[t])
+                    continue;
+
+                for(int k = 0; k < 3; k++) {
+                    const GLuint v(index[t * 3 + k]);
+                    output.push_back(v);
+                    deadEnd.push_back(v);
+                    candidate.push_back(v);
+                    --live[v];
+                    if(time - stamp[v] > cacheSize)
+                        stamp[v] = time++;
+                }
+                emitted[t] = true;
+            }
+
+            // next fanning vertex: the candidate that stays in the cache longest
+            GLint next(-1), best(-1);
+            for(std::size_t c = 0; c < candidate.size(); ++c) {
+                const GLuint v(candidate[c]);
+                if(live[v] == 0)
+                    continue;
+
+                GLint priority(0);
+                if(time - stamp[v] + 2 * static_cast<GLsizei>(live[v]) <= cacheSize)
+                    priority = time - stamp[v];
+                if(priority > best) {
+                    best = priority;
+                    next = static_cast<GLint>(v);
+                }
+            }
+
+            fanning = next >= 0 ? next : skipDeadEnd(deadEnd, live, cursor, vertexcount);
+        }
+
+        index.swap(output);
+    }
+
+    /** @brief Renumber vertices in the order the indices first use them;
+     *  unreferenced vertices are dropped.
+     */
+    static void optimizeFetch(std::vector<Object::Vertex> &vertex, std::vector<GLuint> &index)
+    {
+        const GLuint unused(~0u);
+        std::vector<GLuint> remap(vertex.size(), unused);
+        std::vector<Object::Vertex> ordered;
+        ordered.reserve(vertex.size());
+
+        for(std::size_t i = 0; i < index.size(); ++i) {
+            GLuint &r(remap[index[i]]);
+            if(r == unused) {
+                r = static_cast<GLuint>(ordered.size());
+                ordered.push_back(vertex[index[i]]);
+            }
+            index[i] = r;
+        }
+
+        vertex.swap(ordered);
+    }
+
+    /** @brief Copy the indices to 16 bits.
+     *  @return false (and leaves out untouched) if a vertex count over 65536 needs 32-bit indices.
+     */
+    static bool shrink(GLsizei indexcount, const GLuint *index, GLsizei vertexcount, std::vector<GLushort> &out)
+    {
+        if(vertexcount > 65536)
+            return false;
+
+        out.assign(index, index + indexcount);
+        return true;
+    }
+
+    static Stats optimize(std::vector<Object::Vertex> &vertex, std::vector<GLuint> &index, GLsizei cacheSize = 16)
+    {
+        Stats stats;
+        stats.vertexBefore = static_cast<GLsizei>(vertex.size());
+        stats.acmrBefore = acmr(index, stats.vertexBefore, cacheSize);
+        stats.atvrBefore = atvr(index, stats.vertexBefore, cacheSize);
+
+        weld(vertex, index);
+        optimizeCache(index, static_cast<GLsizei>(vertex.size()), cacheSize);
+        optimizeFetch(vertex, index);
+
+        stats.vertexAfter = static_cast<GLsizei>(vertex.size());
+        stats.acmrAfter = acmr(index, stats.vertexAfter, cacheSize);
+        stats.atvrAfter = atvr(index, stats.vertexAfter, cacheSize);
+
+        return stats;
+    }
+};
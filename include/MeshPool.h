@@ -0,0 +1,363 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "Object.h"
+#include "RenderState.h"
+
+/** @brief Vertex and index arena shared by many meshes.
+ *
+ *  All meshes live in one VBO and one IBO behind a single VAO. Each mesh is
+ *  a Handle to a vertex range and an index range; indices stay local to the
+ *  mesh and glDrawElementsBaseVertex adds the range offset at draw time.
+ *  Ranges come from a first-fit free list that coalesces on release. When
+ *  no free block is large enough the pool is compacted, and the buffers
+ *  grow if the mesh still would not fit. Handles stay valid across both.
+ */
+class MeshPool
+{
+public:
+    typedef GLuint Handle;
+
+    struct Range
+    {
+        GLint baseVertex;
+        GLsizei vertexcount;
+        GLsizei firstIndex;
+        GLsizei indexcount;
+    };
+
+private:
+    /// First-fit free list over [0, capacity) in units of elements.
+    class Allocator
+    {
+        std::map<GLsizei, GLsizei> blocks;  // offset -> size of each free block
+
+        GLsizei capacity;
+
+        GLsizei available;
+
+    public:
+        explicit Allocator(GLsizei capacity) : capacity(0), available(0)
+        {
+            grow(capacity);
+        }
+
+        bool allocate(GLsizei size, GLsizei &offset)
+        {
+            if(size == 0) {
+                offset = 0;
+                return true;
+            }
+
+            for(std::map<GLsizei, GLsizei>::iterator i = blocks.begin(); i != blocks.end(); ++i) {
+                if(i->second >= size) {
+                    offset = i->first;
+                    if(i->second > size)
+                        blocks[i->first + size] = i->second - size;
+                    blocks.erase(i);
+                    available -= size;
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        void release(GLsizei offset, GLsizei size)
+        {
+            if(size == 0)
+                return;
+
+            available += size;
+
+            std::map<GLsizei, GLsizei>::iterator next(blocks.lower_bound(offset));
+            if(next != blocks.end() && offset + size == next->first) {
+                size += next->second;
+                next = blocks.erase(next);
+            }
+
+            if(next != blocks.begin()) {
+                std::map<GLsizei, GLsizei>::iterator prev(next);
+                --prev;
+                if(prev->first + prev->second == offset) {
+                    prev->second += size;
+                    return;
+                }
+            }
+
+            blocks[offset] = size;
+        }
+
+        void grow(GLsizei newCapacity)
+        {
+            const GLsizei old(capacity);
+            capacity = newCapacity;
+            release(old, newCapacity - old);
+        }
+
+        /// Everything below used is allocated, the rest is one free block.
+        void reset(GLsizei used)
+        {
+            blocks.clear();
+            available = 0;
+            release(used, capacity - used);
+        }
+
+        GLsizei getCapacity() const
+        {
+            return capacity;
+        }
+
+        GLsizei getAvailable() const
+        {
+            return available;
+        }
+
+        std::size_t getBlockCount() const
+        {
+            return blocks.size();
+        }
+    };
+
+    const GLint size;
+
+    GLuint vao;
+    GLuint vbo;
+    GLuint ibo;
+
+    Allocator vertices;
+    Allocator indices;
+
+    std::vector<Range> ranges;
+    std::vector<bool> live;
+    std::vector<Handle> unused;
+
+    MeshPool(const MeshPool &);
+    MeshPool &operator=(const MeshPool &);
+
+    void setup() const
+    {
+        attach(vao);
+    }
+
+    static GLuint createBuffer(GLsizeiptr bytes)
+    {
+        GLuint buffer;
+        glGenBuffers(1, &buffer);
+        RenderState::get().bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, bytes, NULL, GL_STATIC_DRAW);
+        return buffer;
+    }
+
+    /** @brief Pack every live range from offset 0 into new buffers of the given capacity.
+     */
+    void rebuild(GLsizei vertexCapacity, GLsizei indexCapacity)
+    {
+        const GLuint newVbo(createBuffer(vertexCapacity * sizeof(Object::Vertex)));
+        const GLuint newIbo(createBuffer(indexCapacity * sizeof(GLuint)));
+
+        GLsizei vertexEnd(0), indexEnd(0);
+        for(std::size_t h = 0; h < ranges.size(); ++h) {
+            if(!live[h])
+                continue;
+
+            Range &r(ranges[h]);
+            const GLsizei baseVertex(vertexEnd);
+            const GLsizei firstIndex(indexEnd);
+
+            RenderState::get().bindBuffer(GL_COPY_READ_BUFFER, vbo);
+            RenderState::get().bindBuffer(GL_COPY_WRITE_BUFFER, newVbo);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, r.baseVertex * sizeof(Object::Vertex),
+                                baseVertex * sizeof(Object::Vertex), r.vertexcount * sizeof(Object::Vertex));
+
+            if(r.indexcount > 0) {
+                RenderState::get().bindBuffer(GL_COPY_READ_BUFFER, ibo);
+                RenderState::get().bindBuffer(GL_COPY_WRITE_BUFFER, newIbo);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, r.firstIndex * sizeof(GLuint),
+                                    firstIndex * sizeof(GLuint), r.indexcount * sizeof(GLuint));
+            }
+
+            r.baseVertex = baseVertex;
+            r.firstIndex = firstIndex;
+            vertexEnd += r.vertexcount;
+            indexEnd += r.indexcount;
+        }
+
+        RenderState::get().forgetBuffer(vbo);
+        glDeleteBuffers(1, &vbo);
+        RenderState::get().forgetBuffer(ibo);
+        glDeleteBuffers(1, &ibo);
+        vbo = newVbo;
+        ibo = newIbo;
+
+        vertices.grow(vertexCapacity);
+        indices.grow(indexCapacity);
+        vertices.reset(vertexEnd);
+        indices.reset(indexEnd);
+
+        setup();
+        RenderState::get().bindVertexArray(0);
+    }
+
+public:
+    /** @param size dimention of vertex.
+     *  @param vertexCapacity initial number of vertices.
+     *  @param indexCapacity initial number of indices.
+     */
+    MeshPool(GLint size, GLsizei vertexCapacity = 65536, GLsizei indexCapacity = 196608)
+        : size(size), vertices(vertexCapacity), indices(indexCapacity)
+    {
+        glGenVertexArrays(1, &vao);
+        vbo = createBuffer(vertexCapacity * sizeof(Object::Vertex));
+        ibo = createBuffer(indexCapacity * sizeof(GLuint));
+
+        setup();
+        RenderState::get().bindVertexArray(0);
+    }
+
+    virtual ~MeshPool()
+    {
+        RenderState::get().forgetBuffer(vbo);
+        glDeleteBuffers(1, &vbo);
+        RenderState::get().forgetBuffer(ibo);
+        glDeleteBuffers(1, &ibo);
+        RenderState::get().forgetVertexArray(vao);
+        glDeleteVertexArrays(1, &vao);
+    }
+
+    /** @brief Copy a mesh into the pool.
+     *  @param index indices local to this mesh (0 .. vertexcount - 1), or NULL.
+     */
+    Handle allocate(GLsizei vertexcount, const Object::Vertex *vertex, GLsizei indexcount = 0,
+                    const GLuint *index = NULL)
+    {
+        GLsizei baseVertex(0), firstIndex(0);
+
+        const bool vertexFit(vertices.allocate(vertexcount, baseVertex));
+        if(!vertexFit || !indices.allocate(indexcount, firstIndex)) {
+            if(vertexFit)
+                vertices.release(baseVertex, vertexcount);
+
+            defragment(vertexcount, indexcount);
+            vertices.allocate(vertexcount, baseVertex);
+            indices.allocate(indexcount, firstIndex);
+        }
+
+        const Range r = {baseVertex, vertexcount, firstIndex, indexcount};
+
+        Handle h;
+        if(unused.empty()) {
+            h = static_cast<Handle>(ranges.size());
+            ranges.push_back(r);
+            live.push_back(true);
+        } else {
+            h = unused.back();
+            unused.pop_back();
+            ranges[h] = r;
+            live[h] = true;
+        }
+
+        RenderState::get().bindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferSubData(GL_ARRAY_BUFFER, baseVertex * sizeof(Object::Vertex), vertexcount * sizeof(Object::Vertex),
+                        vertex);
+
+        if(indexcount > 0) {
+            RenderState::get().bindBuffer(GL_COPY_WRITE_BUFFER, ibo);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, firstIndex * sizeof(GLuint), indexcount * sizeof(GLuint), index);
+        }
+
+        return h;
+    }
+
+    /** @brief Give a mesh's ranges back; releasing a handle that is not live does nothing.
+     */
+    void release(Handle h)
+    {
+        if(h >= live.size() || !live[h])
+            return;
+
+        const Range &r(ranges[h]);
+        vertices.release(r.baseVertex, r.vertexcount);
+        indices.release(r.firstIndex, r.indexcount);
+        live[h] = false;
+        unused.push_back(h);
+    }
+
+    /** @brief Compact all live meshes to the start of the buffers, growing
+     *  them if the extra space requested still would not fit.
+     */
+    void defragment(GLsizei extraVertices = 0, GLsizei extraIndices = 0)
+    {
+        GLsizei vertexCapacity(vertices.getCapacity());
+        GLsizei indexCapacity(indices.getCapacity());
+
+        if(extraVertices > vertices.getAvailable())
+            vertexCapacity = std::max(vertexCapacity * 2, vertexCapacity - vertices.getAvailable() + extraVertices);
+        if(extraIndices > indices.getAvailable())
+            indexCapacity = std::max(indexCapacity * 2, indexCapacity - indices.getAvailable() + extraIndices);
+
+        rebuild(vertexCapacity, indexCapacity);
+    }
+
+    /** @brief Point the position and normal attributes and the element buffer
+     *  of another vertex array at the pool, for a renderer that adds
+     *  attributes of its own without touching the pool's array. Call it
+     *  again after the pool grows or is defragmented. Leaves the array bound.
+     */
+    void attach(GLuint vertexArray) const
+    {
+        RenderState::get().bindVertexArray(vertexArray);
+
+        RenderState::get().bindBuffer(GL_ARRAY_BUFFER, vbo);
+        glVertexAttribPointer(0, size, GL_FLOAT, GL_FALSE, sizeof(Object::Vertex),
+                              static_cast<Object::Vertex *>(0)->position);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Object::Vertex), static_cast<Object::Vertex *>(0)->normal);
+        glEnableVertexAttribArray(1);
+
+        RenderState::get().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+    }
+
+    const Range &getRange(Handle h) const
+    {
+        return ranges[h];
+    }
+
+    void bind() const
+    {
+        RenderState::get().bindVertexArray(vao);
+    }
+
+    /** @brief Draw one mesh; the pool must be bound.
+     */
+    void draw(Handle h, GLenum mode) const
+    {
+        const Range &r(ranges[h]);
+
+        if(r.indexcount > 0) {
+            glDrawElementsBaseVertex(mode, r.indexcount, GL_UNSIGNED_INT,
+                                     static_cast<GLuint *>(0) + r.firstIndex, r.baseVertex);
+        } else {
+            glDrawArrays(mode, r.baseVertex, r.vertexcount);
+        }
+    }
+
+    GLsizei getVertexCapacity() const
+    {
+        return vertices.getCapacity();
+    }
+
+    GLsizei getIndexCapacity() const
+    {
+        return indices.getCapacity();
+    }
+
+    /// Number of free blocks; more than one means the pool is fragmented.
+    std::size_t getFragmentCount() const
+    {
+        return std::max(vertices.getBlockCount(), indices.getBlockCount());
+    }
+};
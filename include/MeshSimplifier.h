@@ -0,0 +1,576 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include "MeshOptimizer.h"
+#include "Object.h"
+
+/** @brief Edge-collapse simplification with quadric error metrics
+ *  (Garland and Heckbert 1997).
+ *
+ *  Collapses run on positions, so vertices that share a position but not a
+ *  normal (hard edges such as the faces of solidCubeVertex) move together
+ *  and keep their own normals. Boundary edges get an extra perpendicular
+ *  quadric so open borders do not shrink, and a collapse that would flip a
+ *  triangle is rejected. Quadrics only order the collapses: they are area
+ *  weighted, so their values scale with the square of the area. The error
+ *  of a level is measured instead, as the largest distance in model units
+ *  from any vertex or triangle centroid of the level to the original
+ *  triangles that were collapsed into it.
+ */
+class MeshSimplifier
+{
+public:
+    struct Level
+    {
+        std::vector<Object::Vertex> vertex;
+        std::vector<GLuint> index;
+        GLfloat error;
+    };
+
+private:
+    struct Quadric
+    {
+        double q[10];  // upper triangle of the symmetric 4x4 matrix
+
+        Quadric()
+        {
+            std::fill(q, q + 10, 0.0);
+        }
+
+        /// weight * (plane . [x y z 1])^2
+        void addPlane(double a, double b, double c, double d, double weight)
+        {
+            q[0] += weight * a * a;
+            q[1] += weight * a * b;
+            q[2] += weight * a * c;
+            q[3] += weight * a * d;
+            q[4] += weight * b * b;
+            q[5] += weight * b * c;
+            q[6] += weight * b * d;
+            q[7] += weight * c * c;
+            q[8] += weight * c * d;
+            q[9] += weight * d * d;
+        }
+
+        void add(const Quadric &o)
+        {
+            for(int i = 0; i < 10; i++)
+                q[i] += o.q[i];
+        }
+
+        double error(const double *v) const
+        {
+            const double x(v[0]), y(v[1]), z(v[2]);
+            return q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z + 2.0 * q[3] * x + q[4] * y * y +
+                   2.0 * q[5] * y * z + 2.0 * q[6] * y + q[7] * z * z + 2.0 * q[8] * z + q[9];
+        }
+
+        /// Position minimizing the error, if the 3x3 system is well conditioned.
+        bool optimum(double *v) const
+        {
+            const double a(q[0]), b(q[1]), c(q[2]), e(q[4]), f(q[5]), h(q[7]);
+            const double det(a * (e * h - f * f) - b * (b * h - f * c) + c * (b * f - e * c));
+            if(fabs(det) < 1e-12)
+                return false;
+
+            const double r0(-q[3]), r1(-q[6]), r2(-q[8]);
+            v[0] = (r0 * (e * h - f * f) - b * (r1 * h - f * r2) + c * (r1 * f - e * r2)) / det;
+            v[1] = (a * (r1 * h - f * r2) - r0 * (b * h - f * c) + c * (b * r2 - r1 * c)) / det;
+            v[2] = (a * (e * r2 - r1 * f) - b * (b * r2 - r1 * c) + r0 * (b * f - e * c)) / det;
+            return true;
+        }
+    };
+
+    struct Collapse
+    {
+        double cost;
+        GLuint keep;
+        GLuint remove;
+        GLuint keepVersion;
+        GLuint removeVersion;
+        double target[3];
+
+        bool operator<(const Collapse &o) const
+        {
+            return cost > o.cost;  // std::priority_queue is a max-heap
+        }
+    };
+
+    struct IsDeleted
+    {
+        const std::vector<bool> &deleted;
+
+        explicit IsDeleted(const std::vector<bool> &deleted) : deleted(deleted)
+        {
+        }
+
+        bool operator()(GLuint t) const
+        {
+            return deleted[t];
+        }
+    };
+
+    std::vector<double> position;  // xyz per unique position
+    std::vector<Quadric> quadric;
+    std::vector<GLuint> version;
+    std::vector<bool> removed;
+    std::vector<GLuint> parent;     // position a removed position collapsed into
+    std::vector<GLuint> triangle;   // position ids, 3 per triangle
+    std::vector<double> original;   // position before any collapse
+    std::vector<GLuint> source;     // triangle before any collapse
+    std::vector<bool> deleted;      // per triangle
+    std::vector<std::vector<GLuint> > adjacent;  // position -> triangles
+    std::priority_queue<Collapse> heap;
+    GLsizei liveTriangles;
+
+    static void normal(const double *a, const double *b, const double *c, double *n)
+    {
+        const double u[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+        const double v[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+        n[0] = u[1] * v[2] - u[2] * v[1];
+        n[1] = u[2] * v[0] - u[0] * v[2];
+        n[2] = u[0] * v[1] - u[1] * v[0];
+    }
+
+    static double dot(const double *a, const double *b)
+    {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    /// Squared distance from p to the triangle a b c (Ericson, Real-Time Collision Detection 5.1.5).
+    static double distance2(const double *p, const double *a, const double *b, const double *c)
+    {
+        const double ab[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+        const double ac[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+        const double ap[3] = {p[0] - a[0], p[1] - a[1], p[2] - a[2]};
+        const double bp[3] = {p[0] - b[0], p[1] - b[1], p[2] - b[2]};
+        const double cp[3] = {p[0] - c[0], p[1] - c[1], p[2] - c[2]};
+        const double d1(dot(ab, ap)), d2(dot(ac, ap)), d3(dot(ab, bp)), d4(dot(ac, bp)), d5(dot(ab, cp)),
+            d6(dot(ac, cp));
+        const double va(d3 * d6 - d5 * d4), vb(d5 * d2 - d1 * d6), vc(d1 * d4 - d3 * d2);
+
+        double q[3];
+        if(d1 <= 0.0 && d2 <= 0.0) {
+            std::copy(a, a + 3, q);
+        } else if(d3 >= 0.0 && d4 <= d3) {
+            std::copy(b, b + 3, q);
+        } else if(vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0) {
+            const double t(d1 / (d1 - d3));
+            for(int k = 0; k < 3; k++)
+                q[k] = a[k] + t * ab[k];
+        } else if(d6 >= 0.0 && d5 <= d6) {
+            std::copy(c, c + 3, q);
+        } else if(vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0) {
+            const double t(d2 / (d2 - d6));
+            for(int k = 0; k < 3; k++)
+                q[k] = a[k] + t * ac[k];
+        } else if(va <= 0.0 && d4 - d3 >= 0.0 && d5 - d6 >= 0.0) {
+            const double t((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+            for(int k = 0; k < 3; k++)
+                q[k] = b[k] + t * (c[k] - b[k]);
+        } else {
+            const double v(vb / (va + vb + vc)), w(vc / (va + vb + vc));
+            for(int k = 0; k < 3; k++)
+                q[k] = a[k] + v * ab[k] + w * ac[k];
+        }
+
+        const double d[3] = {p[0] - q[0], p[1] - q[1], p[2] - q[2]};
+        return dot(d, d);
+    }
+
+    /** @brief Largest distance from the simplified surface to the original one.
+     *  Every surviving position and the centroid of every surviving triangle
+     *  is compared with the original triangles around the positions that were
+     *  collapsed into it. Those need not include the closest one, so the
+     *  result can only overestimate the distance at the sampled points.
+     */
+    double measure() const
+    {
+        const std::size_t count(parent.size());
+        std::vector<GLuint> root(count);
+        for(std::size_t p = 0; p < count; ++p) {
+            GLuint r(static_cast<GLuint>(p));
+            while(parent[r] != r)
+                r = parent[r];
+            root[p] = r;
+        }
+
+        // original triangles with any corner collapsed into each surviving position
+        std::vector<std::vector<GLuint> > around(count);
+        for(std::size_t t = 0; t < source.size() / 3; ++t) {
+            const GLuint *const v(&source[t * 3]);
+            double n[3];
+            normal(&original[v[0] * 3], &original[v[1] * 3], &original[v[2] * 3], n);
+            if(dot(n, n) == 0.0)
+                continue;
+
+            for(int k = 0; k < 3; k++) {
+                std::vector<GLuint> &list(around[root[v[k]]]);
+                if(list.empty() || list.back() != t)
+                    list.push_back(static_cast<GLuint>(t));
+            }
+        }
+
+        const auto nearest = [this, &around](const double *p, const GLuint *owner, int owners) {
+            double best(-1.0);
+            for(int o = 0; o < owners; o++) {
+                const std::vector<GLuint> &list(around[owner[o]]);
+                for(std::size_t a = 0; a < list.size(); ++a) {
+                    const GLuint *const v(&source[list[a] * 3]);
+                    const double d(distance2(p, &original[v[0] * 3], &original[v[1] * 3], &original[v[2] * 3]));
+                    if(best < 0.0 || d < best)
+                        best = d;
+                }
+            }
+            return std::max(best, 0.0);
+        };
+
+        double worst(0.0);
+        std::vector<bool> measured(count, false);
+        for(std::size_t t = 0; t < deleted.size(); ++t) {
+            if(deleted[t])
+                continue;
+
+            const GLuint *const v(&triangle[t * 3]);
+            double centroid[3] = {0.0, 0.0, 0.0};
+            for(int k = 0; k < 3; k++) {
+                const double *const p(&position[v[k] * 3]);
+                for(int c = 0; c < 3; c++)
+                    centroid[c] += p[c] / 3.0;
+
+                if(!measured[v[k]]) {
+                    measured[v[k]] = true;
+                    worst = std::max(worst, nearest(p, &v[k], 1));
+                }
+            }
+            worst = std::max(worst, nearest(centroid, v, 3));
+        }
+
+        return sqrt(worst);
+    }
+
+    void push(GLuint i, GLuint j)
+    {
+        Quadric q(quadric[i]);
+        q.add(quadric[j]);
+
+        Collapse c;
+        c.keep = i;
+        c.remove = j;
+        c.keepVersion = version[i];
+        c.removeVersion = version[j];
+
+        if(!q.optimum(c.target)) {
+            // fall back to the best of the endpoints and the midpoint
+            const double *const a(&position[i * 3]), *const b(&position[j * 3]);
+            const double mid[3] = {(a[0] + b[0]) * 0.5, (a[1] + b[1]) * 0.5, (a[2] + b[2]) * 0.5};
+            const double *const candidate[] = {a, b, mid};
+
+            double best(-1.0);
+            for(int k = 0; k < 3; k++) {
+                const double e(q.error(candidate[k]));
+                if(best < 0.0 || e < best) {
+                    best = e;
+                    std::copy(candidate[k], candidate[k] + 3, c.target);
+                }
+            }
+        }
+
+        c.cost = std::max(0.0, q.error(c.target));
+        heap.push(c);
+    }
+
+    /// True if moving i and j to target turns any surviving triangle over.
+    bool flips(GLuint i, GLuint j, const double *target) const
+    {
+        const GLuint ends[] = {i, j};
+        for(int e = 0; e < 2; e++) {
+            const std::vector<GLuint> &around(adjacent[ends[e]]);
+            for(std::size_t a = 0; a < around.size(); ++a) {
+                const GLuint t(around[a]);
+                if(deleted[t])
+                    continue;
+
+                const GLuint *const v(&triangle[t * 3]);
+                if((v[0] == i || v[1] == i || v[2] == i) && (v[0] == j || v[1] == j || v[2] == j))
+                    continue;  // removed by the collapse
+
+                const double *p[3], *q[3];
+                for(int k = 0; k < 3; k++) {
+                    p[k] = &position[v[k] * 3];
+                    q[k] = v[k] == ends[e] ? target : p[k];
+                }
+
+                double before[3], after[3];
+                normal(p[0], p[1], p[2], before);
+                normal(q[0], q[1], q[2], after);
+                if(before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0.0)
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    void collapse(const Collapse &c)
+    {
+        const GLuint i(c.keep), j(c.remove);
+
+        std::copy(c.target, c.target + 3, &position[i * 3]);
+        quadric[i].add(quadric[j]);
+        removed[j] = true;
+        parent[j] = i;
+        ++version[i];
+        ++version[j];
+
+        for(std::size_t a = 0; a < adjacent[j].size(); ++a) {
+            const GLuint t(adjacent[j][a]);
+            if(deleted[t])
+                continue;
+
+            GLuint *const v(&triangle[t * 3]);
+            if(v[0] == i || v[1] == i || v[2] == i) {
+                deleted[t] = true;
+                --liveTriangles;
+                continue;
+            }
+
+            for(int k = 0; k < 3; k++) {
+                if(v[k] == j)
+                    v[k] = i;
+            }
+            adjacent[i].push_back(t);
+        }
+        std::vector<GLuint>().swap(adjacent[j]);
+
+        // drop deleted triangles from i's list and requeue its edges
+        std::vector<GLuint> &around(adjacent[i]);
+        around.erase(std::remove_if(around.begin(), around.end(), IsDeleted(deleted)), around.end());
+
+        std::vector<GLuint> neighbor;
+        for(std::size_t a = 0; a < around.size(); ++a) {
+            for(int k = 0; k < 3; k++) {
+                const GLuint n(triangle[around[a] * 3 + k]);
+                if(n != i)
+                    neighbor.push_back(n);
+            }
+        }
+        std::sort(neighbor.begin(), neighbor.end());
+        neighbor.erase(std::unique(neighbor.begin(), neighbor.end()), neighbor.end());
+
+        for(std::size_t n = 0; n < neighbor.size(); ++n)
+            push(i, neighbor[n]);
+    }
+
+    void initialize(const std::vector<Object::Vertex> &vertex, const std::vector<GLuint> &index,
+                    std::vector<GLuint> &positionOf)
+    {
+        std::map<std::vector<GLfloat>, GLuint> unique;
+        positionOf.resize(vertex.size());
+        position.clear();
+
+        for(std::size_t v = 0; v < vertex.size(); ++v) {
+            const std::vector<GLfloat> key(vertex[v].position, vertex[v].position + 3);
+            const std::pair<std::map<std::vector<GLfloat>, GLuint>::iterator, bool> r(
+                unique.insert(std::make_pair(key, static_cast<GLuint>(position.size() / 3))));
+            if(r.second)
+                position.insert(position.end(), vertex[v].position, vertex[v].position + 3);
+            positionOf[v] = r.first->second;
+        }
+
+        const std::size_t count(position.size() / 3);
+        quadric.assign(count, Quadric());
+        version.assign(count, 0);
+        removed.assign(count, false);
+        parent.resize(count);
+        for(std::size_t p = 0; p < count; ++p)
+            parent[p] = static_cast<GLuint>(p);
+        adjacent.assign(count, std::vector<GLuint>());
+
+        triangle.resize(index.size());
+        for(std::size_t k = 0; k < index.size(); ++k)
+            triangle[k] = positionOf[index[k]];
+
+        const std::size_t triangles(index.size() / 3);
+        deleted.assign(triangles, false);
+        liveTriangles = static_cast<GLsizei>(triangles);
+        original = position;
+        source = triangle;
+
+        std::map<std::pair<GLuint, GLuint>, int> edgeUse;
+
+        for(std::size_t t = 0; t < triangles; ++t) {
+            const GLuint *const v(&triangle[t * 3]);
+            if(v[0] == v[1] || v[1] == v[2] || v[2] == v[0]) {
+                deleted[t] = true;
+                --liveTriangles;
+                continue;
+            }
+
+            double n[3];
+            normal(&position[v[0] * 3], &position[v[1] * 3], &position[v[2] * 3], n);
+            const double l(sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]));
+            if(l > 0.0) {
+                const double a(n[0] / l), b(n[1] / l), c(n[2] / l);
+                const double d(-(a * position[v[0] * 3] + b * position[v[0] * 3 + 1] + c * position[v[0] * 3 + 2]));
+                for(int k = 0; k < 3; k++)
+                    quadric[v[k]].addPlane(a, b, c, d, l * 0.5);
+            }
+
+            for(int k = 0; k < 3; k++) {
+                adjacent[v[k]].push_back(static_cast<GLuint>(t));
+                ++edgeUse[std::make_pair(std::min(v[k], v[(k + 1) % 3]), std::max(v[k], v[(k + 1) % 3]))];
+            }
+        }
+
+        // boundary edges: a plane through the edge perpendicular to its face
+        for(std::size_t t = 0; t < triangles; ++t) {
+            if(deleted[t])
+                continue;
+
+            const GLuint *const v(&triangle[t * 3]);
+            double n[3];
+            normal(&position[v[0] * 3], &position[v[1] * 3], &position[v[2] * 3], n);
+
+            for(int k = 0; k < 3; k++) {
+                const GLuint a(v[k]), b(v[(k + 1) % 3]);
+                if(edgeUse[std::make_pair(std::min(a, b), std::max(a, b))] != 1)
+                    continue;
+
+                const double *const p(&position[a * 3]), *const q(&position[b * 3]);
+                const double e[3] = {q[0] - p[0], q[1] - p[1], q[2] - p[2]};
+                double m[3] = {e[1] * n[2] - e[2] * n[1], e[2] * n[0] - e[0] * n[2], e[0] * n[1] - e[1] * n[0]};
+                const double l(sqrt(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]));
+                if(l == 0.0)
+                    continue;
+
+                for(int c = 0; c < 3; c++)
+                    m[c] /= l;
+                const double d(-(m[0] * p[0] + m[1] * p[1] + m[2] * p[2]));
+                const double weight(e[0] * e[0] + e[1] * e[1] + e[2] * e[2]);
+                quadric[a].addPlane(m[0], m[1], m[2], d, weight);
+                quadric[b].addPlane(m[0], m[1], m[2], d, weight);
+            }
+        }
+
+        heap = std::priority_queue<Collapse>();
+        for(std::map<std::pair<GLuint, GLuint>, int>::const_iterator e = edgeUse.begin(); e != edgeUse.end(); ++e)
+            push(e->first.first, e->first.second);
+    }
+
+public:
+    /** @brief Simplify an indexed triangle mesh to at most targetIndexCount indices.
+     *  Stops early when no collapse is left that keeps the surface consistent.
+     *  @param creaseAngle normals further apart than this (radians) are kept separate.
+     */
+    Level simplify(const std::vector<Object::Vertex> &vertex, const std::vector<GLuint> &index,
+                   GLsizei targetIndexCount, GLfloat creaseAngle = 1.0f)
+    {
+        std::vector<GLuint> positionOf;
+        initialize(vertex, index, positionOf);
+
+        while(liveTriangles * 3 > targetIndexCount && !heap.empty()) {
+            const Collapse c(heap.top());
+            heap.pop();
+
+            if(removed[c.keep] || removed[c.remove] || version[c.keep] != c.keepVersion ||
+               version[c.remove] != c.removeVersion)
+                continue;
+
+            if(flips(c.keep, c.remove, c.target))
+                continue;
+
+            collapse(c);
+        }
+
+        // a vertex whose position was collapsed away is replaced by the vertex
+        // at the surviving position with the closest normal, unless they are
+        // apart by more than creaseAngle; then it keeps its own normal
+        std::vector<GLuint> root(positionOf.size());
+        std::vector<std::vector<GLuint> > at(parent.size());
+        for(std::size_t v = 0; v < vertex.size(); ++v) {
+            GLuint p(positionOf[v]);
+            while(parent[p] != p)
+                p = parent[p];
+            root[v] = p;
+            if(positionOf[v] == p)
+                at[p].push_back(static_cast<GLuint>(v));
+        }
+
+        std::vector<GLuint> remap(vertex.size());
+        for(std::size_t v = 0; v < vertex.size(); ++v) {
+            remap[v] = static_cast<GLuint>(v);
+            if(positionOf[v] == root[v])
+                continue;
+
+            const GLfloat *const n(vertex[v].normal);
+            GLfloat best(cos(creaseAngle));
+            for(std::size_t c = 0; c < at[root[v]].size(); ++c) {
+                const GLfloat *const m(vertex[at[root[v]][c]].normal);
+                const GLfloat d(n[0] * m[0] + n[1] * m[1] + n[2] * m[2]);
+                if(d >= best) {
+                    best = d;
+                    remap[v] = at[root[v]][c];
+                }
+            }
+        }
+
+        Level level;
+        level.error = static_cast<GLfloat>(measure());
+
+        level.vertex = vertex;
+        for(std::size_t v = 0; v < vertex.size(); ++v) {
+            for(int k = 0; k < 3; k++)
+                level.vertex[v].position[k] = static_cast<GLfloat>(position[root[v] * 3 + k]);
+        }
+
+        const std::size_t triangles(index.size() / 3);
+        for(std::size_t t = 0; t < triangles; ++t) {
+            if(deleted[t])
+                continue;
+
+            for(int k = 0; k < 3; k++)
+                level.index.push_back(remap[index[t * 3 + k]]);
+        }
+
+        MeshOptimizer::weld(level.vertex, level.index);
+        MeshOptimizer::optimizeCache(level.index, static_cast<GLsizei>(level.vertex.size()));
+        MeshOptimizer::optimizeFetch(level.vertex, level.index);
+
+        return level;
+    }
+
+    /** @brief Build a chain of levels, each with about ratio times the
+     *  triangles of the previous one. Level 0 is the input.
+     */
+    std::vector<Level> buildChain(const std::vector<Object::Vertex> &vertex, const std::vector<GLuint> &index,
+                                  int levels = 4, GLfloat ratio = 0.5f, GLsizei minIndexCount = 36)
+    {
+        std::vector<Level> chain(1);
+        chain[0].vertex = vertex;
+        chain[0].index = index;
+        chain[0].error = 0.0f;
+
+        for(int l = 1; l < levels; ++l) {
+            const Level &previous(chain.back());
+            const GLsizei target(static_cast<GLsizei>(previous.index.size() / 3 * ratio) * 3);
+            if(target < minIndexCount)
+                break;
+
+            // simplify from the full mesh so errors do not compound across levels
+            Level level(simplify(vertex, index, target));
+            if(level.index.size() >= previous.index.size())
+                break;
+
+            level.error = std::max(level.error, previous.error);
+            chain.push_back(level);
+        }
+
+        return chain;
+    }
+};
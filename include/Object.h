@@ -1,12 +1,28 @@
 #pragma once
 #include <GL/glew.h>
 
+#include "RenderState.h"
+
 class Object
 {
     GLuint vao;
     GLuint vbo;
     GLuint ibo;
 
+    void create(GLsizeiptr vertexbytes, const GLvoid *vertex, GLsizeiptr indexbytes, const GLvoid *index)
+    {
+        glGenVertexArrays(1, &vao);
+        RenderState::get().bindVertexArray(vao);
+
+        glGenBuffers(1, &vbo);
+        RenderState::get().bindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, vertexbytes, vertex, GL_STATIC_DRAW);
+
+        glGenBuffers(1, &ibo);
+        RenderState::get().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexbytes, index, GL_STATIC_DRAW);
+    }
+
 public:
     struct Vertex
     {
@@ -14,35 +30,63 @@ public:
         GLfloat normal[3];
     };
 
+    /** @brief Half-size vertex, see VertexCodec.
+     *  position is 16-bit normalized within the mesh bounds (w is padding)
+     *  and normal is octahedral-encoded into two 16-bit normalized values.
+     */
+    struct PackedVertex
+    {
+        GLushort position[4];
+        GLshort normal[2];
+    };
+
     /** @brief Constructor.
      *  @param size dimention of vertex.
      *  @param vertexcount number of vertices.
      *  @param vertex array of vertice's attribute. 
      */
     Object(GLint size, GLsizei vertexcount, const Vertex *vertex, GLsizei indexcount = 0, const GLuint *index = NULL)
+        : Object(size, vertexcount, vertex, indexcount, index, GL_UNSIGNED_INT)
     {
-        glGenVertexArrays(1, &vao);
-        glBindVertexArray(vao);
+    }
 
-        glGenBuffers(1, &vbo);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, vertexcount * sizeof(Vertex), vertex, GL_STATIC_DRAW);
+    /** @brief Constructor for any index type.
+     *  @param indextype GL_UNSIGNED_INT, GL_UNSIGNED_SHORT or GL_UNSIGNED_BYTE.
+     */
+    Object(GLint size, GLsizei vertexcount, const Vertex *vertex, GLsizei indexcount, const GLvoid *index,
+           GLenum indextype)
+    {
+        create(vertexcount * sizeof(Vertex), vertex, indexcount * indexSize(indextype), index);
 
         glVertexAttribPointer(0, size, GL_FLOAT, GL_FALSE, sizeof(Vertex), static_cast<Vertex *>(0)->position);
         glEnableVertexAttribArray(0);
         glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), static_cast<Vertex *>(0)->normal);
         glEnableVertexAttribArray(1);
+    }
 
-        glGenBuffers(1, &ibo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexcount * sizeof(GLuint), index, GL_STATIC_DRAW);
+    /** @brief Constructor for packed vertices; the shader sees position in
+     *  [0, 1] and the octahedral normal in [-1, 1] (see packed.vert).
+     */
+    Object(GLint size, GLsizei vertexcount, const PackedVertex *vertex, GLsizei indexcount, const GLvoid *index,
+           GLenum indextype)
+    {
+        create(vertexcount * sizeof(PackedVertex), vertex, indexcount * indexSize(indextype), index);
+
+        glVertexAttribPointer(0, size, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex),
+                              static_cast<PackedVertex *>(0)->position);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), static_cast<PackedVertex *>(0)->normal);
+        glEnableVertexAttribArray(1);
     }
 
     virtual ~Object()
     {
+        RenderState::get().forgetBuffer(vbo);
         glDeleteBuffers(1, &vbo);
+        RenderState::get().forgetVertexArray(vao);
         glDeleteVertexArrays(1, &vao);
 
+        RenderState::get().forgetBuffer(ibo);
         glDeleteBuffers(1, &ibo);
     }
 
@@ -51,8 +95,13 @@ private:
     Object &operator=(const Object &);
 
 public:
+    static GLsizeiptr indexSize(GLenum indextype)
+    {
+        return indextype == GL_UNSIGNED_BYTE ? 1 : indextype == GL_UNSIGNED_SHORT ? 2 : 4;
+    }
+
     void bind() const
     {
-        glBindVertexArray(vao);
+        RenderState::get().bindVertexArray(vao);
     }
 };
\ No newline at end of file
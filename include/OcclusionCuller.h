@@ -0,0 +1,455 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define OCCLUSION_CULLER_SSE 1
+#include <emmintrin.h>
+#endif
+
+#include "Bounds.h"
+#include "Matrix.h"
+#include "Object.h"
+
+/** @brief Occlusion test against a low-resolution CPU depth buffer.
+ *
+ *  A few large occluders, typically the nearest visible objects, are
+ *  rasterized into the buffer conservatively, four pixels at a time with
+ *  SSE2: a pixel takes a triangle only if the triangle covers all of it,
+ *  and then the farthest depth the triangle has inside it. end() keeps the
+ *  farthest depth of every 8x8 block. An occludee is tested with the screen
+ *  rectangle and nearest depth of its view-space box: it is hidden only if
+ *  every pixel the rectangle touches already holds something nearer. Whole
+ *  blocks are accepted from their farthest depth and the per-pixel test
+ *  runs only where that fails. So wherever an object is culled, at any
+ *  resolution, an occluder covers it and is nearer. The price is that the
+ *  pixels along the edges between an occluder's triangles stay empty;
+ *  to keep most of them, two triangles in a row of the index list that
+ *  share an edge are filled as one quad.
+ *
+ *  begin(), addOccluder() and end() run on one thread; isVisible() may then
+ *  be called from any number of threads.
+ */
+class OcclusionCuller
+{
+public:
+    static const GLsizei blockSize = 8;
+
+private:
+    const GLsizei width;
+    const GLsizei height;
+    const GLsizei stride;  // a multiple of 4 and of blockSize
+    const GLsizei blocksX;
+    const GLsizei blocksY;
+
+    std::vector<GLfloat> depth;
+    std::vector<GLfloat> blockDepth;  // farthest depth per block
+    std::vector<GLfloat> clip;        // occluder vertices, kept to reuse the allocation
+
+    Matrix projection;
+
+    mutable std::atomic<GLsizei> tested;
+    mutable std::atomic<GLsizei> culled;
+    GLsizei occluderTriangles;
+
+    OcclusionCuller(const OcclusionCuller &);
+    OcclusionCuller &operator=(const OcclusionCuller &);
+
+    /// Whether a clip-space vertex is inside the view volume.
+    static bool inside(const GLfloat *v)
+    {
+        return v[3] + v[0] >= 0.0f && v[3] - v[0] >= 0.0f && v[3] + v[1] >= 0.0f && v[3] - v[1] >= 0.0f &&
+               v[3] + v[2] >= 0.0f && v[3] - v[2] >= 0.0f;
+    }
+
+    /// Window position and depth of a clip-space vertex inside the view volume; not snapped to a grid.
+    void project(const GLfloat *v, GLfloat &x, GLfloat &y, GLfloat &z) const
+    {
+        const GLfloat w(1.0f / v[3]);
+        x = (v[0] * w * 0.5f + 0.5f) * width;
+        y = (v[1] * w * 0.5f + 0.5f) * height;
+        z = v[2] * w * 0.5f + 0.5f;
+    }
+
+    /// Depth as a plane zx x + zy y + zc in window space through three of the vertices.
+    static void depthPlane(const GLfloat *x, const GLfloat *y, const GLfloat *z, int i, int j, int k, GLfloat *plane)
+    {
+        const GLfloat ux(x[j] - x[i]), uy(y[j] - y[i]), uz(z[j] - z[i]);
+        const GLfloat vx(x[k] - x[i]), vy(y[k] - y[i]), vz(z[k] - z[i]);
+        const GLfloat d(ux * vy - vx * uy);
+        plane[0] = (uz * vy - vz * uy) / d;
+        plane[1] = (vz * ux - uz * vx) / d;
+        plane[2] = z[i] - plane[0] * x[i] - plane[1] * y[i];
+    }
+
+    /** @brief Fill the pixels a convex window-space polygon covers entirely, where it is nearer.
+     *  @param plane the depth planes of its pieces; a pixel takes the farthest of them.
+     *  @return false, drawing nothing, if the polygon is not convex and counter-clockwise.
+     */
+    bool fill(const GLfloat *x, const GLfloat *y, int count, const GLfloat (*plane)[3], int planes)
+    {
+        GLfloat a[9], b[9], c[9];
+        GLfloat minX(FLT_MAX), minY(FLT_MAX), maxX(-FLT_MAX), maxY(-FLT_MAX);
+        for(int e = 0; e < count; ++e) {
+            const int p(e), q((e + 1) % count), r((e + 2) % count);
+            if((x[q] - x[p]) * (y[r] - y[q]) - (x[r] - x[q]) * (y[q] - y[p]) <= 0.0f)
+                return false;  // back face, degenerate or concave
+
+            // positive to the left of the edge from p to q, i.e. inside
+            a[e] = y[p] - y[q];
+            b[e] = x[q] - x[p];
+            c[e] = -(a[e] * x[p] + b[e] * y[p]);
+
+            minX = std::min(minX, x[p]);
+            maxX = std::max(maxX, x[p]);
+            minY = std::min(minY, y[p]);
+            maxY = std::max(maxY, y[p]);
+        }
+        const GLint x0(std::max(static_cast<GLint>(floor(minX)), 0));
+        const GLint y0(std::max(static_cast<GLint>(floor(minY)), 0));
+        const GLint x1(std::min(static_cast<GLint>(ceil(maxX)), width - 1));
+        const GLint y1(std::min(static_cast<GLint>(ceil(maxY)), height - 1));
+
+        // Evaluated at a pixel center, the edge functions moved in by half a pixel along both axes are
+        // their minimum over the pixel and the depths moved out are their maximum, each widened a little for
+        // rounding.
+        const GLfloat reach(0.5f + 1.0f / 1024.0f);
+        for(int e = 0; e < count; ++e)
+            c[e] -= reach * (std::fabs(a[e]) + std::fabs(b[e]));
+        GLfloat farthest[2][3];
+        for(int k = 0; k < planes; ++k) {
+            farthest[k][0] = plane[k][0];
+            farthest[k][1] = plane[k][1];
+            farthest[k][2] = plane[k][2] + reach * (std::fabs(plane[k][0]) + std::fabs(plane[k][1]));
+        }
+
+        for(GLint py = y0; py <= y1; ++py)
+            span(a, b, c, count, farthest, planes, x0, x1, py);
+        return true;
+    }
+
+    /// Clip one clip-space triangle against the view volume and fill what is left.
+    void rasterize(const GLfloat (*clip)[4])
+    {
+        // a triangle gives at most nine vertices
+        GLfloat polygon[2][9][4];
+        int count(3);
+        std::copy(&clip[0][0], &clip[0][0] + 12, &polygon[0][0][0]);
+
+        int current(0);
+        for(int plane = 0; plane < 6; ++plane) {
+            const GLfloat(*in)[4](polygon[current]);
+            GLfloat(*out)[4](polygon[current ^ 1]);
+            const int k(plane >> 1);
+            const GLfloat s(plane & 1 ? -1.0f : 1.0f);
+
+            bool inside(true);
+            for(int i = 0; i < count; ++i)
+                inside = inside && in[i][3] + s * in[i][k] >= 0.0f;
+            if(inside)
+                continue;
+
+            int n(0);
+            for(int i = 0; i < count; ++i) {
+                const GLfloat *const a(in[i]);
+                const GLfloat *const b(in[(i + 1) % count]);
+                const GLfloat da(a[3] + s * a[k]), db(b[3] + s * b[k]);
+
+                if(da >= 0.0f)
+                    std::copy(a, a + 4, out[n++]);
+                if((da >= 0.0f) != (db >= 0.0f)) {
+                    const GLfloat t(da / (da - db));
+                    for(int c = 0; c < 4; ++c)
+                        out[n][c] = a[c] + (b[c] - a[c]) * t;
+                    ++n;
+                }
+            }
+
+            count = n;
+            current ^= 1;
+            if(count < 3)
+                return;
+        }
+
+        GLfloat x[9], y[9], z[9];
+        for(int i = 0; i < count; ++i)
+            project(polygon[current][i], x[i], y[i], z[i]);
+
+        // the clipped triangle is filled whole, as splitting it would leave the pixels along the splits empty;
+        // its depth plane is taken from the largest piece of a fan, the best conditioned one
+        int widest(1);
+        GLfloat widestArea(0.0f);
+        for(int i = 1; i + 1 < count; ++i) {
+            const GLfloat area((x[i] - x[0]) * (y[i + 1] - y[0]) - (x[i + 1] - x[0]) * (y[i] - y[0]));
+            if(area > widestArea) {
+                widestArea = area;
+                widest = i;
+            }
+        }
+        if(widestArea <= 0.0f)
+            return;  // back face or degenerate
+
+        GLfloat plane[1][3];
+        depthPlane(x, y, z, 0, widest, widest + 1, plane[0]);
+        if(fill(x, y, count, plane, 1))
+            ++occluderTriangles;
+    }
+
+    /** @brief Fill two triangles sharing an edge as one quad, so that the
+     *  pixels along the shared edge are not left empty.
+     *  @param quad counter-clockwise, the first triangle being 0, 1, 2 and the second 2, 3, 0.
+     *  @return false, drawing nothing, where they must be rasterized one by one:
+     *  when the quad needs clipping or is not convex and front-facing.
+     */
+    bool rasterizeQuad(const GLfloat (*quad)[4])
+    {
+        for(int i = 0; i < 4; ++i) {
+            if(!inside(quad[i]))
+                return false;
+        }
+
+        GLfloat x[4], y[4], z[4];
+        for(int i = 0; i < 4; ++i)
+            project(quad[i], x[i], y[i], z[i]);
+
+        GLfloat plane[2][3];
+        depthPlane(x, y, z, 0, 1, 2, plane[0]);
+        depthPlane(x, y, z, 2, 3, 0, plane[1]);
+        if(!fill(x, y, 4, plane, 2))
+            return false;
+
+        occluderTriangles += 2;
+        return true;
+    }
+
+    /// Rasterize triangles first and first + 1 of a list as one quad if they share an edge; see rasterizeQuad().
+    bool rasterizePair(const GLuint *index, GLsizei first)
+    {
+        GLuint v[6];
+        for(GLsizei k = 0; k < 6; ++k)
+            v[k] = index != NULL ? index[first + k] : first + k;
+
+        for(int e = 0; e < 3; ++e) {
+            const GLuint p(v[e]), q(v[(e + 1) % 3]);
+            for(int k = 0; k < 3; ++k) {
+                if(v[3 + k] != q || v[3 + (k + 1) % 3] != p)
+                    continue;
+
+                // the first triangle from the shared edge's end, then the second one's far corner
+                const GLuint corner[4] = {q, v[(e + 2) % 3], p, v[3 + (k + 2) % 3]};
+                GLfloat quad[4][4];
+                for(int c = 0; c < 4; ++c)
+                    std::copy(&clip[corner[c] * 4], &clip[corner[c] * 4] + 4, quad[c]);
+                return rasterizeQuad(quad);
+            }
+        }
+        return false;
+    }
+
+    /// Write the farthest of the planes into the pixels of row y whose centers have every a x + b y + c >= 0.
+    void span(const GLfloat *a, const GLfloat *b, const GLfloat *c, int edges, const GLfloat (*plane)[3], int planes,
+              GLint x0, GLint x1, GLint y)
+    {
+        const GLfloat cy(y + 0.5f);
+        GLfloat *const depthRow(&depth[y * stride]);
+
+#if defined(OCCLUSION_CULLER_SSE)
+        const __m128 half(_mm_set1_ps(0.5f));
+        const __m128 zero(_mm_setzero_ps());
+        const GLint start(x0 & ~3);
+
+        // evaluated at every pixel rather than stepped, so rounding does not build up along the row
+        __m128 ak[9], row[9];
+        for(int k = 0; k < edges; ++k) {
+            ak[k] = _mm_set1_ps(a[k]);
+            row[k] = _mm_set1_ps(b[k] * cy + c[k]);
+        }
+        __m128 zx[2], zrow[2];
+        for(int k = 0; k < planes; ++k) {
+            zx[k] = _mm_set1_ps(plane[k][0]);
+            zrow[k] = _mm_set1_ps(plane[k][1] * cy + plane[k][2]);
+        }
+        const __m128i columns(_mm_set_epi32(3, 2, 1, 0));
+
+        for(GLint x = start; x <= x1; x += 4) {
+            const __m128i column(_mm_add_epi32(_mm_set1_epi32(x), columns));
+            const __m128 cx(_mm_add_ps(_mm_cvtepi32_ps(column), half));
+            __m128 mask(_mm_castsi128_ps(_mm_and_si128(_mm_cmpgt_epi32(column, _mm_set1_epi32(x0 - 1)),
+                                                       _mm_cmplt_epi32(column, _mm_set1_epi32(x1 + 1)))));
+            for(int k = 0; k < edges; ++k)
+                mask = _mm_and_ps(mask, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(ak[k], cx), row[k]), zero));
+            if(_mm_movemask_ps(mask) == 0)
+                continue;
+
+            __m128 z(_mm_add_ps(_mm_mul_ps(zx[0], cx), zrow[0]));
+            for(int k = 1; k < planes; ++k)
+                z = _mm_max_ps(z, _mm_add_ps(_mm_mul_ps(zx[k], cx), zrow[k]));
+            const __m128 stored(_mm_loadu_ps(depthRow + x));
+            mask = _mm_and_ps(mask, _mm_cmplt_ps(z, stored));
+            _mm_storeu_ps(depthRow + x, _mm_or_ps(_mm_and_ps(mask, z), _mm_andnot_ps(mask, stored)));
+        }
+#else
+        for(GLint x = x0; x <= x1; ++x) {
+            const GLfloat cx(x + 0.5f);
+            bool inside(true);
+            for(int k = 0; k < edges; ++k)
+                inside = inside && a[k] * cx + (b[k] * cy + c[k]) >= 0.0f;
+
+            GLfloat z(plane[0][0] * cx + (plane[0][1] * cy + plane[0][2]));
+            for(int k = 1; k < planes; ++k)
+                z = std::max(z, plane[k][0] * cx + (plane[k][1] * cy + plane[k][2]));
+            if(inside && z < depthRow[x])
+                depthRow[x] = z;
+        }
+#endif
+    }
+
+public:
+    /** @param width, height resolution of the depth buffer; low, e.g. 256 x 128.
+     */
+    OcclusionCuller(GLsizei width = 256, GLsizei height = 128)
+        : width(width), height(height), stride((width + blockSize - 1) / blockSize * blockSize),
+          blocksX(stride / blockSize), blocksY((height + blockSize - 1) / blockSize),
+          depth(stride * blocksY * blockSize), blockDepth(blocksX * blocksY), tested(0), culled(0),
+          occluderTriangles(0)
+    {
+    }
+
+    virtual ~OcclusionCuller()
+    {
+    }
+
+    /** @brief Clear the buffer for a new frame.
+     *  @param projection maps the view space of the occluders and the boxes to clip space.
+     */
+    void begin(const Matrix &projection)
+    {
+        this->projection = projection;
+        std::fill(depth.begin(), depth.end(), 1.0f);
+        tested = 0;
+        culled = 0;
+        occluderTriangles = 0;
+    }
+
+    /** @brief Rasterize a triangle mesh as seen through modelview.
+     *  @param index triangle list, or NULL to take the vertices in order.
+     */
+    void addOccluder(const Matrix &modelview, GLsizei vertexcount, const Object::Vertex *vertex, GLsizei indexcount,
+                     const GLuint *index)
+    {
+        const Matrix m(projection * modelview);
+        clip.resize(vertexcount * 4);
+        for(GLsizei i = 0; i < vertexcount; ++i) {
+            const GLfloat p[4] = {vertex[i].position[0], vertex[i].position[1], vertex[i].position[2], 1.0f};
+            m.transform(p, &clip[i * 4], 1);
+        }
+
+        const GLsizei count(index != NULL ? indexcount : vertexcount);
+        for(GLsizei i = 0; i + 2 < count;) {
+            if(i + 5 < count && rasterizePair(index, i)) {
+                i += 6;
+                continue;
+            }
+
+            GLfloat triangle[3][4];
+            for(int k = 0; k < 3; ++k) {
+                const GLuint v(index != NULL ? index[i + k] : i + k);
+                std::copy(&clip[v * 4], &clip[v * 4] + 4, triangle[k]);
+            }
+            rasterize(triangle);
+            i += 3;
+        }
+    }
+
+    /// Build the farthest depth of every block; call after the last occluder.
+    void end()
+    {
+        for(GLsizei by = 0; by < blocksY; ++by) {
+            for(GLsizei bx = 0; bx < blocksX; ++bx) {
+                GLfloat farthest(0.0f);
+                for(GLsizei y = by * blockSize; y < (by + 1) * blockSize; ++y) {
+                    const GLfloat *const row(&depth[y * stride + bx * blockSize]);
+                    farthest = std::max(farthest, *std::max_element(row, row + blockSize));
+                }
+                blockDepth[by * blocksX + bx] = farthest;
+            }
+        }
+    }
+
+    /** @brief Whether any part of a view-space box may be in front of the occluders.
+     */
+    bool isVisible(const Bounds &viewBounds) const
+    {
+        ++tested;
+
+        // screen rectangle and nearest window depth of the eight corners
+        GLfloat minX(FLT_MAX), minY(FLT_MAX), maxX(-FLT_MAX), maxY(-FLT_MAX), nearest(FLT_MAX);
+        for(int i = 0; i < 8; ++i) {
+            const GLfloat p[4] = {i & 1 ? viewBounds.max[0] : viewBounds.min[0],
+                                  i & 2 ? viewBounds.max[1] : viewBounds.min[1],
+                                  i & 4 ? viewBounds.max[2] : viewBounds.min[2], 1.0f};
+            GLfloat c[4];
+            projection.transform(p, c, 1);
+            if(c[3] <= 0.0f || c[2] < -c[3])
+                return true;  // reaches the near plane
+
+            const GLfloat w(1.0f / c[3]);
+            const GLfloat x((c[0] * w * 0.5f + 0.5f) * width);
+            const GLfloat y((c[1] * w * 0.5f + 0.5f) * height);
+            minX = std::min(minX, x);
+            maxX = std::max(maxX, x);
+            minY = std::min(minY, y);
+            maxY = std::max(maxY, y);
+            nearest = std::min(nearest, c[2] * w * 0.5f + 0.5f);
+        }
+
+        // every pixel the rectangle touches; clamped first, as a box just past the near plane projects far out
+        const GLfloat right(static_cast<GLfloat>(width)), top(static_cast<GLfloat>(height));
+        const GLint x0(static_cast<GLint>(floor(std::min(std::max(minX, 0.0f), right))));
+        const GLint x1(static_cast<GLint>(floor(std::min(std::max(maxX, -1.0f), right - 1.0f))));
+        const GLint y0(static_cast<GLint>(floor(std::min(std::max(minY, 0.0f), top))));
+        const GLint y1(static_cast<GLint>(floor(std::min(std::max(maxY, -1.0f), top - 1.0f))));
+        if(x0 > x1 || y0 > y1)
+            return true;  // off screen, so nothing to judge
+
+        for(GLint by = y0 / blockSize; by <= y1 / blockSize; ++by) {
+            for(GLint bx = x0 / blockSize; bx <= x1 / blockSize; ++bx) {
+                if(blockDepth[by * blocksX + bx] < nearest)
+                    continue;
+
+                const GLint ya(std::max(y0, by * blockSize)), yb(std::min(y1, by * blockSize + blockSize - 1));
+                const GLint xa(std::max(x0, bx * blockSize)), xb(std::min(x1, bx * blockSize + blockSize - 1));
+                for(GLint y = ya; y <= yb; ++y) {
+                    for(GLint x = xa; x <= xb; ++x) {
+                        if(depth[y * stride + x] >= nearest)
+                            return true;
+                    }
+                }
+            }
+        }
+
+        ++culled;
+        return false;
+    }
+
+    /// Boxes tested and culled since begin().
+    GLsizei getTestedCount() const
+    {
+        return tested;
+    }
+
+    GLsizei getCulledCount() const
+    {
+        return culled;
+    }
+
+    GLsizei getOccluderTriangleCount() const
+    {
+        return occluderTriangles;
+    }
+};
@@ -0,0 +1,101 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <utility>
+#include <vector>
+
+/** @brief Fixed-size objects carved out of large chunks, recycled through a free list.
+ *
+ *  Creating and destroying objects costs a pointer swap and never touches
+ *  the heap once enough chunks exist, and objects of one pool stay close
+ *  together in memory. Memory goes back to the heap only when the pool is
+ *  destroyed. Not thread safe.
+ */
+template <typename T> class PoolAllocator
+{
+    union Slot
+    {
+        Slot *next;
+        alignas(T) char storage[sizeof(T)];
+    };
+
+    std::vector<Slot *> chunks;
+    const std::size_t chunkSize;
+    Slot *freeList;
+
+    std::size_t live;
+    std::size_t peak;
+
+    PoolAllocator(const PoolAllocator &);
+    PoolAllocator &operator=(const PoolAllocator &);
+
+    void grow()
+    {
+        Slot *const chunk(static_cast<Slot *>(malloc(chunkSize * sizeof(Slot))));
+        if(chunk == NULL) {
+            std::cerr << "Can't allocate a pool chunk." << std::endl;
+            exit(1);
+        }
+        chunks.push_back(chunk);
+
+        for(std::size_t i = 0; i < chunkSize; ++i)
+            chunk[i].next = i + 1 < chunkSize ? &chunk[i + 1] : freeList;
+        freeList = chunk;
+    }
+
+public:
+    explicit PoolAllocator(std::size_t chunkSize = 1024) : chunkSize(chunkSize), freeList(NULL), live(0), peak(0)
+    {
+    }
+
+    /// Objects still alive are not destroyed, only their memory is freed.
+    virtual ~PoolAllocator()
+    {
+        for(std::size_t i = 0; i < chunks.size(); ++i)
+            free(chunks[i]);
+    }
+
+    template <typename... Args> T *create(Args &&...args)
+    {
+        if(freeList == NULL)
+            grow();
+
+        Slot *const s(freeList);
+        freeList = s->next;
+        ++live;
+        peak = std::max(peak, live);
+        return new(s->storage) T(std::forward<Args>(args)...);
+    }
+
+    void destroy(T *p)
+    {
+        if(p == NULL)
+            return;
+
+        p->~T();
+        Slot *const s(reinterpret_cast<Slot *>(p));
+        s->next = freeList;
+        freeList = s;
+        --live;
+    }
+
+    std::size_t getLiveCount() const
+    {
+        return live;
+    }
+
+    std::size_t getPeakCount() const
+    {
+        return peak;
+    }
+
+    /// Heap allocations made so far, one per chunk.
+    GLsizei getHeapAllocations() const
+    {
+        return static_cast<GLsizei>(chunks.size());
+    }
+};
@@ -0,0 +1,59 @@
+#pragma once
+#include <memory>
+
+#include "MeshPool.h"
+#include "Shape.h"
+
+/** @brief Shape whose geometry is a range in a shared MeshPool.
+ *  Shapes in the same pool share one VAO, so drawing them back to back
+ *  needs no vertex array rebind.
+ */
+class PooledShape : public Shape
+{
+    const std::shared_ptr<MeshPool> pool;
+
+    const MeshPool::Handle handle;
+
+    const GLenum mode;
+
+    PooledShape(const PooledShape &);
+    PooledShape &operator=(const PooledShape &);
+
+protected:
+    virtual void bind() const
+    {
+        pool->bind();
+    }
+
+public:
+    PooledShape(const std::shared_ptr<MeshPool> &pool, GLsizei vertexcount, const Object::Vertex *vertex,
+                GLsizei indexcount = 0, const GLuint *index = NULL, GLenum mode = GL_TRIANGLES)
+        : Shape(vertexcount, vertex), pool(pool), handle(pool->allocate(vertexcount, vertex, indexcount, index)), mode(mode)
+    {
+    }
+
+    virtual ~PooledShape()
+    {
+        pool->release(handle);
+    }
+
+    virtual void excute() const
+    {
+        pool->draw(handle, mode);
+    }
+
+    const MeshPool &getPool() const
+    {
+        return *pool;
+    }
+
+    MeshPool::Handle getHandle() const
+    {
+        return handle;
+    }
+
+    GLenum getMode() const
+    {
+        return mode;
+    }
+};
@@ -0,0 +1,418 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/** @brief CPU and GPU scope timers and frame counters, exported as a Chrome trace.
+ *
+ *  PROFILE_SCOPE("name") times the rest of the enclosing block on the
+ *  calling thread. Each thread records into its own ring, written only by
+ *  that thread and drained by endFrame() on the GL thread, so recording
+ *  takes no lock. PROFILE_GPU_SCOPE("name") brackets GL commands with
+ *  GL_TIMESTAMP queries that are read back `latency` frames later, only if
+ *  their results are available, so the GPU is never waited for. The
+ *  summary keeps GPU scopes apart from CPU scopes of the same name by
+ *  prefixing them with "gpu:". Names must be string literals (or otherwise
+ *  outlive the profiler).
+ *
+ *  The trace keeps the last maxEvents scopes and the counters of the last
+ *  maxFrames frames in rings allocated once, so a long session neither
+ *  grows without bound nor allocates once every scope name has been seen.
+ *
+ *  While disabled a scope costs one relaxed atomic load; defining
+ *  PROFILER_DISABLE removes the macros altogether. The trace can be opened
+ *  in chrome://tracing or Perfetto.
+ */
+class Profiler
+{
+public:
+    enum Counter
+    {
+        DRAW_CALLS,
+        TRIANGLES,
+        STATE_CHANGES,
+        UPLOAD_BYTES,
+        COUNTERS
+    };
+
+    static const GLuint latency = 4;
+    static const std::size_t maxEvents = 1 << 16;
+    static const std::size_t maxFrames = 1 << 12;
+
+private:
+    struct Event
+    {
+        const char *name;
+        std::int64_t start;  // microseconds since the profiler was created
+        std::int64_t duration;
+        GLuint thread;
+    };
+
+    /// Single producer (its thread), single consumer (endFrame).
+    struct Ring
+    {
+        static const std::size_t size = 4096;
+
+        Event events[size];
+        std::atomic<std::size_t> head;
+        std::atomic<std::size_t> tail;
+        GLuint thread;
+
+        Ring(GLuint thread) : head(0), tail(0), thread(thread)
+        {
+        }
+    };
+
+    struct GpuQuery
+    {
+        const char *name;
+        GLuint query[2];
+    };
+
+    struct Stat
+    {
+        double average;  // milliseconds per frame, exponentially smoothed
+        double frame;    // milliseconds in the current frame
+    };
+
+    std::atomic<bool> enabled;
+    const std::chrono::steady_clock::time_point origin;
+
+    std::mutex ringMutex;
+    std::vector<std::unique_ptr<Ring>> rings;
+    std::atomic<GLsizei> dropped;
+
+    std::vector<GpuQuery> gpuQueries[latency];
+    std::vector<GLuint> freeQueries;
+    std::int64_t gpuOffset;  // CPU minus GPU clock, microseconds
+    bool gpuSynced;
+    GLuint frame;
+
+    std::atomic<std::int64_t> counters[COUNTERS];
+    std::vector<std::int64_t> counterHistory;  // ring of COUNTERS values per frame
+    std::vector<std::int64_t> frameStart;      // ring of maxFrames
+    std::size_t frames;                        // written to the rings in total
+
+    std::vector<Event> events;  // ring of maxEvents
+    std::size_t eventCount;     // written to the ring in total
+    std::map<std::string, Stat> stats;
+
+    Profiler() : enabled(false), origin(std::chrono::steady_clock::now()), dropped(0), gpuOffset(0),
+                 gpuSynced(false), frame(0), frames(0), eventCount(0)
+    {
+        for(int c = 0; c < COUNTERS; c++)
+            counters[c] = 0;
+    }
+
+    Profiler(const Profiler &);
+    Profiler &operator=(const Profiler &);
+
+    Ring &ring()
+    {
+        static thread_local Ring *local(NULL);
+        if(local == NULL) {
+            std::lock_guard<std::mutex> lock(ringMutex);
+            rings.push_back(std::unique_ptr<Ring>(new Ring(static_cast<GLuint>(rings.size()))));
+            local = rings.back().get();
+        }
+        return *local;
+    }
+
+    /// Keep e for the trace and add it to its scope's time in this frame.
+    void add(const Event &e)
+    {
+        if(events.empty())
+            events.resize(maxEvents);
+        events[eventCount++ % maxEvents] = e;
+
+        if(e.thread != ~0u) {
+            stats[e.name].frame += e.duration * 1.0e-3;
+        } else {
+            // short names stay within std::string's own buffer
+            stats[std::string("gpu:") + e.name].frame += e.duration * 1.0e-3;
+        }
+    }
+
+    void drain()
+    {
+        std::lock_guard<std::mutex> lock(ringMutex);
+        for(std::size_t r = 0; r < rings.size(); ++r) {
+            Ring &ring(*rings[r]);
+            const std::size_t head(ring.head.load(std::memory_order_acquire));
+            std::size_t tail(ring.tail.load(std::memory_order_relaxed));
+            for(; tail != head; ++tail)
+                add(ring.events[tail % Ring::size]);
+            ring.tail.store(tail, std::memory_order_release);
+        }
+    }
+
+    /// Read the queries of one frame slot if the GPU is done with them.
+    bool collect(std::vector<GpuQuery> &slot)
+    {
+        for(std::size_t i = 0; i < slot.size(); ++i) {
+            GLint available(GL_FALSE);
+            glGetQueryObjectiv(slot[i].query[1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if(available == GL_FALSE)
+                return false;
+        }
+
+        for(std::size_t i = 0; i < slot.size(); ++i) {
+            GLuint64 t[2];
+            glGetQueryObjectui64v(slot[i].query[0], GL_QUERY_RESULT, &t[0]);
+            glGetQueryObjectui64v(slot[i].query[1], GL_QUERY_RESULT, &t[1]);
+
+            const Event e = {slot[i].name, static_cast<std::int64_t>(t[0] / 1000) + gpuOffset,
+                             static_cast<std::int64_t>((t[1] - t[0]) / 1000), ~0u};
+            add(e);
+
+            freeQueries.push_back(slot[i].query[0]);
+            freeQueries.push_back(slot[i].query[1]);
+        }
+        slot.clear();
+        return true;
+    }
+
+public:
+    static Profiler &get()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    virtual ~Profiler()
+    {
+        // the GL context is usually gone by now, so queries are left to it
+    }
+
+    bool isEnabled() const
+    {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    /** @brief Start recording. GPU scopes need a current context with GL 3.3
+     *  or ARB_timer_query; CPU scopes need no context at all.
+     */
+    void enable()
+    {
+        enabled = true;
+    }
+
+    void disable()
+    {
+        enabled = false;
+    }
+
+    /// Microseconds since the profiler was created.
+    std::int64_t now() const
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - origin)
+            .count();
+    }
+
+    void record(const char *name, std::int64_t start, std::int64_t end)
+    {
+        Ring &r(ring());
+        const std::size_t head(r.head.load(std::memory_order_relaxed));
+        if(head - r.tail.load(std::memory_order_acquire) >= Ring::size) {
+            ++dropped;
+            return;
+        }
+
+        const Event e = {name, start, end - start, r.thread};
+        r.events[head % Ring::size] = e;
+        r.head.store(head + 1, std::memory_order_release);
+    }
+
+    void count(Counter c, std::int64_t value = 1)
+    {
+        if(isEnabled())
+            counters[c].fetch_add(value, std::memory_order_relaxed);
+    }
+
+    /// @return index of the query pair to pass to gpuEnd().
+    GLuint gpuBegin(const char *name)
+    {
+        if(!gpuSynced) {
+            GLint64 gpu(0);
+            glGetInteger64v(GL_TIMESTAMP, &gpu);
+            gpuOffset = now() - gpu / 1000;
+            gpuSynced = true;
+        }
+
+        if(freeQueries.size() < 2) {
+            GLuint q[2];
+            glGenQueries(2, q);
+            freeQueries.insert(freeQueries.end(), q, q + 2);
+        }
+
+        GpuQuery g = {name, {0, 0}};
+        g.query[1] = freeQueries.back();
+        freeQueries.pop_back();
+        g.query[0] = freeQueries.back();
+        freeQueries.pop_back();
+
+        glQueryCounter(g.query[0], GL_TIMESTAMP);
+        std::vector<GpuQuery> &slot(gpuQueries[frame % latency]);
+        slot.push_back(g);
+        return static_cast<GLuint>(slot.size() - 1);
+    }
+
+    void gpuEnd(GLuint index)
+    {
+        glQueryCounter(gpuQueries[frame % latency][index].query[1], GL_TIMESTAMP);
+    }
+
+    /** @brief Call once per frame on the GL thread, after the frame's last scope.
+     */
+    void endFrame()
+    {
+        if(!isEnabled())
+            return;
+
+        if(frameStart.empty()) {
+            frameStart.resize(maxFrames);
+            counterHistory.resize(maxFrames * COUNTERS);
+        }
+        const std::size_t f(frames++ % maxFrames);
+        frameStart[f] = now();
+        drain();
+
+        // the slot about to be reused was issued `latency` frames ago
+        ++frame;
+        std::vector<GpuQuery> &slot(gpuQueries[frame % latency]);
+        if(!collect(slot)) {
+            // still not done: drop it rather than wait
+            for(std::size_t i = 0; i < slot.size(); ++i)
+                glDeleteQueries(2, slot[i].query);
+            slot.clear();
+        }
+
+        for(int c = 0; c < COUNTERS; c++)
+            counterHistory[f * COUNTERS + c] = counters[c].exchange(0, std::memory_order_relaxed);
+
+        for(std::map<std::string, Stat>::iterator s = stats.begin(); s != stats.end(); ++s) {
+            s->second.average += (s->second.frame - s->second.average) * 0.05;
+            s->second.frame = 0.0;
+        }
+    }
+
+    /** @brief One line per scope with its smoothed time per frame, plus the last frame's counters.
+     */
+    void writeSummary(std::ostream &out) const
+    {
+        for(std::map<std::string, Stat>::const_iterator s = stats.begin(); s != stats.end(); ++s)
+            out << s->first << ": " << s->second.average << " ms\n";
+
+        if(frames > 0) {
+            const std::int64_t *const c(&counterHistory[(frames - 1) % maxFrames * COUNTERS]);
+            out << "draw calls " << c[DRAW_CALLS] << ", triangles " << c[TRIANGLES] << ", state changes "
+                << c[STATE_CHANGES] << ", uploaded " << c[UPLOAD_BYTES] << " bytes\n";
+        }
+        if(dropped > 0)
+            out << dropped << " events dropped\n";
+    }
+
+    /** @brief Chrome trace-event JSON: one complete event per scope, GPU scopes on
+     *  their own track, and the counters sampled at every frame end.
+     */
+    void writeChromeTrace(std::ostream &out)
+    {
+        drain();
+
+        static const char *const counterName[COUNTERS] = {"draw calls", "triangles", "state changes",
+                                                          "upload bytes"};
+
+        // GPU scopes go on a track of their own after the CPU threads
+        const std::size_t gpuTrack(rings.size());
+
+        out << "{\"traceEvents\":[";
+        out << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << gpuTrack
+            << ",\"args\":{\"name\":\"GPU\"}}";
+        const char *const separator(",\n");
+        const std::size_t first(eventCount - std::min(eventCount, static_cast<std::size_t>(maxEvents)));
+        for(std::size_t i = first; i < eventCount; ++i) {
+            const Event &e(events[i % maxEvents]);
+            out << separator << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"ts\":" << e.start
+                << ",\"dur\":" << e.duration << ",\"pid\":0,\"tid\":"
+                << (e.thread == ~0u ? gpuTrack : e.thread) << "}";
+        }
+
+        for(std::size_t f = frames - std::min(frames, static_cast<std::size_t>(maxFrames)); f < frames; ++f) {
+            for(int c = 0; c < COUNTERS; c++) {
+                out << separator << "{\"name\":\"" << counterName[c] << "\",\"ph\":\"C\",\"ts\":"
+                    << frameStart[f % maxFrames] << ",\"pid\":0,\"args\":{\"value\":"
+                    << counterHistory[f % maxFrames * COUNTERS + c] << "}}";
+            }
+        }
+        out << "\n]}\n";
+    }
+};
+
+/** @brief Times its own lifetime on the calling thread.
+ */
+class ProfileScope
+{
+    const char *const name;
+    const std::int64_t start;
+
+    ProfileScope(const ProfileScope &);
+    ProfileScope &operator=(const ProfileScope &);
+
+public:
+    explicit ProfileScope(const char *name)
+        : name(Profiler::get().isEnabled() ? name : NULL), start(this->name != NULL ? Profiler::get().now() : 0)
+    {
+    }
+
+    ~ProfileScope()
+    {
+        if(name != NULL)
+            Profiler::get().record(name, start, Profiler::get().now());
+    }
+};
+
+/** @brief Times the GL commands issued during its lifetime. GL thread only.
+ */
+class GpuProfileScope
+{
+    const bool active;
+    GLuint index;
+
+    GpuProfileScope(const GpuProfileScope &);
+    GpuProfileScope &operator=(const GpuProfileScope &);
+
+public:
+    explicit GpuProfileScope(const char *name) : active(Profiler::get().isEnabled()), index(0)
+    {
+        if(active)
+            index = Profiler::get().gpuBegin(name);
+    }
+
+    ~GpuProfileScope()
+    {
+        if(active)
+            Profiler::get().gpuEnd(index);
+    }
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+
+#if defined(PROFILER_DISABLE)
+#define PROFILE_SCOPE(name)
+#define PROFILE_GPU_SCOPE(name)
+#define PROFILE_COUNT(counter, value)
+#else
+#define PROFILE_SCOPE(name) const ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_GPU_SCOPE(name) const GpuProfileScope PROFILE_CONCAT(gpuProfileScope, __LINE__)(name)
+#define PROFILE_COUNT(counter, value) Profiler::get().count(Profiler::counter, value)
+#endif
@@ -0,0 +1,572 @@
+#pragma once
+#include <GL/glew.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "AssetLoader.h"
+#include "RenderState.h"
+#include "UniformBlock.h"
+
+/** @brief Shader programs built from files, with a binary cache and hot reload.
+ *
+ *  load() keys each program by a hash of both sources, the defines and the
+ *  driver (vendor, renderer and version strings). If directory holds a
+ *  program binary for that key it is loaded with glProgramBinary; when the
+ *  driver rejects it (a driver update, say) the program is compiled from
+ *  source and the binary is written again. Binaries need GL 4.1 or
+ *  ARB_get_program_binary; without them every load compiles.
+ *
+ *  On Linux the shader directories are watched with inotify. poll() should
+ *  be called once per frame: it never blocks on the file system, and with
+ *  KHR/ARB_parallel_shader_compile a changed program is compiled by the
+ *  driver's threads over the following frames and swapped in only once it
+ *  links. A program that fails to compile leaves the old one in use.
+ *  Since a reload changes the program name, look it up with getProgram()
+ *  each frame and query uniform locations again when poll() returns true.
+ *
+ *  loadCompute() does the same for a compute shader (GL 4.3).
+ *
+ *  Given an AssetLoader, load() returns at once and the sources are read
+ *  on the loader's threads; getProgram() gives 0 until the program is
+ *  built in AssetLoader::update(), after which poll() returns true.
+ */
+class ProgramCache
+{
+public:
+    typedef std::size_t Handle;
+
+private:
+    struct Entry
+    {
+        std::string vert;  // or the compute shader
+        std::string frag;  // empty for a compute program
+        std::string defines;
+        GLuint program;
+        GLuint pending;       // program being rebuilt after a file change
+        std::uint64_t key;    // of the pending program while there is one
+        bool dirty;           // a file changed since the last rebuild started
+        unsigned generation;  // bumped by every file change, so a late load can tell it is stale
+    };
+
+    struct BinaryHeader
+    {
+        char magic[8];
+        GLenum format;
+        GLint length;
+    };
+
+    const std::string directory;
+    AssetLoader *const loader;
+    bool arrived;  // a program was built by the loader since the last poll()
+    const bool binary;
+    const bool parallel;
+    std::string driver;
+
+    std::vector<Entry> entries;
+
+    int notify;
+    std::map<int, std::string> watches;  // watch descriptor -> directory with trailing '/'
+
+    GLsizei hits;
+    GLsizei misses;
+
+    ProgramCache(const ProgramCache &);
+    ProgramCache &operator=(const ProgramCache &);
+
+    static GLboolean printShaderInfoLog(GLuint shader, const char *str)
+    {
+        GLint status;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+        if(status == GL_FALSE) {
+            std::cerr << "Compile error in " << str << std::endl;
+        }
+
+        GLsizei bufSize;
+        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &bufSize);
+        if(bufSize > 1) {
+            std::vector<GLchar> infoLog(bufSize);
+            GLsizei length;
+            glGetShaderInfoLog(shader, bufSize, &length, &infoLog[0]);
+            std::cerr << &infoLog[0] << std::endl;
+        }
+
+        return static_cast<GLboolean>(status);
+    }
+
+    static GLboolean printProgramInfoLog(GLuint program)
+    {
+        GLint status;
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        if(status == GL_FALSE)
+            std::cerr << "Link error." << std::endl;
+
+        GLsizei bufSize;
+        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &bufSize);
+        if(bufSize > 1) {
+            std::vector<GLchar> infoLog(bufSize);
+            GLsizei length;
+            glGetProgramInfoLog(program, bufSize, &length, &infoLog[0]);
+            std::cerr << &infoLog[0] << std::endl;
+        }
+
+        return static_cast<GLboolean>(status);
+    }
+
+    static bool readShaderSource(const char *name, std::string &buffer)
+    {
+        std::ifstream file(name, std::ios::binary);
+        if(file.fail()) {
+            std::cerr << "Can't open the file." << name << std::endl;
+            return false;
+        }
+
+        buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+        if(file.bad()) {
+            std::cerr << "Can't read the file." << name << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    /// Put the defines right after the #version line, which must stay first.
+    static std::string inject(const std::string &src, const std::string &defines)
+    {
+        if(defines.empty())
+            return src;
+
+        const std::size_t version(src.find("#version"));
+        const std::size_t end(version == std::string::npos ? 0 : src.find('\n', version));
+        const std::size_t at(end == std::string::npos ? src.size() : version == std::string::npos ? 0 : end + 1);
+        return src.substr(0, at) + defines + "\n" + src.substr(at);
+    }
+
+    /// FNV-1a, 64 bits.
+    static std::uint64_t hash(const std::string &s, std::uint64_t h = 1469598103934665603ull)
+    {
+        for(std::size_t i = 0; i < s.size(); ++i)
+            h = (h ^ static_cast<unsigned char>(s[i])) * 1099511628211ull;
+        return (h ^ 0xff) * 1099511628211ull;  // separator so "ab","c" != "a","bc"
+    }
+
+    std::string binaryName(std::uint64_t key) const
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.glprogram", static_cast<unsigned long long>(key));
+        return directory + "/" + name;
+    }
+
+    static std::string describe(const Entry &e)
+    {
+        return e.frag.empty() ? e.vert : e.vert + ", " + e.frag;
+    }
+
+    /** @brief Compile and link without waiting for the result; an empty fsrc makes vsrc a compute shader.
+     *  @param retrievable ask the driver to keep the binary for glGetProgramBinary.
+     */
+    static GLuint compile(const std::string &vsrc, const std::string &fsrc, bool retrievable)
+    {
+        const GLuint program(glCreateProgram());
+
+        const bool compute(fsrc.empty());
+        const GLenum type[] = {static_cast<GLenum>(compute ? GL_COMPUTE_SHADER : GL_VERTEX_SHADER),
+                               GL_FRAGMENT_SHADER};
+        const std::string *const src[] = {&vsrc, &fsrc};
+        for(int i = 0; i < (compute ? 1 : 2); i++) {
+            const GLuint obj(glCreateShader(type[i]));
+            const GLchar *const s(src[i]->c_str());
+            glShaderSource(obj, 1, &s, NULL);
+            glCompileShader(obj);
+            glAttachShader(program, obj);
+            glDeleteShader(obj);  // freed with the program
+        }
+
+        glBindAttribLocation(program, 0, "position");
+        glBindAttribLocation(program, 1, "normal");
+        glBindAttribLocation(program, 2, "instanceModelview");
+        glBindAttribLocation(program, 6, "instanceNormalMatrix");
+        glBindFragDataLocation(program, 0, "fragment");
+        glBindFragDataLocation(program, 1, "albedo");  // second and third G-buffer targets
+        glBindFragDataLocation(program, 2, "specular");
+        if(retrievable)
+            glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(program);
+
+        return program;
+    }
+
+    /// Block bindings are reset by linking and by glProgramBinary, so they are set after both.
+    static void bindBlocks(GLuint program)
+    {
+        const GLuint frame(glGetUniformBlockIndex(program, "Frame"));
+        if(frame != GL_INVALID_INDEX)
+            glUniformBlockBinding(program, frame, FrameBlock::binding);
+
+        const GLuint object(glGetUniformBlockIndex(program, "Object"));
+        if(object != GL_INVALID_INDEX)
+            glUniformBlockBinding(program, object, ObjectBlock::binding);
+    }
+
+    /// Wait for the link and report the logs. Returns false after deleting a broken program.
+    static bool finish(GLuint program, const std::string &name)
+    {
+        GLint count(0);
+        glGetProgramiv(program, GL_ATTACHED_SHADERS, &count);
+        std::vector<GLuint> shader(count);
+        if(count > 0)
+            glGetAttachedShaders(program, count, NULL, shader.data());
+
+        bool compiled(true);
+        for(std::size_t i = 0; i < shader.size(); ++i)
+            compiled = printShaderInfoLog(shader[i], name.c_str()) && compiled;
+
+        if(printProgramInfoLog(program) && compiled) {
+            for(std::size_t i = 0; i < shader.size(); ++i)
+                glDetachShader(program, shader[i]);
+            bindBlocks(program);
+            return true;
+        }
+
+        RenderState::get().forgetProgram(program);
+        glDeleteProgram(program);
+        return false;
+    }
+
+    GLuint loadBinary(std::uint64_t key)
+    {
+        if(!binary)
+            return 0;
+
+        const std::string name(binaryName(key));
+        std::ifstream file(name.c_str(), std::ios::binary);
+        if(file.fail())
+            return 0;
+
+        BinaryHeader h;
+        file.read(reinterpret_cast<char *>(&h), sizeof(h));
+        if(file.fail() || memcmp(h.magic, "GLPROG1", 8) != 0 || h.length <= 0)
+            return 0;
+
+        std::vector<char> data(h.length);
+        file.read(data.data(), h.length);
+        if(file.fail())
+            return 0;
+
+        const GLuint program(glCreateProgram());
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glProgramBinary(program, h.format, data.data(), h.length);
+
+        GLint status;
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        if(status == GL_FALSE) {
+            // the driver changed in a way its strings did not show
+            RenderState::get().forgetProgram(program);
+            glDeleteProgram(program);
+            std::remove(name.c_str());
+            return 0;
+        }
+
+        bindBlocks(program);
+        return program;
+    }
+
+    void saveBinary(std::uint64_t key, GLuint program) const
+    {
+        if(!binary)
+            return;
+
+        GLint length(0);
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if(length <= 0)
+            return;
+
+        BinaryHeader h;
+        memcpy(h.magic, "GLPROG1", 8);
+        std::vector<char> data(length);
+        glGetProgramBinary(program, length, &h.length, &h.format, data.data());
+
+        const std::string name(binaryName(key));
+        const std::string temporary(name + ".tmp");
+        std::ofstream file(temporary.c_str(), std::ios::binary);
+        if(file.fail()) {
+            std::cerr << "Can't open the file." << temporary << std::endl;
+            return;
+        }
+
+        file.write(reinterpret_cast<const char *>(&h), sizeof(h));
+        file.write(data.data(), h.length);
+        file.close();
+        if(file.fail() || std::rename(temporary.c_str(), name.c_str()) != 0) {
+            std::cerr << "Can't write the file." << name << std::endl;
+            std::remove(temporary.c_str());
+        }
+    }
+
+    /// Read both sources; the key covers what the driver would see. Safe on any thread.
+    static bool read(const Entry &e, const std::string &driver, std::string &vsrc, std::string &fsrc,
+                     std::uint64_t &key)
+    {
+        fsrc.clear();
+        if(!readShaderSource(e.vert.c_str(), vsrc) || (!e.frag.empty() && !readShaderSource(e.frag.c_str(), fsrc)))
+            return false;
+
+        vsrc = inject(vsrc, e.defines);
+        if(!e.frag.empty())
+            fsrc = inject(fsrc, e.defines);
+        key = hash(fsrc, hash(vsrc, hash(driver)));
+        return true;
+    }
+
+    bool read(const Entry &e, std::string &vsrc, std::string &fsrc, std::uint64_t &key) const
+    {
+        return read(e, driver, vsrc, fsrc, key);
+    }
+
+    /** @brief Load the cached binary or compile the sources, and swap the result in for e.program.
+     *  @return false if both failed, leaving e.program as it was.
+     */
+    bool build(Entry &e, std::uint64_t key, const std::string &vsrc, const std::string &fsrc)
+    {
+        GLuint program(loadBinary(key));
+        if(program != 0) {
+            ++hits;
+        } else {
+            ++misses;
+            program = compile(vsrc, fsrc, binary);
+            if(!finish(program, describe(e)))
+                return false;
+            saveBinary(key, program);
+        }
+
+        RenderState::get().forgetProgram(e.program);
+        glDeleteProgram(e.program);
+        e.program = program;
+        return true;
+    }
+
+    void watch(const std::string &file)
+    {
+#if defined(__linux__)
+        if(notify < 0 || file.empty())
+            return;
+
+        const std::size_t slash(file.rfind('/'));
+        const std::string dir(slash == std::string::npos ? std::string(".") : file.substr(0, slash));
+
+        // editors often save by renaming a new file over the old one
+        const int wd(inotify_add_watch(notify, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE));
+        if(wd >= 0)
+            watches[wd] = slash == std::string::npos ? std::string() : dir + "/";
+#endif
+    }
+
+    void markChanged(const std::string &file)
+    {
+        for(std::size_t i = 0; i < entries.size(); ++i) {
+            if(entries[i].vert == file || entries[i].frag == file) {
+                entries[i].dirty = true;
+                ++entries[i].generation;
+            }
+        }
+    }
+
+public:
+    /** @param directory where program binaries are kept; it must exist.
+     *  @param loader reads the sources of load() in the background, or NULL to read them in place.
+     */
+    explicit ProgramCache(const std::string &directory = ".", AssetLoader *loader = NULL)
+        : directory(directory), loader(loader), arrived(false), binary(GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary),
+          parallel(GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile), notify(-1), hits(0),
+          misses(0)
+    {
+        const GLenum strings[] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+        for(int i = 0; i < 3; i++) {
+            const GLubyte *const s(glGetString(strings[i]));
+            if(s != NULL)
+                driver += reinterpret_cast<const char *>(s);
+            driver += '\n';
+        }
+
+        // let the driver choose; the two extensions name the same call differently
+        if(GLEW_KHR_parallel_shader_compile)
+            glMaxShaderCompilerThreadsKHR(0xffffffffu);
+        else if(GLEW_ARB_parallel_shader_compile)
+            glMaxShaderCompilerThreadsARB(0xffffffffu);
+
+#if defined(__linux__)
+        notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+    }
+
+    virtual ~ProgramCache()
+    {
+#if defined(__linux__)
+        if(notify >= 0)
+            close(notify);
+#endif
+        for(std::size_t i = 0; i < entries.size(); ++i) {
+            RenderState::get().forgetProgram(entries[i].program);
+            glDeleteProgram(entries[i].program);
+            RenderState::get().forgetProgram(entries[i].pending);
+            glDeleteProgram(entries[i].pending);
+        }
+    }
+
+    /** @brief Build a program from a vertex and a fragment shader file.
+     *  @param defines lines such as "#define PACKED 1" inserted after #version.
+     *  @return a handle for getProgram(), whose program is 0 if building failed
+     *  or, with a loader, until the sources have arrived.
+     */
+    Handle load(const char *vert, const char *frag, const std::string &defines = std::string())
+    {
+        Entry e;
+        e.vert = vert;
+        e.frag = frag;
+        e.defines = defines;
+        e.program = e.pending = 0;
+        e.key = 0;
+        e.dirty = false;
+        e.generation = 0;
+
+        watch(e.vert);
+        watch(e.frag);
+
+        entries.push_back(e);
+        const Handle h(entries.size() - 1);
+
+        if(loader != NULL) {
+            struct Sources
+            {
+                std::string vsrc;
+                std::string fsrc;
+                std::uint64_t key;
+            };
+            const std::shared_ptr<Sources> sources(new Sources);
+            const std::string driver(this->driver);
+            const unsigned generation(e.generation);
+
+            loader->request(
+                [e, driver, sources]() -> GLsizeiptr {
+                    if(!read(e, driver, sources->vsrc, sources->fsrc, sources->key))
+                        return -1;
+                    return static_cast<GLsizeiptr>(sources->vsrc.size() + sources->fsrc.size());
+                },
+                [this, h, sources, generation] {
+                    // a file changed while this was read; poll() builds the newer sources instead
+                    if(entries[h].generation != generation)
+                        return;
+                    if(build(entries[h], sources->key, sources->vsrc, sources->fsrc))
+                        arrived = true;
+                });
+            return h;
+        }
+
+        std::string vsrc, fsrc;
+        std::uint64_t key;
+        if(read(e, vsrc, fsrc, key))
+            build(entries[h], key, vsrc, fsrc);
+        return h;
+    }
+
+    /** @brief Build a compute program from one file, like load().
+     */
+    Handle loadCompute(const char *comp, const std::string &defines = std::string())
+    {
+        return load(comp, "", defines);
+    }
+
+    GLuint getProgram(Handle h) const
+    {
+        return entries[h].program;
+    }
+
+    /** @brief Pick up changed files and swap in programs that finished building.
+     *  @return true if any program name changed this call.
+     */
+    bool poll()
+    {
+#if defined(__linux__)
+        if(notify >= 0) {
+            char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+            ssize_t length;
+            while((length = ::read(notify, buffer, sizeof(buffer))) > 0) {
+                for(char *p = buffer; p < buffer + length;) {
+                    const struct inotify_event *const event(reinterpret_cast<const struct inotify_event *>(p));
+                    if(event->len > 0 && watches.count(event->wd) > 0)
+                        markChanged(watches[event->wd] + event->name);
+                    p += sizeof(struct inotify_event) + event->len;
+                }
+            }
+        }
+#endif
+
+        bool changed(arrived);
+        arrived = false;
+
+        for(std::size_t i = 0; i < entries.size(); ++i) {
+            Entry &e(entries[i]);
+
+            if(e.pending != 0) {
+                GLint done(GL_TRUE);
+                if(parallel)
+                    glGetProgramiv(e.pending, GL_COMPLETION_STATUS_KHR, &done);
+                if(done == GL_FALSE)
+                    continue;
+
+                if(finish(e.pending, describe(e))) {
+                    saveBinary(e.key, e.pending);
+                    RenderState::get().forgetProgram(e.program);
+                    glDeleteProgram(e.program);
+                    e.program = e.pending;
+                    changed = true;
+                }
+                e.pending = 0;
+            }
+
+            if(e.dirty) {
+                e.dirty = false;
+
+                std::string vsrc, fsrc;
+                if(!read(e, vsrc, fsrc, e.key))
+                    continue;
+
+                // an edit that was undone may already have a binary
+                const GLuint cached(loadBinary(e.key));
+                if(cached != 0) {
+                    RenderState::get().forgetProgram(e.program);
+                    glDeleteProgram(e.program);
+                    e.program = cached;
+                    changed = true;
+                } else {
+                    e.pending = compile(vsrc, fsrc, binary);
+                }
+            }
+        }
+
+        return changed;
+    }
+
+    /// Programs loaded from a binary and programs compiled from source by load().
+    GLsizei getHitCount() const
+    {
+        return hits;
+    }
+
+    GLsizei getMissCount() const
+    {
+        return misses;
+    }
+};
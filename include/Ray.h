@@ -0,0 +1,71 @@
+#pragma once
+#include <GL/glew.h>
+#include <cfloat>
+
+#include "Matrix.h"
+
+/** @brief The points origin + t * direction, for picking.
+ */
+struct Ray
+{
+    GLfloat origin[3];
+    GLfloat direction[3];
+
+    /** @brief The ray under a point in normalized device coordinates, such as
+     *  Window::getLocation(), running from the near plane at t = 0 to the far
+     *  plane at t = 1.
+     *  @param inverse of projection * view for a world-space ray, of the
+     *  projection alone for an eye-space one.
+     */
+    static Ray unproject(const Matrix &inverse, GLfloat x, GLfloat y)
+    {
+        const GLfloat ndc[8] = {x, y, -1.0f, 1.0f, x, y, 1.0f, 1.0f};
+        GLfloat p[8];
+        inverse.transform(ndc, p, 2);
+
+        Ray r;
+        for(int k = 0; k < 3; k++) {
+            r.origin[k] = p[k] / p[3];
+            r.direction[k] = p[4 + k] / p[7] - r.origin[k];
+        }
+        return r;
+    }
+
+    /** @brief The same ray after an affine transform, usually an inverse
+     *  model matrix; a point keeps its t.
+     */
+    Ray transform(const Matrix &m) const
+    {
+        Ray r;
+        for(int k = 0; k < 3; k++) {
+            r.origin[k] = m[k] * origin[0] + m[4 + k] * origin[1] + m[8 + k] * origin[2] + m[12 + k];
+            r.direction[k] = m[k] * direction[0] + m[4 + k] * direction[1] + m[8 + k] * direction[2];
+        }
+        return r;
+    }
+};
+
+/** @brief Nearest hit found so far along a ray; queries only ever shorten t.
+ */
+struct RayHit
+{
+    static const GLuint NONE = ~0u;
+
+    GLfloat t;
+    GLuint instance;  // RayCaster instance
+    GLuint triangle;  // in the mesh, as in its index array / 3
+    GLfloat u, v;     // barycentric coordinates of the hit: v0 + u * (v1 - v0) + v * (v2 - v0)
+
+    /** @param tMax the farthest hit wanted, 1 for the far plane of Ray::unproject().
+     */
+    static RayHit miss(GLfloat tMax = FLT_MAX)
+    {
+        const RayHit h = {tMax, NONE, NONE, 0.0f, 0.0f};
+        return h;
+    }
+
+    bool isHit() const
+    {
+        return triangle != NONE;
+    }
+};
@@ -0,0 +1,182 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "Bounds.h"
+#include "Bvh.h"
+#include "Matrix.h"
+#include "Ray.h"
+#include "TriangleBvh.h"
+
+/** @brief Ray casts and box queries against placed copies of meshes, for picking.
+ *
+ *  Each instance is a TriangleBvh, shared between copies, with a model
+ *  matrix. The instances' world boxes are kept in a Bvh: setTransform()
+ *  changes one and update() refits only the branches above the changed
+ *  ones, so objects may move every frame; add() rebuilds the tree at the
+ *  next update(). A ray gathers the instances whose boxes it crosses,
+ *  visits them nearest box first and is carried into each one's model
+ *  space, where its t stays the same since model matrices are affine.
+ */
+class RayCaster
+{
+    struct Instance
+    {
+        std::shared_ptr<const TriangleBvh> mesh;
+        Matrix model;
+        Matrix inverse;
+    };
+
+    std::vector<Instance> instances;
+    std::vector<Bounds> bounds;  // world boxes
+    Bvh bvh;
+    bool rebuild;
+
+    RayCaster(const RayCaster &);
+    RayCaster &operator=(const RayCaster &);
+
+    /// The instances the ray may hit before tMax, nearest box first.
+    void gather(const Ray &ray, GLfloat tMax, std::vector<GLuint> &candidate,
+                std::vector<std::pair<GLfloat, GLuint>> &order) const
+    {
+        candidate.clear();
+        bvh.raycast(ray.origin, ray.direction, tMax, candidate);
+
+        const GLfloat inverse[3] = {1.0f / ray.direction[0], 1.0f / ray.direction[1], 1.0f / ray.direction[2]};
+        order.clear();
+        for(GLuint i : candidate) {
+            GLfloat t;
+            if(bounds[i].intersect(ray.origin, inverse, tMax, t))
+                order.push_back(std::make_pair(t, i));
+        }
+        std::sort(order.begin(), order.end());
+    }
+
+public:
+    RayCaster() : rebuild(false)
+    {
+    }
+
+    /** @return the instance number reported in RayHit::instance.
+     */
+    GLuint add(const std::shared_ptr<const TriangleBvh> &mesh, const Matrix &model)
+    {
+        const Instance i = {mesh, model, model.inverse()};
+        instances.push_back(i);
+        bounds.push_back(mesh->getBounds().transform(model));
+        rebuild = true;
+        return static_cast<GLuint>(instances.size() - 1);
+    }
+
+    /** @brief Move an instance; queries see it after the next update().
+     */
+    void setTransform(GLuint i, const Matrix &model)
+    {
+        instances[i].model = model;
+        instances[i].inverse = model.inverse();
+        bounds[i] = instances[i].mesh->getBounds().transform(model);
+        if(!rebuild)
+            bvh.update(i, bounds[i]);
+    }
+
+    void update()
+    {
+        if(rebuild)
+            bvh.build(bounds);
+        else
+            bvh.refit();
+        rebuild = false;
+    }
+
+    /** @brief Shorten hit to the nearest triangle the ray meets before hit.t.
+     *  @return whether anything closer was hit.
+     */
+    bool intersect(const Ray &ray, RayHit &hit) const
+    {
+        std::vector<GLuint> candidate;
+        std::vector<std::pair<GLfloat, GLuint>> order;
+        gather(ray, hit.t, candidate, order);
+
+        bool found(false);
+        for(const std::pair<GLfloat, GLuint> &o : order) {
+            if(o.first > hit.t)
+                break;
+
+            const Instance &i(instances[o.second]);
+            if(i.mesh->intersect(ray.transform(i.inverse), hit)) {
+                hit.instance = o.second;
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    /** @brief intersect() for count rays. Four at a time go through each
+     *  instance any of them reaches together, which suits neighbouring rays.
+     */
+    void intersect(std::size_t count, const Ray *ray, RayHit *hit) const
+    {
+        std::vector<GLuint> candidate, visit;
+        std::vector<std::pair<GLfloat, GLuint>> order;
+
+        for(std::size_t first = 0; first < count; first += 4) {
+            const std::size_t n(std::min(count - first, static_cast<std::size_t>(4)));
+
+            visit.clear();
+            for(std::size_t r = first; r < first + n; ++r) {
+                gather(ray[r], hit[r].t, candidate, order);
+                for(const std::pair<GLfloat, GLuint> &o : order)
+                    visit.push_back(o.second);
+            }
+            std::sort(visit.begin(), visit.end());
+            visit.erase(std::unique(visit.begin(), visit.end()), visit.end());
+
+            for(GLuint v : visit) {
+                const Instance &i(instances[v]);
+                Ray local[4];
+                GLuint triangle[4];
+                GLfloat t[4];
+                for(std::size_t r = 0; r < n; ++r) {
+                    local[r] = ray[first + r].transform(i.inverse);
+                    triangle[r] = hit[first + r].triangle;
+                    t[r] = hit[first + r].t;
+                }
+
+                i.mesh->intersect(n, local, hit + first);
+                for(std::size_t r = 0; r < n; ++r) {
+                    if(hit[first + r].t != t[r] || hit[first + r].triangle != triangle[r])
+                        hit[first + r].instance = v;
+                }
+            }
+        }
+    }
+
+    /** @brief Append the instances whose world boxes overlap the given one, for proximity queries.
+     */
+    void query(const Bounds &box, std::vector<GLuint> &found) const
+    {
+        bvh.query(box, found);
+    }
+
+    const Bounds &getBounds(GLuint i) const
+    {
+        return bounds[i];
+    }
+
+    GLsizei getInstanceCount() const
+    {
+        return static_cast<GLsizei>(instances.size());
+    }
+
+    /// Triangles over all instances.
+    GLsizei getTriangleCount() const
+    {
+        GLsizei count(0);
+        for(const Instance &i : instances)
+            count += i.mesh->getTriangleCount();
+        return count;
+    }
+};
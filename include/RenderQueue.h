@@ -0,0 +1,292 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include "Instance.h"
+#include "Matrix.h"
+#include "PooledShape.h"
+#include "Profiler.h"
+#include "RenderState.h"
+
+/** @brief Collects a frame's draws and submits them in as few calls as possible.
+ *
+ *  Submissions are sorted by program, mesh pool, material, primitive mode
+ *  and mesh, keeping the order they came in otherwise, so draws submitted
+ *  front to back stay that way. Every run sharing the first four is issued
+ *  as one glMultiDrawElementsIndirect call; the per-draw transform reaches
+ *  instanced.vert through an instance buffer indexed by each command's
+ *  baseInstance. The queue reads the pools through a vertex array of its
+ *  own, so the instance attributes never appear in the pools' arrays that
+ *  other draws use. Contexts without indirect draws or base instance
+ *  (GL < 4.3) issue one glDrawElementsInstancedBaseVertex per run of the
+ *  same mesh instead, pointing the instance attributes at the run's first
+ *  transform. glMultiDrawElementsBaseVertex would merge different meshes
+ *  too, but gives a draw no way to find its own transform there.
+ *  Only indexed meshes can be queued.
+ */
+class RenderQueue
+{
+public:
+    struct DrawElementsIndirectCommand
+    {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+
+    /// Called when the material changes inside a program, with that program in use.
+    typedef std::function<void(GLuint program, GLuint material)> MaterialFunc;
+
+private:
+    struct Item
+    {
+        GLuint program;
+        const MeshPool *pool;
+        MeshPool::Handle mesh;
+        GLenum mode;
+        GLuint material;
+
+        bool sameBatch(const Item &b) const
+        {
+            return program == b.program && pool == b.pool && material == b.material && mode == b.mode;
+        }
+
+        bool operator<(const Item &b) const
+        {
+            if(program != b.program)
+                return program < b.program;
+            if(pool != b.pool)
+                return pool < b.pool;
+            if(material != b.material)
+                return material < b.material;
+            if(mode != b.mode)
+                return mode < b.mode;
+            return mesh < b.mesh;
+        }
+    };
+
+    struct Order
+    {
+        const std::vector<Item> &items;
+
+        bool operator()(GLuint a, GLuint b) const
+        {
+            if(items[a] < items[b])
+                return true;
+            return !(items[b] < items[a]) && a < b;
+        }
+    };
+
+    const bool indirect;
+
+    GLuint vertexArray;  // a pool's vertices plus the instance attributes
+
+    GLuint instanceBuffer;
+    GLuint indirectBuffer;
+    GLsizeiptr instanceCapacity;  // bytes allocated in each
+    GLsizeiptr indirectCapacity;
+
+    std::vector<Item> items;
+    std::vector<Instance> instances;
+
+    std::vector<GLuint> order;
+    std::vector<Instance> sorted;
+    std::vector<DrawElementsIndirectCommand> commands;
+
+    MaterialFunc material;
+
+    GLsizei drawCalls;
+
+    RenderQueue(const RenderQueue &);
+    RenderQueue &operator=(const RenderQueue &);
+
+    /** @brief Replace the contents of a buffer, reallocating it only when it
+     *  is too small. The old contents are invalidated, so the driver hands
+     *  out fresh storage instead of waiting for draws still reading them.
+     */
+    static void upload(GLenum target, GLuint buffer, GLsizeiptr &capacity, GLsizeiptr size, const GLvoid *data)
+    {
+        RenderState::get().bindBuffer(target, buffer);
+        if(size > capacity) {
+            capacity = std::max(size, capacity * 2);
+            glBufferData(target, capacity, NULL, GL_STREAM_DRAW);
+        }
+
+        void *const map(glMapBufferRange(target, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+        if(map != NULL) {
+            memcpy(map, data, size);
+            glUnmapBuffer(target);
+        } else {
+            glBufferSubData(target, 0, size, data);
+        }
+        PROFILE_COUNT(UPLOAD_BYTES, size);
+    }
+
+    void flushIndirect()
+    {
+        commands.resize(order.size());
+        for(std::size_t i = 0; i < order.size(); ++i) {
+            const Item &item(items[order[i]]);
+            const MeshPool::Range &r(item.pool->getRange(item.mesh));
+            const DrawElementsIndirectCommand command = {static_cast<GLuint>(r.indexcount), 1,
+                                                         static_cast<GLuint>(r.firstIndex), r.baseVertex,
+                                                         static_cast<GLuint>(i)};
+            commands[i] = command;
+        }
+
+        upload(GL_DRAW_INDIRECT_BUFFER, indirectBuffer, indirectCapacity,
+               commands.size() * sizeof(DrawElementsIndirectCommand), commands.data());
+
+        for(std::size_t first = 0; first < order.size();) {
+            const Item &item(items[order[first]]);
+
+            std::size_t last(first + 1);
+            while(last < order.size() && items[order[last]].sameBatch(item))
+                ++last;
+
+            if(first == 0 || item.program != items[order[first - 1]].program)
+                RenderState::get().useProgram(item.program);
+
+            if(first == 0 || item.pool != items[order[first - 1]].pool)
+                item.pool->attach(vertexArray);
+
+            if(material && (first == 0 || !items[order[first - 1]].sameBatch(item)))
+                material(item.program, item.material);
+
+            glMultiDrawElementsIndirect(item.mode, GL_UNSIGNED_INT,
+                                        static_cast<DrawElementsIndirectCommand *>(0) + first,
+                                        static_cast<GLsizei>(last - first), 0);
+            ++drawCalls;
+            PROFILE_COUNT(DRAW_CALLS, 1);
+
+            first = last;
+        }
+    }
+
+    void flushInstanced()
+    {
+        for(std::size_t first = 0; first < order.size();) {
+            const Item &item(items[order[first]]);
+
+            std::size_t last(first + 1);
+            while(last < order.size() && items[order[last]].sameBatch(item) && items[order[last]].mesh == item.mesh)
+                ++last;
+
+            const Item *const previous(first > 0 ? &items[order[first - 1]] : NULL);
+            if(previous == NULL || item.program != previous->program)
+                RenderState::get().useProgram(item.program);
+
+            if(previous == NULL || item.pool != previous->pool)
+                item.pool->attach(vertexArray);
+            else
+                RenderState::get().bindVertexArray(vertexArray);
+
+            if(material && (previous == NULL || !item.sameBatch(*previous)))
+                material(item.program, item.material);
+
+            Instance::setup(instanceBuffer, static_cast<GLsizei>(first));
+            const MeshPool::Range &r(item.pool->getRange(item.mesh));
+            glDrawElementsInstancedBaseVertex(item.mode, r.indexcount, GL_UNSIGNED_INT,
+                                              static_cast<GLuint *>(0) + r.firstIndex,
+                                              static_cast<GLsizei>(last - first), r.baseVertex);
+            ++drawCalls;
+            PROFILE_COUNT(DRAW_CALLS, 1);
+
+            first = last;
+        }
+    }
+
+public:
+    RenderQueue()
+        : indirect(GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance)),
+          instanceCapacity(0), indirectCapacity(0), drawCalls(0)
+    {
+        glGenBuffers(1, &instanceBuffer);
+        glGenBuffers(1, &indirectBuffer);
+
+        glGenVertexArrays(1, &vertexArray);
+        RenderState::get().bindVertexArray(vertexArray);
+        Instance::setup(instanceBuffer);
+        RenderState::get().bindVertexArray(0);
+    }
+
+    virtual ~RenderQueue()
+    {
+        RenderState::get().forgetVertexArray(vertexArray);
+        glDeleteVertexArrays(1, &vertexArray);
+        RenderState::get().forgetBuffer(indirectBuffer);
+        glDeleteBuffers(1, &indirectBuffer);
+        RenderState::get().forgetBuffer(instanceBuffer);
+        glDeleteBuffers(1, &instanceBuffer);
+    }
+
+    void setMaterialCallback(const MaterialFunc &func)
+    {
+        material = func;
+    }
+
+    /** @param shape an indexed shape from a MeshPool.
+     *  @param modelview transform of this draw; its normal matrix is derived here.
+     *  @param material key handed to the material callback; draws are grouped by it.
+     */
+    void submit(GLuint program, const PooledShape &shape, const Matrix &modelview, GLuint material = 0)
+    {
+        Instance instance;
+        instance.set(modelview);
+        submit(program, shape, instance, material);
+    }
+
+    /** @brief submit() with the modelview and normal matrix already worked out.
+     */
+    void submit(GLuint program, const PooledShape &shape, const Instance &instance, GLuint material = 0)
+    {
+        const Item item = {program, &shape.getPool(), shape.getHandle(), shape.getMode(), material};
+        items.push_back(item);
+        instances.push_back(instance);
+    }
+
+    /** @brief Draw everything submitted since the last flush and empty the queue.
+     */
+    void flush()
+    {
+        drawCalls = 0;
+        if(items.empty())
+            return;
+
+        order.resize(items.size());
+        for(std::size_t i = 0; i < order.size(); ++i)
+            order[i] = static_cast<GLuint>(i);
+
+        const Order less = {items};
+        std::sort(order.begin(), order.end(), less);
+
+        sorted.resize(order.size());
+        for(std::size_t i = 0; i < order.size(); ++i)
+            sorted[i] = instances[order[i]];
+        upload(GL_ARRAY_BUFFER, instanceBuffer, instanceCapacity, sorted.size() * sizeof(Instance), sorted.data());
+
+        if(indirect)
+            flushIndirect();
+        else
+            flushInstanced();
+
+        items.clear();
+        instances.clear();
+    }
+
+    bool isIndirect() const
+    {
+        return indirect;
+    }
+
+    /// Draw calls issued by the last flush.
+    GLsizei getDrawCalls() const
+    {
+        return drawCalls;
+    }
+};
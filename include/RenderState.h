@@ -0,0 +1,671 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <iostream>
+
+#include "Profiler.h"
+
+/** @brief Shadow copy of the GL state the renderer changes, to skip calls that would change nothing.
+ *
+ *  Tracks the program, vertex array, buffer bindings (generic, indexed
+ *  uniform and indexed shader storage), texture bindings per unit, framebuffers, depth, cull and blend
+ *  state and the viewport. A call setting the value already in the shadow
+ *  returns without reaching the driver and is counted as skipped; the
+ *  others are counted as issued and as Profiler STATE_CHANGES.
+ *
+ *  Every change of tracked state must go through this class, and objects
+ *  must be forgotten before they are deleted, since GL may reuse the name.
+ *  Anything else that touches the state must be followed by invalidate().
+ *  The element array binding belongs to the vertex array, so it becomes
+ *  unknown whenever another vertex array is bound.
+ *
+ *  In debug mode every skipped call is checked against glGet*, and
+ *  validate() compares the whole shadow with the context; a mismatch is
+ *  reported and the shadow takes the actual value. Single context, GL
+ *  thread only.
+ */
+class RenderState
+{
+public:
+    static const GLuint UNKNOWN = ~0u;
+    static const GLuint textureUnits = 16;
+    static const GLuint uniformBindings = 16;
+    static const GLuint storageBindings = 16;
+
+private:
+    enum BufferTarget
+    {
+        ARRAY_BUFFER,
+        ELEMENT_ARRAY_BUFFER,
+        UNIFORM_BUFFER,
+        DRAW_INDIRECT_BUFFER,
+        COPY_READ_BUFFER,
+        COPY_WRITE_BUFFER,
+        BUFFER_TARGETS
+    };
+
+    enum TextureTarget
+    {
+        TEXTURE_2D,
+        TEXTURE_2D_ARRAY,
+        TEXTURE_3D,
+        TEXTURE_CUBE_MAP,
+        TEXTURE_BUFFER,
+        TEXTURE_TARGETS
+    };
+
+    enum Capability
+    {
+        DEPTH_TEST,
+        CULL_FACE,
+        BLEND,
+        SCISSOR_TEST,
+        CAPABILITIES
+    };
+
+    struct Range
+    {
+        GLuint buffer;
+        GLintptr offset;
+        GLsizeiptr size;
+    };
+
+    GLuint program;
+    GLuint vertexArray;
+    GLuint buffer[BUFFER_TARGETS];
+    Range uniform[uniformBindings];  // size 0: the whole buffer, from bindBufferBase()
+    GLuint storage[storageBindings];
+    GLuint activeUnit;
+    GLuint texture[textureUnits][TEXTURE_TARGETS];
+    GLuint drawFramebuffer;
+    GLuint readFramebuffer;
+
+    GLuint enabled[CAPABILITIES];  // 0, 1 or UNKNOWN
+    GLuint depthFunction;
+    GLuint depthWrite;
+    GLuint cullMode;
+    GLuint frontFaceMode;
+    GLuint blendSource;
+    GLuint blendDestination;
+    GLint viewportBox[4];
+    bool viewportKnown;
+
+    bool debug;
+    GLsizei issued;
+    GLsizei skipped;
+    GLsizei mismatches;
+
+    RenderState() : debug(false), issued(0), skipped(0), mismatches(0)
+    {
+        invalidate();
+    }
+
+    RenderState(const RenderState &);
+    RenderState &operator=(const RenderState &);
+
+    static GLenum bufferTarget(BufferTarget t)
+    {
+        static const GLenum targets[BUFFER_TARGETS] = {GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER,
+                                                       GL_UNIFORM_BUFFER, GL_DRAW_INDIRECT_BUFFER,
+                                                       GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER};
+        return targets[t];
+    }
+
+    static GLenum bufferBinding(BufferTarget t)
+    {
+        static const GLenum bindings[BUFFER_TARGETS] = {
+            GL_ARRAY_BUFFER_BINDING,         GL_ELEMENT_ARRAY_BUFFER_BINDING, GL_UNIFORM_BUFFER_BINDING,
+            GL_DRAW_INDIRECT_BUFFER_BINDING, GL_COPY_READ_BUFFER_BINDING,     GL_COPY_WRITE_BUFFER_BINDING};
+        return bindings[t];
+    }
+
+    /// The indirect target needs GL 4.0; on a 3.3 context even querying its binding is an error.
+    static bool supported(BufferTarget t)
+    {
+        return t != DRAW_INDIRECT_BUFFER || GLEW_VERSION_4_0 || GLEW_ARB_draw_indirect;
+    }
+
+    /// The shadow slot of target, or -1 when it isn't tracked and calls go straight to GL.
+    static GLint bufferIndex(GLenum target)
+    {
+        for(GLint t = 0; t < BUFFER_TARGETS; ++t) {
+            if(bufferTarget(static_cast<BufferTarget>(t)) == target)
+                return supported(static_cast<BufferTarget>(t)) ? t : -1;
+        }
+        return -1;
+    }
+
+    static GLenum textureTarget(TextureTarget t)
+    {
+        static const GLenum targets[TEXTURE_TARGETS] = {GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_3D,
+                                                        GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BUFFER};
+        return targets[t];
+    }
+
+    static GLenum textureBinding(TextureTarget t)
+    {
+        static const GLenum bindings[TEXTURE_TARGETS] = {GL_TEXTURE_BINDING_2D, GL_TEXTURE_BINDING_2D_ARRAY,
+                                                         GL_TEXTURE_BINDING_3D, GL_TEXTURE_BINDING_CUBE_MAP,
+                                                         GL_TEXTURE_BINDING_BUFFER};
+        return bindings[t];
+    }
+
+    static GLint textureIndex(GLenum target)
+    {
+        for(GLint t = 0; t < TEXTURE_TARGETS; ++t) {
+            if(textureTarget(static_cast<TextureTarget>(t)) == target)
+                return t;
+        }
+        return -1;
+    }
+
+    static GLenum capability(Capability c)
+    {
+        static const GLenum caps[CAPABILITIES] = {GL_DEPTH_TEST, GL_CULL_FACE, GL_BLEND, GL_SCISSOR_TEST};
+        return caps[c];
+    }
+
+    static GLint capabilityIndex(GLenum cap)
+    {
+        for(GLint c = 0; c < CAPABILITIES; ++c) {
+            if(capability(static_cast<Capability>(c)) == cap)
+                return c;
+        }
+        return -1;
+    }
+
+    static GLuint query(GLenum name)
+    {
+        GLint value(0);
+        glGetIntegerv(name, &value);
+        return static_cast<GLuint>(value);
+    }
+
+    /// Compare a shadow value with the context and adopt the context's on mismatch.
+    void check(const char *name, GLuint &shadow, GLuint actual)
+    {
+        if(shadow == UNKNOWN || shadow == actual)
+            return;
+
+        std::cerr << "Render state out of sync: " << name << " is " << actual << ", cached " << shadow << std::endl;
+        shadow = actual;
+        ++mismatches;
+    }
+
+    /// @return true if value is already set, i.e. the call can be skipped.
+    bool cached(GLuint &shadow, GLuint value)
+    {
+        if(shadow == value) {
+            ++skipped;
+            return true;
+        }
+        shadow = value;
+        ++issued;
+        PROFILE_COUNT(STATE_CHANGES, 1);
+        return false;
+    }
+
+    void activeTexture(GLuint unit)
+    {
+        if(debug)
+            check("active texture", activeUnit, query(GL_ACTIVE_TEXTURE) - GL_TEXTURE0);
+        if(!cached(activeUnit, unit))
+            glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+public:
+    static RenderState &get()
+    {
+        static RenderState state;
+        return state;
+    }
+
+    /** @brief In debug mode skipped calls are checked against glGet*; slow.
+     */
+    void setDebug(bool debug)
+    {
+        this->debug = debug;
+    }
+
+    bool isDebug() const
+    {
+        return debug;
+    }
+
+    /** @brief Forget everything, e.g. after code that changed the state directly.
+     *  The next call of each kind reaches the driver.
+     */
+    void invalidate()
+    {
+        program = UNKNOWN;
+        vertexArray = UNKNOWN;
+        for(GLuint t = 0; t < BUFFER_TARGETS; ++t)
+            buffer[t] = UNKNOWN;
+        for(GLuint b = 0; b < uniformBindings; ++b)
+            uniform[b].buffer = UNKNOWN;
+        for(GLuint b = 0; b < storageBindings; ++b)
+            storage[b] = UNKNOWN;
+        activeUnit = UNKNOWN;
+        for(GLuint u = 0; u < textureUnits; ++u) {
+            for(GLuint t = 0; t < TEXTURE_TARGETS; ++t)
+                texture[u][t] = UNKNOWN;
+        }
+        drawFramebuffer = UNKNOWN;
+        readFramebuffer = UNKNOWN;
+
+        for(GLuint c = 0; c < CAPABILITIES; ++c)
+            enabled[c] = UNKNOWN;
+        depthFunction = UNKNOWN;
+        depthWrite = UNKNOWN;
+        cullMode = UNKNOWN;
+        frontFaceMode = UNKNOWN;
+        blendSource = UNKNOWN;
+        blendDestination = UNKNOWN;
+        viewportKnown = false;
+    }
+
+    void useProgram(GLuint p)
+    {
+        if(debug)
+            check("program", program, query(GL_CURRENT_PROGRAM));
+        if(!cached(program, p))
+            glUseProgram(p);
+    }
+
+    void bindVertexArray(GLuint vao)
+    {
+        if(debug)
+            check("vertex array", vertexArray, query(GL_VERTEX_ARRAY_BINDING));
+        if(!cached(vertexArray, vao)) {
+            glBindVertexArray(vao);
+            buffer[ELEMENT_ARRAY_BUFFER] = UNKNOWN;
+        }
+    }
+
+    /** @brief glBindBuffer; targets other than those tracked are passed through.
+     */
+    void bindBuffer(GLenum target, GLuint b)
+    {
+        const GLint t(bufferIndex(target));
+        if(t < 0) {
+            glBindBuffer(target, b);
+            return;
+        }
+
+        if(debug)
+            check("buffer", buffer[t], query(bufferBinding(static_cast<BufferTarget>(t))));
+        if(!cached(buffer[t], b))
+            glBindBuffer(target, b);
+    }
+
+    /** @brief glBindBufferRange; also binds the generic target, as GL does.
+     */
+    void bindBufferRange(GLenum target, GLuint index, GLuint b, GLintptr offset, GLsizeiptr size)
+    {
+        const GLint t(bufferIndex(target));
+        if(target != GL_UNIFORM_BUFFER || index >= uniformBindings) {
+            glBindBufferRange(target, index, b, offset, size);
+            if(t >= 0)
+                buffer[t] = b;
+            return;
+        }
+
+        Range &r(uniform[index]);
+        if(r.buffer == b && r.offset == offset && r.size == size) {
+            if(debug) {
+                GLint actual(0);
+                glGetIntegeri_v(GL_UNIFORM_BUFFER_BINDING, index, &actual);
+                check("uniform buffer range", r.buffer, static_cast<GLuint>(actual));
+            }
+            if(r.buffer == b) {
+                ++skipped;
+                return;
+            }
+        }
+
+        glBindBufferRange(target, index, b, offset, size);
+        r.buffer = b;
+        r.offset = offset;
+        r.size = size;
+        buffer[t] = b;
+        ++issued;
+        PROFILE_COUNT(STATE_CHANGES, 1);
+    }
+
+    /** @brief glBindBufferBase; uniform and shader storage bindings are tracked.
+     *  The generic shader storage binding is not, as it needs GL 4.3 to query.
+     */
+    void bindBufferBase(GLenum target, GLuint index, GLuint b)
+    {
+        const GLint t(bufferIndex(target));
+        if(target == GL_SHADER_STORAGE_BUFFER && index < storageBindings) {
+            if(debug) {
+                GLint actual(0);
+                glGetIntegeri_v(GL_SHADER_STORAGE_BUFFER_BINDING, index, &actual);
+                check("shader storage buffer", storage[index], static_cast<GLuint>(actual));
+            }
+            if(!cached(storage[index], b))
+                glBindBufferBase(target, index, b);
+            return;
+        }
+        if(target != GL_UNIFORM_BUFFER || index >= uniformBindings) {
+            glBindBufferBase(target, index, b);
+            if(t >= 0)
+                buffer[t] = b;
+            return;
+        }
+
+        Range &r(uniform[index]);
+        if(r.buffer == b && r.size == 0) {
+            if(debug) {
+                GLint actual(0);
+                glGetIntegeri_v(GL_UNIFORM_BUFFER_BINDING, index, &actual);
+                check("uniform buffer range", r.buffer, static_cast<GLuint>(actual));
+            }
+            if(r.buffer == b) {
+                ++skipped;
+                return;
+            }
+        }
+
+        glBindBufferBase(target, index, b);
+        r.buffer = b;
+        r.offset = 0;
+        r.size = 0;
+        buffer[t] = b;
+        ++issued;
+        PROFILE_COUNT(STATE_CHANGES, 1);
+    }
+
+    /** @brief Bind a texture to a unit; targets other than those tracked are passed through.
+     */
+    void bindTexture(GLuint unit, GLenum target, GLuint tex)
+    {
+        const GLint t(textureIndex(target));
+        if(t < 0 || unit >= textureUnits) {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            glBindTexture(target, tex);
+            activeUnit = unit;
+            return;
+        }
+
+        if(debug && texture[unit][t] != UNKNOWN) {
+            activeTexture(unit);
+            check("texture", texture[unit][t], query(textureBinding(static_cast<TextureTarget>(t))));
+        }
+        if(texture[unit][t] == tex) {
+            ++skipped;
+            return;
+        }
+
+        activeTexture(unit);
+        cached(texture[unit][t], tex);
+        glBindTexture(target, tex);
+    }
+
+    /** @param target GL_FRAMEBUFFER binds both draw and read framebuffers.
+     */
+    void bindFramebuffer(GLenum target, GLuint fbo)
+    {
+        if(debug) {
+            check("draw framebuffer", drawFramebuffer, query(GL_DRAW_FRAMEBUFFER_BINDING));
+            check("read framebuffer", readFramebuffer, query(GL_READ_FRAMEBUFFER_BINDING));
+        }
+
+        if(target == GL_FRAMEBUFFER) {
+            if(drawFramebuffer == fbo && readFramebuffer == fbo) {
+                ++skipped;
+                return;
+            }
+            glBindFramebuffer(target, fbo);
+            drawFramebuffer = readFramebuffer = fbo;
+            ++issued;
+            PROFILE_COUNT(STATE_CHANGES, 1);
+        } else if(!cached(target == GL_READ_FRAMEBUFFER ? readFramebuffer : drawFramebuffer, fbo)) {
+            glBindFramebuffer(target, fbo);
+        }
+    }
+
+    /** @brief glEnable or glDisable; capabilities other than those tracked are passed through.
+     */
+    void setEnabled(GLenum cap, bool on)
+    {
+        const GLint c(capabilityIndex(cap));
+        if(c < 0) {
+            if(on)
+                glEnable(cap);
+            else
+                glDisable(cap);
+            return;
+        }
+
+        if(debug)
+            check("capability", enabled[c], glIsEnabled(cap) ? 1 : 0);
+        if(cached(enabled[c], on ? 1 : 0))
+            return;
+
+        if(on)
+            glEnable(cap);
+        else
+            glDisable(cap);
+    }
+
+    void enable(GLenum cap)
+    {
+        setEnabled(cap, true);
+    }
+
+    void disable(GLenum cap)
+    {
+        setEnabled(cap, false);
+    }
+
+    void depthFunc(GLenum func)
+    {
+        if(debug)
+            check("depth function", depthFunction, query(GL_DEPTH_FUNC));
+        if(!cached(depthFunction, func))
+            glDepthFunc(func);
+    }
+
+    void depthMask(GLboolean write)
+    {
+        if(debug)
+            check("depth write mask", depthWrite, query(GL_DEPTH_WRITEMASK));
+        if(!cached(depthWrite, write ? GL_TRUE : GL_FALSE))
+            glDepthMask(write);
+    }
+
+    void cullFace(GLenum mode)
+    {
+        if(debug)
+            check("cull face", cullMode, query(GL_CULL_FACE_MODE));
+        if(!cached(cullMode, mode))
+            glCullFace(mode);
+    }
+
+    void frontFace(GLenum mode)
+    {
+        if(debug)
+            check("front face", frontFaceMode, query(GL_FRONT_FACE));
+        if(!cached(frontFaceMode, mode))
+            glFrontFace(mode);
+    }
+
+    void blendFunc(GLenum source, GLenum destination)
+    {
+        if(debug) {
+            check("blend source", blendSource, query(GL_BLEND_SRC_RGB));
+            check("blend destination", blendDestination, query(GL_BLEND_DST_RGB));
+        }
+        if(blendSource == source && blendDestination == destination) {
+            ++skipped;
+            return;
+        }
+
+        glBlendFunc(source, destination);
+        blendSource = source;
+        blendDestination = destination;
+        ++issued;
+        PROFILE_COUNT(STATE_CHANGES, 1);
+    }
+
+    void viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+    {
+        const GLint box[4] = {x, y, width, height};
+        if(viewportKnown && std::equal(box, box + 4, viewportBox)) {
+            if(debug) {
+                GLint actual[4];
+                glGetIntegerv(GL_VIEWPORT, actual);
+                if(!std::equal(box, box + 4, actual)) {
+                    std::cerr << "Render state out of sync: viewport" << std::endl;
+                    ++mismatches;
+                    viewportKnown = false;
+                }
+            }
+            if(viewportKnown) {
+                ++skipped;
+                return;
+            }
+        }
+
+        glViewport(x, y, width, height);
+        std::copy(box, box + 4, viewportBox);
+        viewportKnown = true;
+        ++issued;
+        PROFILE_COUNT(STATE_CHANGES, 1);
+    }
+
+    /** @brief Call before glDeleteBuffers; a deleted name may come back from glGenBuffers.
+     */
+    void forgetBuffer(GLuint b)
+    {
+        for(GLuint t = 0; t < BUFFER_TARGETS; ++t) {
+            if(buffer[t] == b)
+                buffer[t] = UNKNOWN;
+        }
+        for(GLuint i = 0; i < uniformBindings; ++i) {
+            if(uniform[i].buffer == b)
+                uniform[i].buffer = UNKNOWN;
+        }
+        for(GLuint i = 0; i < storageBindings; ++i) {
+            if(storage[i] == b)
+                storage[i] = UNKNOWN;
+        }
+    }
+
+    void forgetVertexArray(GLuint vao)
+    {
+        if(vertexArray == vao) {
+            vertexArray = UNKNOWN;
+            buffer[ELEMENT_ARRAY_BUFFER] = UNKNOWN;
+        }
+    }
+
+    void forgetProgram(GLuint p)
+    {
+        if(program == p)
+            program = UNKNOWN;
+    }
+
+    void forgetTexture(GLuint tex)
+    {
+        for(GLuint u = 0; u < textureUnits; ++u) {
+            for(GLuint t = 0; t < TEXTURE_TARGETS; ++t) {
+                if(texture[u][t] == tex)
+                    texture[u][t] = UNKNOWN;
+            }
+        }
+    }
+
+    void forgetFramebuffer(GLuint fbo)
+    {
+        if(drawFramebuffer == fbo)
+            drawFramebuffer = UNKNOWN;
+        if(readFramebuffer == fbo)
+            readFramebuffer = UNKNOWN;
+    }
+
+    /** @brief Compare the whole shadow with the context.
+     *  @return the number of mismatches found; each is reported and fixed.
+     */
+    GLsizei validate()
+    {
+        const GLsizei before(mismatches);
+
+        check("program", program, query(GL_CURRENT_PROGRAM));
+        check("vertex array", vertexArray, query(GL_VERTEX_ARRAY_BINDING));
+        for(GLuint t = 0; t < BUFFER_TARGETS; ++t) {
+            if(supported(static_cast<BufferTarget>(t)))
+                check("buffer", buffer[t], query(bufferBinding(static_cast<BufferTarget>(t))));
+        }
+        for(GLuint i = 0; i < uniformBindings; ++i) {
+            if(uniform[i].buffer == UNKNOWN)
+                continue;
+            GLint actual(0);
+            glGetIntegeri_v(GL_UNIFORM_BUFFER_BINDING, i, &actual);
+            check("uniform buffer range", uniform[i].buffer, static_cast<GLuint>(actual));
+        }
+        for(GLuint i = 0; i < storageBindings; ++i) {
+            if(storage[i] == UNKNOWN)
+                continue;
+            GLint actual(0);
+            glGetIntegeri_v(GL_SHADER_STORAGE_BUFFER_BINDING, i, &actual);
+            check("shader storage buffer", storage[i], static_cast<GLuint>(actual));
+        }
+
+        const GLuint unit(query(GL_ACTIVE_TEXTURE) - GL_TEXTURE0);
+        check("active texture", activeUnit, unit);
+        for(GLuint u = 0; u < textureUnits; ++u) {
+            for(GLuint t = 0; t < TEXTURE_TARGETS; ++t) {
+                if(texture[u][t] == UNKNOWN)
+                    continue;
+                glActiveTexture(GL_TEXTURE0 + u);
+                check("texture", texture[u][t], query(textureBinding(static_cast<TextureTarget>(t))));
+            }
+        }
+        glActiveTexture(GL_TEXTURE0 + unit);
+
+        check("draw framebuffer", drawFramebuffer, query(GL_DRAW_FRAMEBUFFER_BINDING));
+        check("read framebuffer", readFramebuffer, query(GL_READ_FRAMEBUFFER_BINDING));
+
+        for(GLuint c = 0; c < CAPABILITIES; ++c)
+            check("capability", enabled[c], glIsEnabled(capability(static_cast<Capability>(c))) ? 1 : 0);
+        check("depth function", depthFunction, query(GL_DEPTH_FUNC));
+        check("depth write mask", depthWrite, query(GL_DEPTH_WRITEMASK));
+        check("cull face", cullMode, query(GL_CULL_FACE_MODE));
+        check("front face", frontFaceMode, query(GL_FRONT_FACE));
+        check("blend source", blendSource, query(GL_BLEND_SRC_RGB));
+        check("blend destination", blendDestination, query(GL_BLEND_DST_RGB));
+
+        if(viewportKnown) {
+            GLint actual[4];
+            glGetIntegerv(GL_VIEWPORT, actual);
+            if(!std::equal(actual, actual + 4, viewportBox)) {
+                std::cerr << "Render state out of sync: viewport" << std::endl;
+                std::copy(actual, actual + 4, viewportBox);
+                ++mismatches;
+            }
+        }
+
+        return mismatches - before;
+    }
+
+    /// Calls that reached the driver.
+    GLsizei getIssuedCount() const
+    {
+        return issued;
+    }
+
+    /// Calls skipped because they would have changed nothing.
+    GLsizei getSkippedCount() const
+    {
+        return skipped;
+    }
+
+    /// Differences found between the shadow and the context in debug mode.
+    GLsizei getMismatchCount() const
+    {
+        return mismatches;
+    }
+};
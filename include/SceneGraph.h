@@ -0,0 +1,196 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "Mat.h"
+
+/** @brief Transform hierarchy stored as structure of arrays.
+ *
+ *  A node's parent is always created before it, so the arrays are in
+ *  topological order and update() computes every world matrix in one
+ *  forward sweep: world = world(parent) * translate * rotate * scale.
+ *  Setting a local transform marks the node dirty; the sweep starts at the
+ *  first dirty node, recomputes the local matrix only of nodes that were
+ *  set and the world matrix only of nodes under a dirty one, and skips the
+ *  rest with a flag test. The matrices are Affine, so a world product
+ *  skips the constant last row.
+ */
+class SceneGraph
+{
+public:
+    typedef GLuint Node;
+
+    static const Node NONE = ~0u;
+
+private:
+    enum Flag
+    {
+        LOCAL_DIRTY = 1,
+        WORLD_DIRTY = 2
+    };
+
+    std::vector<Node> parent;
+    std::vector<GLfloat> translation;  // xyz per node
+    std::vector<GLfloat> rotation;     // unit quaternion xyzw per node
+    std::vector<GLfloat> scaling;      // xyz per node
+    std::vector<Affine<>> local;
+    std::vector<Affine<>> world;
+    std::vector<GLubyte> flags;
+
+    Node firstDirty;
+    GLsizei updated;
+
+    void touch(Node n)
+    {
+        flags[n] |= LOCAL_DIRTY;
+        firstDirty = std::min(firstDirty, n);
+    }
+
+    void composeLocal(Node n)
+    {
+        const GLfloat *const q(&rotation[n * 4]);
+        const GLfloat *const s(&scaling[n * 3]);
+        const GLfloat *const t(&translation[n * 3]);
+        const GLfloat x(q[0]), y(q[1]), z(q[2]), w(q[3]);
+
+        GLfloat *const m(local[n].m);
+        m[0] = (1.0f - 2.0f * (y * y + z * z)) * s[0];
+        m[1] = 2.0f * (x * y + z * w) * s[0];
+        m[2] = 2.0f * (x * z - y * w) * s[0];
+        m[3] = 2.0f * (x * y - z * w) * s[1];
+        m[4] = (1.0f - 2.0f * (x * x + z * z)) * s[1];
+        m[5] = 2.0f * (y * z + x * w) * s[1];
+        m[6] = 2.0f * (x * z + y * w) * s[2];
+        m[7] = 2.0f * (y * z - x * w) * s[2];
+        m[8] = (1.0f - 2.0f * (x * x + y * y)) * s[2];
+        m[9] = t[0];
+        m[10] = t[1];
+        m[11] = t[2];
+    }
+
+public:
+    SceneGraph() : firstDirty(0), updated(0)
+    {
+    }
+
+    void reserve(std::size_t nodes)
+    {
+        parent.reserve(nodes);
+        translation.reserve(nodes * 3);
+        rotation.reserve(nodes * 4);
+        scaling.reserve(nodes * 3);
+        local.reserve(nodes);
+        world.reserve(nodes);
+        flags.reserve(nodes);
+    }
+
+    /** @brief Add a node with an identity transform.
+     *  @param p its parent, or NONE for a root.
+     */
+    Node create(Node p = NONE)
+    {
+        const Node n(static_cast<Node>(parent.size()));
+
+        parent.push_back(p);
+        translation.insert(translation.end(), 3, 0.0f);
+        rotation.insert(rotation.end(), 3, 0.0f);
+        rotation.push_back(1.0f);
+        scaling.insert(scaling.end(), 3, 1.0f);
+        local.push_back(Affine<>());
+        world.push_back(Affine<>());
+        flags.push_back(0);
+
+        touch(n);
+        return n;
+    }
+
+    void setTranslation(Node n, GLfloat x, GLfloat y, GLfloat z)
+    {
+        GLfloat *const t(&translation[n * 3]);
+        t[0] = x;
+        t[1] = y;
+        t[2] = z;
+        touch(n);
+    }
+
+    /** @brief Rotate by a radians about (x, y, z), like Matrix::rotate.
+     *  A zero axis gives no rotation.
+     */
+    void setRotation(Node n, GLfloat a, GLfloat x, GLfloat y, GLfloat z)
+    {
+        GLfloat *const q(&rotation[n * 4]);
+        const GLfloat d(sqrt(x * x + y * y + z * z));
+        const GLfloat s(d > 0.0f ? sin(a * 0.5f) / d : 0.0f);
+
+        q[0] = x * s;
+        q[1] = y * s;
+        q[2] = z * s;
+        q[3] = d > 0.0f ? cos(a * 0.5f) : 1.0f;
+        touch(n);
+    }
+
+    void setScale(Node n, GLfloat x, GLfloat y, GLfloat z)
+    {
+        GLfloat *const s(&scaling[n * 3]);
+        s[0] = x;
+        s[1] = y;
+        s[2] = z;
+        touch(n);
+    }
+
+    /** @brief Bring the world matrices of all dirty nodes and their descendants up to date.
+     */
+    void update()
+    {
+        updated = 0;
+
+        const Node count(static_cast<Node>(parent.size()));
+        for(Node n = firstDirty; n < count; ++n) {
+            GLubyte f(flags[n]);
+            if(parent[n] != NONE && (flags[parent[n]] & WORLD_DIRTY))
+                f |= WORLD_DIRTY;
+
+            if(f == 0)
+                continue;
+
+            if(f & LOCAL_DIRTY)
+                composeLocal(n);
+
+            world[n] = parent[n] == NONE ? local[n] : world[parent[n]] * local[n];
+            flags[n] = WORLD_DIRTY;  // read by the children further on
+            ++updated;
+        }
+
+        for(Node n = firstDirty; n < count; ++n)
+            flags[n] = 0;
+        firstDirty = count;
+    }
+
+    const Affine<> &getWorld(Node n) const
+    {
+        return world[n];
+    }
+
+    const Affine<> &getLocal(Node n) const
+    {
+        return local[n];
+    }
+
+    Node getParent(Node n) const
+    {
+        return parent[n];
+    }
+
+    GLsizei getNodeCount() const
+    {
+        return static_cast<GLsizei>(parent.size());
+    }
+
+    /// World matrices recomputed by the last update().
+    GLsizei getUpdatedCount() const
+    {
+        return updated;
+    }
+};
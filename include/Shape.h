@@ -1,29 +1,60 @@
 #pragma once
 #include <memory>
 
+#include "Bounds.h"
 #include "Object.h"
 
 class Shape
 {
     std::shared_ptr<const Object> object;
 
+    const Bounds bounds;
+
 protected:
     const GLsizei vertexcount;
 
+    /** @brief For shapes whose geometry is stored elsewhere; they must override bind().
+     */
+    Shape(GLsizei vertexcount, const Object::Vertex *vertex)
+        : bounds(Bounds::fromVertices(vertexcount, vertex)), vertexcount(vertexcount)
+    {
+    }
+
+    virtual void bind() const
+    {
+        object->bind();
+    }
+
 public:
     Shape(GLint size, GLsizei vertexcount, const Object::Vertex *vertex, GLsizei indexcount = 0,
           const GLuint *index = NULL)
-        : object(new Object(size, vertexcount, vertex, indexcount, index)), vertexcount(vertexcount)
+        : object(new Object(size, vertexcount, vertex, indexcount, index)),
+          bounds(Bounds::fromVertices(vertexcount, vertex)), vertexcount(vertexcount)
     {
     }
     
+    Shape(GLint size, GLsizei vertexcount, const Object::Vertex *vertex, GLsizei indexcount, const GLvoid *index,
+          GLenum indextype)
+        : object(new Object(size, vertexcount, vertex, indexcount, index, indextype)),
+          bounds(Bounds::fromVertices(vertexcount, vertex)), vertexcount(vertexcount)
+    {
+    }
+
+    /** @brief Share an Object built elsewhere, e.g. from packed vertices.
+     *  @param bounds model-space bounds of the vertices.
+     */
+    Shape(const std::shared_ptr<const Object> &object, GLsizei vertexcount, const Bounds &bounds)
+        : object(object), bounds(bounds), vertexcount(vertexcount)
+    {
+    }
+
     virtual ~Shape()
     {
     }
 
     void draw() const
     {
-        object->bind();
+        bind();
         excute();
     }
 
@@ -31,4 +62,11 @@ public:
     {
         glDrawArrays(GL_LINE_LOOP, 0, vertexcount);
     }
+
+    /** @brief Bounding box of the vertex positions in model space.
+     */
+    const Bounds &getBounds() const
+    {
+        return bounds;
+    }
 };
\ No newline at end of file
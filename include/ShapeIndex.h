@@ -7,14 +7,39 @@ class ShapeIndex : public Shape
 protected:
     const GLsizei indexcount;
 
+    const GLenum indextype;
+
 public:
     ShapeIndex(GLint size, GLsizei vertexcount, const Object::Vertex *vertex, GLsizei indexcount, const GLuint *index)
-        : Shape(size, vertexcount, vertex, indexcount, index), indexcount(indexcount)
+        : Shape(size, vertexcount, vertex, indexcount, index), indexcount(indexcount), indextype(GL_UNSIGNED_INT)
+    {
+    }
+
+    ShapeIndex(GLint size, GLsizei vertexcount, const Object::Vertex *vertex, GLsizei indexcount,
+               const GLushort *index)
+        : Shape(size, vertexcount, vertex, indexcount, index, GL_UNSIGNED_SHORT), indexcount(indexcount),
+          indextype(GL_UNSIGNED_SHORT)
+    {
+    }
+
+    ShapeIndex(const std::shared_ptr<const Object> &object, GLsizei vertexcount, const Bounds &bounds,
+               GLsizei indexcount, GLenum indextype)
+        : Shape(object, vertexcount, bounds), indexcount(indexcount), indextype(indextype)
+    {
+    }
+
+    GLsizei getIndexCount() const
+    {
+        return indexcount;
+    }
+
+    GLenum getIndexType() const
     {
+        return indextype;
     }
 
     virtual void excute() const
     {
-        glDrawElements(GL_LINES, indexcount, GL_UNSIGNED_INT, 0);
+        glDrawElements(GL_LINES, indexcount, indextype, 0);
     }
 };
\ No newline at end of file
@@ -0,0 +1,552 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define SOFTWARE_RENDERER_SSE 1
+#include <emmintrin.h>
+#endif
+
+#include "Instance.h"
+#include "JobSystem.h"
+#include "Object.h"
+#include "UniformBlock.h"
+
+/** @brief CPU rasterizer that draws what InstancedShape draws, lit like instanced.vert and point.frag.
+ *
+ *  draw() takes the same vertex and index arrays and Instance records as
+ *  InstancedShape and the same FrameBlock and Material as the uniform
+ *  blocks, so a frame can be rendered without a GL context, e.g. as a
+ *  reference image or on machines without a GPU. Vertices are shaded
+ *  (Blinn-Phong per vertex), clipped against the view volume and set up on
+ *  the job threads; finish() sorts the triangles into screen tiles and
+ *  rasterizes the tiles in parallel with edge functions, four pixels at a
+ *  time with SSE2 or one at a time, to the same image. Triangles keep their
+ *  submission order within a tile, so the image does not depend on the
+ *  thread count either.
+ *
+ *  Follows the state main.cpp sets: counter-clockwise front faces, back
+ *  faces culled, GL_LESS depth test, colors interpolated perspective
+ *  correctly. The image is RGBA8, bottom row first, like Framebuffer.
+ */
+class SoftwareRenderer
+{
+public:
+    static const GLsizei tileSize = 32;
+
+private:
+    struct ShadedVertex
+    {
+        GLfloat clip[4];
+        GLfloat color[3];
+    };
+
+    /// Screen-space triangle ready for the tiles.
+    struct Triangle
+    {
+        GLfloat a[3], b[3], c[3];  // edge functions a x + b y + c, positive inside
+        GLfloat z[3];              // window depth
+        GLfloat w[3];              // 1 / clip w
+        GLfloat color[3][3];       // color / clip w
+        GLfloat inverseArea;
+        GLint bounds[4];  // x0, y0, x1, y1 inclusive
+    };
+
+    static const std::size_t setupGrain = 4096;
+
+    JobSystem &jobs;
+    const GLsizei width;
+    const GLsizei height;
+    const GLsizei stride;  // pixels per row, a multiple of 4
+    const GLsizei tilesX;
+    const GLsizei tilesY;
+
+    std::vector<std::uint32_t> color;
+    std::vector<GLfloat> depth;
+
+    FrameBlock frame;
+    Material material;
+
+    std::vector<ShadedVertex> shaded;
+    std::vector<std::vector<Triangle>> chunks;
+    std::vector<Triangle> triangles;
+    std::vector<std::vector<GLuint>> bins;
+    bool vectorized;
+
+    SoftwareRenderer(const SoftwareRenderer &);
+    SoftwareRenderer &operator=(const SoftwareRenderer &);
+
+    static GLfloat normalize(GLfloat *v)
+    {
+        const GLfloat l(sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]));
+        if(l > 0.0f) {
+            v[0] /= l;
+            v[1] /= l;
+            v[2] /= l;
+        }
+        return l;
+    }
+
+    /// instanced.vert for one vertex of one instance.
+    void shade(const Instance &instance, const Object::Vertex &vertex, ShadedVertex &out) const
+    {
+        const GLfloat *const m(instance.modelview);
+        const GLfloat *const p(vertex.position);
+        GLfloat P[4];
+        for(int r = 0; r < 4; ++r)
+            P[r] = m[r] * p[0] + m[4 + r] * p[1] + m[8 + r] * p[2] + m[12 + r];
+
+        const GLfloat *const n(instance.normalMatrix);
+        const GLfloat *const q(vertex.normal);
+        GLfloat N[3];
+        for(int r = 0; r < 3; ++r)
+            N[r] = n[r] * q[0] + n[3 + r] * q[1] + n[6 + r] * q[2];
+        normalize(N);
+
+        GLfloat V[3] = {-P[0], -P[1], -P[2]};
+        normalize(V);
+
+        GLfloat diffuse[3] = {0.0f, 0.0f, 0.0f};
+        GLfloat specular[3] = {0.0f, 0.0f, 0.0f};
+        for(GLint i = 0; i < frame.lightCount; ++i) {
+            const Light &light(frame.light[i]);
+            GLfloat L[3], H[3];
+            for(int k = 0; k < 3; ++k)
+                L[k] = light.position[k] * P[3] - P[k] * light.position[3];
+            const GLfloat a(light.attenuate(L[0] * L[0] + L[1] * L[1] + L[2] * L[2]));
+            normalize(L);
+            for(int k = 0; k < 3; ++k)
+                H[k] = L[k] + V[k];
+            normalize(H);
+
+            const GLfloat d(std::max(N[0] * L[0] + N[1] * L[1] + N[2] * L[2], 0.0f));
+            const GLfloat s(pow(std::max(N[0] * H[0] + N[1] * H[1] + N[2] * H[2], 0.0f), material.shininess));
+            for(int k = 0; k < 3; ++k) {
+                diffuse[k] += a * d * material.diffuse[k] * light.diffuse[k];
+                specular[k] += a * s * material.specular[k] * light.specular[k];
+            }
+        }
+
+        const GLfloat *const proj(frame.projection);
+        for(int r = 0; r < 4; ++r)
+            out.clip[r] = proj[r] * P[0] + proj[4 + r] * P[1] + proj[8 + r] * P[2] + proj[12 + r] * P[3];
+        for(int k = 0; k < 3; ++k)
+            out.color[k] = diffuse[k] + specular[k];
+    }
+
+    /// Signed distance of v to clip plane i; the view volume is where all six are non-negative.
+    static GLfloat planeDistance(const ShadedVertex &v, int i)
+    {
+        const GLfloat c(v.clip[i >> 1]);
+        return v.clip[3] + (i & 1 ? -c : c);
+    }
+
+    /** @brief Clip one triangle against the view volume and append the visible, front-facing pieces.
+     */
+    void setup(const ShadedVertex &v0, const ShadedVertex &v1, const ShadedVertex &v2,
+               std::vector<Triangle> &out) const
+    {
+        ShadedVertex polygon[2][9];
+        int count(3);
+        polygon[0][0] = v0;
+        polygon[0][1] = v1;
+        polygon[0][2] = v2;
+
+        int current(0);
+        for(int plane = 0; plane < 6; ++plane) {
+            const ShadedVertex *const in(polygon[current]);
+            ShadedVertex *const clipped(polygon[current ^ 1]);
+
+            bool inside(true);
+            for(int i = 0; i < count; ++i)
+                inside = inside && planeDistance(in[i], plane) >= 0.0f;
+            if(inside)
+                continue;
+
+            int n(0);
+            for(int i = 0; i < count; ++i) {
+                const ShadedVertex &a(in[i]);
+                const ShadedVertex &b(in[(i + 1) % count]);
+                const GLfloat da(planeDistance(a, plane));
+                const GLfloat db(planeDistance(b, plane));
+
+                if(da >= 0.0f)
+                    clipped[n++] = a;
+                if((da >= 0.0f) != (db >= 0.0f)) {
+                    const GLfloat t(da / (da - db));
+                    ShadedVertex &v(clipped[n++]);
+                    for(int k = 0; k < 4; ++k)
+                        v.clip[k] = a.clip[k] + (b.clip[k] - a.clip[k]) * t;
+                    for(int k = 0; k < 3; ++k)
+                        v.color[k] = a.color[k] + (b.color[k] - a.color[k]) * t;
+                }
+            }
+
+            count = n;
+            current ^= 1;
+            if(count < 3)
+                return;
+        }
+
+        // viewport transform, snapped to 1/16 pixel so shared edges match exactly
+        GLfloat x[9], y[9], z[9], w[9];
+        const ShadedVertex *const v(polygon[current]);
+        for(int i = 0; i < count; ++i) {
+            w[i] = 1.0f / v[i].clip[3];
+            x[i] = floor((v[i].clip[0] * w[i] * 0.5f + 0.5f) * width * 16.0f + 0.5f) / 16.0f;
+            y[i] = floor((v[i].clip[1] * w[i] * 0.5f + 0.5f) * height * 16.0f + 0.5f) / 16.0f;
+            z[i] = v[i].clip[2] * w[i] * 0.5f + 0.5f;
+        }
+
+        for(int i = 1; i + 1 < count; ++i) {
+            const int index[3] = {0, i, i + 1};
+            const GLfloat area((x[i] - x[0]) * (y[i + 1] - y[0]) - (x[i + 1] - x[0]) * (y[i] - y[0]));
+            if(area <= 0.0f)
+                continue;  // back face or degenerate
+
+            Triangle t;
+            for(int e = 0; e < 3; ++e) {
+                // edge e is opposite vertex e, so its function is that vertex's weight
+                const int p(index[(e + 1) % 3]), q(index[(e + 2) % 3]);
+                t.a[e] = y[p] - y[q];
+                t.b[e] = x[q] - x[p];
+                t.c[e] = -(t.a[e] * x[p] + t.b[e] * y[p]);
+
+                const int k(index[e]);
+                t.z[e] = z[k];
+                t.w[e] = w[k];
+                for(int c = 0; c < 3; ++c)
+                    t.color[e][c] = v[k].color[c] * w[k];
+            }
+            t.inverseArea = 1.0f / area;
+
+            const GLfloat minX(std::min(x[0], std::min(x[i], x[i + 1])));
+            const GLfloat maxX(std::max(x[0], std::max(x[i], x[i + 1])));
+            const GLfloat minY(std::min(y[0], std::min(y[i], y[i + 1])));
+            const GLfloat maxY(std::max(y[0], std::max(y[i], y[i + 1])));
+            t.bounds[0] = std::max(static_cast<GLint>(floor(minX)), 0);
+            t.bounds[1] = std::max(static_cast<GLint>(floor(minY)), 0);
+            t.bounds[2] = std::min(static_cast<GLint>(ceil(maxX)), width - 1);
+            t.bounds[3] = std::min(static_cast<GLint>(ceil(maxY)), height - 1);
+            if(t.bounds[0] > t.bounds[2] || t.bounds[1] > t.bounds[3])
+                continue;
+
+            out.push_back(t);
+        }
+    }
+
+    /** @brief Fill rule for pixel centers exactly on an edge: of the two triangles
+     *  sharing the edge, whose functions are negatives of each other, exactly one takes it.
+     */
+    static bool ownsEdge(const Triangle &t, int e)
+    {
+        return t.a[e] > 0.0f || (t.a[e] == 0.0f && t.b[e] > 0.0f);
+    }
+
+    /** @brief The color of a pixel: the perspective-correct interpolation of
+     *  color / w over 1 / w, clamped to [0, 1] and rounded half up to 8 bits.
+     *  rasterizeVector() does the same operations in the same order, so both
+     *  paths give the same image.
+     */
+    void rasterizeScalar(const Triangle &t, GLint x0, GLint y0, GLint x1, GLint y1)
+    {
+        bool owns[3];
+        for(int e = 0; e < 3; ++e)
+            owns[e] = ownsEdge(t, e);
+
+        for(GLint y = y0; y <= y1; ++y) {
+            const GLfloat py(y + 0.5f);
+            for(GLint x = x0; x <= x1; ++x) {
+                const GLfloat px(x + 0.5f);
+                GLfloat e[3];
+                bool inside(true);
+                for(int k = 0; k < 3; ++k) {
+                    e[k] = t.a[k] * px + t.b[k] * py + t.c[k];
+                    inside = inside && (e[k] > 0.0f || (e[k] == 0.0f && owns[k]));
+                }
+                if(!inside)
+                    continue;
+
+                const GLfloat w0(e[0] * t.inverseArea), w1(e[1] * t.inverseArea), w2(e[2] * t.inverseArea);
+                const GLfloat z(w0 * t.z[0] + w1 * t.z[1] + w2 * t.z[2]);
+                GLfloat &stored(depth[y * stride + x]);
+                if(!(z < stored))
+                    continue;
+                stored = z;
+
+                const GLfloat iw(1.0f / (w0 * t.w[0] + w1 * t.w[1] + w2 * t.w[2]));
+                std::uint32_t rgba(0xff000000u);
+                for(int c = 0; c < 3; ++c) {
+                    const GLfloat v((w0 * t.color[0][c] + w1 * t.color[1][c] + w2 * t.color[2][c]) * iw);
+                    rgba |= static_cast<std::uint32_t>(std::min(std::max(v, 0.0f), 1.0f) * 255.0f + 0.5f) << 8 * c;
+                }
+                color[y * stride + x] = rgba;
+            }
+        }
+    }
+
+#if defined(SOFTWARE_RENDERER_SSE)
+    /** @brief rasterizeScalar() four pixels at a time. The edge functions are
+     *  evaluated at every pixel center rather than stepped, as stepping
+     *  accumulates rounding and would move pixels across edges.
+     */
+    void rasterizeVector(const Triangle &t, GLint x0, GLint y0, GLint x1, GLint y1)
+    {
+        const __m128i lane(_mm_set_epi32(3, 2, 1, 0));
+        const __m128 zero(_mm_setzero_ps());
+        const __m128 half(_mm_set1_ps(0.5f));
+        const __m128 one(_mm_set1_ps(1.0f));
+        __m128 a[3], c[3], owns[3];
+        for(int e = 0; e < 3; ++e) {
+            a[e] = _mm_set1_ps(t.a[e]);
+            c[e] = _mm_set1_ps(t.c[e]);
+            owns[e] = ownsEdge(t, e) ? _mm_castsi128_ps(_mm_set1_epi32(-1)) : zero;
+        }
+        const __m128 inverseArea(_mm_set1_ps(t.inverseArea));
+        const __m128 scale(_mm_set1_ps(255.0f));
+        const __m128i alpha(_mm_set1_epi32(static_cast<int>(0xff000000u)));
+
+        // 4-pixel spans start on a multiple of 4 so the loads stay inside the padded rows
+        x0 &= ~3;
+        for(GLint y = y0; y <= y1; ++y) {
+            const GLfloat py(y + 0.5f);
+            __m128 by[3];
+            for(int k = 0; k < 3; ++k)
+                by[k] = _mm_set1_ps(t.b[k] * py);
+
+            GLfloat *const depthRow(&depth[y * stride]);
+            std::uint32_t *const colorRow(&color[y * stride]);
+            for(GLint x = x0; x <= x1; x += 4) {
+                const __m128i column(_mm_add_epi32(_mm_set1_epi32(x), lane));
+                const __m128 px(_mm_add_ps(_mm_cvtepi32_ps(column), half));
+                __m128 mask(_mm_castsi128_ps(_mm_cmplt_epi32(column, _mm_set1_epi32(x1 + 1))));
+                __m128 e[3];
+                for(int k = 0; k < 3; ++k) {
+                    e[k] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[k], px), by[k]), c[k]);
+                    const __m128 edge(_mm_and_ps(_mm_cmpeq_ps(e[k], zero), owns[k]));
+                    mask = _mm_and_ps(mask, _mm_or_ps(_mm_cmpgt_ps(e[k], zero), edge));
+                }
+                if(_mm_movemask_ps(mask) == 0)
+                    continue;
+
+                const __m128 w0(_mm_mul_ps(e[0], inverseArea));
+                const __m128 w1(_mm_mul_ps(e[1], inverseArea));
+                const __m128 w2(_mm_mul_ps(e[2], inverseArea));
+                const __m128 z(_mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(w0, _mm_set1_ps(t.z[0])), _mm_mul_ps(w1, _mm_set1_ps(t.z[1]))),
+                    _mm_mul_ps(w2, _mm_set1_ps(t.z[2]))));
+                const __m128 stored(_mm_loadu_ps(depthRow + x));
+                mask = _mm_and_ps(mask, _mm_cmplt_ps(z, stored));
+                if(_mm_movemask_ps(mask) == 0)
+                    continue;
+
+                _mm_storeu_ps(depthRow + x, _mm_or_ps(_mm_and_ps(mask, z), _mm_andnot_ps(mask, stored)));
+
+                const __m128 iw(_mm_div_ps(
+                    one, _mm_add_ps(_mm_add_ps(_mm_mul_ps(w0, _mm_set1_ps(t.w[0])), _mm_mul_ps(w1, _mm_set1_ps(t.w[1]))),
+                                    _mm_mul_ps(w2, _mm_set1_ps(t.w[2])))));
+                __m128i rgba(alpha);
+                for(int k = 0; k < 3; ++k) {
+                    __m128 v(_mm_add_ps(_mm_add_ps(_mm_mul_ps(w0, _mm_set1_ps(t.color[0][k])),
+                                                   _mm_mul_ps(w1, _mm_set1_ps(t.color[1][k]))),
+                                        _mm_mul_ps(w2, _mm_set1_ps(t.color[2][k]))));
+                    v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(v, iw), zero), one);
+                    // truncating what is non-negative after adding a half rounds half up, like the scalar cast
+                    v = _mm_add_ps(_mm_mul_ps(v, scale), half);
+                    rgba = _mm_or_si128(rgba, _mm_slli_epi32(_mm_cvttps_epi32(v), 8 * k));
+                }
+
+                const __m128i m(_mm_castps_si128(mask));
+                __m128i *const target(reinterpret_cast<__m128i *>(colorRow + x));
+                const __m128i old(_mm_loadu_si128(target));
+                _mm_storeu_si128(target, _mm_or_si128(_mm_and_si128(m, rgba), _mm_andnot_si128(m, old)));
+            }
+        }
+    }
+#endif
+
+    void rasterize(const Triangle &t, GLint x0, GLint y0, GLint x1, GLint y1)
+    {
+#if defined(SOFTWARE_RENDERER_SSE)
+        if(vectorized) {
+            rasterizeVector(t, x0, y0, x1, y1);
+            return;
+        }
+#endif
+        rasterizeScalar(t, x0, y0, x1, y1);
+    }
+
+public:
+    SoftwareRenderer(GLsizei width, GLsizei height, JobSystem &jobs)
+        : jobs(jobs), width(width), height(height), stride((width + 3) & ~3), tilesX((width + tileSize - 1) / tileSize),
+          tilesY((height + tileSize - 1) / tileSize), color(stride * height), depth(stride * height),
+          frame(FrameBlock()), material(Material()), bins(tilesX * tilesY), vectorized(true)
+    {
+    }
+
+    virtual ~SoftwareRenderer()
+    {
+    }
+
+    /** @param r, g, b, a like glClearColor; the depth is cleared to 1.
+     */
+    void clear(GLfloat r, GLfloat g, GLfloat b, GLfloat a)
+    {
+        const GLfloat c[4] = {r, g, b, a};
+        std::uint32_t rgba(0);
+        for(int k = 0; k < 4; ++k)
+            rgba |= static_cast<std::uint32_t>(std::min(std::max(c[k], 0.0f), 1.0f) * 255.0f + 0.5f) << 8 * k;
+
+        std::fill(color.begin(), color.end(), rgba);
+        std::fill(depth.begin(), depth.end(), 1.0f);
+    }
+
+    /// Projection and lights for the following draws; the view is already in the instances.
+    void setFrame(const FrameBlock &frame)
+    {
+        this->frame = frame;
+    }
+
+    void setMaterial(const Material &material)
+    {
+        this->material = material;
+    }
+
+    /** @brief Shade and set up instancecount copies of an indexed triangle mesh.
+     *  @param index triangle list, or NULL to take the vertices in order.
+     */
+    void draw(GLsizei vertexcount, const Object::Vertex *vertex, GLsizei indexcount, const GLuint *index,
+              GLsizei instancecount, const Instance *instance)
+    {
+        const std::size_t first(shaded.size());
+        const std::size_t vertices(static_cast<std::size_t>(vertexcount) * instancecount);
+        shaded.resize(first + vertices);
+
+        jobs.parallelFor(vertices, setupGrain, [&](std::size_t begin, std::size_t end) {
+            for(std::size_t i = begin; i < end; ++i)
+                shade(instance[i / vertexcount], vertex[i % vertexcount], shaded[first + i]);
+        });
+
+        const std::size_t perInstance((index != NULL ? indexcount : vertexcount) / 3);
+        const std::size_t count(perInstance * instancecount);
+        const std::size_t chunkCount((count + setupGrain - 1) / setupGrain);
+        if(chunks.size() < chunkCount)
+            chunks.resize(chunkCount);
+
+        jobs.parallelFor(count, setupGrain, [&](std::size_t begin, std::size_t end) {
+            std::vector<Triangle> &out(chunks[begin / setupGrain]);
+            out.clear();
+            for(std::size_t i = begin; i < end; ++i) {
+                const ShadedVertex *const v(&shaded[first + i / perInstance * vertexcount]);
+                const std::size_t k(i % perInstance * 3);
+                if(index != NULL)
+                    setup(v[index[k]], v[index[k + 1]], v[index[k + 2]], out);
+                else
+                    setup(v[k], v[k + 1], v[k + 2], out);
+            }
+        });
+
+        for(std::size_t c = 0; c < chunkCount; ++c)
+            triangles.insert(triangles.end(), chunks[c].begin(), chunks[c].end());
+    }
+
+    /** @brief Rasterize everything drawn since the last finish().
+     */
+    void finish()
+    {
+        for(std::vector<GLuint> &bin : bins)
+            bin.clear();
+
+        for(GLuint i = 0; i < triangles.size(); ++i) {
+            const Triangle &t(triangles[i]);
+            for(GLint ty = t.bounds[1] / tileSize; ty <= t.bounds[3] / tileSize; ++ty) {
+                for(GLint tx = t.bounds[0] / tileSize; tx <= t.bounds[2] / tileSize; ++tx)
+                    bins[ty * tilesX + tx].push_back(i);
+            }
+        }
+
+        jobs.parallelFor(bins.size(), 1, [this](std::size_t begin, std::size_t end) {
+            for(std::size_t b = begin; b < end; ++b) {
+                const GLint tx0(static_cast<GLint>(b % tilesX) * tileSize);
+                const GLint ty0(static_cast<GLint>(b / tilesX) * tileSize);
+                const GLint tx1(std::min(tx0 + tileSize, width) - 1);
+                const GLint ty1(std::min(ty0 + tileSize, height) - 1);
+
+                for(GLuint i : bins[b]) {
+                    const Triangle &t(triangles[i]);
+                    rasterize(t, std::max(t.bounds[0], tx0), std::max(t.bounds[1], ty0), std::min(t.bounds[2], tx1),
+                              std::min(t.bounds[3], ty1));
+                }
+            }
+        });
+
+        shaded.clear();
+        triangles.clear();
+    }
+
+    /** @brief The color buffer as RGBA8, bottom row first, like Framebuffer::readPixels.
+     */
+    void readPixels(std::vector<GLubyte> &pixels) const
+    {
+        pixels.resize(width * height * 4);
+        for(GLsizei y = 0; y < height; ++y)
+            std::copy(reinterpret_cast<const GLubyte *>(&color[y * stride]),
+                      reinterpret_cast<const GLubyte *>(&color[y * stride + width]), &pixels[y * width * 4]);
+    }
+
+    /** @brief Save the color buffer as a binary PPM, top row first.
+     */
+    bool writePpm(const char *name) const
+    {
+        FILE *const file(fopen(name, "wb"));
+        if(file == NULL) {
+            std::cerr << "Can't open the file." << name << std::endl;
+            return false;
+        }
+
+        fprintf(file, "P6\n%d %d\n255\n", width, height);
+        std::vector<GLubyte> row(width * 3);
+        for(GLsizei y = height - 1; y >= 0; --y) {
+            for(GLsizei x = 0; x < width; ++x) {
+                const std::uint32_t rgba(color[y * stride + x]);
+                for(int c = 0; c < 3; ++c)
+                    row[x * 3 + c] = static_cast<GLubyte>(rgba >> 8 * c);
+            }
+            fwrite(row.data(), 1, row.size(), file);
+        }
+
+        return fclose(file) == 0;
+    }
+
+    /** @brief Rasterize four pixels at a time with SSE2 where it is available
+     *  (the default), or one at a time; both give the same image.
+     */
+    void setVectorized(bool vectorized)
+    {
+        this->vectorized = vectorized;
+    }
+
+    bool isVectorized() const
+    {
+#if defined(SOFTWARE_RENDERER_SSE)
+        return vectorized;
+#else
+        return false;
+#endif
+    }
+
+    GLsizei getWidth() const
+    {
+        return width;
+    }
+
+    GLsizei getHeight() const
+    {
+        return height;
+    }
+};
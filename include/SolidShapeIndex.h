@@ -1,4 +1,4 @@
-#pragma
+#pragma once
 
 #include "ShapeIndex.h"
 
@@ -11,8 +11,20 @@ public:
     {
     }
 
+    SolidShapeIndex(GLint size, GLsizei vertexcount, const Object::Vertex *vertex, GLsizei indexcount,
+                    const GLushort *index)
+        : ShapeIndex(size, vertexcount, vertex, indexcount, index)
+    {
+    }
+
+    SolidShapeIndex(const std::shared_ptr<const Object> &object, GLsizei vertexcount, const Bounds &bounds,
+                    GLsizei indexcount, GLenum indextype)
+        : ShapeIndex(object, vertexcount, bounds, indexcount, indextype)
+    {
+    }
+
     virtual void excute() const
     {
-        glDrawElements(GL_TRIANGLES, indexcount, GL_UNSIGNED_INT, 0);
+        glDrawElements(GL_TRIANGLES, indexcount, indextype, 0);
     }
 };
\ No newline at end of file
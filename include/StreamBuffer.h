@@ -0,0 +1,189 @@
+#pragma once
+#include <GL/glew.h>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "RenderState.h"
+
+/** @brief Buffer for data rewritten every frame, split into three fenced regions.
+ *
+ *  The CPU writes region (N + 2) % 3 while the GPU may still read the two
+ *  regions before it. begin() moves to the next region and waits for the
+ *  fence placed on it by end() three frames earlier; each wait that finds
+ *  the GPU not yet done counts as a stall.
+ *
+ *  PERSISTENT maps the buffer once with glBufferStorage (GL 4.4 or
+ *  ARB_buffer_storage) as persistent and coherent. UNSYNCHRONIZED maps each
+ *  write with glMapBufferRange and relies on the fences instead of the
+ *  driver. ORPHAN reallocates the store every frame with glBufferData and
+ *  needs no fences. The constructor falls back from the preferred mode to
+ *  what the context supports.
+ */
+class StreamBuffer
+{
+public:
+    enum Mode
+    {
+        PERSISTENT,
+        UNSYNCHRONIZED,
+        ORPHAN
+    };
+
+    static const GLuint regions = 3;
+
+private:
+    const GLenum target;
+    GLuint buffer;
+
+    const GLsizeiptr regionSize;
+    Mode mode;
+
+    GLubyte *persistent;
+    GLsync fence[regions];
+
+    GLuint region;
+    GLsizeiptr used;
+
+    GLsizei stalls;
+    GLsizeiptr streamed;
+
+    StreamBuffer(const StreamBuffer &);
+    StreamBuffer &operator=(const StreamBuffer &);
+
+    void wait(GLsync &sync)
+    {
+        if(sync == 0)
+            return;
+
+        GLenum result(glClientWaitSync(sync, 0, 0));
+        if(result == GL_TIMEOUT_EXPIRED) {
+            ++stalls;
+            do
+                result = glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+            while(result == GL_TIMEOUT_EXPIRED);
+        }
+
+        glDeleteSync(sync);
+        sync = 0;
+    }
+
+public:
+    /** @param target binding used for uploads, e.g. GL_ARRAY_BUFFER.
+     *  @param regionSize bytes that can be written per frame.
+     */
+    StreamBuffer(GLenum target, GLsizeiptr regionSize, Mode preferred = PERSISTENT)
+        : target(target), regionSize(regionSize), mode(preferred), persistent(NULL), region(0), used(0), stalls(0),
+          streamed(0)
+    {
+        for(GLuint i = 0; i < regions; i++)
+            fence[i] = 0;
+
+        if(mode == PERSISTENT && !(GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage))
+            mode = UNSYNCHRONIZED;
+        if(mode == UNSYNCHRONIZED && !(GLEW_VERSION_3_2 || GLEW_ARB_sync))
+            mode = ORPHAN;
+
+        glGenBuffers(1, &buffer);
+        RenderState::get().bindBuffer(target, buffer);
+
+        if(mode == PERSISTENT) {
+            const GLbitfield flags(GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+            glBufferStorage(target, regionSize * regions, NULL, flags);
+            persistent = static_cast<GLubyte *>(glMapBufferRange(target, 0, regionSize * regions, flags));
+            if(persistent == NULL) {
+                std::cerr << "Can't map the stream buffer persistently." << std::endl;
+                exit(1);
+            }
+        } else {
+            glBufferData(target, regionSize * regions, NULL, GL_STREAM_DRAW);
+        }
+    }
+
+    virtual ~StreamBuffer()
+    {
+        for(GLuint i = 0; i < regions; i++) {
+            if(fence[i] != 0)
+                glDeleteSync(fence[i]);
+        }
+
+        if(persistent != NULL) {
+            RenderState::get().bindBuffer(target, buffer);
+            glUnmapBuffer(target);
+        }
+        RenderState::get().forgetBuffer(buffer);
+        glDeleteBuffers(1, &buffer);
+    }
+
+    /// Start writing the next region, waiting for the GPU to finish with it if needed.
+    void begin()
+    {
+        region = (region + 1) % regions;
+        used = 0;
+
+        if(mode == ORPHAN) {
+            RenderState::get().bindBuffer(target, buffer);
+            glBufferData(target, regionSize * regions, NULL, GL_STREAM_DRAW);
+        } else {
+            wait(fence[region]);
+        }
+    }
+
+    /** @brief Copy size bytes into the current region.
+     *  @return offset of the data in the buffer, or -1 if the region is full.
+     */
+    GLintptr write(const void *data, GLsizeiptr size, GLsizeiptr alignment = 16)
+    {
+        const GLsizeiptr start((used + alignment - 1) / alignment * alignment);
+        if(start + size > regionSize)
+            return -1;
+
+        const GLintptr offset(region * regionSize + start);
+
+        if(persistent != NULL) {
+            memcpy(persistent + offset, data, size);
+        } else {
+            RenderState::get().bindBuffer(target, buffer);
+            void *const map(glMapBufferRange(target, offset, size,
+                                             GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+                                                 GL_MAP_UNSYNCHRONIZED_BIT));
+            if(map == NULL)
+                return -1;
+            memcpy(map, data, size);
+            glUnmapBuffer(target);
+        }
+
+        used = start + size;
+        streamed += size;
+        return offset;
+    }
+
+    /// Fence the current region after the draws reading it have been issued.
+    void end()
+    {
+        if(mode != ORPHAN)
+            fence[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    GLuint getBuffer() const
+    {
+        return buffer;
+    }
+
+    Mode getMode() const
+    {
+        return mode;
+    }
+
+    /// Times begin() had to wait for the GPU.
+    GLsizei getStallCount() const
+    {
+        return stalls;
+    }
+
+    /// Bytes written since construction.
+    GLsizeiptr getStreamedBytes() const
+    {
+        return streamed;
+    }
+};
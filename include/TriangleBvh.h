@@ -0,0 +1,466 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <cfloat>
+#include <iostream>
+#include <vector>
+
+#include "Bounds.h"
+#include "MatrixKernel.h"
+#include "Object.h"
+#include "Ray.h"
+
+/** @brief Bounding volume hierarchy over the triangles of one mesh, for ray casts.
+ *
+ *  The tree is built top down, splitting where the surface area heuristic
+ *  over binned triangle centers is cheapest. Nodes are 32 bytes in
+ *  depth-first order with the left child right after its parent, and the
+ *  triangles are copied into leaf order as a corner and two edges, the
+ *  form the Moller-Trumbore test wants. intersect() finds the nearest hit
+ *  of one ray, visiting the nearer child first and skipping nodes beyond
+ *  the hit so far. The batched intersect() traces four rays at a time
+ *  through the same nodes with SSE; that pays off for neighbouring rays,
+ *  such as those of a pick rectangle, which mostly visit the same nodes.
+ *  Coordinates are the mesh's own; RayCaster places copies of it.
+ */
+class TriangleBvh
+{
+    struct Node
+    {
+        GLfloat min[3];
+        GLuint offset;  // first triangle of a leaf, right child of an inner node
+        GLfloat max[3];
+        GLuint count;   // triangles in a leaf, 0 for an inner node
+    };
+
+    struct Entry
+    {
+        GLuint node;
+        GLfloat t;  // where the ray enters it
+    };
+
+    static const GLuint leafSize = 4;
+    static const int bins = 12;
+
+    // deeper than this the split is at the median, so the traversal stack can't overflow
+    static const int maxDepth = 64;
+    static const int stackSize = 128;
+
+    std::vector<Node> nodes;
+    std::vector<GLfloat> triangle;  // corner and two edges, 9 floats per triangle
+    std::vector<GLuint> id;         // mesh triangle of each
+
+    TriangleBvh(const TriangleBvh &);
+    TriangleBvh &operator=(const TriangleBvh &);
+
+    static GLfloat area(const Bounds &b)
+    {
+        const GLfloat x(b.max[0] - b.min[0]), y(b.max[1] - b.min[1]), z(b.max[2] - b.min[2]);
+        return x * y + y * z + z * x;
+    }
+
+    static void setBounds(Node &node, const Bounds &b)
+    {
+        std::copy(b.min, b.min + 3, node.min);
+        std::copy(b.max, b.max + 3, node.max);
+    }
+
+    GLuint build(std::vector<GLuint> &order, const std::vector<Bounds> &box, const std::vector<GLfloat> &center,
+                 GLuint first, GLuint count, int depth)
+    {
+        const GLuint index(static_cast<GLuint>(nodes.size()));
+        nodes.push_back(Node());
+
+        Bounds b(Bounds::empty()), centers(Bounds::empty());
+        for(GLuint i = first; i < first + count; ++i) {
+            b.merge(box[order[i]]);
+            centers.merge(&center[order[i] * 3]);
+        }
+        setBounds(nodes[index], b);
+
+        int axis(0);
+        for(int k = 1; k < 3; k++) {
+            if(centers.max[k] - centers.min[k] > centers.max[axis] - centers.min[axis])
+                axis = k;
+        }
+        const GLfloat extent(centers.max[axis] - centers.min[axis]);
+
+        // small nodes become leaves, and so do a few more triangles around the same center
+        if(count <= leafSize || (extent <= 0.0f && count <= leafSize * 4)) {
+            nodes[index].offset = first;
+            nodes[index].count = count;
+            return index;
+        }
+
+        GLuint half(count / 2);
+        if(depth < maxDepth && extent > 0.0f) {
+            // bin the centers along the widest axis and sweep for the cheapest split
+            Bounds binBounds[bins];
+            GLuint binCount[bins] = {0};
+            std::fill(binBounds, binBounds + bins, Bounds::empty());
+            const GLfloat scale(bins / extent);
+            for(GLuint i = first; i < first + count; ++i) {
+                const int k(std::min(static_cast<int>((center[order[i] * 3 + axis] - centers.min[axis]) * scale),
+                                     bins - 1));
+                binBounds[k].merge(box[order[i]]);
+                ++binCount[k];
+            }
+
+            GLfloat rightArea[bins];
+            GLuint rightCount[bins];
+            Bounds right(Bounds::empty());
+            GLuint n(0);
+            for(int k = bins - 1; k > 0; --k) {
+                right.merge(binBounds[k]);
+                n += binCount[k];
+                rightArea[k] = area(right);
+                rightCount[k] = n;
+            }
+
+            GLfloat best(FLT_MAX);
+            int split(0);
+            Bounds left(Bounds::empty());
+            n = 0;
+            for(int k = 0; k < bins - 1; ++k) {
+                left.merge(binBounds[k]);
+                n += binCount[k];
+                if(n == 0 || rightCount[k + 1] == 0)
+                    continue;
+                const GLfloat cost(area(left) * n + rightArea[k + 1] * rightCount[k + 1]);
+                if(cost < best) {
+                    best = cost;
+                    split = k + 1;
+                }
+            }
+
+            // a leaf is cheaper than any split, as long as it stays small
+            if(count <= leafSize * 4 && area(b) * count <= best) {
+                nodes[index].offset = first;
+                nodes[index].count = count;
+                return index;
+            }
+
+            if(split > 0) {
+                const GLfloat limit(centers.min[axis] + split / scale);
+                const GLuint *const middle(std::partition(
+                    &order[first], &order[first] + count, [&center, axis, limit](GLuint t) {
+                        return center[t * 3 + axis] < limit;
+                    }));
+                half = static_cast<GLuint>(middle - &order[first]);
+            }
+        }
+
+        // the binning could not separate them: split at the median
+        if(half == 0 || half == count) {
+            half = count / 2;
+            const auto less = [&center, axis](GLuint a, GLuint c) {
+                return center[a * 3 + axis] < center[c * 3 + axis];
+            };
+            std::nth_element(&order[first], &order[first] + half, &order[first] + count, less);
+        }
+
+        nodes[index].count = 0;
+        build(order, box, center, first, half, depth + 1);
+        const GLuint right(build(order, box, center, first + half, count - half, depth + 1));
+        nodes[index].offset = right;
+        return index;
+    }
+
+    static bool enter(const Node &node, const GLfloat *origin, const GLfloat *inverse, GLfloat tMax, GLfloat &t)
+    {
+        GLfloat t0(0.0f), t1(tMax);
+        for(int k = 0; k < 3; k++) {
+            const GLfloat a((node.min[k] - origin[k]) * inverse[k]);
+            const GLfloat b((node.max[k] - origin[k]) * inverse[k]);
+            t0 = std::max(t0, std::min(a, b));
+            t1 = std::min(t1, std::max(a, b));
+        }
+        t = t0;
+        return t0 <= t1;
+    }
+
+    /// Moller-Trumbore against triangle i; both sides count.
+    bool hitTriangle(GLuint i, const Ray &ray, RayHit &hit) const
+    {
+        const GLfloat *const v0(&triangle[i * 9]), *const e1(v0 + 3), *const e2(v0 + 6);
+        const GLfloat *const d(ray.direction);
+
+        const GLfloat p[3] = {d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0]};
+        const GLfloat det(e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2]);
+        if(det == 0.0f)
+            return false;
+        const GLfloat inv(1.0f / det);
+
+        const GLfloat s[3] = {ray.origin[0] - v0[0], ray.origin[1] - v0[1], ray.origin[2] - v0[2]};
+        const GLfloat u((s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv);
+        if(u < 0.0f || u > 1.0f)
+            return false;
+
+        const GLfloat q[3] = {s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0]};
+        const GLfloat v((d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inv);
+        if(v < 0.0f || u + v > 1.0f)
+            return false;
+
+        const GLfloat t((e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inv);
+        if(t <= 0.0f || t >= hit.t)
+            return false;
+
+        hit.t = t;
+        hit.triangle = id[i];
+        hit.u = u;
+        hit.v = v;
+        return true;
+    }
+
+#if defined(MATRIX_KERNEL_X86)
+    static __m128 blend(__m128 mask, __m128 a, __m128 b)
+    {
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    }
+
+    /// Four rays through the tree together; a node is visited if any of them reaches it.
+    void intersect4(const Ray *ray, RayHit *hit) const
+    {
+        __m128 o[3], d[3], inverse[3];
+        for(int k = 0; k < 3; k++) {
+            o[k] = _mm_setr_ps(ray[0].origin[k], ray[1].origin[k], ray[2].origin[k], ray[3].origin[k]);
+            d[k] = _mm_setr_ps(ray[0].direction[k], ray[1].direction[k], ray[2].direction[k], ray[3].direction[k]);
+            inverse[k] = _mm_div_ps(_mm_set1_ps(1.0f), d[k]);
+        }
+
+        __m128 tHit(_mm_setr_ps(hit[0].t, hit[1].t, hit[2].t, hit[3].t));
+        __m128 uHit(_mm_setzero_ps()), vHit(_mm_setzero_ps());
+        __m128 idHit(_mm_castsi128_ps(_mm_set1_epi32(-1)));
+        const __m128 zero(_mm_setzero_ps()), one(_mm_set1_ps(1.0f));
+
+        // entry distances of the active lanes, or FLT_MAX
+        const auto enter4 = [&](const Node &node, GLfloat &tMin) -> bool {
+            __m128 t0(zero), t1(tHit);
+            for(int k = 0; k < 3; k++) {
+                const __m128 a(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min[k]), o[k]), inverse[k]));
+                const __m128 b(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max[k]), o[k]), inverse[k]));
+                t0 = _mm_max_ps(t0, _mm_min_ps(a, b));
+                t1 = _mm_min_ps(t1, _mm_max_ps(a, b));
+            }
+            const __m128 mask(_mm_cmple_ps(t0, t1));
+            if(_mm_movemask_ps(mask) == 0)
+                return false;
+
+            GLfloat t[4];
+            _mm_storeu_ps(t, blend(mask, t0, _mm_set1_ps(FLT_MAX)));
+            tMin = std::min(std::min(t[0], t[1]), std::min(t[2], t[3]));
+            return true;
+        };
+
+        Entry stack[stackSize];
+        int top(0);
+        GLfloat t;
+        if(nodes.empty() || !enter4(nodes[0], t))
+            return;
+        const Entry root = {0, t};
+        stack[top++] = root;
+
+        while(top > 0) {
+            const Entry e(stack[--top]);
+
+            GLfloat farthest[4];
+            _mm_storeu_ps(farthest, tHit);
+            if(e.t > std::max(std::max(farthest[0], farthest[1]), std::max(farthest[2], farthest[3])))
+                continue;
+
+            const Node &node(nodes[e.node]);
+            if(node.count == 0) {
+                GLfloat tl, tr;
+                const bool l(enter4(nodes[e.node + 1], tl)), r(enter4(nodes[node.offset], tr));
+                const Entry left = {e.node + 1, tl}, right = {node.offset, tr};
+                if(l && r) {
+                    stack[top++] = tl <= tr ? right : left;
+                    stack[top++] = tl <= tr ? left : right;
+                } else if(l) {
+                    stack[top++] = left;
+                } else if(r) {
+                    stack[top++] = right;
+                }
+                continue;
+            }
+
+            for(GLuint i = node.offset; i < node.offset + node.count; ++i) {
+                const GLfloat *const c(&triangle[i * 9]);
+                const __m128 v0[3] = {_mm_set1_ps(c[0]), _mm_set1_ps(c[1]), _mm_set1_ps(c[2])};
+                const __m128 e1[3] = {_mm_set1_ps(c[3]), _mm_set1_ps(c[4]), _mm_set1_ps(c[5])};
+                const __m128 e2[3] = {_mm_set1_ps(c[6]), _mm_set1_ps(c[7]), _mm_set1_ps(c[8])};
+
+                const __m128 p[3] = {_mm_sub_ps(_mm_mul_ps(d[1], e2[2]), _mm_mul_ps(d[2], e2[1])),
+                                     _mm_sub_ps(_mm_mul_ps(d[2], e2[0]), _mm_mul_ps(d[0], e2[2])),
+                                     _mm_sub_ps(_mm_mul_ps(d[0], e2[1]), _mm_mul_ps(d[1], e2[0]))};
+                const __m128 det(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e1[0], p[0]), _mm_mul_ps(e1[1], p[1])),
+                                            _mm_mul_ps(e1[2], p[2])));
+                const __m128 inv(_mm_div_ps(one, det));
+
+                const __m128 s[3] = {_mm_sub_ps(o[0], v0[0]), _mm_sub_ps(o[1], v0[1]), _mm_sub_ps(o[2], v0[2])};
+                const __m128 u(_mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(s[0], p[0]), _mm_mul_ps(s[1], p[1])),
+                                                     _mm_mul_ps(s[2], p[2])),
+                                          inv));
+
+                const __m128 q[3] = {_mm_sub_ps(_mm_mul_ps(s[1], e1[2]), _mm_mul_ps(s[2], e1[1])),
+                                     _mm_sub_ps(_mm_mul_ps(s[2], e1[0]), _mm_mul_ps(s[0], e1[2])),
+                                     _mm_sub_ps(_mm_mul_ps(s[0], e1[1]), _mm_mul_ps(s[1], e1[0]))};
+                const __m128 v(_mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], q[0]), _mm_mul_ps(d[1], q[1])),
+                                                     _mm_mul_ps(d[2], q[2])),
+                                          inv));
+                const __m128 tt(_mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2[0], q[0]), _mm_mul_ps(e2[1], q[1])),
+                                                      _mm_mul_ps(e2[2], q[2])),
+                                           inv));
+
+                // comparisons with the NaNs of a zero determinant are false
+                __m128 mask(_mm_cmpneq_ps(det, zero));
+                mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero)));
+                mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), one));
+                mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpgt_ps(tt, zero), _mm_cmplt_ps(tt, tHit)));
+                if(_mm_movemask_ps(mask) == 0)
+                    continue;
+
+                tHit = blend(mask, tt, tHit);
+                uHit = blend(mask, u, uHit);
+                vHit = blend(mask, v, vHit);
+                idHit = blend(mask, _mm_castsi128_ps(_mm_set1_epi32(static_cast<int>(id[i]))), idHit);
+            }
+        }
+
+        GLfloat ts[4], us[4], vs[4];
+        GLuint ids[4];
+        _mm_storeu_ps(ts, tHit);
+        _mm_storeu_ps(us, uHit);
+        _mm_storeu_ps(vs, vHit);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(ids), _mm_castps_si128(idHit));
+        for(int r = 0; r < 4; ++r) {
+            if(ids[r] == RayHit::NONE)
+                continue;
+            hit[r].t = ts[r];
+            hit[r].triangle = ids[r];
+            hit[r].u = us[r];
+            hit[r].v = vs[r];
+        }
+    }
+#endif
+
+public:
+    /** @param index three per triangle; triangles with an index past vertexcount are left out.
+     */
+    TriangleBvh(GLsizei vertexcount, const Object::Vertex *vertex, GLsizei indexcount, const GLuint *index)
+    {
+        std::vector<Bounds> box(indexcount / 3);
+        std::vector<GLfloat> center(box.size() * 3);
+        std::vector<GLuint> order;
+        order.reserve(box.size());
+        for(GLuint t = 0; t < box.size(); ++t) {
+            if(std::max(std::max(index[t * 3], index[t * 3 + 1]), index[t * 3 + 2]) >= static_cast<GLuint>(vertexcount))
+                continue;
+            box[t] = Bounds::empty();
+            for(int c = 0; c < 3; c++)
+                box[t].merge(vertex[index[t * 3 + c]].position);
+            box[t].getCenter(&center[t * 3]);
+            order.push_back(t);
+        }
+        if(order.size() < box.size())
+            std::cerr << "Can't pick " << box.size() - order.size() << " triangles with an index past the "
+                      << vertexcount << " vertices." << std::endl;
+
+        const GLuint count(static_cast<GLuint>(order.size()));
+        if(count > 0)
+            build(order, box, center, 0, count, 0);
+
+        triangle.resize(count * 9);
+        id.resize(count);
+        for(GLuint i = 0; i < count; ++i) {
+            const GLuint t(order[i]);
+            const GLfloat *const p0(vertex[index[t * 3]].position);
+            const GLfloat *const p1(vertex[index[t * 3 + 1]].position);
+            const GLfloat *const p2(vertex[index[t * 3 + 2]].position);
+            GLfloat *const c(&triangle[i * 9]);
+            for(int k = 0; k < 3; k++) {
+                c[k] = p0[k];
+                c[3 + k] = p1[k] - p0[k];
+                c[6 + k] = p2[k] - p0[k];
+            }
+            id[i] = t;
+        }
+    }
+
+    /** @brief Shorten hit to the nearest triangle the ray meets before hit.t, if any.
+     *  @return whether hit changed; hit.instance is left alone.
+     */
+    bool intersect(const Ray &ray, RayHit &hit) const
+    {
+        const GLfloat inverse[3] = {1.0f / ray.direction[0], 1.0f / ray.direction[1], 1.0f / ray.direction[2]};
+
+        Entry stack[stackSize];
+        int top(0);
+        GLfloat t;
+        if(nodes.empty() || !enter(nodes[0], ray.origin, inverse, hit.t, t))
+            return false;
+        const Entry root = {0, t};
+        stack[top++] = root;
+
+        bool found(false);
+        while(top > 0) {
+            const Entry e(stack[--top]);
+            if(e.t > hit.t)
+                continue;
+
+            const Node &node(nodes[e.node]);
+            if(node.count > 0) {
+                for(GLuint i = node.offset; i < node.offset + node.count; ++i)
+                    found = hitTriangle(i, ray, hit) || found;
+                continue;
+            }
+
+            GLfloat tl, tr;
+            const bool l(enter(nodes[e.node + 1], ray.origin, inverse, hit.t, tl));
+            const bool r(enter(nodes[node.offset], ray.origin, inverse, hit.t, tr));
+            const Entry left = {e.node + 1, tl}, right = {node.offset, tr};
+            if(l && r) {
+                stack[top++] = tl <= tr ? right : left;
+                stack[top++] = tl <= tr ? left : right;
+            } else if(l) {
+                stack[top++] = left;
+            } else if(r) {
+                stack[top++] = right;
+            }
+        }
+        return found;
+    }
+
+    /** @brief intersect() for count rays, four at a time where SSE is available.
+     */
+    void intersect(std::size_t count, const Ray *ray, RayHit *hit) const
+    {
+        std::size_t i(0);
+#if defined(MATRIX_KERNEL_X86)
+        for(; i + 4 <= count; i += 4)
+            intersect4(ray + i, hit + i);
+#endif
+        for(; i < count; ++i)
+            intersect(ray[i], hit[i]);
+    }
+
+    Bounds getBounds() const
+    {
+        Bounds b(Bounds::empty());
+        if(!nodes.empty()) {
+            std::copy(nodes[0].min, nodes[0].min + 3, b.min);
+            std::copy(nodes[0].max, nodes[0].max + 3, b.max);
+        }
+        return b;
+    }
+
+    GLsizei getTriangleCount() const
+    {
+        return static_cast<GLsizei>(id.size());
+    }
+
+    GLsizei getNodeCount() const
+    {
+        return static_cast<GLsizei>(nodes.size());
+    }
+};
@@ -0,0 +1,98 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <cstddef>
+
+#include "Matrix.h"
+
+/** @brief C++ mirrors of the std140 uniform blocks in the shaders.
+ *
+ *  std140 rounds vec3 up to 16 bytes unless a float follows it and starts
+ *  arrays and structs on 16 bytes, so colors are stored as vec4 or as a
+ *  vec3 packed with a float. The static_asserts below keep the offsets in
+ *  step with the GLSL declarations in instanced.vert and packed.vert;
+ *  change both together. ProgramCache binds the blocks named Frame and
+ *  Object to FrameBlock::binding and ObjectBlock::binding.
+ */
+
+/** @brief A point light (position.w = 1) or a directional one (position.w = 0),
+ *  in eye coordinates.
+ *  A point light with a radius fades out as (1 - d^2 / radius^2)^2 and
+ *  reaches nothing beyond it, which lets LightGrid cull it; a radius of 0
+ *  reaches everywhere at full strength.
+ */
+struct Light
+{
+    GLfloat position[4];
+    GLfloat diffuse[4];
+    GLfloat specular[3];
+    GLfloat radius;
+
+    static Light point(GLfloat x, GLfloat y, GLfloat z, GLfloat diffuse = 1.0f, GLfloat specular = 1.0f,
+                       GLfloat radius = 0.0f)
+    {
+        const Light l = {{x, y, z, 1.0f}, {diffuse, diffuse, diffuse, 1.0f}, {specular, specular, specular}, radius};
+        return l;
+    }
+
+    /// Strength left at squared distance d2.
+    GLfloat attenuate(GLfloat d2) const
+    {
+        if(radius <= 0.0f)
+            return 1.0f;
+        const GLfloat f(std::max(1.0f - d2 / (radius * radius), 0.0f));
+        return f * f;
+    }
+};
+
+struct Material
+{
+    GLfloat diffuse[4];
+    GLfloat specular[3];
+    GLfloat shininess;
+
+    static Material make(GLfloat r, GLfloat g, GLfloat b, GLfloat specular, GLfloat shininess)
+    {
+        const Material m = {{r, g, b, 1.0f}, {specular, specular, specular}, shininess};
+        return m;
+    }
+};
+
+/// uniform Frame: updated once per frame.
+struct FrameBlock
+{
+    static const GLuint binding = 0;
+    static const int MAX_LIGHTS = 256;  // 12 KB, within the 16 KB every GL 3.3 implementation allows
+
+    GLfloat projection[16];
+    GLfloat view[16];
+    Light light[MAX_LIGHTS];
+    GLint lightCount;
+    GLint pad[3];
+
+    void setProjection(const Matrix &m)
+    {
+        std::copy(m.data(), m.data() + 16, projection);
+    }
+
+    void setView(const Matrix &m)
+    {
+        std::copy(m.data(), m.data() + 16, view);
+    }
+};
+
+/// uniform Object: one per draw, bound with glBindBufferRange.
+struct ObjectBlock
+{
+    static const GLuint binding = 1;
+
+    Material material;
+};
+
+static_assert(sizeof(Light) == 48 && offsetof(Light, radius) == 44, "std140 Light is two vec4, a vec3 and a float");
+static_assert(offsetof(Material, specular) == 16 && offsetof(Material, shininess) == 28 && sizeof(Material) == 32,
+              "std140 Material is vec4, vec3 and float");
+static_assert(offsetof(FrameBlock, view) == 64 && offsetof(FrameBlock, light) == 128 &&
+                  offsetof(FrameBlock, lightCount) == 128 + 48 * FrameBlock::MAX_LIGHTS && sizeof(FrameBlock) % 16 == 0,
+              "std140 Frame layout");
+static_assert(sizeof(ObjectBlock) % 16 == 0, "std140 Object layout");
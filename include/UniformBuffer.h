@@ -0,0 +1,115 @@
+#pragma once
+#include <GL/glew.h>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "Profiler.h"
+#include "RenderState.h"
+#include "StreamBuffer.h"
+
+/** @brief Ring of per-frame regions holding uniform block data.
+ *
+ *  Blocks pushed during a frame are staged in memory at offsets rounded up
+ *  to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, written to the frame's region of
+ *  a StreamBuffer by upload(), and bound per draw with glBindBufferRange.
+ *  The StreamBuffer fences each region and waits before reusing it, so the
+ *  regions the GPU is still reading are never overwritten. A frame that
+ *  outgrows its region replaces the StreamBuffer with one of larger
+ *  regions.
+ *
+ *  Usage: begin(); offset = push(block)...; upload(); bind(binding, offset, size)...
+ */
+class UniformBuffer
+{
+    GLint alignment;
+    GLsizeiptr regionSize;
+    std::unique_ptr<StreamBuffer> stream;
+    GLintptr base;   // of this frame's region in the buffer
+    GLsizei stalls;  // of the streams replaced so far
+
+    std::vector<GLubyte> staging;
+
+    UniformBuffer(const UniformBuffer &);
+    UniformBuffer &operator=(const UniformBuffer &);
+
+public:
+    /** @param regionSize initial bytes per frame.
+     */
+    explicit UniformBuffer(GLsizeiptr regionSize = 65536) : alignment(256), regionSize(regionSize), base(0), stalls(0)
+    {
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        this->regionSize = (regionSize + alignment - 1) / alignment * alignment;  // regions start aligned
+
+        stream.reset(new StreamBuffer(GL_UNIFORM_BUFFER, this->regionSize));
+    }
+
+    /// Start the next frame's region, waiting for the GPU to finish with it if needed.
+    void begin()
+    {
+        // the previous frame's draws have all been issued by now
+        stream->end();
+        stream->begin();
+        staging.clear();
+    }
+
+    /** @return offset of the block in this frame, for bind().
+     */
+    GLintptr push(const void *data, GLsizeiptr size)
+    {
+        const GLintptr offset((staging.size() + alignment - 1) / alignment * alignment);
+        staging.resize(offset + size);
+        memcpy(&staging[offset], data, size);
+        return offset;
+    }
+
+    template <typename T> GLintptr push(const T &block)
+    {
+        return push(&block, sizeof(T));
+    }
+
+    /// Copy everything pushed since begin() to the buffer.
+    void upload()
+    {
+        if(staging.empty())
+            return;
+
+        // new storage is not read by any frame in flight, so the old fences go with the old stream
+        if(static_cast<GLsizeiptr>(staging.size()) > regionSize) {
+            while(regionSize < static_cast<GLsizeiptr>(staging.size()))
+                regionSize *= 2;
+            stalls += stream->getStallCount();
+            stream.reset(new StreamBuffer(GL_UNIFORM_BUFFER, regionSize));
+        }
+
+        const GLintptr offset(stream->write(staging.data(), staging.size(), alignment));
+        if(offset < 0)
+            std::cerr << "Can't map the uniform buffer." << std::endl;
+        else
+            base = offset;
+        PROFILE_COUNT(UPLOAD_BYTES, staging.size());
+    }
+
+    void bind(GLuint binding, GLintptr offset, GLsizeiptr size) const
+    {
+        RenderState::get().bindBufferRange(GL_UNIFORM_BUFFER, binding, stream->getBuffer(), base + offset, size);
+    }
+
+    template <typename T> void bind(GLintptr offset) const
+    {
+        bind(T::binding, offset, sizeof(T));
+    }
+
+    /// Times begin() had to wait for the GPU.
+    GLsizei getStallCount() const
+    {
+        return stalls + stream->getStallCount();
+    }
+
+    /// Bytes pushed this frame, including alignment padding.
+    GLsizeiptr getSize() const
+    {
+        return static_cast<GLsizeiptr>(staging.size());
+    }
+};
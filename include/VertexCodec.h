@@ -0,0 +1,119 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <cmath>
+
+#include "Bounds.h"
+#include "Object.h"
+
+/** @brief Conversion between Object::Vertex and Object::PackedVertex.
+ *
+ *  Positions are stored as 16-bit unsigned normalized values relative to
+ *  the mesh bounds, so the error per axis is about half a step,
+ *  extent / 131070. Normals are mapped onto an octahedron and stored as two
+ *  16-bit signed normalized values; the angular error stays below 0.05
+ *  degrees. Together they halve the vertex size from 24 to 12 bytes.
+ */
+class VertexCodec
+{
+    static GLushort quantizeUnit(GLfloat v)
+    {
+        return static_cast<GLushort>(floor(std::max(0.0f, std::min(1.0f, v)) * 65535.0f + 0.5f));
+    }
+
+    static GLshort quantizeSigned(GLfloat v)
+    {
+        return static_cast<GLshort>(floor(std::max(-1.0f, std::min(1.0f, v)) * 32767.0f + 0.5f));
+    }
+
+    static GLfloat signNotZero(GLfloat v)
+    {
+        return v >= 0.0f ? 1.0f : -1.0f;
+    }
+
+public:
+    /** @brief Dequantization parameters: position = offset + scale * packed / 65535.
+     */
+    struct Range
+    {
+        GLfloat offset[3];
+        GLfloat scale[3];
+    };
+
+    static void encodeNormal(const GLfloat *n, GLshort *e)
+    {
+        const GLfloat l1(fabs(n[0]) + fabs(n[1]) + fabs(n[2]));
+        if(l1 == 0.0f) {
+            e[0] = e[1] = 0;
+            return;
+        }
+
+        GLfloat x(n[0] / l1), y(n[1] / l1);
+        if(n[2] < 0.0f) {
+            const GLfloat ox((1.0f - fabs(y)) * signNotZero(x));
+            const GLfloat oy((1.0f - fabs(x)) * signNotZero(y));
+            x = ox;
+            y = oy;
+        }
+
+        e[0] = quantizeSigned(x);
+        e[1] = quantizeSigned(y);
+    }
+
+    /** @brief Same decoding as packed.vert.
+     */
+    static void decodeNormal(const GLshort *e, GLfloat *n)
+    {
+        const GLfloat x(std::max(e[0] / 32767.0f, -1.0f));
+        const GLfloat y(std::max(e[1] / 32767.0f, -1.0f));
+
+        n[0] = x;
+        n[1] = y;
+        n[2] = 1.0f - fabs(x) - fabs(y);
+        if(n[2] < 0.0f) {
+            n[0] = (1.0f - fabs(y)) * signNotZero(x);
+            n[1] = (1.0f - fabs(x)) * signNotZero(y);
+        }
+
+        const GLfloat l(sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]));
+        for(int k = 0; k < 3; k++)
+            n[k] /= l;
+    }
+
+    static Range range(const Bounds &bounds)
+    {
+        Range r;
+        for(int k = 0; k < 3; k++) {
+            r.offset[k] = bounds.min[k];
+            r.scale[k] = bounds.max[k] - bounds.min[k];
+        }
+        return r;
+    }
+
+    static void pack(const Range &r, const Object::Vertex &v, Object::PackedVertex &p)
+    {
+        for(int k = 0; k < 3; k++)
+            p.position[k] = r.scale[k] > 0.0f ? quantizeUnit((v.position[k] - r.offset[k]) / r.scale[k]) : 0;
+        p.position[3] = 0;
+
+        encodeNormal(v.normal, p.normal);
+    }
+
+    static void unpack(const Range &r, const Object::PackedVertex &p, Object::Vertex &v)
+    {
+        for(int k = 0; k < 3; k++)
+            v.position[k] = r.offset[k] + r.scale[k] * (p.position[k] / 65535.0f);
+
+        decodeNormal(p.normal, v.normal);
+    }
+
+    /** @brief Pack a whole mesh; returns the range the shader needs.
+     */
+    static Range pack(GLsizei vertexcount, const Object::Vertex *vertex, Object::PackedVertex *packed)
+    {
+        const Range r(range(Bounds::fromVertices(vertexcount, vertex)));
+        for(GLsizei i = 0; i < vertexcount; ++i)
+            pack(r, vertex[i], packed[i]);
+        return r;
+    }
+};
@@ -1,8 +1,11 @@
 #pragma once
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include <algorithm>
 #include <iostream>
 
+#include "RenderState.h"
+
 class Window
 {
     GLFWwindow *const window;
@@ -13,12 +16,27 @@ class Window
 
     GLfloat location[2];
 
+    GLfloat click[2];
+
+    bool pressed;
+
+    bool clicked;
+
     int keyStatus;
 
+    static GLFWwindow *create(int width, int height, const char *title, bool visible)
+    {
+        glfwWindowHint(GLFW_VISIBLE, visible ? GLFW_TRUE : GLFW_FALSE);
+        return glfwCreateWindow(width, height, title, NULL, NULL);
+    }
+
 public:
-    Window(int width = 640, int height = 480, const char *title = "Hello!")
-        : window(glfwCreateWindow(width, height, title, NULL, NULL)), scale(100.0f), location{0.0f, 0.0f},
-          keyStatus(GLFW_RELEASE)
+    /** @param visible false creates a hidden window that only provides the
+     *  GL context, for offscreen rendering; vsync is turned off as well.
+     */
+    Window(int width = 640, int height = 480, const char *title = "Hello!", bool visible = true)
+        : window(create(width, height, title, visible)), scale(100.0f), location{0.0f, 0.0f}, click{0.0f, 0.0f},
+          pressed(false), clicked(false), keyStatus(GLFW_RELEASE)
     {
         if(window == NULL) {
             std::cerr << "Cant't create GLFW window." << std::endl;
@@ -33,7 +51,7 @@ public:
             exit(1);
         }
 
-        glfwSwapInterval(1);
+        glfwSwapInterval(visible ? 1 : 0);
 
         glfwSetWindowSizeCallback(window, resize);
 
@@ -65,12 +83,15 @@ public:
           location[1] += 2.0f / size[1];
         }
 
-        if(glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_1) != GLFW_RELEASE) {
+        const bool down(glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_1) != GLFW_RELEASE);
+        clicked = down && !pressed;
+        pressed = down;
+        if(clicked) {
             double x, y;
             glfwGetCursorPos(window, &x, &y);
 
-            location[0] = static_cast<GLfloat>(x) * 2.0f / size[0] - 1.0f;
-            location[1] = 1.0f - static_cast<GLfloat>(y) * 2.0f / size[1];
+            click[0] = static_cast<GLfloat>(x) * 2.0f / size[0] - 1.0f;
+            click[1] = 1.0f - static_cast<GLfloat>(y) * 2.0f / size[1];
         }
 
         return !glfwWindowShouldClose(window) && !glfwGetKey(window, GLFW_KEY_ESCAPE);
@@ -81,12 +102,28 @@ public:
         glfwSwapBuffers(window);
     }
 
+    /// Size of the default framebuffer in pixels, larger than getSize() on high-DPI displays.
+    void getFramebufferSize(GLsizei &width, GLsizei &height) const
+    {
+        glfwGetFramebufferSize(window, &width, &height);
+    }
+
+    /** @brief Render into the window again after an offscreen pass.
+     */
+    void bind() const
+    {
+        GLsizei width, height;
+        getFramebufferSize(width, height);
+        RenderState::get().bindFramebuffer(GL_FRAMEBUFFER, 0);
+        RenderState::get().viewport(0, 0, width, height);
+    }
+
     static void resize(GLFWwindow *window, int width, int height)
     {
         int fbwidth, fbheight;
         glfwGetFramebufferSize(window, &fbwidth, &fbheight);
 
-        glViewport(0, 0, fbwidth, fbheight);
+        RenderState::get().viewport(0, 0, fbwidth, fbheight);
 
         Window *const instance(static_cast<Window *>(glfwGetWindowUserPointer(window)));
 
@@ -128,4 +165,18 @@ public:
     {
         return location;
     }
+
+    /** @brief Where the mouse button went down during the last poll, in
+     *  normalized device coordinates as Ray::unproject() takes them. Each
+     *  click is taken once.
+     *  @return false if there is none.
+     */
+    bool takeClick(GLfloat *ndc)
+    {
+        if(!clicked)
+            return false;
+        std::copy(click, click + 2, ndc);
+        clicked = false;
+        return true;
+    }
 };
\ No newline at end of file
@@ -0,0 +1,74 @@
+#version 150 core
+struct Light
+{
+    vec4 position;
+    vec4 diffuse;
+    vec3 specular;
+    float radius;
+};
+layout(std140) uniform Frame
+{
+    mat4 projection;
+    mat4 view;
+    Light light[256];
+    int lightCount;
+};
+uniform sampler2D normalTexture;
+uniform sampler2D albedoTexture;
+uniform sampler2D specularTexture;
+uniform sampler2D depthTexture;
+uniform samplerBuffer lightTexture;
+uniform isamplerBuffer clusterTexture;
+uniform isamplerBuffer indexTexture;
+uniform vec2 viewportSize;
+uniform int tileSize;
+uniform ivec2 tileCount;
+uniform int sliceCount;
+uniform vec2 sliceTransform;
+out vec4 fragment;
+float attenuate(float radius, vec3 D)
+{
+    if(radius <= 0.0)
+        return 1.0;
+    float f = max(1.0 - dot(D, D) / (radius * radius), 0.0);
+    return f * f;
+}
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(depthTexture, pixel, 0).r;
+    if(depth == 1.0)
+        discard;
+    vec4 normal = texelFetch(normalTexture, pixel, 0);
+    vec3 albedo = texelFetch(albedoTexture, pixel, 0).rgb;
+    vec3 reflectance = texelFetch(specularTexture, pixel, 0).rgb;
+
+    // eye coordinates from the depth and the perspective projection
+    float z = -projection[3][2] / (depth * 2.0 - 1.0 + projection[2][2]);
+    vec2 ndc = gl_FragCoord.xy / viewportSize * 2.0 - 1.0;
+    vec3 P = vec3(-z * (ndc + vec2(projection[2][0], projection[2][1])) / vec2(projection[0][0], projection[1][1]), z);
+    vec3 N = normal.xyz;
+    vec3 V = -normalize(P);
+
+    // the lights binned by LightGrid into this pixel's cluster
+    int slice = clamp(int(floor(log(-z) * sliceTransform.x + sliceTransform.y)), 0, sliceCount - 1);
+    ivec2 tile = pixel / tileSize;
+    ivec2 range = texelFetch(clusterTexture, (slice * tileCount.y + tile.y) * tileCount.x + tile.x).xy;
+
+    vec3 Idiff = vec3(0.0);
+    vec3 Ispec = vec3(0.0);
+    for(int i = range.x; i < range.x + range.y; ++i)
+    {
+        int l = texelFetch(indexTexture, i).r * 3;
+        vec4 position = texelFetch(lightTexture, l);
+        vec3 diffuse = texelFetch(lightTexture, l + 1).rgb;
+        vec4 specular = texelFetch(lightTexture, l + 2);
+        vec3 D = position.xyz - P * position.w;
+        vec3 L = normalize(D);
+        vec3 H = normalize(L + V);
+        float A = attenuate(specular.w, D);
+        Idiff += A * max(dot(N, L), 0.0) * albedo * diffuse;
+        Ispec += A * pow(max(dot(N, H), 0.0), normal.w) * reflectance * specular.rgb;
+    }
+    fragment = vec4(Idiff + Ispec, 1.0);
+}
@@ -0,0 +1,6 @@
+#version 150 core
+void main()
+{
+    // one triangle covering the viewport
+    gl_Position = vec4(vec2(gl_VertexID & 1, gl_VertexID >> 1) * 4.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,21 @@
+#version 150 core
+struct Material
+{
+    vec4 diffuse;
+    vec3 specular;
+    float shininess;
+};
+layout(std140) uniform Object
+{
+    Material material;
+};
+in vec3 N;
+out vec4 fragment;
+out vec4 albedo;
+out vec4 specular;
+void main()
+{
+    fragment = vec4(normalize(N), material.shininess);
+    albedo = material.diffuse;
+    specular = vec4(material.specular, 1.0);
+}
@@ -0,0 +1,25 @@
+#version 150 core
+struct Light
+{
+    vec4 position;
+    vec4 diffuse;
+    vec3 specular;
+    float radius;
+};
+layout(std140) uniform Frame
+{
+    mat4 projection;
+    mat4 view;
+    Light light[256];
+    int lightCount;
+};
+in vec4 position;
+in vec3 normal;
+in mat4 instanceModelview;
+in mat3 instanceNormalMatrix;
+out vec3 N;
+void main()
+{
+    N = instanceNormalMatrix * normal;
+    gl_Position = projection * (instanceModelview * position);
+}
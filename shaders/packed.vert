@@ -0,0 +1,65 @@
+#version 150 core
+struct Light
+{
+    vec4 position;
+    vec4 diffuse;
+    vec3 specular;
+    float radius;
+};
+struct Material
+{
+    vec4 diffuse;
+    vec3 specular;
+    float shininess;
+};
+layout(std140) uniform Frame
+{
+    mat4 projection;
+    mat4 view;
+    Light light[256];
+    int lightCount;
+};
+layout(std140) uniform Object
+{
+    Material material;
+};
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+in vec4 position;
+in vec2 normal;
+in mat4 instanceModelview;
+in mat3 instanceNormalMatrix;
+out vec3 Idiff;
+out vec3 Ispec;
+vec3 decodeNormal(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if(n.z < 0.0)
+        n.xy = (1.0 - abs(e.yx)) * vec2(e.x >= 0.0 ? 1.0 : -1.0, e.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+float attenuate(Light l, vec3 D)
+{
+    if(l.radius <= 0.0)
+        return 1.0;
+    float f = max(1.0 - dot(D, D) / (l.radius * l.radius), 0.0);
+    return f * f;
+}
+void main()
+{
+    vec4 P = instanceModelview * vec4(positionOffset + positionScale * position.xyz, 1.0);
+    vec3 N = normalize(instanceNormalMatrix * decodeNormal(normal));
+    vec3 V = -normalize(P.xyz);
+    Idiff = vec3(0.0);
+    Ispec = vec3(0.0);
+    for(int i = 0; i < lightCount; ++i)
+    {
+        vec3 D = (light[i].position * P.w - P * light[i].position.w).xyz;
+        vec3 L = normalize(D);
+        vec3 H = normalize(L + V);
+        float A = attenuate(light[i], D);
+        Idiff += A * max(dot(N, L), 0.0) * material.diffuse.rgb * light[i].diffuse.rgb;
+        Ispec += A * pow(max(dot(N, H), 0.0), material.shininess) * material.specular * light[i].specular;
+    }
+    gl_Position = projection * P;
+}
@@ -0,0 +1,30 @@
+#include "HeapCounter.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<std::size_t> count(0);
+
+std::size_t HeapCounter::getCount()
+{
+    return count.load(std::memory_order_relaxed);
+}
+
+void *operator new(std::size_t size)
+{
+    count.fetch_add(1, std::memory_order_relaxed);
+    void *const p(malloc(size > 0 ? size : 1));
+    if(p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    free(p);
+}
@@ -1,137 +1,57 @@
+#include "AssetLoader.h"
+#include "Bvh.h"
+#include "DeferredRenderer.h"
+#include "FrameTimer.h"
+#include "FrameArena.h"
+#include "FramePacket.h"
+#include "Framebuffer.h"
+#include "Frustum.h"
+#include "GpuCuller.h"
+#include "HeapCounter.h"
+#include "InstancedShape.h"
+#include "JobSystem.h"
+#include "LodSelector.h"
+#include "Mat.h"
 #include "Matrix.h"
+#include "MeshLoader.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "OcclusionCuller.h"
+#include "PooledShape.h"
+#include "ProgramCache.h"
+#include "Profiler.h"
+#include "RayCaster.h"
+#include "RenderQueue.h"
+#include "RenderState.h"
+#include "SceneGraph.h"
 #include "Shape.h"
 #include "ShapeIndex.h"
 #include "SolidShape.h"
 #include "SolidShapeIndex.h"
+#include "SoftwareRenderer.h"
+#include "StreamBuffer.h"
+#include "UniformBlock.h"
+#include "UniformBuffer.h"
+#include "VertexCodec.h"
 #include "Window.h"
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
 #include <vector>
 
-GLboolean printShaderInfoLog(GLuint shader, const char *str)
-{
-    GLint status;
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
-    if(status == GL_FALSE) {
-        std::cerr << "Compile error in " << str << std::endl;
-    }
-
-    GLsizei bufSize;
-    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &bufSize);
-    if(bufSize > 1) {
-        std::vector<GLchar> infoLog(bufSize);
-        GLsizei length;
-        glGetShaderInfoLog(shader, bufSize, &length, &infoLog[0]);
-        std::cerr << &infoLog[0] << std::endl;
-    }
-
-    return static_cast<GLboolean>(status);
-}
-
-GLboolean printProgramInfoLog(GLuint program)
-{
-    GLint status;
-    glGetProgramiv(program, GL_LINK_STATUS, &status);
-    if(status == GL_FALSE)
-        std::cerr << "Link error." << std::endl;
-
-    GLsizei bufSize;
-    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &bufSize);
-    if(bufSize > 1) {
-        std::vector<GLchar> infoLog(bufSize);
-        GLsizei length;
-        glGetProgramInfoLog(program, bufSize, &length, &infoLog[0]);
-        std::cerr << &infoLog[0] << std::endl;
-    }
-
-    return static_cast<GLboolean>(status);
-}
-
-/**
- *  @param vsrc vertex shader source
- *  @param fsrc fragment shader source
- */
-GLuint createProgram(const char *vsrc, const char *fsrc)
-{
-    const GLuint program(glCreateProgram());
-
-    if(vsrc != NULL) {
-        const GLuint vobj(glCreateShader(GL_VERTEX_SHADER));
-        glShaderSource(vobj, 1, &vsrc, NULL);
-        glCompileShader(vobj);
-
-        if(printShaderInfoLog(vobj, "vertex shader"))
-            glAttachShader(program, vobj);
-        glDeleteShader(vobj);
-    }
-
-    if(fsrc != NULL) {
-        const GLuint fobj(glCreateShader(GL_FRAGMENT_SHADER));
-        glShaderSource(fobj, 1, &fsrc, NULL);
-        glCompileShader(fobj);
-
-        if(printShaderInfoLog(fobj, "fragment shader"))
-            glAttachShader(program, fobj);
-        glDeleteShader(fobj);
-    }
-
-    glBindAttribLocation(program, 0, "position");
-    glBindAttribLocation(program, 1, "normal");
-    glBindFragDataLocation(program, 0, "fragment");
-    glLinkProgram(program);
-
-    if(printProgramInfoLog(program))
-        return program;
-
-    glDeleteProgram(program);
-    return 0;
-}
-
-bool readShaderSource(const char *name, std::vector<GLchar> &buffer)
-{
-    if(name == NULL)
-        return false;
-
-    std::ifstream file(name, std::ios::binary);
-    if(file.fail()) {
-        std::cerr << "Can't open the file." << name << std::endl;
-        return false;
-    }
-
-    file.seekg(0L, std::ios::end);
-    GLsizei length = static_cast<GLsizei>(file.tellg());
-
-    buffer.resize(length + 1);
-
-    file.seekg(0L, std::ios::beg);
-    file.read(buffer.data(), length);
-    buffer[length] = '\0';
-
-    if(file.fail()) {
-        std::cerr << "Can't read the file." << name << std::endl;
-        file.close();
-        return false;
-    }
-
-    file.close();
-    return true;
-}
-
-GLuint loadProgram(const char *vert, const char *frag)
-{
-    std::vector<GLchar> vsrc;
-    const bool vstat(readShaderSource(vert, vsrc));
-
-    std::vector<GLchar> fsrc;
-    const bool fstat(readShaderSource(frag, fsrc));
-
-    return vstat && fstat ? createProgram(vsrc.data(), fsrc.data()) : 0;
-}
-
 constexpr Object::Vertex rectangleVertex[] = {
     {-0.5f, -0.5f},
     {0.5f,  -0.5f},
@@ -235,81 +155,2702 @@ constexpr GLuint solidCubeIndex[] = {
     30,31,32,33,34,35 // front
 };
 
-int main()
+/**
+ *  @brief Multiply one matrix by the given number of matrices and vectors
+ *  with the scalar loop Matrix::operator* used to run and with every kernel
+ *  this CPU supports, one call per matrix and one call for the whole array,
+ *  and print the time per element and the largest difference from the scalar loop.
+ */
+void benchmarkMatrix(GLuint count)
 {
-    if(glfwInit() == GL_FALSE) {
-        std::cerr << "Can't initialize GLFW" << std::endl;
-        return 1;
+    struct Kernel
+    {
+        const char *name;
+        MatrixKernel::MultiplyFunc multiply;
+        MatrixKernel::TransformFunc transform;
+    };
+    std::vector<Kernel> kernels;
+    kernels.push_back(Kernel{"scalar", MatrixKernel::multiplyScalar, MatrixKernel::transformScalar});
+#if defined(MATRIX_KERNEL_X86)
+    kernels.push_back(Kernel{"sse", MatrixKernel::multiplySse, MatrixKernel::transformSse});
+#endif
+#if defined(MATRIX_KERNEL_AVX2)
+    if(MatrixKernel::isa() == MatrixKernel::AVX2)
+        kernels.push_back(Kernel{"avx2", MatrixKernel::multiplyAvx2, MatrixKernel::transformAvx2});
+#endif
+#if defined(MATRIX_KERNEL_NEON)
+    kernels.push_back(Kernel{"neon", MatrixKernel::multiplyNeon, MatrixKernel::transformNeon});
+#endif
+
+    std::vector<GLfloat> a(16), b(count * 16);
+    for(GLfloat &x : a)
+        x = 2.0f * rand() / RAND_MAX - 1.0f;
+    for(GLfloat &x : b)
+        x = 2.0f * rand() / RAND_MAX - 1.0f;
+
+    std::vector<GLfloat> reference[3];
+    const int repeats(10);
+    std::cout << "matrix: " << count << " elements, " << MatrixKernel::isaName() << " dispatched" << std::endl;
+
+    for(const Kernel &k : kernels) {
+        // one matrix per call as in view * model, all matrices in one call, all columns as vectors
+        std::vector<GLfloat> t[3];
+        double ns[3];
+        for(int pass = 0; pass < 3; ++pass) {
+            t[pass].resize(b.size());
+            const std::chrono::steady_clock::time_point start(std::chrono::steady_clock::now());
+            for(int r = 0; r < repeats; ++r) {
+                if(pass == 0) {
+                    for(GLuint i = 0; i < count; ++i)
+                        k.multiply(a.data(), &b[i * 16], &t[pass][i * 16], 1);
+                } else if(pass == 1) {
+                    k.multiply(a.data(), b.data(), t[pass].data(), count);
+                } else {
+                    k.transform(a.data(), b.data(), t[pass].data(), count * 4);
+                }
+            }
+            ns[pass] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() /
+                       (repeats * (pass == 2 ? count * 4 : count));
+        }
+
+        GLfloat error(0.0f);
+        for(int pass = 0; pass < 3; ++pass) {
+            if(reference[pass].empty())
+                reference[pass] = t[pass];
+            for(std::size_t i = 0; i < b.size(); ++i)
+                error = std::max(error, std::fabs(t[pass][i] - reference[pass][i]));
+        }
+
+        std::cout << k.name << ": " << ns[0] << " ns per multiply, " << ns[1] << " ns per batched multiply, "
+                  << ns[2] << " ns per vector, largest difference " << error << std::endl;
     }
+}
 
-    atexit(glfwTerminate);
+/**
+ *  @brief Stream 4 MB per frame for the given number of frames with each
+ *  StreamBuffer mode and with glBufferSubData, and print the upload rate.
+ *  Every upload is copied to another buffer so the GPU really reads it.
+ */
+void benchmarkStream(GLuint frames)
+{
+    const GLsizeiptr size(4 << 20);
+    const std::vector<GLubyte> data(size, 1);
 
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    GLuint sink;
+    glGenBuffers(1, &sink);
+    RenderState::get().bindBuffer(GL_COPY_WRITE_BUFFER, sink);
+    glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STREAM_COPY);
 
-    Window window;
+    const char *const name[] = {"persistent", "unsynchronized", "orphan"};
+    const GLdouble megabytes(static_cast<GLdouble>(size) * frames / (1 << 20));
 
-    glClearColor(1.0f, 1.0f, 1.0f, 0.0f);
+    for(int m = StreamBuffer::PERSISTENT; m <= StreamBuffer::ORPHAN; ++m) {
+        StreamBuffer stream(GL_COPY_READ_BUFFER, size, static_cast<StreamBuffer::Mode>(m));
 
-    glFrontFace(GL_CCW);
-    glCullFace(GL_BACK);
-    glEnable(GL_CULL_FACE);
+        glFinish();
+        const GLdouble start(glfwGetTime());
+        for(GLuint frame = 0; frame < frames; ++frame) {
+            stream.begin();
+            const GLintptr offset(stream.write(data.data(), size));
+            RenderState::get().bindBuffer(GL_COPY_READ_BUFFER, stream.getBuffer());
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset, 0, size);
+            stream.end();
+        }
+        glFinish();
+        const GLdouble seconds(glfwGetTime() - start);
 
-    // depth buffer
-    glClearDepth(1.0);
-    glDepthFunc(GL_LESS);
-    glEnable(GL_DEPTH_TEST);
+        std::cout << name[stream.getMode()] << ": " << megabytes / seconds << " MB/s, " << stream.getStallCount()
+                  << " stalls" << std::endl;
+    }
 
-    const GLuint program(loadProgram("../shaders/point.vert", "../shaders/point.frag"));
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    RenderState::get().bindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glBufferData(GL_COPY_READ_BUFFER, size, NULL, GL_STREAM_DRAW);
 
-    const GLint modelviewLoc(glGetUniformLocation(program, "modelview"));
-    const GLint projectionLoc(glGetUniformLocation(program, "projection"));
-    const GLint normalMatrixLoc(glGetUniformLocation(program, "normalMatrix"));
+    glFinish();
+    const GLdouble start(glfwGetTime());
+    for(GLuint frame = 0; frame < frames; ++frame) {
+        glBufferSubData(GL_COPY_READ_BUFFER, 0, size, data.data());
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, size);
+    }
+    glFinish();
+    std::cout << "glBufferSubData: " << megabytes / (glfwGetTime() - start) << " MB/s" << std::endl;
 
-    std::unique_ptr<const Shape> shape(new SolidShapeIndex(3, 36, solidCubeVertex, 36, solidCubeIndex));
+    RenderState::get().forgetBuffer(buffer);
+    glDeleteBuffers(1, &buffer);
+    RenderState::get().forgetBuffer(sink);
+    glDeleteBuffers(1, &sink);
+}
 
-    glfwSetTime(0.0);
+/// Log what MeshOptimizer did to a mesh.
+void reportOptimize(const char *name, const MeshOptimizer::Stats &stats)
+{
+    std::clog << name << ": " << stats.vertexBefore << " -> " << stats.vertexAfter << " vertices, ACMR "
+              << stats.acmrBefore << " -> " << stats.acmrAfter << ", ATVR " << stats.atvrBefore << " -> "
+              << stats.atvrAfter << std::endl;
+}
 
-    while(window) {
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+/**
+ *  @brief Load the given model, or the cube if name is NULL.
+ *  The optimizer statistics are logged whenever the mesh is optimized,
+ *  which for a model is only when its cache has to be rebuilt.
+ */
+bool loadMesh(const char *name, MeshData &mesh)
+{
+    if(name != NULL) {
+        MeshOptimizer::Stats stats;
+        stats.vertexBefore = 0;
+        if(!MeshLoader::load(name, mesh, 0, &stats))
+            return false;
+        if(stats.vertexBefore > 0)
+            reportOptimize(name, stats);
+        return true;
+    }
+
+    // weld the 36 cube vertices down to 24 and reorder them for the vertex cache
+    std::vector<Object::Vertex> vertex(solidCubeVertex, solidCubeVertex + 36);
+    std::vector<GLuint> index(solidCubeIndex, solidCubeIndex + 36);
+    reportOptimize("cube", MeshOptimizer::optimize(vertex, index));
+    mesh.assign(vertex, index);
+    return true;
+}
+
+/// The camera looks at the origin, where the objects are.
+Matrix cameraView()
+{
+    return Matrix::lookat(3.0f, 4.0f, 5.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f);
+}
+
+/**
+ *  @brief The lights and the material shared by the GL and software renderers.
+ *  @param lights every light, in eye coordinates; the Frame block holds the
+ *  first FrameBlock::MAX_LIGHTS of them, which is all the forward path sees.
+ *  @param count 0 for the single light in front of the camera, or that many
+ *  colored lights with a radius scattered around the objects.
+ */
+void setupLighting(FrameBlock &frameBlock, ObjectBlock &objectBlock, std::vector<Light> &lights, GLsizei count = 0)
+{
+    lights.clear();
+    if(count == 0)
+        lights.push_back(Light::point(0.0f, 0.0f, 5.0f));
+
+    // dimmer as they get more numerous, so the scene stays about as bright
+    const Matrix view(cameraView());
+    const GLfloat intensity(std::min(4.0f / std::sqrt(static_cast<GLfloat>(std::max(count, 1))), 1.0f));
+    // the same lights every run, so the paths can be compared, without reseeding rand() for anyone else
+    std::mt19937 random(1);
+    std::uniform_real_distribution<GLfloat> unit(0.0f, 1.0f);
+    for(GLsizei i = 0; i < count; ++i) {
+        const GLfloat p[4] = {6.0f * unit(random) - 3.0f, 4.0f * unit(random) - 2.0f, 7.0f * unit(random) - 2.0f,
+                              1.0f};
+        GLfloat q[4];
+        view.transform(p, q, 1);
+
+        Light light(Light::point(q[0], q[1], q[2], intensity, intensity, 2.5f));
+        for(int k = 0; k < 3; ++k)
+            light.diffuse[k] *= 0.25f + 0.75f * unit(random);
+        lights.push_back(light);
+    }
+
+    frameBlock.lightCount = std::min(static_cast<GLint>(lights.size()), static_cast<GLint>(FrameBlock::MAX_LIGHTS));
+    std::copy(lights.begin(), lights.begin() + frameBlock.lightCount, frameBlock.light);
+    objectBlock.material = Material::make(0.6f, 0.6f, 0.2f, 0.3f, 30.0f);
+}
+
+/**
+ *  @brief A mesh and its simplified levels, decoded into the arrays that go
+ *  to GL. decodeModel() builds it on any thread; uploadModel() turns it into
+ *  shapes on the GL thread. Streamed, readModel() and decodeLevel() build it
+ *  a level at a time and uploadLevel() adds each level's shape.
+ */
+struct Model
+{
+    MeshData mesh;  // level 0, also drawn into the occlusion buffer
+    std::vector<MeshSimplifier::Level> simplified;
+    std::vector<GLfloat> levelError;
+
+    // every level is quantized into the same range so they share the uniforms
+    VertexCodec::Range packRange;
+
+    // per level; index16 is empty where an index needs 32 bits, packedVertex unless packed
+    std::vector<std::vector<GLushort>> index16;
+    std::vector<std::vector<Object::PackedVertex>> packedVertex;
+
+    GLsizei getVertexCount(std::size_t l) const
+    {
+        return l == 0 ? mesh.getVertexCount() : static_cast<GLsizei>(simplified[l - 1].vertex.size());
+    }
+
+    const Object::Vertex *getVertex(std::size_t l) const
+    {
+        return l == 0 ? mesh.getVertex() : simplified[l - 1].vertex.data();
+    }
+
+    GLsizei getIndexCount(std::size_t l) const
+    {
+        return l == 0 ? mesh.getIndexCount() : static_cast<GLsizei>(simplified[l - 1].index.size());
+    }
+
+    const GLuint *getIndex(std::size_t l) const
+    {
+        return l == 0 ? mesh.getIndex() : simplified[l - 1].index.data();
+    }
+
+    /// Bytes uploadLevel() sends to GL.
+    GLsizeiptr getLevelSize(std::size_t l) const
+    {
+        const GLsizeiptr vertexBytes(packedVertex[l].empty() ? getVertexCount(l) * sizeof(Object::Vertex)
+                                                             : packedVertex[l].size() * sizeof(Object::PackedVertex));
+        return vertexBytes +
+               (index16[l].empty() ? getIndexCount(l) * sizeof(GLuint) : index16[l].size() * sizeof(GLushort));
+    }
+};
+
+/**
+ *  @brief Load the given model, or the cube if name is NULL, simplify its
+ *  levels and find the range they are quantized into, leaving each level
+ *  for decodeLevel(). Touches no GL state.
+ */
+bool readModel(const char *meshName, bool lod, Model &model)
+{
+    if(!loadMesh(meshName, model.mesh))
+        return false;
+
+    const MeshData &mesh(model.mesh);
+
+    // level 0 is the mesh itself, the others are simplified from it
+    if(lod) {
+        model.simplified = MeshSimplifier().buildChain(
+            std::vector<Object::Vertex>(mesh.getVertex(), mesh.getVertex() + mesh.getVertexCount()),
+            std::vector<GLuint>(mesh.getIndex(), mesh.getIndex() + mesh.getIndexCount()));
+        model.simplified.erase(model.simplified.begin());
+    }
+
+    model.levelError.assign(1, 0.0f);
+    Bounds range(Bounds::fromVertices(mesh.getVertexCount(), mesh.getVertex()));
+    for(const MeshSimplifier::Level &level : model.simplified) {
+        model.levelError.push_back(level.error);
+        range.merge(Bounds::fromVertices(static_cast<GLsizei>(level.vertex.size()), level.vertex.data()));
+    }
+    model.packRange = VertexCodec::range(range);
+
+    // sized up front, so levels can be decoded on other threads while earlier ones are drawn
+    model.index16.assign(model.levelError.size(), std::vector<GLushort>());
+    model.packedVertex.assign(model.levelError.size(), std::vector<Object::PackedVertex>());
+    return true;
+}
+
+/// Prepare level l of a model from readModel() for upload. Touches no GL state.
+void decodeLevel(Model &model, std::size_t l, bool packed)
+{
+    const GLsizei vertexcount(model.getVertexCount(l));
+    if(!MeshOptimizer::shrink(model.getIndexCount(l), model.getIndex(l), vertexcount, model.index16[l]))
+        model.index16[l].clear();
 
-        glUseProgram(program);
+    if(packed) {
+        const Object::Vertex *const vertex(model.getVertex(l));
+        model.packedVertex[l].resize(vertexcount);
+        for(GLsizei v = 0; v < vertexcount; ++v)
+            VertexCodec::pack(model.packRange, vertex[v], model.packedVertex[l][v]);
+    }
+}
+
+/**
+ *  @brief Load the given model, or the cube if name is NULL, and prepare
+ *  every level for upload. Touches no GL state.
+ */
+bool decodeModel(const char *meshName, bool lod, bool packed, Model &model)
+{
+    if(!readModel(meshName, lod, model))
+        return false;
+
+    for(std::size_t l = 0; l < model.levelError.size(); ++l)
+        decodeLevel(model, l, packed);
+    return true;
+}
+
+/// Append the shape of level l of the model.
+void uploadLevel(const Model &model, std::size_t l, bool packed, std::vector<std::unique_ptr<InstancedShape>> &shapes)
+{
+    const GLsizei vertexcount(model.getVertexCount(l));
+    const Object::Vertex *const vertex(model.getVertex(l));
+    const GLsizei indexcount(model.getIndexCount(l));
+
+    const bool shortIndex(!model.index16[l].empty());
+    const GLvoid *const index(shortIndex ? static_cast<const GLvoid *>(model.index16[l].data()) : model.getIndex(l));
+    const GLenum indextype(shortIndex ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT);
+
+    std::shared_ptr<const Object> object;
+    if(packed)
+        object.reset(new Object(3, vertexcount, model.packedVertex[l].data(), indexcount, index, indextype));
+    else
+        object.reset(new Object(3, vertexcount, vertex, indexcount, index, indextype));
+
+    shapes.emplace_back(
+        new InstancedShape(object, vertexcount, Bounds::fromVertices(vertexcount, vertex), indexcount, indextype));
+}
+
+/// One shape per level of the model.
+void uploadModel(const Model &model, bool packed, std::vector<std::unique_ptr<InstancedShape>> &shapes)
+{
+    shapes.clear();
+    for(std::size_t l = 0; l < model.levelError.size(); ++l)
+        uploadLevel(model, l, packed, shapes);
+}
+
+/// Append level l of the model to a shared pool, for RenderQueue; float vertices only.
+void poolLevel(const Model &model, std::size_t l, const std::shared_ptr<MeshPool> &pool,
+               std::vector<std::unique_ptr<PooledShape>> &pooled)
+{
+    pooled.emplace_back(new PooledShape(pool, model.getVertexCount(l), model.getVertex(l), model.getIndexCount(l),
+                                        model.getIndex(l), GL_TRIANGLES));
+}
+
+/// One shape per level of the model in a shared pool.
+void poolModel(const Model &model, const std::shared_ptr<MeshPool> &pool,
+               std::vector<std::unique_ptr<PooledShape>> &pooled)
+{
+    pooled.clear();
+    for(std::size_t l = 0; l < model.levelError.size(); ++l)
+        poolLevel(model, l, pool, pooled);
+}
+
+/**
+ *  @brief Time SceneGraph::update() on a four-way tree of the given number of
+ *  nodes, once with the root changed (every node recomputed) and once with
+ *  1% of the nodes changed, and print the results.
+ */
+void benchmarkScene(GLuint nodes)
+{
+    SceneGraph scene;
+    scene.reserve(nodes);
+    for(GLuint n = 0; n < nodes; ++n) {
+        const SceneGraph::Node node(scene.create(n == 0 ? SceneGraph::NONE : (n - 1) / 4));
+        scene.setTranslation(node, 1.0f, 0.0f, 0.0f);
+        scene.setRotation(node, 0.1f, 0.0f, 1.0f, 0.0f);
+    }
+    scene.update();
+
+    const int repeats(10);
+    for(int partial = 0; partial < 2; ++partial) {
+        GLsizei updated(0);
+        std::chrono::steady_clock::duration elapsed(0);
+
+        for(int r = 0; r < repeats; ++r) {
+            if(partial) {
+                for(GLuint k = 0; k < nodes / 100; ++k)
+                    scene.setTranslation(static_cast<SceneGraph::Node>(rand() % nodes), 1.0f, 0.0f, 0.1f * r);
+            } else {
+                scene.setRotation(0, 0.1f * r, 0.0f, 1.0f, 0.0f);
+            }
+
+            const std::chrono::steady_clock::time_point start(std::chrono::steady_clock::now());
+            scene.update();
+            elapsed += std::chrono::steady_clock::now() - start;
+            updated += scene.getUpdatedCount();
+        }
+
+        const double ms(std::chrono::duration<double, std::milli>(elapsed).count() / repeats);
+        std::cout << (partial ? "partial" : "full") << " update: " << ms << " ms, " << updated / repeats
+                  << " of " << nodes << " nodes" << std::endl;
+    }
+}
+
+/// Positions of the drawn objects relative to the scene root.
+constexpr GLfloat objectPosition[][3] = {
+    {0.0f, 0.0f, 0.0f},
+    {0.0f, 0.0f, 3.0f}
+};
+
+/**
+ *  @brief Position and scale of each drawn object relative to the scene
+ *  root, four floats apiece: the objects of objectPosition, or for
+ *  --instances count smaller ones scattered through a box around them.
+ */
+void placeObjects(GLsizei count, std::vector<GLfloat> &placement)
+{
+    placement.clear();
+    if(count <= 0) {
+        for(const GLfloat *p : objectPosition)
+            placement.insert(placement.end(), {p[0], p[1], p[2], 1.0f});
+        return;
+    }
+
+    // the box stays about as full whatever the count
+    const GLfloat scale(2.0f / std::cbrt(static_cast<GLfloat>(count)));
+    std::mt19937 random(2);
+    std::uniform_real_distribution<GLfloat> unit(-1.0f, 1.0f);
+    for(GLsizei i = 0; i < count; ++i) {
+        for(int k = 0; k < 3; ++k)
+            placement.push_back(4.0f * unit(random));
+        placement.push_back(scale);
+    }
+}
+
+/** @brief Put a copy of mesh at each placement from placeObjects(), for
+ *  picking in the space of the objects' parent; the copies never move.
+ */
+void placePicker(RayCaster &picker, const MeshData &mesh, const std::vector<GLfloat> &placement)
+{
+    const std::shared_ptr<const TriangleBvh> bvh(
+        new TriangleBvh(mesh.getVertexCount(), mesh.getVertex(), mesh.getIndexCount(), mesh.getIndex()));
+    for(std::size_t i = 0; i < placement.size(); i += 4) {
+        const GLfloat *const p(&placement[i]);
+        picker.add(bvh, Matrix::translate(p[0], p[1], p[2]) * Matrix::scale(p[3], p[3], p[3]));
+    }
+    picker.update();
+}
+
+/// Objects rasterized into the occlusion buffer each frame.
+const std::size_t occluderCount(16);
+
+/**
+ *  @brief Draw the nearest visible objects into the occlusion buffer and
+ *  clear the visible flag of every object hidden behind them.
+ *  @param nearest scratch space, kept by the caller so it is not reallocated every frame.
+ */
+void cullOccluded(JobSystem &jobs, OcclusionCuller &occlusion, const Matrix &projection,
+                  const std::vector<Instance> &instance, std::vector<GLubyte> &visible, const Bounds &bounds,
+                  const MeshData &mesh, std::vector<GLuint> &nearest)
+{
+    PROFILE_SCOPE("occlusion");
+
+    nearest.clear();
+    for(GLuint i = 0; i < visible.size(); ++i) {
+        if(visible[i])
+            nearest.push_back(i);
+    }
+    const std::size_t count(std::min(nearest.size(), occluderCount));
+    // view space looks down -z, so the nearest have the largest z
+    std::partial_sort(nearest.begin(), nearest.begin() + count, nearest.end(), [&instance](GLuint a, GLuint b) {
+        return instance[a].modelview[14] > instance[b].modelview[14];
+    });
+
+    occlusion.begin(projection);
+    for(std::size_t k = 0; k < count; ++k) {
+        occlusion.addOccluder(Matrix(instance[nearest[k]].modelview), mesh.getVertexCount(), mesh.getVertex(),
+                              mesh.getIndexCount(), mesh.getIndex());
+    }
+    occlusion.end();
+
+    jobs.parallelFor(visible.size(), 256, [&](std::size_t begin, std::size_t end) {
+        for(std::size_t i = begin; i < end; ++i) {
+            if(visible[i] && !occlusion.isVisible(bounds.transform(Matrix(instance[i].modelview))))
+                visible[i] = 0;
+        }
+    });
+}
+
+/**
+ *  @brief Build the tree simulate() culls through, over the boxes of the
+ *  objects in the space of root, their parent. Root moves every frame but
+ *  the objects stay put in its space, so the tree never needs a refit
+ *  unless one of them moves on its own. The scene must be updated.
+ */
+void buildCullTree(Bvh &tree, const SceneGraph &scene, const std::vector<SceneGraph::Node> &objects,
+                   const Bounds &bounds)
+{
+    std::vector<Bounds> box(objects.size());
+    for(std::size_t i = 0; i < objects.size(); ++i) {
+        GLfloat local[16];
+        scene.getLocal(objects[i]).toArray(local);
+        box[i] = bounds.transform(Matrix(local));
+    }
+    tree.build(box);
+}
+
+/**
+ *  @brief Fill in the matrices and per-object slots of a packet whose inputs are set.
+ *  Runs on the job threads; currentLevel carries each object's level between frames.
+ *  @param root scene node moved by the arrow keys and spun over time.
+ *  @param objects the drawn nodes; none when GpuCuller keeps them.
+ *  @param tree the objects' boxes from buildCullTree().
+ *  @param occlusion culls objects hidden behind the nearest ones drawn with mesh, or NULL.
+ *  @param picker the objects relative to root, from placePicker(), to pick under a click; or NULL.
+ */
+void simulate(JobSystem &jobs, FramePacket &packet, SceneGraph &scene, SceneGraph::Node root,
+              const std::vector<SceneGraph::Node> &objects, Bvh &tree, const Bounds &bounds, LodSelector &selector,
+              std::vector<GLint> &currentLevel, OcclusionCuller *occlusion, const MeshData &mesh,
+              const RayCaster *picker)
+{
+    const GLfloat fovy(packet.scale * 0.01f);
+    const GLfloat aspect(packet.size[0] / packet.size[1]);
+    packet.projection = Matrix::perspective(fovy, aspect, 1.0f, 10.0f);
+    packet.view = cameraView();
+
+    PROFILE_SCOPE("simulate");
+
+    scene.setTranslation(root, packet.location[0], packet.location[1], 0.0f);
+    scene.setRotation(root, packet.time, 0.0f, 1.0f, 0.0f);
+    scene.update();
+
+    // the view is affine, so every modelview is an Affine product converted once for Bounds and Instance
+    const Affine<> view(Affine<>::fromArray(packet.view.data()));
+    GLfloat parent[16];
+    (view * scene.getWorld(root)).toArray(parent);
+    packet.parent = Matrix(parent);
+
+    // the picker's objects stay put relative to the root, so the ray goes into the root's space instead
+    packet.pick = RayHit::miss(1.0f);
+    if(packet.clicked && picker != NULL) {
+        PROFILE_SCOPE("pick");
+        const Matrix inverse((packet.projection * packet.parent).inverse());
+        picker->intersect(Ray::unproject(inverse, packet.click[0], packet.click[1]), packet.pick);
+    }
+
+    // the tree holds the objects in root's space, so the frustum is carried there instead
+    const Frustum frustum(packet.projection * packet.parent);
+    selector.setProjection(packet.projection, static_cast<GLsizei>(packet.size[1]));
+
+    packet.resize(objects.size());
+    std::fill(packet.visible.begin(), packet.visible.end(), 0);
+    packet.inFrustum.clear();
+    {
+        PROFILE_SCOPE("cull");
+        tree.refit();
+        tree.cull(frustum, packet.inFrustum);
+        for(GLuint i : packet.inFrustum)
+            packet.visible[i] = 1;
+    }
+
+    // in object order, so each job writes its own stretch of the packet rather than sharing cache lines
+    jobs.parallelFor(objects.size(), 64, [&](std::size_t begin, std::size_t end) {
+        PROFILE_SCOPE("select levels");
+
+        for(std::size_t i = begin; i < end; ++i) {
+            if(!packet.visible[i])
+                continue;
+
+            GLfloat modelview[16];
+            (view * scene.getWorld(objects[i])).toArray(modelview);
+            const Matrix m(modelview);
+            const Bounds viewBounds(bounds.transform(m));
+
+            currentLevel[i] = selector.select(currentLevel[i], LodSelector::distance(viewBounds));
+            packet.level[i] = currentLevel[i];
+            packet.instance[i].set(m);
+            packet.sortKey[i] = FramePacket::makeSortKey(packet.level[i], -m[14]);
+        }
+    });
+
+    packet.occlusionTested = packet.occlusionCulled = 0;
+    if(occlusion == NULL)
+        return;
+
+    cullOccluded(jobs, *occlusion, packet.projection, packet.instance, packet.visible, bounds, mesh, packet.nearest);
+    packet.occlusionTested = occlusion->getTestedCount();
+    packet.occlusionCulled = occlusion->getCulledCount();
+}
+
+/// Cubes spread over the view from 5 to 80 units away, looking down -z, seen through occlusionProjection().
+std::vector<Instance> occlusionField(GLuint count, std::mt19937 &random)
+{
+    std::uniform_real_distribution<GLfloat> unit(0.0f, 1.0f);
+    std::vector<Instance> instance(count);
+    for(Instance &i : instance) {
+        const GLfloat z(5.0f + 75.0f * unit(random));
+        const GLfloat x((2.0f * unit(random) - 1.0f) * 0.7f * z);
+        const GLfloat y((2.0f * unit(random) - 1.0f) * 0.5f * z);
+        const GLfloat s(0.5f + 1.5f * unit(random));
+        i.set(Matrix::translate(x, y, -z) * Matrix::rotate(z, 0.0f, 1.0f, 0.0f) * Matrix::scale(s, s, s));
+    }
+    return instance;
+}
+
+Matrix occlusionProjection()
+{
+    return Matrix::perspective(1.0f, 4.0f / 3.0f, 1.0f, 100.0f);
+}
+
+/**
+ *  @brief Which instances of a mesh show in a width x height image where
+ *  every pixel center takes the nearest front-facing triangle. Written apart
+ *  from OcclusionCuller, in double precision and clipping at the near plane
+ *  only, so it can check that culler at a higher resolution than its own.
+ *  @param shown resized to the instance count, 1 where an instance owns a pixel.
+ */
+void referenceVisibility(const Matrix &projection, const std::vector<Instance> &instance, const MeshData &mesh,
+                         GLsizei width, GLsizei height, std::vector<GLubyte> &shown)
+{
+    std::vector<double> depth(static_cast<std::size_t>(width) * height, 1.0);
+    std::vector<GLuint> owner(depth.size(), ~0u);
+
+    std::vector<double> clip(mesh.getVertexCount() * 4);
+    for(std::size_t i = 0; i < instance.size(); ++i) {
+        const Matrix m(projection * Matrix(instance[i].modelview));
+        for(GLsizei v = 0; v < mesh.getVertexCount(); ++v) {
+            const GLfloat *const p(mesh.getVertex()[v].position);
+            for(int r = 0; r < 4; ++r)
+                clip[v * 4 + r] = static_cast<double>(m[r]) * p[0] + static_cast<double>(m[4 + r]) * p[1] +
+                                  static_cast<double>(m[8 + r]) * p[2] + m[12 + r];
+        }
+
+        for(GLsizei t = 0; t + 2 < mesh.getIndexCount(); t += 3) {
+            // clip against z >= -w; a triangle gives at most four vertices
+            double polygon[4][4];
+            int count(0);
+            for(int k = 0; k < 3; ++k) {
+                const double *const a(&clip[mesh.getIndex()[t + k] * 4]);
+                const double *const b(&clip[mesh.getIndex()[t + (k + 1) % 3] * 4]);
+                const double da(a[2] + a[3]), db(b[2] + b[3]);
+                if(da >= 0.0)
+                    std::copy(a, a + 4, polygon[count++]);
+                if((da >= 0.0) != (db >= 0.0)) {
+                    for(int c = 0; c < 4; ++c)
+                        polygon[count][c] = a[c] + (b[c] - a[c]) * da / (da - db);
+                    ++count;
+                }
+            }
 
-        const GLfloat *const size(window.getSize());
-        const GLfloat fovy(window.getScale() * 0.01f);
-        const GLfloat aspect(size[0] / size[1]);
-        const Matrix projection(Matrix::perspective(fovy, aspect, 1.0f, 10.0f));
+            double x[4], y[4], z[4];
+            for(int k = 0; k < count; ++k) {
+                x[k] = (polygon[k][0] / polygon[k][3] * 0.5 + 0.5) * width;
+                y[k] = (polygon[k][1] / polygon[k][3] * 0.5 + 0.5) * height;
+                z[k] = polygon[k][2] / polygon[k][3] * 0.5 + 0.5;
+            }
 
-        const GLfloat *const location(window.getLocation());
-        const Matrix r(Matrix::rotate(static_cast<GLfloat>(glfwGetTime()), 0.0f, 1.0f, 0.0f));
-        const Matrix model(Matrix::translate(location[0], location[1], 0.0f) * r);
+            for(int k = 1; k + 1 < count; ++k) {
+                const int v[3] = {0, k, k + 1};
+                const double area((x[k] - x[0]) * (y[k + 1] - y[0]) - (x[k + 1] - x[0]) * (y[k] - y[0]));
+                if(area <= 0.0)
+                    continue;
 
-        const Matrix view(Matrix::lookat(3.0f, 4.0f, 5.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f));
+                // barycentric weights as planes in window space
+                double weight[3][3];
+                for(int e = 0; e < 3; ++e) {
+                    const int p(v[(e + 1) % 3]), q(v[(e + 2) % 3]);
+                    weight[e][0] = (y[p] - y[q]) / area;
+                    weight[e][1] = (x[q] - x[p]) / area;
+                    weight[e][2] = (x[p] * y[q] - x[q] * y[p]) / area;
+                }
 
-        GLfloat normalMatrix[9];
+                const GLint x0(std::max(static_cast<GLint>(std::floor(std::min({x[0], x[k], x[k + 1]}))), 0));
+                const GLint x1(std::min(static_cast<GLint>(std::ceil(std::max({x[0], x[k], x[k + 1]}))), width - 1));
+                const GLint y0(std::max(static_cast<GLint>(std::floor(std::min({y[0], y[k], y[k + 1]}))), 0));
+                const GLint y1(std::min(static_cast<GLint>(std::ceil(std::max({y[0], y[k], y[k + 1]}))), height - 1));
+                for(GLint py = y0; py <= y1; ++py) {
+                    for(GLint px = x0; px <= x1; ++px) {
+                        double d(0.0);
+                        bool inside(true);
+                        for(int e = 0; e < 3; ++e) {
+                            const double w(weight[e][0] * (px + 0.5) + weight[e][1] * (py + 0.5) + weight[e][2]);
+                            inside = inside && w >= 0.0;
+                            d += w * z[v[e]];
+                        }
+
+                        double &stored(depth[py * width + px]);
+                        if(inside && d < stored) {
+                            stored = d;
+                            owner[py * width + px] = static_cast<GLuint>(i);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    shown.assign(instance.size(), 0);
+    for(GLuint id : owner) {
+        if(id < shown.size())
+            shown[id] = 1;
+    }
+}
 
-        const Matrix modelview(view * model);
+/**
+ *  @brief Cull a dense random field of the given number of cubes against
+ *  their nearest ones and check the result against referenceVisibility()
+ *  at eight times the culler's resolution: an object culled there but
+ *  owning a pixel of the reference is a false cull.
+ */
+void benchmarkOcclusion(GLuint count)
+{
+    MeshData mesh;
+    loadMesh(NULL, mesh);
+    const Bounds bounds(Bounds::fromVertices(mesh.getVertexCount(), mesh.getVertex()));
 
-        modelview.getNormalMatrix(normalMatrix);
+    const Matrix projection(occlusionProjection());
+    std::mt19937 random(2);
+    const std::vector<Instance> instance(occlusionField(count, random));
 
-        glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, projection.data());
-        glUniformMatrix4fv(modelviewLoc, 1, GL_FALSE, modelview.data());
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, normalMatrix);
+    JobSystem jobs;
+    OcclusionCuller occlusion;
+    const Frustum frustum(projection);
+    std::vector<GLubyte> visible(count);
 
-        shape->draw();
+    const int repeats(10);
+    std::vector<GLuint> nearest;
+    const std::chrono::steady_clock::time_point start(std::chrono::steady_clock::now());
+    for(int r = 0; r < repeats; ++r) {
+        for(GLuint i = 0; i < count; ++i)
+            visible[i] = frustum.isVisible(bounds.transform(Matrix(instance[i].modelview)));
+        cullOccluded(jobs, occlusion, projection, instance, visible, bounds, mesh, nearest);
+    }
+    const double ms(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
 
-        const Matrix modelview1(modelview * Matrix::translate(0.0f, 0.0f, 3.0f));
+    std::vector<GLubyte> shown;
+    referenceVisibility(projection, instance, mesh, 2048, 1024, shown);
 
-        modelview1.getNormalMatrix(normalMatrix);
+    GLsizei hidden(0), falseCulls(0);
+    for(GLuint i = 0; i < count; ++i) {
+        hidden += !shown[i];
+        falseCulls += shown[i] && !visible[i];
+    }
 
-        glUniformMatrix4fv(modelviewLoc, 1, GL_FALSE, modelview1.data());
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, normalMatrix);
+    std::cout << "occlusion: " << occlusion.getCulledCount() << " of " << occlusion.getTestedCount()
+              << " tested objects culled (" << 100.0 * occlusion.getCulledCount() / count << "% of " << count
+              << ") in " << ms / repeats << " ms, " << occlusion.getOccluderTriangleCount() << " occluder triangles"
+              << std::endl;
+    std::cout << "reference: " << hidden << " objects hidden at 2048 x 1024, " << falseCulls << " false culls"
+              << std::endl;
+}
 
-        shape->draw();
+/// A rippled 2 x 2 square in the xz plane with (n + 1)^2 vertices and 2 n^2 triangles, for picking.
+void rippledGrid(GLuint n, std::vector<Object::Vertex> &vertex, std::vector<GLuint> &index)
+{
+    for(GLuint z = 0; z <= n; ++z) {
+        for(GLuint x = 0; x <= n; ++x) {
+            const GLfloat u(2.0f * x / n - 1.0f), v(2.0f * z / n - 1.0f);
+            const Object::Vertex p = {{u, 0.1f * std::sin(8.0f * u) * std::cos(8.0f * v), v}, {0.0f, 1.0f, 0.0f}};
+            vertex.push_back(p);
+        }
+    }
+    for(GLuint z = 0; z < n; ++z) {
+        for(GLuint x = 0; x < n; ++x) {
+            const GLuint a(z * (n + 1) + x), b(a + 1), c(a + n + 1), d(c + 1);
+            index.insert(index.end(), {a, c, b, b, c, d});
+        }
+    }
+}
 
-        window.swapBuffers();
+/** @brief The nearest t below 1 at which the ray meets a triangle of any of
+ *  the copies of a mesh, by testing every one of them; 1 if none.
+ */
+GLfloat pickEveryTriangle(const Ray &ray, const std::vector<Matrix> &model, const std::vector<Object::Vertex> &vertex,
+                          const std::vector<GLuint> &index)
+{
+    GLfloat best(1.0f);
+    for(std::size_t m = 0; m < model.size(); ++m) {
+        const Ray local(ray.transform(model[m].inverse()));
+        const GLfloat *const o(local.origin), *const d(local.direction);
+        for(std::size_t t = 0; t < index.size(); t += 3) {
+            const GLfloat *const p0(vertex[index[t]].position), *const p1(vertex[index[t + 1]].position);
+            const GLfloat *const p2(vertex[index[t + 2]].position);
+            const GLfloat e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+            const GLfloat e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+            const GLfloat q[3] = {d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2],
+                                  d[0] * e2[1] - d[1] * e2[0]};
+            const GLfloat det(e1[0] * q[0] + e1[1] * q[1] + e1[2] * q[2]);
+            if(det == 0.0f)
+                continue;
+            const GLfloat s[3] = {o[0] - p0[0], o[1] - p0[1], o[2] - p0[2]};
+            const GLfloat u((s[0] * q[0] + s[1] * q[1] + s[2] * q[2]) / det);
+            const GLfloat r[3] = {s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2],
+                                  s[0] * e1[1] - s[1] * e1[0]};
+            const GLfloat v((d[0] * r[0] + d[1] * r[1] + d[2] * r[2]) / det);
+            const GLfloat t0((e2[0] * r[0] + e2[1] * r[1] + e2[2] * r[2]) / det);
+            if(u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t0 > 0.0f && t0 < best)
+                best = t0;
+        }
     }
+    return best;
 }
 
+/**
+ *  @brief Pick into four copies of a rippled grid of the given total number
+ *  of triangles: time the tree build, single and batched rays from a block
+ *  of screen points, and the refit after moving one copy; check every hit
+ *  of the batched rays against the single ones and a sample against
+ *  testing every triangle.
+ */
+void benchmarkPicking(GLuint triangles)
+{
+    const GLuint n(std::max(static_cast<GLuint>(std::sqrt(triangles / 8.0)), 1u));
+    std::vector<Object::Vertex> vertex;
+    std::vector<GLuint> index;
+    rippledGrid(n, vertex, index);
+
+    std::chrono::steady_clock::time_point start(std::chrono::steady_clock::now());
+    const std::shared_ptr<const TriangleBvh> mesh(new TriangleBvh(static_cast<GLsizei>(vertex.size()), vertex.data(),
+                                                                  static_cast<GLsizei>(index.size()), index.data()));
+    const double buildMs(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+    RayCaster caster;
+    std::vector<Matrix> model;
+    for(int i = 0; i < 4; ++i) {
+        model.push_back(Matrix::translate(i & 1 ? 1.1f : -1.1f, 0.0f, i & 2 ? 1.1f : -1.1f) *
+                        Matrix::rotate(0.5f * i, 0.0f, 1.0f, 0.0f));
+        caster.add(mesh, model.back());
+    }
+    caster.update();
+
+    // a 64 x 64 block of screen points around the middle, in 2 x 2 quads so each four rays are neighbours
+    const Matrix inverse((Matrix::perspective(1.0f, 4.0f / 3.0f, 1.0f, 10.0f) * cameraView()).inverse());
+    const GLuint side(64);
+    std::vector<Ray> ray;
+    for(GLuint qy = 0; qy < side; qy += 2) {
+        for(GLuint qx = 0; qx < side; qx += 2) {
+            for(GLuint k = 0; k < 4; ++k) {
+                const GLfloat x((qx + (k & 1)) * 1.2f / side - 0.6f), y((qy + (k >> 1)) * 1.2f / side - 0.6f);
+                ray.push_back(Ray::unproject(inverse, x, y));
+            }
+        }
+    }
+
+    const int repeats(10);
+    std::vector<RayHit> single(ray.size()), batched(ray.size());
+    start = std::chrono::steady_clock::now();
+    for(int r = 0; r < repeats; ++r) {
+        for(std::size_t i = 0; i < ray.size(); ++i) {
+            single[i] = RayHit::miss(1.0f);
+            caster.intersect(ray[i], single[i]);
+        }
+    }
+    const double singleUs(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() /
+                          (repeats * ray.size()));
+
+    start = std::chrono::steady_clock::now();
+    for(int r = 0; r < repeats; ++r) {
+        std::fill(batched.begin(), batched.end(), RayHit::miss(1.0f));
+        caster.intersect(ray.size(), ray.data(), batched.data());
+    }
+    const double batchedUs(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() /
+                           (repeats * ray.size()));
+
+    GLsizei hits(0), differ(0);
+    for(std::size_t i = 0; i < ray.size(); ++i) {
+        hits += single[i].isHit();
+        differ += single[i].instance != batched[i].instance || single[i].triangle != batched[i].triangle;
+    }
+
+    // the reference tests every triangle of every copy
+    GLsizei wrong(0), checked(0);
+    for(std::size_t i = 0; i < ray.size(); i += 37, ++checked)
+        wrong += std::fabs(pickEveryTriangle(ray[i], model, vertex, index) - single[i].t) > 1e-5f;
+
+    // move one copy a little each time; only its branch of the instance tree is refit
+    start = std::chrono::steady_clock::now();
+    for(int r = 0; r < repeats; ++r) {
+        caster.setTransform(0, Matrix::translate(0.0f, 0.01f * r, 0.0f) * model[0]);
+        caster.update();
+    }
+    const double refitUs(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() /
+                         repeats);
+
+    std::cout << "picking: " << caster.getTriangleCount() << " triangles in " << caster.getInstanceCount()
+              << " objects, tree of " << mesh->getNodeCount() << " nodes built in " << buildMs << " ms" << std::endl;
+    std::cout << "single: " << singleUs << " us per ray, batched: " << batchedUs << " us per ray, " << hits << " of "
+              << ray.size() << " rays hit" << std::endl;
+    std::cout << "check: " << differ << " batched hits differ, " << wrong << " of " << checked
+              << " differ from testing every triangle; refit after a move: " << refitUs << " us" << std::endl;
+}
+
+/**
+ *  @brief Render the scene on the CPU without a GL context and save the first frame as a PPM.
+ *  Frames advance with a fixed timestep at the initial window size and zoom.
+ *  @return the exit status.
+ */
+int renderSoftware(const char *image, const char *meshName, GLuint frames, GLsizei lightCount)
+{
+    MeshData mesh;
+    if(!loadMesh(meshName, mesh))
+        return 1;
+
+    FrameBlock frameBlock = FrameBlock();
+    ObjectBlock objectBlock = ObjectBlock();
+    std::vector<Light> lights;
+    setupLighting(frameBlock, objectBlock, lights, lightCount);
+
+    SceneGraph scene;
+    const SceneGraph::Node root(scene.create());
+    std::vector<SceneGraph::Node> objects;
+    for(const GLfloat *p : objectPosition) {
+        objects.push_back(scene.create(root));
+        scene.setTranslation(objects.back(), p[0], p[1], p[2]);
+    }
+
+    const Bounds bounds(Bounds::fromVertices(mesh.getVertexCount(), mesh.getVertex()));
+    LodSelector selector(std::vector<GLfloat>(1, 0.0f));
+    std::vector<GLint> currentLevel(objects.size(), -1);
+    scene.update();
+    Bvh tree;
+    buildCullTree(tree, scene, objects, bounds);
+
+    JobSystem jobs;
+    SoftwareRenderer renderer(640, 480, jobs);
+    renderer.setMaterial(objectBlock.material);
+
+    FramePacket packet;
+    packet.scale = 100.0f;
+    packet.size[0] = static_cast<GLfloat>(renderer.getWidth());
+    packet.size[1] = static_cast<GLfloat>(renderer.getHeight());
+    packet.location[0] = packet.location[1] = 0.0f;
+    packet.clicked = false;
+
+    std::vector<Instance> visible;
+    std::chrono::steady_clock::duration elapsed(0);
+    for(GLuint frame = 0; frame < std::max(frames, 1u); ++frame) {
+        packet.frame = frame;
+        packet.time = frame / 60.0f;
+
+        const std::chrono::steady_clock::time_point start(std::chrono::steady_clock::now());
+        simulate(jobs, packet, scene, root, objects, tree, bounds, selector, currentLevel, NULL, mesh, NULL);
+
+        visible.clear();
+        for(std::size_t i = 0; i < objects.size(); ++i) {
+            if(packet.visible[i])
+                visible.push_back(packet.instance[i]);
+        }
+
+        frameBlock.setProjection(packet.projection);
+        renderer.setFrame(frameBlock);
+        renderer.clear(1.0f, 1.0f, 1.0f, 0.0f);
+        renderer.draw(mesh.getVertexCount(), mesh.getVertex(), mesh.getIndexCount(), mesh.getIndex(),
+                      static_cast<GLsizei>(visible.size()), visible.data());
+        renderer.finish();
+        elapsed += std::chrono::steady_clock::now() - start;
+
+        if(frame == 0 && !renderer.writePpm(image))
+            return 1;
+    }
+
+    std::cout << "software: " << std::chrono::duration<double, std::milli>(elapsed).count() / std::max(frames, 1u)
+              << " ms per frame on " << jobs.getThreadCount() << " threads" << std::endl;
+    return 0;
+}
+
+/**
+ *  @brief Draw 1k, 10k and 100k cubes for the given number of frames each,
+ *  once with a draw call per cube and its transform set as constant
+ *  attributes, as main.cpp used to, and once with a single instanced draw,
+ *  and print the draw calls, the time per frame and how many pixels differ.
+ */
+void benchmarkInstancing(GLuint frames)
+{
+    ProgramCache programs(".");
+    const GLuint program(programs.getProgram(programs.load("../shaders/instanced.vert", "../shaders/point.frag")));
+
+    MeshData mesh;
+    loadMesh(NULL, mesh);
+    // the same cube twice: one VAO without instance arrays, one with
+    const SolidShapeIndex single(3, mesh.getVertexCount(), mesh.getVertex(), mesh.getIndexCount(), mesh.getIndex());
+    InstancedShape instanced(3, mesh.getVertexCount(), mesh.getVertex(), mesh.getIndexCount(), mesh.getIndex());
+
+    UniformBuffer uniforms;
+    FrameBlock frameBlock = FrameBlock();
+    ObjectBlock objectBlock = ObjectBlock();
+    std::vector<Light> lights;
+    setupLighting(frameBlock, objectBlock, lights);
+    const Matrix view(cameraView());
+    frameBlock.setView(view);
+    frameBlock.setProjection(Matrix::perspective(1.0f, 4.0f / 3.0f, 1.0f, 10.0f));
+
+    const Framebuffer target(640, 480);
+    RenderState::get().useProgram(program);
+
+    for(GLsizei count = 1000; count <= 100000; count *= 10) {
+        std::vector<GLfloat> placement;
+        placeObjects(count, placement);
+        std::vector<Instance> instances(count);
+        for(GLsizei i = 0; i < count; ++i) {
+            const GLfloat *const p(&placement[i * 4]);
+            instances[i].set(view * Matrix::translate(p[0], p[1], p[2]) * Matrix::scale(p[3], p[3], p[3]));
+        }
+        std::cout << count << " cubes:";
+
+        std::vector<GLubyte> image[2];
+        for(int pass = 0; pass < 2; ++pass) {
+            glFinish();
+            const GLdouble start(glfwGetTime());
+            for(GLuint frame = 0; frame < frames; ++frame) {
+                target.bind();
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+                uniforms.begin();
+                const GLintptr frameOffset(uniforms.push(frameBlock));
+                const GLintptr objectOffset(uniforms.push(objectBlock));
+                uniforms.upload();
+                uniforms.bind<FrameBlock>(frameOffset);
+                uniforms.bind<ObjectBlock>(objectOffset);
+
+                if(pass == 0) {
+                    for(const Instance &i : instances) {
+                        i.apply();
+                        single.draw();
+                    }
+                } else {
+                    instanced.setInstances(instances);
+                    instanced.draw();
+                }
+            }
+            glFinish();
+
+            std::cout << (pass == 0 ? " per cube " : ", instanced ") << (pass == 0 ? count : 1) << " draws "
+                      << (glfwGetTime() - start) * 1000.0 / frames << " ms";
+            target.readPixels(image[pass]);
+        }
+
+        GLsizei differ(0);
+        for(std::size_t p = 0; p < image[0].size(); p += 4)
+            differ += !std::equal(&image[0][p], &image[0][p] + 4, &image[1][p]);
+        std::cout << ", " << differ << " pixels differ" << std::endl;
+    }
+}
+
+/**
+ *  @brief Draw 1k, 10k and 100k cubes for the given number of frames each,
+ *  spread over four meshes of one MeshPool as a scene of different parts
+ *  would be: once with a draw call per cube and its transform set as
+ *  constant attributes, and once through RenderQueue. Print the draw calls,
+ *  the CPU time to submit a frame, the time per frame and how many pixels differ.
+ *  The pool first gets a mesh released twice, and must hand its range out only once.
+ */
+void benchmarkQueue(GLuint frames)
+{
+    ProgramCache programs(".");
+    const GLuint program(programs.getProgram(programs.load("../shaders/instanced.vert", "../shaders/point.frag")));
+
+    MeshData mesh;
+    loadMesh(NULL, mesh);
+    const std::shared_ptr<MeshPool> pool(new MeshPool(3));
+
+    // a released mesh is handed out again once, however often it was released
+    const MeshPool::Handle spare(
+        pool->allocate(mesh.getVertexCount(), mesh.getVertex(), mesh.getIndexCount(), mesh.getIndex()));
+    const GLint spareVertex(pool->getRange(spare).baseVertex);
+    pool->release(spare);
+    pool->release(spare);
+
+    std::vector<std::unique_ptr<PooledShape>> parts;
+    for(int p = 0; p < 4; ++p) {
+        parts.emplace_back(new PooledShape(pool, mesh.getVertexCount(), mesh.getVertex(), mesh.getIndexCount(),
+                                           mesh.getIndex(), GL_TRIANGLES));
+    }
+
+    bool reused(parts[0]->getHandle() == spare && pool->getRange(spare).baseVertex == spareVertex);
+    for(std::size_t a = 0; a < parts.size(); ++a) {
+        for(std::size_t b = a + 1; b < parts.size(); ++b) {
+            const MeshPool::Handle ha(parts[a]->getHandle()), hb(parts[b]->getHandle());
+            reused = reused && ha != hb && pool->getRange(ha).baseVertex != pool->getRange(hb).baseVertex;
+        }
+    }
+    if(!reused)
+        std::cerr << "Can't trust the mesh pool: a released mesh was handed out twice." << std::endl;
+    RenderQueue queue;
+
+    UniformBuffer uniforms;
+    FrameBlock frameBlock = FrameBlock();
+    ObjectBlock objectBlock = ObjectBlock();
+    std::vector<Light> lights;
+    setupLighting(frameBlock, objectBlock, lights);
+    const Matrix view(cameraView());
+    frameBlock.setView(view);
+    frameBlock.setProjection(Matrix::perspective(1.0f, 4.0f / 3.0f, 1.0f, 10.0f));
+
+    const Framebuffer target(640, 480);
+
+    // the queue reorders draws, so the images only agree with a depth test
+    glClearDepth(1.0);
+    RenderState::get().depthFunc(GL_LESS);
+    RenderState::get().enable(GL_DEPTH_TEST);
+
+    for(GLsizei count = 1000; count <= 100000; count *= 10) {
+        std::vector<GLfloat> placement;
+        placeObjects(count, placement);
+        std::vector<Instance> instances(count);
+        for(GLsizei i = 0; i < count; ++i) {
+            const GLfloat *const p(&placement[i * 4]);
+            instances[i].set(view * Matrix::translate(p[0], p[1], p[2]) * Matrix::scale(p[3], p[3], p[3]));
+        }
+        std::cout << count << " cubes:";
+
+        std::vector<GLubyte> image[2];
+        for(int pass = 0; pass < 2; ++pass) {
+            GLsizei draws(0);
+            GLdouble submit(0.0);
+            glFinish();
+            const GLdouble start(glfwGetTime());
+            for(GLuint frame = 0; frame < frames; ++frame) {
+                target.bind();
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+                uniforms.begin();
+                const GLintptr frameOffset(uniforms.push(frameBlock));
+                const GLintptr objectOffset(uniforms.push(objectBlock));
+                uniforms.upload();
+                uniforms.bind<FrameBlock>(frameOffset);
+                uniforms.bind<ObjectBlock>(objectOffset);
+
+                const GLdouble begin(glfwGetTime());
+                if(pass == 0) {
+                    RenderState::get().useProgram(program);
+                    pool->bind();
+                    for(GLsizei i = 0; i < count; ++i) {
+                        instances[i].apply();
+                        pool->draw(parts[i % parts.size()]->getHandle(), GL_TRIANGLES);
+                    }
+                    draws = count;
+                } else {
+                    for(GLsizei i = 0; i < count; ++i)
+                        queue.submit(program, *parts[i % parts.size()], instances[i]);
+                    queue.flush();
+                    draws = queue.getDrawCalls();
+                }
+                submit += glfwGetTime() - begin;
+            }
+            glFinish();
+
+            std::cout << (pass == 0 ? " per cube " : queue.isIndirect() ? ", queued indirect " : ", queued instanced ")
+                      << draws << " draws, submit " << submit * 1000.0 / frames << " ms, frame "
+                      << (glfwGetTime() - start) * 1000.0 / frames << " ms";
+            target.readPixels(image[pass]);
+        }
+
+        GLsizei differ(0);
+        for(std::size_t p = 0; p < image[0].size(); p += 4)
+            differ += !std::equal(&image[0][p], &image[0][p] + 4, &image[1][p]);
+        std::cout << ", " << differ << " pixels differ" << std::endl;
+    }
+
+    RenderState::get().disable(GL_DEPTH_TEST);
+}
+
+/**
+ *  @brief Draw a grid of cubes lit by 16 to 1024 point lights at several
+ *  resolutions, forward and deferred, for the given number of frames each,
+ *  and print the time per frame. The forward path stops at FrameBlock::MAX_LIGHTS.
+ */
+void benchmarkLighting(GLuint frames)
+{
+    ProgramCache programs(".");
+    const GLuint forwardProgram(
+        programs.getProgram(programs.load("../shaders/instanced.vert", "../shaders/point.frag")));
+    const GLuint geometryProgram(
+        programs.getProgram(programs.load("../shaders/gbuffer.vert", "../shaders/gbuffer.frag")));
+    const GLuint lightingProgram(
+        programs.getProgram(programs.load("../shaders/deferred.vert", "../shaders/deferred.frag")));
+
+    MeshData mesh;
+    loadMesh(NULL, mesh);
+    std::shared_ptr<const Object> object(new Object(3, mesh.getVertexCount(), mesh.getVertex(), mesh.getIndexCount(),
+                                                    mesh.getIndex(), GL_UNSIGNED_INT));
+    InstancedShape shape(object, mesh.getVertexCount(), Bounds::fromVertices(mesh.getVertexCount(), mesh.getVertex()),
+                         mesh.getIndexCount(), GL_UNSIGNED_INT);
+
+    // a 24 x 24 grid of small cubes around the origin
+    const Matrix view(cameraView());
+    std::vector<Instance> instances(24 * 24);
+    for(GLuint i = 0; i < instances.size(); ++i) {
+        const GLfloat x((i % 24) * 0.25f - 2.875f), z((i / 24) * 0.25f - 2.875f);
+        instances[i].set(view * Matrix::translate(x, 0.0f, z) * Matrix::scale(0.1f, 0.1f, 0.1f));
+    }
+    shape.setInstances(instances);
+
+    UniformBuffer uniforms;
+    FrameBlock frameBlock = FrameBlock();
+    ObjectBlock objectBlock = ObjectBlock();
+    frameBlock.setView(view);
+    std::vector<Light> lights;
+
+    const GLsizei size[][2] = {
+        {320,  240 },
+        {640,  480 },
+        {1280, 720 },
+        {1920, 1080}
+    };
+    for(const GLsizei *s : size) {
+        const Framebuffer target(s[0], s[1]);
+        DeferredRenderer deferred(s[0], s[1]);
+        const Matrix projection(Matrix::perspective(1.0f, static_cast<GLfloat>(s[0]) / s[1], 1.0f, 10.0f));
+        frameBlock.setProjection(projection);
+
+        for(GLsizei count = 16; count <= 1024; count *= 4) {
+            setupLighting(frameBlock, objectBlock, lights, count);
+            std::cout << s[0] << "x" << s[1] << ", " << count << " lights:";
+
+            for(int pass = count <= FrameBlock::MAX_LIGHTS ? 0 : 1; pass < 2; ++pass) {
+                glFinish();
+                const GLdouble start(glfwGetTime());
+                for(GLuint frame = 0; frame < frames; ++frame) {
+                    target.bind();
+                    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+                    uniforms.begin();
+                    const GLintptr frameOffset(uniforms.push(frameBlock));
+                    const GLintptr objectOffset(uniforms.push(objectBlock));
+                    uniforms.upload();
+                    uniforms.bind<FrameBlock>(frameOffset);
+                    uniforms.bind<ObjectBlock>(objectOffset);
+
+                    if(pass == 0) {
+                        RenderState::get().useProgram(forwardProgram);
+                        shape.draw();
+                        continue;
+                    }
+
+                    deferred.bind();
+                    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                    RenderState::get().useProgram(geometryProgram);
+                    shape.draw();
+                    deferred.setLights(projection, count, lights.data());
+                    target.bind();
+                    deferred.draw(lightingProgram);
+                }
+                glFinish();
+
+                std::cout << (pass == 0 ? " forward " : " deferred ") << (glfwGetTime() - start) * 1000.0 / frames
+                          << " ms";
+            }
+            std::cout << ", " << deferred.getGrid().getAverageLights() << " lights per cluster" << std::endl;
+        }
+    }
+}
+
+/**
+ *  @brief Cull random boxes from random cameras with Frustum and Bvh and
+ *  compare both against testing the eight corners of every box in clip
+ *  space, before and after moving some of the boxes and refitting the tree.
+ *  Boxes within a rounding error of a plane are not counted.
+ *  @return whether everything matched.
+ */
+bool testCulling()
+{
+    std::mt19937 random(6);
+    std::uniform_real_distribution<GLfloat> unit(0.0f, 1.0f);
+    const auto between = [&random, &unit](GLfloat a, GLfloat b) { return a + (b - a) * unit(random); };
+
+    GLsizei mismatches(0), tested(0);
+    for(int scene = 0; scene < 20; ++scene) {
+        const GLfloat fovy(between(0.5f, 1.5f)), aspect(between(0.5f, 2.0f)), zNear(between(0.1f, 1.0f));
+        const Matrix m(Matrix::perspective(fovy, aspect, zNear, zNear + between(5.0f, 50.0f)) *
+                       Matrix::lookat(between(-10.0f, 10.0f), between(-10.0f, 10.0f), between(-10.0f, 10.0f),
+                                      between(-2.0f, 2.0f), between(-2.0f, 2.0f), between(-2.0f, 2.0f), 0.0f, 1.0f,
+                                      0.0f));
+        const Frustum frustum(m);
+
+        std::vector<Bounds> bounds(2000);
+        const auto place = [&between](Bounds &b, GLfloat range) {
+            for(int k = 0; k < 3; ++k) {
+                const GLfloat c(between(-range, range)), e(between(0.01f, 3.0f));
+                b.min[k] = c - e;
+                b.max[k] = c + e;
+            }
+        };
+        for(Bounds &b : bounds)
+            place(b, 15.0f);
+
+        Bvh bvh;
+        bvh.build(bounds);
+        for(int pass = 0; pass < 2; ++pass) {
+            // moved boxes may leave the tree's old bounds
+            if(pass == 1) {
+                for(GLuint i = 0; i < bounds.size(); i += 7) {
+                    place(bounds[i], 30.0f);
+                    bvh.update(i, bounds[i]);
+                }
+                bvh.refit();
+            }
+
+            std::vector<GLuint> visible;
+            bvh.cull(frustum, visible);
+            std::vector<GLubyte> inTree(bounds.size(), 0);
+            for(GLuint i : visible)
+                inTree[i] = 1;
+
+            for(std::size_t i = 0; i < bounds.size(); ++i) {
+                // the largest distance of a corner inside each clip plane, w + x, w - x, w + y, ...
+                double inside[6] = {-1e30, -1e30, -1e30, -1e30, -1e30, -1e30}, scale(0.0);
+                bool allInside(true);
+                for(int corner = 0; corner < 8; ++corner) {
+                    const GLfloat p[4] = {corner & 1 ? bounds[i].max[0] : bounds[i].min[0],
+                                          corner & 2 ? bounds[i].max[1] : bounds[i].min[1],
+                                          corner & 4 ? bounds[i].max[2] : bounds[i].min[2], 1.0f};
+                    double q[4];
+                    for(int r = 0; r < 4; ++r)
+                        q[r] = m[r] * p[0] + m[4 + r] * p[1] + m[8 + r] * p[2] + m[12 + r];
+                    for(int plane = 0; plane < 6; ++plane) {
+                        const double v(q[3] + (plane & 1 ? -q[plane >> 1] : q[plane >> 1]));
+                        inside[plane] = std::max(inside[plane], v);
+                        allInside = allInside && v >= 0.0;
+                        scale = std::max(scale, std::fabs(q[3]) + std::fabs(q[plane >> 1]));
+                    }
+                }
+
+                bool outside(false), close(false);
+                for(double v : inside) {
+                    outside = outside || v < 0.0;
+                    close = close || std::fabs(v) < 1e-4 * scale;
+                }
+                if(close)
+                    continue;
+
+                ++tested;
+                const Frustum::Result result(frustum.classify(bounds[i]));
+                mismatches += (result == Frustum::OUTSIDE) != outside || inTree[i] != !outside;
+                // a box straddling a plane must not be reported inside
+                mismatches += result == Frustum::INSIDE && !allInside;
+            }
+        }
+    }
+
+    std::cout << "culling: " << mismatches << " of " << tested << " boxes differ from the clip-space reference"
+              << std::endl;
+    return mismatches == 0;
+}
+
+/**
+ *  @brief Round-trip random meshes through VertexCodec and check the
+ *  documented bounds: half a quantization step per position axis plus float
+ *  rounding, and 0.05 degrees between a normal and its decoded value. The
+ *  normals include the axes and the octahedron's folded edges.
+ *  @return whether every vertex stayed within the bounds.
+ */
+bool testCodec()
+{
+    std::mt19937 random(9);
+    std::uniform_real_distribution<GLfloat> unit(-1.0f, 1.0f);
+
+    const GLfloat maxAngle(0.05f * 3.14159265f / 180.0f);
+    double worstPosition(0.0), worstAngle(0.0);
+    GLsizei failures(0), tested(0);
+    for(int mesh = 0; mesh < 20; ++mesh) {
+        // from millimetres to kilometres, and a flat mesh with zero extent along one axis
+        const GLfloat size(std::pow(10.0f, static_cast<GLfloat>(mesh % 7) - 3.0f));
+        GLfloat centre[3];
+        for(int k = 0; k < 3; ++k)
+            centre[k] = unit(random) * size * 10.0f;
+
+        std::vector<Object::Vertex> vertex(5000);
+        for(std::size_t i = 0; i < vertex.size(); ++i) {
+            Object::Vertex &v(vertex[i]);
+            for(int k = 0; k < 3; ++k)
+                v.position[k] = centre[k] + (mesh == 3 && k == 1 ? 0.0f : unit(random) * size);
+
+            if(i < 26) {
+                // every combination of -1, 0 and 1 except the zero vector
+                const GLuint c(i < 13 ? i : i + 1);
+                v.normal[0] = static_cast<GLfloat>(c % 3) - 1.0f;
+                v.normal[1] = static_cast<GLfloat>(c / 3 % 3) - 1.0f;
+                v.normal[2] = static_cast<GLfloat>(c / 9) - 1.0f;
+            } else {
+                for(int k = 0; k < 3; ++k)
+                    v.normal[k] = unit(random);
+            }
+            const GLfloat l(std::sqrt(v.normal[0] * v.normal[0] + v.normal[1] * v.normal[1] +
+                                      v.normal[2] * v.normal[2]));
+            for(int k = 0; k < 3; ++k)
+                v.normal[k] = l > 0.0f ? v.normal[k] / l : (k == 2 ? 1.0f : 0.0f);
+        }
+
+        std::vector<Object::PackedVertex> packed(vertex.size());
+        const VertexCodec::Range r(VertexCodec::pack(static_cast<GLsizei>(vertex.size()), &vertex[0], &packed[0]));
+        for(std::size_t i = 0; i < vertex.size(); ++i) {
+            Object::Vertex u;
+            VertexCodec::unpack(r, packed[i], u);
+
+            bool ok(true);
+            for(int k = 0; k < 3; ++k) {
+                const double error(std::fabs(static_cast<double>(u.position[k]) - vertex[i].position[k]));
+                const double bound(r.scale[k] * 0.5 / 65535.0 +
+                                   1e-6 * (std::fabs(r.offset[k]) + std::fabs(r.scale[k])));
+                worstPosition = std::max(worstPosition, r.scale[k] > 0.0f ? error / r.scale[k] : 0.0);
+                ok = ok && error <= bound;
+            }
+
+            double dot(0.0);
+            for(int k = 0; k < 3; ++k)
+                dot += static_cast<double>(u.normal[k]) * vertex[i].normal[k];
+            const double angle(std::acos(std::min(1.0, dot)));
+            worstAngle = std::max(worstAngle, angle);
+            ok = ok && angle < maxAngle;
+
+            failures += !ok;
+            ++tested;
+        }
+    }
+
+    std::cout << "codec: " << failures << " of " << tested << " vertices out of bounds, worst position error "
+              << worstPosition * 65535.0 << " steps, worst normal error " << worstAngle * 180.0 / 3.14159265
+              << " degrees" << std::endl;
+    return failures == 0;
+}
+
+/**
+ *  @brief Compare Affine and Mat with Matrix on random transforms: products,
+ *  projection times modelview, inverses, normal matrices, transformed points
+ *  and a three-level SceneGraph against the same chain built from Matrix
+ *  factories. A zero rotation axis must give the identity in both.
+ *  @return whether every element agreed within float rounding.
+ */
+bool testMath()
+{
+    std::mt19937 random(19);
+    std::uniform_real_distribution<GLfloat> unit(-1.0f, 1.0f);
+    std::uniform_real_distribution<GLfloat> size(0.5f, 2.0f);
+
+    GLsizei failures(0), tested(0);
+    double worst(0.0);
+    const auto compare = [&](const GLfloat *a, const GLfloat *b, std::size_t count) {
+        bool ok(true);
+        for(std::size_t i = 0; i < count; ++i) {
+            const double error(std::fabs(static_cast<double>(a[i]) - b[i]) / (1.0 + std::fabs(b[i])));
+            worst = std::max(worst, error);
+            ok = ok && error <= 1e-4;
+        }
+        failures += !ok;
+        ++tested;
+    };
+
+    struct Transform
+    {
+        GLfloat t[3], a, axis[3], s[3];
+
+        Matrix matrix() const
+        {
+            return Matrix::translate(t[0], t[1], t[2]) * Matrix::rotate(a, axis[0], axis[1], axis[2]) *
+                   Matrix::scale(s[0], s[1], s[2]);
+        }
+
+        Affine<> affine() const
+        {
+            return Affine<>::translate(t[0], t[1], t[2]) * Affine<>::rotate(a, axis[0], axis[1], axis[2]) *
+                   Affine<>::scale(s[0], s[1], s[2]);
+        }
+    };
+    const auto randomTransform = [&]() {
+        Transform r;
+        for(int k = 0; k < 3; ++k) {
+            r.t[k] = unit(random) * 10.0f;
+            r.axis[k] = unit(random);
+            r.s[k] = size(random);
+        }
+        r.a = unit(random) * 3.14159265f;
+        return r;
+    };
+
+    const Matrix projection(Matrix::perspective(1.0f, 1.5f, 1.0f, 10.0f));
+    const Mat<4> projectionMat(Mat<4>::fromArray(projection.data()));
+    GLfloat a[16], b[16];
+    for(int i = 0; i < 1000; ++i) {
+        const Transform x(randomTransform()), y(randomTransform());
+        const Matrix mx(x.matrix()), my(y.matrix());
+        const Affine<> ax(x.affine()), ay(y.affine());
+
+        ax.toArray(a);
+        compare(a, mx.data(), 16);
+        (ax * ay).toArray(a);
+        compare(a, (mx * my).data(), 16);
+        compare((projectionMat * ax).data(), (projection * mx).data(), 16);
+        compare((projectionMat * ax.toMat()).data(), (projection * mx).data(), 16);
+        ax.inverse().toArray(a);
+        compare(a, mx.inverse().data(), 16);
+
+        mx.getNormalMatrix(b);
+        compare(ax.normalMatrix().data(), b, 9);
+
+        const GLfloat point[4] = {unit(random), unit(random), unit(random), 1.0f};
+        mx.transform(point, b, 1);
+        const Vec<3> p(ax.transformPoint(Vec<3>(point[0], point[1], point[2])));
+        compare(&p[0], b, 3);
+    }
+
+    Affine<>::rotate(1.0f, 0.0f, 0.0f, 0.0f).toArray(a);
+    compare(a, Matrix::rotate(1.0f, 0.0f, 0.0f, 0.0f).data(), 16);
+
+    // root, child and grandchild, set in a scrambled order
+    SceneGraph scene;
+    std::vector<SceneGraph::Node> nodes;
+    std::vector<Transform> local;
+    for(int i = 0; i < 300; ++i) {
+        nodes.push_back(scene.create(i % 3 == 0 ? SceneGraph::NONE : nodes.back()));
+        local.push_back(randomTransform());
+    }
+    for(std::size_t i = nodes.size(); i-- > 0;) {
+        const Transform &t(local[i]);
+        scene.setScale(nodes[i], t.s[0], t.s[1], t.s[2]);
+        scene.setRotation(nodes[i], t.a, t.axis[0], t.axis[1], t.axis[2]);
+        scene.setTranslation(nodes[i], t.t[0], t.t[1], t.t[2]);
+    }
+    scene.update();
+
+    Matrix world;
+    for(std::size_t i = 0; i < nodes.size(); ++i) {
+        world = i % 3 == 0 ? local[i].matrix() : world * local[i].matrix();
+        scene.getWorld(nodes[i]).toArray(a);
+        compare(a, world.data(), 16);
+    }
+
+    std::cout << "math: " << failures << " of " << tested << " results differ from Matrix, worst relative error "
+              << worst << std::endl;
+    return failures == 0;
+}
+
+/**
+ *  @brief Read a binary PPM as written by SoftwareRenderer::writePpm().
+ *  @param rgb three bytes per pixel, top row first.
+ */
+bool readPpm(const char *name, GLsizei &width, GLsizei &height, std::vector<GLubyte> &rgb)
+{
+    std::ifstream file(name, std::ios::binary);
+    std::string magic;
+    GLint maximum(0);
+    if(!(file >> magic >> width >> height >> maximum) || magic != "P6" || maximum != 255 || width <= 0 ||
+       height <= 0) {
+        std::cerr << "Can't read the image " << name << std::endl;
+        return false;
+    }
+    file.get();  // the single whitespace before the pixels
+
+    rgb.resize(static_cast<std::size_t>(width) * height * 3);
+    return static_cast<bool>(file.read(reinterpret_cast<char *>(rgb.data()), rgb.size()));
+}
+
+/**
+ *  @brief Render a fixed scene of lit cubes, some cut by the near plane and
+ *  the image borders, with SoftwareRenderer four pixels at a time and one
+ *  at a time, and compare the two with each other and with the golden image
+ *  ../tests/golden/software.ppm. The paths must agree exactly. The golden
+ *  image may differ by one step per channel, and in a few pixels along the
+ *  edges, where another math library rounds the transforms differently.
+ *  On a mismatch the image is saved as software-test.ppm; once it has been
+ *  checked by eye, copy it over the golden image.
+ *  @return whether the images matched.
+ */
+bool testSoftware()
+{
+    const GLsizei width(130), height(97);  // a partial tile and rows padded to 4 pixels
+    const char *const golden("../tests/golden/software.ppm");
+
+    FrameBlock frameBlock = FrameBlock();
+    frameBlock.setProjection(Matrix::perspective(1.0f, static_cast<GLfloat>(width) / height, 1.0f, 10.0f));
+    frameBlock.light[0] = Light::point(0.0f, 0.0f, 5.0f);
+    frameBlock.light[1] = Light::point(-2.0f, 1.0f, -4.0f, 0.8f, 0.5f, 4.0f);
+    frameBlock.light[1].diffuse[2] = 0.2f;
+    frameBlock.lightCount = 2;
+
+    const Matrix view(cameraView());
+    std::vector<Instance> instance;
+    for(int i = 0; i < 40; ++i) {
+        const GLfloat x(static_cast<GLfloat>(i % 5) - 2.0f), y(static_cast<GLfloat>(i / 5 % 4) - 1.5f);
+        const GLfloat z(static_cast<GLfloat>(i / 20) * 2.0f - 1.0f);
+        Instance object;
+        object.set(view * Matrix::translate(x * 1.2f, y * 1.2f, z) * Matrix::rotate(0.3f * i, 1.0f, 2.0f, 0.5f) *
+                   Matrix::scale(0.4f, 0.4f, 0.4f));
+        instance.push_back(object);
+    }
+    // in view space, across the near plane
+    Instance crossing;
+    crossing.set(Matrix::translate(0.3f, -0.25f, -1.1f) * Matrix::rotate(0.5f, 1.0f, 1.0f, 0.0f) *
+                 Matrix::scale(0.3f, 0.3f, 0.3f));
+    instance.push_back(crossing);
+
+    JobSystem jobs;
+    std::vector<GLubyte> image[2];
+    for(int vectorized = 0; vectorized < 2; ++vectorized) {
+        SoftwareRenderer renderer(width, height, jobs);
+        renderer.setVectorized(vectorized != 0);
+        renderer.setFrame(frameBlock);
+        renderer.setMaterial(Material::make(0.6f, 0.6f, 0.2f, 0.3f, 30.0f));
+        renderer.clear(1.0f, 1.0f, 1.0f, 0.0f);
+        renderer.draw(36, solidCubeVertex, 36, solidCubeIndex, static_cast<GLsizei>(instance.size()), instance.data());
+        renderer.finish();
+        renderer.readPixels(image[vectorized]);
+
+        if(vectorized != 0 && !renderer.isVectorized())
+            std::cout << "software: no SSE2, the scalar path is compared with itself" << std::endl;
+        if(vectorized != 0)
+            renderer.writePpm("software-test.ppm");
+    }
+    const bool same(image[0] == image[1]);
+
+    GLsizei goldenWidth(0), goldenHeight(0);
+    std::vector<GLubyte> rgb;
+    GLsizei changed(0), beyond(0);
+    const bool found(readPpm(golden, goldenWidth, goldenHeight, rgb));
+    const bool sized(found && goldenWidth == width && goldenHeight == height);
+    if(sized) {
+        for(GLsizei y = 0; y < height; ++y) {
+            for(GLsizei x = 0; x < width; ++x) {
+                int difference(0);
+                for(int c = 0; c < 3; ++c) {
+                    const int a(image[1][(y * width + x) * 4 + c]), b(rgb[((height - 1 - y) * width + x) * 3 + c]);
+                    difference = std::max(difference, std::abs(a - b));
+                }
+                changed += difference > 0;
+                beyond += difference > 1;
+            }
+        }
+    }
+    const bool matches(sized && beyond <= width * height / 200);
+    if(same && matches)
+        std::remove("software-test.ppm");
+
+    std::cout << "software: " << (same ? "the SSE2 and scalar paths agree" : "the SSE2 and scalar paths differ")
+              << ", " << changed << " pixels differ from the golden image and " << beyond << " by more than one step"
+              << std::endl;
+    return same && matches;
+}
+
+/**
+ *  @brief Check OcclusionCuller at 256 x 128 against referenceVisibility()
+ *  at 2048 x 1024, where no culled cube may show: fields of cubes culled
+ *  against their nearest ones, and tiny cubes scattered around the edges of
+ *  a single occluder, which the low resolution sees only partly. Some must
+ *  be culled, or the check proves nothing.
+ *  @return whether there were no false culls.
+ */
+bool testOcclusion()
+{
+    std::vector<Object::Vertex> vertex(solidCubeVertex, solidCubeVertex + 36);
+    std::vector<GLuint> index(solidCubeIndex, solidCubeIndex + 36);
+    MeshData mesh;
+    mesh.assign(vertex, index);
+    const Bounds bounds(Bounds::fromVertices(mesh.getVertexCount(), mesh.getVertex()));
+
+    const Matrix projection(occlusionProjection());
+    const Frustum frustum(projection);
+    JobSystem jobs;
+    OcclusionCuller occlusion;
+    std::mt19937 random(21);
+    std::uniform_real_distribution<GLfloat> unit(-1.0f, 1.0f);
+    std::vector<GLuint> nearest;
+    std::vector<GLubyte> visible, shown;
+
+    GLsizei culled(0), falseCulls(0), objects(0);
+    for(GLuint count : {500u, 3000u}) {
+        const std::vector<Instance> instance(occlusionField(count, random));
+        visible.resize(count);
+        for(GLuint i = 0; i < count; ++i)
+            visible[i] = frustum.isVisible(bounds.transform(Matrix(instance[i].modelview)));
+        cullOccluded(jobs, occlusion, projection, instance, visible, bounds, mesh, nearest);
+        referenceVisibility(projection, instance, mesh, 2048, 1024, shown);
+
+        for(GLuint i = 0; i < count; ++i)
+            falseCulls += shown[i] && !visible[i];
+        culled += occlusion.getCulledCount();
+        objects += count;
+    }
+
+    // the occluder is first, the others are a pixel or two across behind it
+    for(int scene = 0; scene < 20; ++scene) {
+        std::vector<Instance> instance(1000);
+        instance[0].set(Matrix::translate(0.0f, 0.0f, -10.0f) *
+                        Matrix::rotate(3.0f * unit(random), unit(random), unit(random), unit(random)));
+        for(std::size_t i = 1; i < instance.size(); ++i) {
+            const GLfloat z(26.0f + 14.0f * unit(random));
+            const GLfloat s((0.006f + 0.004f * unit(random)) * z);
+            instance[i].set(Matrix::translate(0.2f * z * unit(random), 0.2f * z * unit(random), -z) *
+                            Matrix::scale(s, s, s));
+        }
+
+        occlusion.begin(projection);
+        occlusion.addOccluder(Matrix(instance[0].modelview), mesh.getVertexCount(), mesh.getVertex(),
+                              mesh.getIndexCount(), mesh.getIndex());
+        occlusion.end();
+        referenceVisibility(projection, instance, mesh, 2048, 1024, shown);
+
+        for(std::size_t i = 1; i < instance.size(); ++i) {
+            const bool hidden(!occlusion.isVisible(bounds.transform(Matrix(instance[i].modelview))));
+            falseCulls += shown[i] && hidden;
+            culled += hidden;
+        }
+        objects += static_cast<GLsizei>(instance.size() - 1);
+    }
+
+    std::cout << "occlusion: " << culled << " of " << objects << " cubes culled, " << falseCulls
+              << " of them shown by the reference" << std::endl;
+    return falseCulls == 0 && culled > 0;
+}
+
+/**
+ *  @brief Simplify a sphere of 4096 triangles and check each level: about
+ *  half the triangles of the one before, an error that never shrinks, and
+ *  one that covers how far the level's vertices and triangle centroids
+ *  actually are from the sphere, up to how far the input itself is from it.
+ *  The same sphere scaled by 100 must give levels with about 100 times the
+ *  error.
+ *  @return whether every level passed.
+ */
+bool testSimplifier()
+{
+    const int stacks(32), slices(64);
+    const double pi(3.14159265358979);
+    // the input is at most this far inside the unit sphere, at the middle of its widest faces
+    const double tessellation(1.0 - std::cos(pi / slices) * std::cos(pi / (2 * stacks)));
+
+    std::vector<MeshSimplifier::Level> chain[2];
+    const GLfloat scale[2] = {1.0f, 100.0f};
+    GLsizei failures(0);
+    for(int s = 0; s < 2; ++s) {
+        std::vector<Object::Vertex> vertex;
+        std::vector<GLuint> index;
+        for(int i = 0; i <= stacks; ++i) {
+            for(int j = 0; j <= slices; ++j) {
+                const double theta(pi * i / stacks), phi(2.0 * pi * (j % slices) / slices);
+                const GLfloat n[3] = {static_cast<GLfloat>(std::sin(theta) * std::cos(phi)),
+                                      static_cast<GLfloat>(std::cos(theta)),
+                                      static_cast<GLfloat>(std::sin(theta) * std::sin(phi))};
+                Object::Vertex v;
+                for(int k = 0; k < 3; ++k) {
+                    v.position[k] = n[k] * scale[s];
+                    v.normal[k] = n[k];
+                }
+                vertex.push_back(v);
+            }
+        }
+        for(int i = 0; i < stacks; ++i) {
+            for(int j = 0; j < slices; ++j) {
+                const GLuint a(i * (slices + 1) + j), b(a + slices + 1);
+                const GLuint quad[6] = {a, a + 1, b, b, a + 1, b + 1};
+                index.insert(index.end(), quad, quad + 6);
+            }
+        }
+
+        chain[s] = MeshSimplifier().buildChain(vertex, index, 5, 0.5f);
+        failures += chain[s].size() != 5 || chain[s][0].index != index || chain[s][0].error != 0.0f;
+    }
+
+    for(std::size_t l = 1; l < chain[0].size(); ++l) {
+        const MeshSimplifier::Level &level(chain[0][l]), &previous(chain[0][l - 1]);
+        const std::size_t triangles(level.index.size() / 3), before(previous.index.size() / 3);
+
+        // the distance to the sphere, at the vertices and triangle centroids
+        double actual(0.0);
+        for(std::size_t t = 0; t < triangles; ++t) {
+            double centroid[3] = {0.0, 0.0, 0.0};
+            for(int k = 0; k < 3; ++k) {
+                const GLfloat *const p(level.vertex[level.index[t * 3 + k]].position);
+                actual = std::max(actual, std::fabs(std::sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]) - 1.0));
+                for(int c = 0; c < 3; ++c)
+                    centroid[c] += p[c] / 3.0;
+            }
+            actual = std::max(actual, std::fabs(std::sqrt(centroid[0] * centroid[0] + centroid[1] * centroid[1] +
+                                                          centroid[2] * centroid[2]) -
+                                                1.0));
+        }
+
+        const std::size_t scaledTriangles(chain[1][l].index.size() / 3), scaledBefore(chain[1][l - 1].index.size() / 3);
+        const bool counts(triangles <= before / 2 && triangles >= before / 4 && scaledTriangles <= scaledBefore / 2 &&
+                          scaledTriangles >= scaledBefore / 4);
+        const bool error(level.error >= previous.error && level.error >= actual - tessellation - 1e-6 &&
+                         level.error <= 2.0 * (actual + tessellation));
+        // rounding breaks the sphere's many ties differently at the two scales,
+        // so the levels are alike but not identical, within a triangle or two; an area-weighted error
+        // would be 10000 times larger instead of 100
+        const bool scaled(chain[1][l].error >= 80.0f * level.error && chain[1][l].error <= 125.0f * level.error);
+        failures += !counts || !error || !scaled;
+
+        std::cout << "simplifier: level " << l << ", " << triangles << " triangles, error " << level.error
+                  << ", sphere distance " << actual << ", error at scale 100 " << chain[1][l].error << std::endl;
+    }
+    return failures == 0;
+}
+
+/// The triangles as sorted vertex values, each rotated to start at its smallest corner, so winding is kept.
+std::vector<std::vector<GLfloat>> triangleSet(const std::vector<Object::Vertex> &vertex,
+                                              const std::vector<GLuint> &index)
+{
+    std::vector<std::vector<GLfloat>> triangles;
+    for(std::size_t t = 0; t + 2 < index.size(); t += 3) {
+        std::vector<GLfloat> corner[3];
+        for(int k = 0; k < 3; ++k) {
+            const Object::Vertex &v(vertex[index[t + k]]);
+            corner[k].assign(v.position, v.position + 3);
+            corner[k].insert(corner[k].end(), v.normal, v.normal + 3);
+        }
+
+        const int first(static_cast<int>(std::min_element(corner, corner + 3) - corner));
+        std::vector<GLfloat> key;
+        for(int k = 0; k < 3; ++k)
+            key.insert(key.end(), corner[(first + k) % 3].begin(), corner[(first + k) % 3].end());
+        triangles.push_back(key);
+    }
+    std::sort(triangles.begin(), triangles.end());
+    return triangles;
+}
+
+/**
+ *  @brief Weld the 36-vertex cube, which must leave its 24 distinct corners,
+ *  and two vertices that differ only in the sign of zero, which must merge.
+ *  Then shuffle the triangles of a grid, check that Tipsify doesn't raise
+ *  its ACMR, and that the whole of optimize() keeps every triangle of both
+ *  meshes with its winding.
+ *  @return whether every check held.
+ */
+bool testOptimizer()
+{
+    std::vector<Object::Vertex> cube(solidCubeVertex, solidCubeVertex + 36);
+    std::vector<GLuint> cubeIndex(solidCubeIndex, solidCubeIndex + 36);
+    const std::vector<std::vector<GLfloat>> cubeTriangles(triangleSet(cube, cubeIndex));
+    const MeshOptimizer::Stats stats(MeshOptimizer::optimize(cube, cubeIndex));
+
+    std::vector<Object::Vertex> zero(2, Object::Vertex{{0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}});
+    zero[1].position[0] = -0.0f;
+    zero[1].normal[1] = -0.0f;
+    std::vector<GLuint> zeroIndex(3, 1);
+    zeroIndex[0] = 0;
+    MeshOptimizer::weld(zero, zeroIndex);
+
+    std::vector<Object::Vertex> grid;
+    std::vector<GLuint> gridIndex;
+    rippledGrid(24, grid, gridIndex);
+    std::mt19937 random(23);
+    for(std::size_t t = gridIndex.size() / 3; t > 1; --t) {
+        const std::size_t other(random() % t);
+        std::swap_ranges(gridIndex.begin() + 3 * (t - 1), gridIndex.begin() + 3 * t, gridIndex.begin() + 3 * other);
+    }
+    const std::vector<std::vector<GLfloat>> gridTriangles(triangleSet(grid, gridIndex));
+    const GLsizei gridVertices(static_cast<GLsizei>(grid.size()));
+    const GLfloat before(MeshOptimizer::acmr(gridIndex, gridVertices));
+    MeshOptimizer::optimizeCache(gridIndex, gridVertices);
+    const GLfloat after(MeshOptimizer::acmr(gridIndex, gridVertices));
+    MeshOptimizer::optimizeFetch(grid, gridIndex);
+
+    const bool kept(triangleSet(cube, cubeIndex) == cubeTriangles && triangleSet(grid, gridIndex) == gridTriangles);
+    std::cout << "optimizer: cube " << stats.vertexBefore << " -> " << stats.vertexAfter << " vertices, signed zeros "
+              << zero.size() << " vertex, grid ACMR " << before << " -> " << after << ", triangles "
+              << (kept ? "kept" : "changed") << std::endl;
+    return stats.vertexAfter == 24 && zero.size() == 1 && zeroIndex[0] == 0 && zeroIndex[1] == 0 && after <= before &&
+           kept;
+}
+
+/**
+ *  @brief Queue five small assets and one larger than the budget on a single
+ *  loader thread, so they decode in order, and check that update() stops at
+ *  its byte budget: two of the small ones per call, then the large one
+ *  alone, since the first upload of a call always goes ahead.
+ *  @return whether each update() uploaded the expected assets in order.
+ */
+bool testAssetLoader()
+{
+    AssetLoader loader(1, 8);
+    const GLsizeiptr size[] = {400, 400, 400, 400, 5000, 400};
+    const GLsizeiptr budget(1000);
+    std::vector<std::size_t> uploaded;
+
+    std::vector<AssetLoader::Handle> handles;
+    for(std::size_t i = 0; i < 6; ++i)
+        handles.push_back(loader.request([&size, i] { return size[i]; }, [&uploaded, i] { uploaded.push_back(i); }));
+    for(AssetLoader::Handle h : handles) {
+        while(loader.getState(h) != AssetLoader::DECODED)
+            std::this_thread::yield();
+    }
+
+    const GLsizei expected[] = {2, 2, 1, 1, 0};
+    GLsizei failures(0);
+    std::cout << "assets:";
+    for(GLsizei e : expected) {
+        const GLsizei count(loader.update(budget, 1e9));
+        std::cout << " " << count << " (" << loader.getFrameBytes() << " bytes)";
+        failures += count != e;
+    }
+    std::cout << " uploaded per update under a " << budget << "-byte budget" << std::endl;
+
+    for(std::size_t i = 0; i < uploaded.size(); ++i)
+        failures += uploaded[i] != i;
+    return failures == 0 && uploaded.size() == 6 && loader.isIdle();
+}
+
+/**
+ *  @brief Cast a 16 x 16 block of screen rays, in 2 x 2 quads, into four
+ *  copies of a small rippled grid, one at a time and four at a time, which
+ *  takes TriangleBvh's SSE path where there is one, and check both against
+ *  testing every triangle. Some rays miss.
+ *  @return whether every ray found the nearest hit, or none, both ways.
+ */
+bool testPicking()
+{
+    std::vector<Object::Vertex> vertex;
+    std::vector<GLuint> index;
+    rippledGrid(12, vertex, index);
+    const std::shared_ptr<const TriangleBvh> mesh(new TriangleBvh(static_cast<GLsizei>(vertex.size()), vertex.data(),
+                                                                  static_cast<GLsizei>(index.size()), index.data()));
+
+    RayCaster caster;
+    std::vector<Matrix> model;
+    for(int i = 0; i < 4; ++i) {
+        model.push_back(Matrix::translate(i & 1 ? 1.1f : -1.1f, 0.2f * i, i & 2 ? 1.1f : -1.1f) *
+                        Matrix::rotate(0.5f * i, 0.0f, 1.0f, 0.0f));
+        caster.add(mesh, model.back());
+    }
+    caster.update();
+
+    const Matrix inverse((Matrix::perspective(1.0f, 4.0f / 3.0f, 1.0f, 10.0f) * cameraView()).inverse());
+    const GLuint side(16);
+    std::vector<Ray> ray;
+    for(GLuint qy = 0; qy < side; qy += 2) {
+        for(GLuint qx = 0; qx < side; qx += 2) {
+            for(GLuint k = 0; k < 4; ++k) {
+                const GLfloat x((qx + (k & 1)) * 1.8f / side - 0.9f), y((qy + (k >> 1)) * 1.8f / side - 0.9f);
+                ray.push_back(Ray::unproject(inverse, x, y));
+            }
+        }
+    }
+
+    std::vector<RayHit> single(ray.size(), RayHit::miss(1.0f)), batched(ray.size(), RayHit::miss(1.0f));
+    for(std::size_t i = 0; i < ray.size(); ++i)
+        caster.intersect(ray[i], single[i]);
+    caster.intersect(ray.size(), ray.data(), batched.data());
+
+    GLsizei hits(0), wrong(0), differ(0);
+    for(std::size_t i = 0; i < ray.size(); ++i) {
+        const GLfloat best(pickEveryTriangle(ray[i], model, vertex, index));
+        hits += best < 1.0f;
+        wrong += single[i].isHit() != (best < 1.0f) || std::fabs(best - single[i].t) > 1e-5f;
+        differ += single[i].instance != batched[i].instance || single[i].triangle != batched[i].triangle ||
+                  single[i].t != batched[i].t;
+    }
+
+    std::cout << "picking: " << hits << " of " << ray.size() << " rays hit, " << wrong
+              << " differ from testing every triangle, " << differ << " batched hits differ" << std::endl;
+    return hits > 0 && hits < static_cast<GLsizei>(ray.size()) && wrong == 0 && differ == 0;
+}
+
+/// Replace the file name with text.
+bool writeText(const std::string &name, const std::string &text)
+{
+    std::ofstream file(name.c_str(), std::ios::binary | std::ios::trunc);
+    file << text;
+    return !file.fail();
+}
+
+/**
+ *  @brief Write a square as a tiny .obj and .ply, load each twice and check
+ *  that the first load parses it and the second comes from the cache, that
+ *  rewriting the same text still hits the cache through the hash while a
+ *  same-sized edit is parsed again, and that a .ply with a quad or with a
+ *  list longer than the file is rejected. Writes to the working directory.
+ *  @return whether every load did what was expected.
+ */
+bool testMeshLoader()
+{
+    const std::string ply("ply\nformat ascii 1.0\nelement vertex 4\nproperty float x\nproperty float y\n"
+                          "property float z\nelement face 2\nproperty list uchar int vertex_indices\nend_header\n"
+                          "0 0 0\n1 0 0\n1 1 0\n0 1 0\n");
+    const std::string obj("v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nf 1 2 3\nf 1 3 4\n");
+    const struct
+    {
+        const char *name;
+        std::string text, edit;
+    } source[] = {
+        {"self-test.obj", obj, "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nf 1 2 4\nf 2 3 4\n"},
+        {"self-test.ply", ply + "3 0 1 2\n3 0 2 3\n", ply + "3 0 1 3\n3 1 2 3\n"},
+    };
+
+    GLsizei failures(0);
+    std::cout << "meshes:";
+    for(const auto &s : source) {
+        // parsed, cached, same text rewritten, same size edited
+        const std::string text[] = {s.text, s.text, s.text, s.edit};
+        const bool parse[] = {true, false, false, true};
+        std::remove((std::string(s.name) + ".meshcache").c_str());
+
+        std::cout << " " << s.name;
+        for(int i = 0; i < 4; ++i) {
+            if(i != 1 && !writeText(s.name, text[i]))
+                return false;
+
+            MeshData mesh;
+            MeshOptimizer::Stats stats;
+            stats.vertexBefore = 0;
+            const bool loaded(MeshLoader::load(s.name, mesh, 0, &stats));
+            const bool parsed(stats.vertexBefore > 0);
+            std::cout << (parsed ? " parsed" : " cached");
+            failures += !loaded || mesh.getVertexCount() != 4 || mesh.getIndexCount() != 6 || parsed != parse[i];
+        }
+        std::remove(s.name);
+        std::remove((std::string(s.name) + ".meshcache").c_str());
+    }
+    std::cout << std::endl;
+
+    const std::string bad[] = {ply + "4 0 1 2 3\n3 0 1 2\n", ply + "3 0 1 2\n200 0 1\n"};
+    for(const std::string &text : bad) {
+        MeshData mesh;
+        failures += !writeText("self-test.ply", text) || MeshLoader::load("self-test.ply", mesh);
+        std::remove("self-test.ply");
+        std::remove("self-test.ply.meshcache");
+    }
+    return failures == 0;
+}
+
+/// Occurrences of what in text.
+std::size_t countOf(const std::string &text, const std::string &what)
+{
+    std::size_t n(0);
+    for(std::size_t at = text.find(what); at != std::string::npos; at = text.find(what, at + what.size()))
+        ++n;
+    return n;
+}
+
+/**
+ *  @brief Feed the profiler more scopes and frames than it keeps and check
+ *  what it reports: a full per-thread ring drops and counts events, scopes
+ *  of another thread are drained too, the smoothed time per frame converges
+ *  and the trace holds exactly the most recent maxEvents scopes and
+ *  maxFrames frames of counters. Must run last, as it leaves the profiler
+ *  full. GPU scopes need a context and are not covered.
+ *  @return whether every report matched.
+ */
+bool testProfiler()
+{
+    Profiler &profiler(Profiler::get());
+    profiler.enable();
+
+    // a frame that overflows this thread's ring, while another thread records as well
+    const std::size_t overflow(5000);
+    for(std::size_t i = 0; i < overflow; ++i)
+        profiler.record("overflow", 0, 0);
+    std::thread other([&profiler] {
+        for(int i = 0; i < 10; ++i)
+            profiler.record("other thread", 0, 1000);
+    });
+    other.join();
+    profiler.endFrame();
+
+    // 20 scopes of 100 us, 2 ms per frame
+    const std::size_t frames(5000), scopes(20);
+    for(std::size_t f = 0; f < frames; ++f) {
+        for(std::size_t i = 0; i < scopes; ++i)
+            profiler.record("scope", 0, 100);
+        profiler.endFrame();
+    }
+    profiler.disable();
+
+    std::ostringstream summary, trace;
+    profiler.writeSummary(summary);
+    profiler.writeChromeTrace(trace);
+
+    const std::string text(summary.str());
+    const std::size_t at(text.find("\nscope: "));
+    const double ms(at != std::string::npos ? atof(text.c_str() + at + 8) : 0.0);
+    const std::size_t dropped(overflow - 4096);  // Profiler::Ring::size
+
+    const std::size_t scopeEvents(countOf(trace.str(), "\"ph\":\"X\""));
+    const std::size_t counterEvents(countOf(trace.str(), "\"ph\":\"C\""));
+    std::cout << "profiler: scope " << ms << " ms per frame, " << scopeEvents << " scopes and " << counterEvents
+              << " counter samples in the trace" << std::endl;
+
+    return std::fabs(ms - 2.0) < 1e-3 && text.find("other thread: ") != std::string::npos &&
+           countOf(text, std::to_string(dropped) + " events dropped") == 1 && scopeEvents == Profiler::maxEvents &&
+           counterEvents == Profiler::maxFrames * Profiler::COUNTERS &&
+           countOf(trace.str(), "\"name\":\"overflow\"") == 0;
+}
+
+/**
+ *  @brief Run the checks that need no GL context and print one line for each.
+ *  @return the exit status, 0 when every check passed.
+ */
+int runSelfTests()
+{
+    struct Test
+    {
+        const char *name;
+        bool (*run)();
+    };
+    const Test tests[] = {
+        {"culling", testCulling},
+        {"occlusion", testOcclusion},
+        {"codec", testCodec},
+        {"simplifier", testSimplifier},
+        {"optimizer", testOptimizer},
+        {"math", testMath},
+        {"software", testSoftware},
+        {"picking", testPicking},
+        {"assets", testAssetLoader},
+        {"meshes", testMeshLoader},
+        {"profiler", testProfiler},
+    };
+
+    int failed(0);
+    for(const Test &t : tests) {
+        const bool passed(t.run());
+        std::cout << t.name << (passed ? " passed" : " FAILED") << std::endl;
+        failed += !passed;
+    }
+    return failed > 0 ? 1 : 0;
+}
+
+/**
+ *  Usage: OpenGLTutorial [--mesh file.obj|file.ply] [--packed] [--lod] [--headless frames] [--output file.csv|file.json]
+ *         [--trace file.json] [--check-state] [--occlusion] [--deferred] [--lights count] [--async]
+ *         [--gpu-culling] [--instances count] [--queue]
+ *         [--software image.ppm] [--stream-benchmark frames] [--scene-benchmark nodes] [--occlusion-benchmark objects]
+ *         [--lighting-benchmark frames] [--pick-benchmark triangles] [--matrix-benchmark count]
+ *         [--instancing-benchmark frames] [--queue-benchmark frames] [--self-test]
+ *  --mesh draws the given model instead of the cube.
+ *  --packed uploads 12-byte quantized vertices instead of 24-byte float ones.
+ *  --lod adds simplified levels of the model and draws each instance with
+ *  the coarsest one whose error stays under a pixel.
+ *  --headless renders the given number of frames into a framebuffer object
+ *  with a fixed timestep and reports per-frame CPU and GPU time.
+ *  --trace profiles every pass, prints a rolling summary and writes a Chrome trace at exit.
+ *  --check-state checks the cached render state against glGet* after every skipped call and every frame.
+ *  --occlusion skips objects hidden behind the nearest ones in a low-resolution CPU depth buffer.
+ *  --deferred draws into a G-buffer and lights each covered pixel once with clustered light lists.
+ *  --lights scatters the given number of point lights around the objects; the forward path uses
+ *  at most FrameBlock::MAX_LIGHTS of them, the deferred path any number.
+ *  --async reads shaders and the model on loader threads and uploads them within a per-frame budget;
+ *  the cube is drawn until the model's finest level arrives, and the coarser levels follow one asset each.
+ *  --gpu-culling culls and selects levels in a compute shader that writes indirect draws, where the
+ *  context has GL 4.3; elsewhere the objects are culled on the CPU as usual.
+ *  --instances draws the given number of smaller objects scattered around the origin.
+ *  --queue submits every visible object to a RenderQueue over pooled levels instead of one instanced draw per level.
+ *  --software renders on the CPU without a GL context, saves the first frame and exits;
+ *  with --headless it renders that many frames and reports the time per frame.
+ *  --stream-benchmark compares streaming upload rates over the given number of frames and exits.
+ *  --scene-benchmark times full and partial transform updates of the given number of nodes and exits.
+ *  --occlusion-benchmark culls a dense field of the given number of cubes, checks it for false culls and exits.
+ *  --lighting-benchmark times forward and deferred lighting over light counts and resolutions and exits.
+ *  --instancing-benchmark times a draw call per object against one instanced draw at 1k to 100k objects and exits.
+ *  --queue-benchmark times submitting 1k to 100k pooled draws one by one and through RenderQueue and exits.
+ *  --pick-benchmark times ray picks into a scene of the given number of triangles, checks them and exits.
+ *  --self-test runs the checks that need no GL context and exits with 1 if any of them fails.
+ *  --matrix-benchmark times the matrix kernels against the scalar loop on the given number of matrices and exits.
+ */
+int main(int argc, char *argv[])
+{
+    GLuint frames(0);
+    const char *output(NULL);
+    const char *meshName(NULL);
+    bool packed(false);
+    bool lod(false);
+    GLuint streamFrames(0);
+    const char *trace(NULL);
+    const char *software(NULL);
+    bool checkState(false);
+    bool occlusionCulling(false);
+    bool deferredShading(false);
+    bool async(false);
+    bool gpuCulling(false);
+    GLsizei instanceCount(0);
+    GLsizei lightCount(0);
+    GLuint lightingFrames(0);
+    GLuint instancingFrames(0);
+    bool queued(false);
+    GLuint queueFrames(0);
+
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "--headless") == 0 && i + 1 < argc) {
+            frames = static_cast<GLuint>(atoi(argv[++i]));
+        } else if(strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if(strcmp(argv[i], "--mesh") == 0 && i + 1 < argc) {
+            meshName = argv[++i];
+        } else if(strcmp(argv[i], "--packed") == 0) {
+            packed = true;
+        } else if(strcmp(argv[i], "--lod") == 0) {
+            lod = true;
+        } else if(strcmp(argv[i], "--stream-benchmark") == 0 && i + 1 < argc) {
+            streamFrames = static_cast<GLuint>(atoi(argv[++i]));
+        } else if(strcmp(argv[i], "--software") == 0 && i + 1 < argc) {
+            software = argv[++i];
+        } else if(strcmp(argv[i], "--check-state") == 0) {
+            checkState = true;
+        } else if(strcmp(argv[i], "--occlusion") == 0) {
+            occlusionCulling = true;
+        } else if(strcmp(argv[i], "--deferred") == 0) {
+            deferredShading = true;
+        } else if(strcmp(argv[i], "--gpu-culling") == 0) {
+            gpuCulling = true;
+        } else if(strcmp(argv[i], "--queue") == 0) {
+            queued = true;
+        } else if(strcmp(argv[i], "--queue-benchmark") == 0 && i + 1 < argc) {
+            queueFrames = static_cast<GLuint>(atoi(argv[++i]));
+        } else if(strcmp(argv[i], "--instances") == 0 && i + 1 < argc) {
+            instanceCount = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "--async") == 0) {
+            async = true;
+        } else if(strcmp(argv[i], "--lights") == 0 && i + 1 < argc) {
+            lightCount = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "--lighting-benchmark") == 0 && i + 1 < argc) {
+            lightingFrames = static_cast<GLuint>(atoi(argv[++i]));
+        } else if(strcmp(argv[i], "--instancing-benchmark") == 0 && i + 1 < argc) {
+            instancingFrames = static_cast<GLuint>(atoi(argv[++i]));
+        } else if(strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace = argv[++i];
+        } else if(strcmp(argv[i], "--scene-benchmark") == 0 && i + 1 < argc) {
+            benchmarkScene(static_cast<GLuint>(atoi(argv[++i])));
+            return 0;
+        } else if(strcmp(argv[i], "--self-test") == 0) {
+            return runSelfTests();
+        } else if(strcmp(argv[i], "--matrix-benchmark") == 0 && i + 1 < argc) {
+            benchmarkMatrix(static_cast<GLuint>(atoi(argv[++i])));
+            return 0;
+        } else if(strcmp(argv[i], "--pick-benchmark") == 0 && i + 1 < argc) {
+            benchmarkPicking(static_cast<GLuint>(atoi(argv[++i])));
+            return 0;
+        } else if(strcmp(argv[i], "--occlusion-benchmark") == 0 && i + 1 < argc) {
+            benchmarkOcclusion(static_cast<GLuint>(atoi(argv[++i])));
+            return 0;
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--mesh file.obj|file.ply] [--packed] [--lod] [--headless frames] [--output file.csv|file.json]"
+                      << " [--trace file.json] [--check-state] [--occlusion] [--deferred] [--lights count] [--async]"
+                      << " [--gpu-culling] [--instances count] [--queue]"
+                      << " [--software image.ppm] [--stream-benchmark frames] [--scene-benchmark nodes]"
+                      << " [--occlusion-benchmark objects] [--lighting-benchmark frames] [--pick-benchmark triangles]"
+                      << " [--matrix-benchmark count] [--instancing-benchmark frames] [--queue-benchmark frames]"
+                      << " [--self-test]" << std::endl;
+            return 1;
+        }
+    }
+
+    if(software != NULL)
+        return renderSoftware(software, meshName, frames, lightCount);
+
+    if(deferredShading && packed) {
+        std::cerr << "Can't use --packed with --deferred; the G-buffer pass reads float vertices." << std::endl;
+        return 1;
+    }
+
+    if(gpuCulling && (packed || deferredShading || occlusionCulling)) {
+        std::cerr << "Can't use --gpu-culling with --packed, --deferred or --occlusion." << std::endl;
+        return 1;
+    }
+
+    if(queued && (packed || gpuCulling)) {
+        std::cerr << "Can't use --queue with --packed or --gpu-culling; the pool holds float vertices." << std::endl;
+        return 1;
+    }
+
+    const bool headless(frames > 0 || streamFrames > 0 || lightingFrames > 0 || instancingFrames > 0 ||
+                        queueFrames > 0);
+
+    // fixed timestep used instead of glfwGetTime() when running headless
+    const GLfloat timestep(1.0f / 60.0f);
+
+    if(glfwInit() == GL_FALSE) {
+        std::cerr << "Can't initialize GLFW" << std::endl;
+        return 1;
+    }
+
+    atexit(glfwTerminate);
+
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+    Window window(640, 480, "Hello!", !headless);
+
+    if(streamFrames > 0) {
+        benchmarkStream(streamFrames);
+        return 0;
+    }
+
+    if(lightingFrames > 0) {
+        benchmarkLighting(lightingFrames);
+        return 0;
+    }
+
+    if(instancingFrames > 0) {
+        benchmarkInstancing(instancingFrames);
+        return 0;
+    }
+
+    if(queueFrames > 0) {
+        benchmarkQueue(queueFrames);
+        return 0;
+    }
+
+    if(trace != NULL)
+        Profiler::get().enable();
+
+    if(gpuCulling && !GpuCuller::isSupported()) {
+        std::cerr << "No compute shaders on this context; culling on the CPU." << std::endl;
+        gpuCulling = false;
+    }
+
+    std::unique_ptr<const Framebuffer> framebuffer(headless ? new Framebuffer(640, 480) : NULL);
+    std::unique_ptr<FrameTimer> timer(headless ? new FrameTimer(frames) : NULL);
+
+    glClearColor(1.0f, 1.0f, 1.0f, 0.0f);
+
+    RenderState &state(RenderState::get());
+    state.setDebug(checkState);
+
+    state.frontFace(GL_CCW);
+    state.cullFace(GL_BACK);
+    state.enable(GL_CULL_FACE);
+
+    // depth buffer
+    glClearDepth(1.0);
+    state.depthFunc(GL_LESS);
+    state.enable(GL_DEPTH_TEST);
+
+    // with --async, shaders and the model are read and decoded off this thread; each model level is an
+    // asset of its own, and update() uploads them within a per-frame budget
+    std::unique_ptr<AssetLoader> loader(async ? new AssetLoader : NULL);
+    const GLsizeiptr uploadBudgetBytes(1 << 20);
+    const double uploadBudgetMilliseconds(2.0);
+
+    // program binaries are cached in the working directory
+    ProgramCache programs(".", loader.get());
+    const char *const vert(gpuCulling ? "../shaders/culled.vert"
+                                      : packed ? "../shaders/packed.vert" : "../shaders/instanced.vert");
+    const ProgramCache::Handle programHandle(programs.load(vert, "../shaders/point.frag"));
+
+    GLuint program(0);
+
+    // GPU culling runs a compute program before the draws
+    const ProgramCache::Handle cullHandle(gpuCulling ? programs.loadCompute("../shaders/cull.comp") : 0);
+    GLuint cullProgram(0);
+
+    // the deferred path draws the geometry with its own program, then lights it with another
+    std::unique_ptr<DeferredRenderer> deferred;
+    ProgramCache::Handle geometryHandle(0), lightingHandle(0);
+    GLuint lightingProgram(0);
+    if(deferredShading) {
+        geometryHandle = programs.load("../shaders/gbuffer.vert", "../shaders/gbuffer.frag");
+        lightingHandle = programs.load("../shaders/deferred.vert", "../shaders/deferred.frag");
+        deferred.reset(new DeferredRenderer(640, 480));
+    }
+
+    // lights and materials are data in the Frame and Object uniform blocks
+    UniformBuffer uniforms;
+    FrameBlock frameBlock = FrameBlock();
+    ObjectBlock objectBlock = ObjectBlock();
+    std::vector<Light> lights;
+    setupLighting(frameBlock, objectBlock, lights, lightCount);
+
+    // the model drawn; with --async a mesh file streams in while the cube stands in for it
+    std::shared_ptr<Model> model(new Model);
+    if(!decodeModel(loader ? NULL : meshName, lod, packed, *model))
+        return 1;
+
+    std::vector<std::unique_ptr<InstancedShape>> shapes;
+    uploadModel(*model, packed, shapes);
+
+    // with --queue the levels are pooled as well, and each visible object is a RenderQueue submission
+    const std::shared_ptr<MeshPool> pool(queued ? new MeshPool(3) : NULL);
+    std::vector<std::unique_ptr<PooledShape>> pooled;
+    std::unique_ptr<RenderQueue> queue(queued ? new RenderQueue : NULL);
+    if(queue)
+        poolModel(*model, pool, pooled);
+
+    LodSelector selector(model->levelError);
+
+    // the objects hang off a root that the arrow keys move; GpuCuller keeps them on the GPU instead of in the scene
+    SceneGraph scene;
+    const SceneGraph::Node root(scene.create());
+    std::vector<SceneGraph::Node> objects;
+    std::vector<GLfloat> placement;
+    placeObjects(instanceCount, placement);
+    std::shared_ptr<RayCaster> picker(new RayCaster);
+    placePicker(*picker, model->mesh, placement);
+    std::unique_ptr<GpuCuller> gpu(gpuCulling ? new GpuCuller : NULL);
+    if(gpu) {
+        std::vector<Matrix> model;
+        for(std::size_t i = 0; i < placement.size(); i += 4) {
+            const GLfloat *const p(&placement[i]);
+            model.push_back(Matrix::translate(p[0], p[1], p[2]) * Matrix::scale(p[3], p[3], p[3]));
+        }
+        gpu->setObjects(static_cast<GLsizei>(model.size()), model.data());
+    } else {
+        for(std::size_t i = 0; i < placement.size(); i += 4) {
+            const GLfloat *const p(&placement[i]);
+            objects.push_back(scene.create(root));
+            scene.setTranslation(objects.back(), p[0], p[1], p[2]);
+            scene.setScale(objects.back(), p[3], p[3], p[3]);
+        }
+    }
+
+    std::vector<GLint> currentLevel(objects.size(), -1);
+    std::vector<std::vector<InstancedShape::Instance>> instances(shapes.size());
+
+    // per-frame temporaries; it stops touching the heap after the first frames
+    FrameArena arena;
+    GLsizei steadyHeapAllocations(0);
+    // operator new calls made by any thread from frame 3 on; the arena's blocks come from malloc
+    std::size_t steadyStart(0), steadyEnd(0);
+
+    // frame N + 1 is simulated on the job threads while frame N is submitted
+    JobSystem jobs;
+    JobSystem::Counter simulated;
+    FramePacket packets[2];
+    Bounds bounds(shapes[0]->getBounds());
+    Bvh tree;
+    scene.update();
+    buildCullTree(tree, scene, objects, bounds);
+    std::unique_ptr<OcclusionCuller> occlusion(occlusionCulling ? new OcclusionCuller : NULL);
+    GLsizei occlusionTested(0), occlusionCulled(0);
+
+    const auto simulateInto = [&](FramePacket &next) {
+        simulate(jobs, next, scene, root, objects, tree, bounds, selector, currentLevel, occlusion.get(), model->mesh,
+                 picker.get());
+    };
+
+    // window input is read here, on the thread that owns it
+    const auto start = [&](FramePacket &next, GLuint f) {
+        next.frame = f;
+        next.time = headless ? f * timestep : static_cast<GLfloat>(glfwGetTime());
+        std::copy(window.getSize(), window.getSize() + 2, next.size);
+        next.scale = window.getScale();
+        std::copy(window.getLocation(), window.getLocation() + 2, next.location);
+        next.clicked = window.takeClick(next.click);
+
+        // two references are small enough for std::function to hold without allocating
+        jobs.run([&simulateInto, &next] { simulateInto(next); }, simulated);
+    };
+
+    // the streamed model replaces the cube between frames, while no simulate job runs, and its coarser
+    // levels join the chain one per asset after it; the loader threads decode each level and build the picker
+    bool modelChanged(false);
+    std::function<void(const std::shared_ptr<Model> &, std::size_t)> streamLevel;
+    const auto addLevel = [&](const std::shared_ptr<Model> &loaded, std::size_t l) {
+        uploadLevel(*loaded, l, packed, shapes);
+        if(queue)
+            poolLevel(*loaded, l, pool, pooled);
+        selector = LodSelector(std::vector<GLfloat>(loaded->levelError.begin(), loaded->levelError.begin() + l + 1));
+        instances.resize(shapes.size());
+        if(l + 1 < loaded->levelError.size())
+            streamLevel(loaded, l + 1);
+    };
+    streamLevel = [&](const std::shared_ptr<Model> &loaded, std::size_t l) {
+        loader->request([loaded, l, packed]() -> GLsizeiptr {
+            decodeLevel(*loaded, l, packed);
+            return loaded->getLevelSize(l);
+        }, [&addLevel, loaded, l] { addLevel(loaded, l); });
+    };
+    if(loader && meshName != NULL) {
+        const std::shared_ptr<Model> loaded(new Model);
+        const std::shared_ptr<RayCaster> loadedPicker(new RayCaster);
+        loader->request([loaded, loadedPicker, meshName, lod, packed, placement]() -> GLsizeiptr {
+            if(!readModel(meshName, lod, *loaded))
+                return -1;
+            decodeLevel(*loaded, 0, packed);
+            placePicker(*loadedPicker, loaded->mesh, placement);
+            return loaded->getLevelSize(0);
+        }, [&, loaded, loadedPicker] {
+            shapes.clear();
+            pooled.clear();
+            model = loaded;
+            picker = loadedPicker;
+            addLevel(loaded, 0);
+            bounds = shapes[0]->getBounds();
+            buildCullTree(tree, scene, objects, bounds);
+            std::fill(currentLevel.begin(), currentLevel.end(), -1);
+            modelChanged = true;
+        });
+    }
+
+    glfwSetTime(0.0);
+
+    for(GLuint frame = 0; headless ? frame < frames : static_cast<bool>(window); ++frame) {
+        if(timer)
+            timer->begin();
+
+        // frame 0 is simulated up front; every later one while its predecessor is drawn
+        if(frame == 0)
+            start(packets[0], 0);
+        {
+            PROFILE_SCOPE("wait simulate");
+            jobs.wait(simulated);
+        }
+        if(loader)
+            loader->update(uploadBudgetBytes, uploadBudgetMilliseconds);
+        if(!headless || frame + 1 < frames)
+            start(packets[(frame + 1) % 2], frame + 1);
+
+        const FramePacket &packet(packets[frame % 2]);
+        occlusionTested += packet.occlusionTested;
+        occlusionCulled += packet.occlusionCulled;
+        if(packet.pick.isHit())
+            std::cout << "Picked object " << packet.pick.instance << ", triangle " << packet.pick.triangle << std::endl;
+
+        if(framebuffer)
+            framebuffer->bind();
+
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        // a reloaded program comes with new uniform locations and values, a new model with new ranges
+        if(programs.poll() || frame == 0 || modelChanged) {
+            modelChanged = false;
+            program = programs.getProgram(deferred ? geometryHandle : programHandle);
+            if(deferred)
+                lightingProgram = programs.getProgram(lightingHandle);
+            if(gpu)
+                cullProgram = programs.getProgram(cullHandle);
+            state.useProgram(program);
+            if(packed && program != 0) {
+                glUniform3fv(glGetUniformLocation(program, "positionOffset"), 1, model->packRange.offset);
+                glUniform3fv(glGetUniformLocation(program, "positionScale"), 1, model->packRange.scale);
+            }
+        }
+
+        if(deferred) {
+            GLsizei width(640), height(480);
+            if(framebuffer) {
+                width = framebuffer->getWidth();
+                height = framebuffer->getHeight();
+            } else {
+                window.getFramebufferSize(width, height);
+            }
+            deferred->resize(width, height);
+            deferred->bind();
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        }
+
+        state.useProgram(program);
+
+        // nothing is drawn until the programs have arrived
+        const bool ready(program != 0 && (!deferred || lightingProgram != 0) && (!gpu || cullProgram != 0));
+
+        // replay the packet: visible objects by level, front to back
+        if(frame > 2)
+            steadyHeapAllocations += arena.getFrameHeapAllocations();
+        if(frame == 3)
+            steadyStart = HeapCounter::getCount();
+        arena.reset();
+
+        {
+            PROFILE_SCOPE("replay");
+
+            std::vector<GLuint, ArenaAllocator<GLuint>> order((ArenaAllocator<GLuint>(arena)));
+            order.reserve(packet.visible.size());
+            for(GLuint i = 0; i < packet.visible.size(); ++i) {
+                if(packet.visible[i])
+                    order.push_back(i);
+            }
+            std::sort(order.begin(), order.end(),
+                      [&packet](GLuint a, GLuint b) { return packet.sortKey[a] < packet.sortKey[b]; });
+
+            for(std::vector<InstancedShape::Instance> &i : instances)
+                i.clear();
+            // a packet simulated before a new model arrived may name a level it lacks
+            if(!queue) {
+                for(GLuint i : order) {
+                    const std::size_t l(std::min<std::size_t>(packet.level[i], instances.size() - 1));
+                    instances[l].push_back(packet.instance[i]);
+                }
+            } else if(ready) {
+                for(GLuint i : order)
+                    queue->submit(program, *pooled[std::min<std::size_t>(packet.level[i], pooled.size() - 1)],
+                                  packet.instance[i]);
+            }
+        }
+
+        {
+            PROFILE_SCOPE("uniforms");
+
+            frameBlock.setProjection(packet.projection);
+            frameBlock.setView(packet.view);
+
+            uniforms.begin();
+            const GLintptr frameOffset(uniforms.push(frameBlock));
+            const GLintptr objectOffset(uniforms.push(objectBlock));
+            uniforms.upload();
+            uniforms.bind<FrameBlock>(frameOffset);
+            uniforms.bind<ObjectBlock>(objectOffset);
+        }
+
+        if(ready) {
+            PROFILE_SCOPE("draw");
+            PROFILE_GPU_SCOPE("draw");
+
+            if(gpu) {
+                gpu->cull(cullProgram, packet.projection, packet.parent, static_cast<GLsizei>(packet.size[1]),
+                          selector, shapes);
+                gpu->draw(program, shapes);
+            }
+
+            if(queue)
+                queue->flush();
+
+            for(std::size_t l = 0; l < shapes.size(); ++l) {
+                if(instances[l].empty())
+                    continue;
+
+                shapes[l]->setInstances(instances[l]);
+                shapes[l]->draw();
+            }
+        }
+
+        if(deferred && ready) {
+            PROFILE_SCOPE("lighting");
+            PROFILE_GPU_SCOPE("lighting");
+
+            deferred->setLights(packet.projection, static_cast<GLsizei>(lights.size()), lights.data());
+            if(framebuffer)
+                framebuffer->bind();
+            else
+                window.bind();
+            deferred->draw(lightingProgram);
+        }
+
+        if(timer)
+            timer->end();
+
+        {
+            PROFILE_SCOPE("present");
+            if(headless)
+                glFlush();
+            else
+                window.swapBuffers();
+        }
+
+        if(checkState)
+            state.validate();
+
+        Profiler::get().endFrame();
+        if(trace != NULL && !headless && frame % 120 == 119)
+            Profiler::get().writeSummary(std::cerr);
+    }
+
+    jobs.wait(simulated);
+    steadyEnd = HeapCounter::getCount();
+
+    if(trace != NULL) {
+        std::ofstream file(trace);
+        if(file.fail()) {
+            std::cerr << "Can't open the file." << trace << std::endl;
+            return 1;
+        }
+        Profiler::get().writeChromeTrace(file);
+        Profiler::get().writeSummary(std::cerr);
+    }
+
+    if(headless) {
+        steadyHeapAllocations += arena.getFrameHeapAllocations();
+        arena.reset();
+        std::cerr << "Frame arena: peak " << arena.getPeak() << " bytes per frame, " << steadyHeapAllocations
+                  << " overflow blocks after frame 2" << std::endl;
+        if(frames > 3)
+            std::cerr << "Heap: " << steadyEnd - steadyStart << " operator new calls after frame 2" << std::endl;
+        std::cerr << "Render state: " << state.getIssuedCount() << " calls issued, " << state.getSkippedCount()
+                  << " redundant calls skipped, " << state.getMismatchCount() << " mismatches" << std::endl;
+        if(occlusion) {
+            std::cerr << "Occlusion: " << occlusionCulled << " of " << occlusionTested << " tested objects culled ("
+                      << 100.0 * occlusionCulled / std::max(occlusionTested, 1) << "%)" << std::endl;
+        }
+        if(gpu) {
+            std::cerr << "GPU culling: " << gpu->getDrawnCount() << " of " << gpu->getObjectCount()
+                      << " objects drawn in the last frame" << std::endl;
+        }
+        if(loader) {
+            std::cerr << "Assets: " << loader->getUploadedCount() << " uploaded, at most "
+                      << loader->getPeakBytes() << " bytes and " << loader->getPeakMilliseconds()
+                      << " ms per frame" << std::endl;
+        }
+    }
+
+    if(timer) {
+        timer->finish();
+
+        std::ofstream file;
+        if(output != NULL) {
+            file.open(output);
+            if(file.fail()) {
+                std::cerr << "Can't open the file." << output << std::endl;
+                return 1;
+            }
+        }
+        std::ostream &out(output != NULL ? file : std::cout);
+
+        const std::size_t length(output != NULL ? strlen(output) : 0);
+        if(length > 5 && strcmp(output + length - 5, ".json") == 0)
+            timer->writeJson(out);
+        else
+            timer->writeCsv(out);
+    }
+}
\ No newline at end of file